@@ -73,6 +73,65 @@ TPM_RESULT TPMLIB_Process(unsigned char **respbuffer, uint32_t *resp_size,
 
 TPM_RESULT TPMLIB_VolatileAll_Store(unsigned char **buffer, uint32_t *buflen);
 
+TPM_RESULT TPMLIB_CreateInstance(uint32_t tpm_number);
+
+TPM_RESULT TPMLIB_DestroyInstance(uint32_t tpm_number);
+
+TPM_RESULT TPMLIB_ProcessInstance(uint32_t tpm_number,
+                                  unsigned char **respbuffer,
+                                  uint32_t *resp_size,
+                                  uint32_t *respbufsize,
+                                  unsigned char *command,
+                                  uint32_t command_size);
+
+TPM_RESULT TPMLIB_VolatileAll_StoreInstance(uint32_t tpm_number,
+                                            unsigned char **buffer,
+                                            uint32_t *buflen);
+
+TPM_RESULT TPMLIB_VolatileAll_StoreDelta(uint32_t tpm_number,
+                                         uint32_t *generation,
+                                         unsigned char **buffer,
+                                         uint32_t *buflen);
+
+TPM_RESULT TPMLIB_VolatileAll_ApplyDelta(const unsigned char *base,
+                                         uint32_t base_len,
+                                         const unsigned char *delta,
+                                         uint32_t delta_len,
+                                         unsigned char **buffer,
+                                         uint32_t *buflen);
+
+TPM_RESULT TPMLIB_ProcessBatch(uint32_t tpm_number,
+                               unsigned char **respbuffer,
+                               uint32_t *resp_size,
+                               uint32_t *respbufsize,
+                               unsigned char *commands,
+                               uint32_t commands_size,
+                               uint32_t *count);
+
+typedef void (*TPMLIB_ProcessCallback)(void *opaque,
+                                       TPM_RESULT result,
+                                       const unsigned char *response,
+                                       uint32_t resp_size);
+
+TPM_RESULT TPMLIB_ProcessAsync(uint32_t tpm_number,
+                               const unsigned char *command,
+                               uint32_t command_size,
+                               TPMLIB_ProcessCallback callback,
+                               void *opaque);
+
+enum TPMLIB_VolatileStorePolicy {
+    TPMLIB_VOLATILE_STORE_ON_DEMAND = 0,
+    TPMLIB_VOLATILE_STORE_COMMANDS,
+    TPMLIB_VOLATILE_STORE_IDLE,
+    TPMLIB_VOLATILE_STORE_CHANGED,
+};
+
+TPM_RESULT TPMLIB_SetVolatileStorePolicy(uint32_t tpm_number,
+                                         enum TPMLIB_VolatileStorePolicy policy,
+                                         uint32_t value);
+
+TPM_RESULT TPMLIB_VolatileAll_NVStore(uint32_t tpm_number);
+
 enum TPMLIB_TPMProperty {
     TPMPROP_TPM_RSA_KEY_LENGTH_MAX = 1,
     TPMPROP_TPM_BUFFER_MAX,
@@ -89,10 +148,15 @@ enum TPMLIB_TPMProperty {
     TPMPROP_TPM_MAX_NV_SPACE,
     TPMPROP_TPM_MAX_SAVESTATE_SPACE,
     TPMPROP_TPM_MAX_VOLATILESTATE_SPACE,
+    TPMPROP_TPM_INSTANCES_MAX,
 };
 
 TPM_RESULT TPMLIB_GetTPMProperty(enum TPMLIB_TPMProperty prop, int *result);
 
+TPM_RESULT TPMLIB_SetRSAKeyPool(unsigned int depth, unsigned int threads);
+
+typedef void (*TPMLIB_NVRAMCallback)(void *context, TPM_RESULT result);
+
 struct libtpms_callbacks {
     int sizeOfStruct;
     TPM_RESULT (*tpm_nvram_init)(void);
@@ -112,6 +176,19 @@ struct libtpms_callbacks {
 				     uint32_t tpm_number);
     TPM_RESULT (*tpm_io_getphysicalpresence)(TPM_BOOL *physicalPresence,
 					     uint32_t tpm_number);
+    TPM_RESULT (*tpm_nvram_updatedata)(const unsigned char *data,
+                                       uint32_t length,
+                                       uint32_t offset,
+                                       uint32_t tpm_number,
+                                       const char *name);
+    TPM_RESULT (*tpm_nvram_begin)(uint32_t tpm_number);
+    TPM_RESULT (*tpm_nvram_commit)(uint32_t tpm_number);
+    TPM_RESULT (*tpm_nvram_storedata_async)(const unsigned char *data,
+                                            uint32_t length,
+                                            uint32_t tpm_number,
+                                            const char *name,
+                                            TPMLIB_NVRAMCallback done,
+                                            void *context);
 };
 
 TPM_RESULT TPMLIB_RegisterCallbacks(struct libtpms_callbacks *);
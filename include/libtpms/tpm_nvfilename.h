@@ -52,5 +52,9 @@
 
 #define TPM_VOLATILESTATE_NAME      "volatilestate"
 
+/* the data of an NV index in a --enable-nv-index-files build, formatted with the nvIndex */
+
+#define TPM_NV_INDEX_NAME_FORMAT    "nv%08x"
+
 
 #endif
@@ -137,7 +137,10 @@ typedef uint32_t  TPM_FAMILY_OPERATION;	/* What operation is happening  */
 typedef uint16_t  TPM_TAG;		/* The command and response tags */
 
 typedef unsigned char *	TPM_SYMMETRIC_KEY_TOKEN;	/* abstract symmetric key token */
+typedef unsigned char *	TPM_RSA_KEY_TOKEN;		/* abstract RSA private key token */
 typedef unsigned char *	TPM_BIGNUM;			/* abstract bignum */
+typedef unsigned char *	TPM_BN_MONT_CTX;		/* abstract modulus context */
+typedef unsigned char *	TPM_BN_FIXED_BASE;		/* abstract fixed base powers */
 
 #ifdef __cplusplus
 }
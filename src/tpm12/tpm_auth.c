@@ -217,6 +217,7 @@ TPM_RESULT TPM_AuthParams_Set(TPM_STORE_BUFFER *response,
     if (rc == 0) {
 	rc = TPM_Authdata_Generate(resAuth,			/* result */
 				   hmacKey,			/* HMAC key */
+				   &(auth_session_data->hmacContext),
 				   outParamDigest,		/* params */
 				   auth_session_data->nonceEven,
 				   nonceOdd,
@@ -229,8 +230,14 @@ TPM_RESULT TPM_AuthParams_Set(TPM_STORE_BUFFER *response,
     return rc;
 }
 
+/* TPM_Authdata_Generate() generates the response authorization digest.
+
+   'hmac_context' caches the HMAC key midstates across calls.  It may be NULL.
+*/
+
 TPM_RESULT TPM_Authdata_Generate(TPM_AUTHDATA resAuth,		/* result */
 				 TPM_SECRET usageAuth,		/* HMAC key */
+				 TPM_HMAC_CONTEXT *hmac_context,	/* HMAC key midstates */
 				 TPM_DIGEST outParamDigest, /* digest of outputs above double
 							       line */
 				 TPM_NONCE nonceEven,
@@ -238,6 +245,7 @@ TPM_RESULT TPM_Authdata_Generate(TPM_AUTHDATA resAuth,		/* result */
 				 TPM_BOOL continueSession)
 {
     TPM_RESULT		rc = 0;
+    TPM_DIGEST_IOVEC	iov[4];
     
     printf(" TPM_Authdata_Generate:\n");
     if (rc == 0) {
@@ -246,13 +254,18 @@ TPM_RESULT TPM_Authdata_Generate(TPM_AUTHDATA resAuth,		/* result */
 	TPM_PrintFour("  TPM_Authdata_Generate: nonceEven", nonceEven);
 	TPM_PrintFour("  TPM_Authdata_Generate: nonceOdd", nonceOdd);
 	printf       ("  TPM_Authdata_Generate: continueSession %02x\n", continueSession);
-	rc = TPM_HMAC_Generate(resAuth,
-			       usageAuth,				/* key */
-			       TPM_DIGEST_SIZE, outParamDigest,		/* response digest */
-			       TPM_NONCE_SIZE, nonceEven,		/* 2H */
-			       TPM_NONCE_SIZE, nonceOdd,		/* 3H */
-			       sizeof(TPM_BOOL), &continueSession,	/* 4H */
-			       0, NULL);
+	iov[0].length = TPM_DIGEST_SIZE;		/* response digest */
+	iov[0].buffer = outParamDigest;
+	iov[1].length = TPM_NONCE_SIZE;			/* 2H */
+	iov[1].buffer = nonceEven;
+	iov[2].length = TPM_NONCE_SIZE;			/* 3H */
+	iov[2].buffer = nonceOdd;
+	iov[3].length = sizeof(TPM_BOOL);		/* 4H */
+	iov[3].buffer = &continueSession;
+	rc = TPM_HMAC_GenerateIovec(resAuth,
+				    hmac_context,
+				    usageAuth,			/* key */
+				    iov, 4);
 	TPM_PrintFour("  TPM_Authdata_Generate: resAuth", resAuth);
     }
     return rc;
@@ -276,6 +289,7 @@ TPM_RESULT TPM_Authdata_Check(tpm_state_t	*tpm_state,
 {
     TPM_RESULT		rc = 0;
     TPM_BOOL		valid;
+    TPM_DIGEST_IOVEC	iov[4];
     
     printf(" TPM_Authdata_Check:\n");
     if (rc == 0) {
@@ -286,14 +300,19 @@ TPM_RESULT TPM_Authdata_Check(tpm_state_t	*tpm_state,
 	printf       ("  TPM_Authdata_Check: continueSession %02x\n", continueSession);
 	/* HMAC the inParamDigest, authLastNonceEven, nonceOdd, continue */
 	/* authLastNonceEven is retrieved from internal authorization session storage */
-	rc = TPM_HMAC_Check(&valid,
-			    usageAuth,					/* expected, from command */
-			    hmacKey,					/* key */
-			    sizeof(TPM_DIGEST), inParamDigest,		/* command digest */
-			    sizeof(TPM_NONCE), tpm_auth_session_data->nonceEven,	/* 2H */
-			    sizeof(TPM_NONCE), nonceOdd,				/* 3H */
-			    sizeof(TPM_BOOL), &continueSession,				/* 4H */
-			    0, NULL);
+	iov[0].length = sizeof(TPM_DIGEST);		/* command digest */
+	iov[0].buffer = inParamDigest;
+	iov[1].length = sizeof(TPM_NONCE);		/* 2H */
+	iov[1].buffer = tpm_auth_session_data->nonceEven;
+	iov[2].length = sizeof(TPM_NONCE);		/* 3H */
+	iov[2].buffer = nonceOdd;
+	iov[3].length = sizeof(TPM_BOOL);		/* 4H */
+	iov[3].buffer = &continueSession;
+	rc = TPM_HMAC_CheckIovec(&valid,
+				 usageAuth,			/* expected, from command */
+				 &(tpm_auth_session_data->hmacContext),
+				 hmacKey,			/* key */
+				 iov, 4);
     }
     if (rc == 0) {
 	if (!valid) {
@@ -59,6 +59,7 @@ TPM_RESULT TPM_Authdata_Store(TPM_STORE_BUFFER *sbuffer,
 
 TPM_RESULT TPM_Authdata_Generate(TPM_AUTHDATA resAuth,
                                  TPM_SECRET usageAuth,
+                                 TPM_HMAC_CONTEXT *hmac_context,
                                  TPM_DIGEST outParamDigest,
                                  TPM_NONCE nonceEven,
                                  TPM_NONCE nonceOdd,
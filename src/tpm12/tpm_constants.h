@@ -315,6 +315,10 @@
 
 #define TPM_TAG_NVSTATE_NV_V2		0x0002
 
+/* V3 moved the data of each NV index to its own NVRAM name, TPM_NV_INDEX_NAME_FORMAT */
+
+#define TPM_TAG_NVSTATE_NV_V3		0x0003
+
 /*
   These tags are used to describe the format of serialized TPM volatile state
 */
@@ -327,6 +331,11 @@
 
 #define TPM_TAG_VSTATE_V1		0x0001
 
+/* This tag describes the format of a delta between two serialized volatile states, created by
+   TPM_VolatileAll_StoreDelta() */
+
+#define TPM_TAG_VSTATE_DELTA_V1		0x0001
+
 /* This tag defines the TPM Parameters format */
 
 #define TPM_TAG_TPM_PARAMETERS_V1	0x0001
@@ -355,9 +364,14 @@
    outside the TPM, the tag value can be changed if the format changes.
 */
 
-/* This tag defines the key handle entries format */
+/* These tags define the key handle entries format */
+
+/* V2 has the same layout, but may hold the keys swapped out of the key slots as well, up to
+   TPM_KEY_TABLE_ENTRIES.  V1 is still stored when the keys fit into TPM_KEY_HANDLES, so that
+   older versions can load the state. */
 
 #define TPM_TAG_KEY_HANDLE_ENTRIES_V1	0x0001
+#define TPM_TAG_KEY_HANDLE_ENTRIES_V2	0x0002
 
 /* This tag defines the SHA-1 context format */
 
@@ -43,6 +43,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <openssl/crypto.h>
 #include <openssl/rand.h>
@@ -173,6 +174,53 @@ static TPM_RESULT TPM_AES_ctr128_encrypt(unsigned char *data_out,
 
 #endif
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+
+/* OpenSSL before 1.1.0 is only thread safe if the application provides the locking callbacks.
+   They are installed by TPM_Crypto_Init() unless the application has already done so. */
+
+static pthread_mutex_t *tpm_openssl_locks = NULL;
+
+static void TPM_OpenSSL_LockingCallback(int mode, int n, const char *file, int line)
+{
+    file = file;
+    line = line;
+    if (mode & CRYPTO_LOCK) {
+	pthread_mutex_lock(&tpm_openssl_locks[n]);
+    }
+    else {
+	pthread_mutex_unlock(&tpm_openssl_locks[n]);
+    }
+    return;
+}
+
+static unsigned long TPM_OpenSSL_IdCallback(void)
+{
+    return (unsigned long)pthread_self();
+}
+
+static TPM_RESULT TPM_OpenSSL_InitLocks(void)
+{
+    TPM_RESULT rc = 0;
+    int i;
+
+    if (CRYPTO_get_locking_callback() == NULL) {
+	printf(" TPM_OpenSSL_InitLocks: Installing %d locks\n", CRYPTO_num_locks());
+	rc = TPM_Malloc((unsigned char **)&tpm_openssl_locks,
+			CRYPTO_num_locks() * sizeof(pthread_mutex_t));
+	if (rc == 0) {
+	    for (i = 0 ; i < CRYPTO_num_locks() ; i++) {
+		pthread_mutex_init(&tpm_openssl_locks[i], NULL);
+	    }
+	    CRYPTO_set_id_callback(TPM_OpenSSL_IdCallback);
+	    CRYPTO_set_locking_callback(TPM_OpenSSL_LockingCallback);
+	}
+    }
+    return rc;
+}
+
+#endif	/* OPENSSL_VERSION_NUMBER */
+
 /*
   Initialization function
 */
@@ -182,6 +230,9 @@ TPM_RESULT TPM_Crypto_Init()
     TPM_RESULT rc = 0;
 
     printf("TPM_Crypto_Init: OpenSSL library %08lx\n", (unsigned long)OPENSSL_VERSION_NUMBER);
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    rc = TPM_OpenSSL_InitLocks();
+#endif
     OpenSSL_add_all_algorithms();
     /* sanity check that the SHA1 context handling remains portable */
     if (rc == 0) {
@@ -495,6 +546,155 @@ static TPM_RESULT TPM_RSAGeneratePrivateToken(RSA **rsa_pri_key,	/* freed by cal
     return rc;
 }
 
+/* TPM_RSAKeyToken_New() creates the private key token 'rsa_key_token' from n, e, d and the prime
+   factors p and q.
+
+   Unlike the token built for a single operation, it includes the CRT parameters, so that private
+   key operations use the CRT.  OpenSSL caches the Montgomery contexts for n, p, and q in the token
+   on first use.  A token kept with a loaded key therefore saves rebuilding all of these for each
+   operation.
+
+   The token must be freed with TPM_RSAKeyToken_Free().
+*/
+
+TPM_RESULT TPM_RSAKeyToken_New(TPM_RSA_KEY_TOKEN *rsa_key_token,	/* freed by caller */
+			       unsigned char *narr,	/* public modulus */
+			       uint32_t nbytes,
+			       unsigned char *earr,	/* public exponent */
+			       uint32_t ebytes,
+			       unsigned char *darr,	/* private exponent */
+			       uint32_t dbytes,
+			       unsigned char *parr,	/* secret prime factor */
+			       uint32_t pbytes,
+			       unsigned char *qarr,	/* secret prime factor */
+			       uint32_t qbytes)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;            /* openSSL return code */
+    BIGNUM      *brc;           /* BIGNUM return code */
+    RSA *       rsa_pri_key = NULL;	/* freed @1 */
+    BIGNUM *    p = NULL;		/* freed @2 */
+    BIGNUM *    q = NULL;		/* freed @3 */
+    BIGNUM *    dmp1 = NULL;		/* d mod (p-1), freed @4 */
+    BIGNUM *    dmq1 = NULL;		/* d mod (q-1), freed @5 */
+    BIGNUM *    iqmp = NULL;		/* q^-1 mod p, freed @6 */
+    BN_CTX *    ctx = NULL;		/* freed @7 */
+    BIGNUM *    r0 = NULL;		/* p-1, q-1 */
+
+    printf(" TPM_RSAKeyToken_New:\n");
+    *rsa_key_token = NULL;
+    /* construct the OpenSSL private key object from n, e, d */
+    if (rc == 0) {
+	rc = TPM_RSAGeneratePrivateToken(&rsa_pri_key,	/* freed @1 */
+					 narr, nbytes,
+					 earr, ebytes,
+					 darr, dbytes);
+    }
+    if (rc == 0) {
+        rc = TPM_bin2bn((TPM_BIGNUM *)&p, parr, pbytes);	/* freed @2 */
+    }
+    if (rc == 0) {
+        rc = TPM_bin2bn((TPM_BIGNUM *)&q, qarr, qbytes);	/* freed @3 */
+    }
+    if (rc == 0) {
+        rc = TPM_BN_new((TPM_BIGNUM *)&dmp1);			/* freed @4 */
+    }
+    if (rc == 0) {
+        rc = TPM_BN_new((TPM_BIGNUM *)&dmq1);			/* freed @5 */
+    }
+    if (rc == 0) {
+        rc = TPM_BN_new((TPM_BIGNUM *)&iqmp);			/* freed @6 */
+    }
+    /* get a temporary BIGNUM for use in the calculations */
+    if (rc == 0) {
+        rc = TPM_BN_CTX_new(&ctx);				/* freed @7 */
+    }
+    if (rc == 0) {
+        BN_CTX_start(ctx);      /* no return code */
+        r0 = BN_CTX_get(ctx);
+        if (r0 == NULL) {
+            printf("TPM_RSAKeyToken_New: Error in BN_CTX_get()\n");
+            TPM_OpenSSL_PrintError();
+            rc = TPM_SIZE;
+        }
+    }
+    /* calculate dmp1 = d mod (p-1) */
+    if (rc == 0) {
+        irc = BN_sub(r0, p, BN_value_one());
+        if (irc == 1) {
+            irc = BN_mod(dmp1, rsa_pri_key->d, r0, ctx);
+        }
+        if (irc != 1) {         /* 1 is success */
+            printf("TPM_RSAKeyToken_New: Error calculating d mod (p-1)\n");
+            TPM_OpenSSL_PrintError();
+            rc = TPM_BAD_PARAMETER;
+        }
+    }
+    /* calculate dmq1 = d mod (q-1) */
+    if (rc == 0) {
+        irc = BN_sub(r0, q, BN_value_one());
+        if (irc == 1) {
+            irc = BN_mod(dmq1, rsa_pri_key->d, r0, ctx);
+        }
+        if (irc != 1) {         /* 1 is success */
+            printf("TPM_RSAKeyToken_New: Error calculating d mod (q-1)\n");
+            TPM_OpenSSL_PrintError();
+            rc = TPM_BAD_PARAMETER;
+        }
+    }
+    /* calculate iqmp = q^-1 mod p */
+    if (rc == 0) {
+        brc = BN_mod_inverse(iqmp, q, p, ctx);
+        if (brc == NULL) {
+            printf("TPM_RSAKeyToken_New: Error in BN_mod_inverse()\n");
+            TPM_OpenSSL_PrintError();
+            rc = TPM_BAD_PARAMETER;
+        }
+    }
+    /* the key object takes over the BIGNUM's */
+    if (rc == 0) {
+        rsa_pri_key->p = p;
+        rsa_pri_key->q = q;
+        rsa_pri_key->dmp1 = dmp1;
+        rsa_pri_key->dmq1 = dmq1;
+        rsa_pri_key->iqmp = iqmp;
+        p = NULL;
+        q = NULL;
+        dmp1 = NULL;
+        dmq1 = NULL;
+        iqmp = NULL;
+        *rsa_key_token = (TPM_RSA_KEY_TOKEN)rsa_pri_key;
+        rsa_pri_key = NULL;
+    }
+    if (rsa_pri_key != NULL) {
+        RSA_free(rsa_pri_key);  /* @1 */
+    }
+    BN_free(p);                 /* @2 */
+    BN_free(q);                 /* @3 */
+    BN_free(dmp1);              /* @4 */
+    BN_free(dmq1);              /* @5 */
+    BN_free(iqmp);              /* @6 */
+    if (ctx != NULL) {
+        BN_CTX_end(ctx);
+        BN_CTX_free(ctx);       /* @7 */
+    }
+    return rc;
+}
+
+/* TPM_RSAKeyToken_Free() frees the private key token created by TPM_RSAKeyToken_New() and sets it
+   to NULL.
+*/
+
+void TPM_RSAKeyToken_Free(TPM_RSA_KEY_TOKEN *rsa_key_token)
+{
+    printf(" TPM_RSAKeyToken_Free:\n");
+    if (*rsa_key_token != NULL) {
+        RSA_free((RSA *)*rsa_key_token);
+        *rsa_key_token = NULL;
+    }
+    return;
+}
+
 /* TPM_RSAPrivateDecrypt() decrypts 'encrypt_data' using the private key 'n, e, d'.  The OAEP
    padding is removed and 'decrypt_data_length' bytes are moved to 'decrypt_data'.
 
@@ -516,12 +716,8 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,   /* decrypted dat
                                  uint32_t dbytes)
 {
     TPM_RESULT  rc = 0;
-    int         irc;
     RSA *       rsa_pri_key = NULL;	/* freed @1 */
 
-    unsigned char       *padded_data = NULL;
-    int                 padded_data_size = 0;
-    
     printf(" TPM_RSAPrivateDecrypt:\n");
     /* construct the OpenSSL private key object */
     if (rc == 0) {
@@ -533,11 +729,52 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,   /* decrypted dat
 					 darr,		/* private exponent */
 					 dbytes);
     }
+    if (rc == 0) {
+	rc = TPM_RSAKeyToken_PrivateDecrypt(decrypt_data,
+					    decrypt_data_length,
+					    decrypt_data_size,
+					    encScheme,
+					    encrypt_data,
+					    encrypt_data_size,
+					    (TPM_RSA_KEY_TOKEN)rsa_pri_key);
+    }
+    if (rsa_pri_key != NULL) {
+        RSA_free(rsa_pri_key);          /* @1 */
+    }
+    return rc;
+}
+
+/* TPM_RSAKeyToken_PrivateDecrypt() decrypts 'encrypt_data' using the private key token
+   'rsa_key_token'.  The OAEP padding is removed and 'decrypt_data_length' bytes are moved to
+   'decrypt_data'.
+
+   'decrypt_data_length' is at most 'decrypt_data_size'.
+*/
+
+TPM_RESULT TPM_RSAKeyToken_PrivateDecrypt(unsigned char *decrypt_data,	/* decrypted data */
+					  uint32_t *decrypt_data_length,	/* length of data put
+										   into
+										   decrypt_data */
+					  size_t decrypt_data_size,	/* size of decrypt_data
+									   buffer */
+					  TPM_ENC_SCHEME encScheme,	/* encryption scheme */
+					  unsigned char *encrypt_data,	/* encrypted data */
+					  uint32_t encrypt_data_size,
+					  TPM_RSA_KEY_TOKEN rsa_key_token)	/* private key */
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+    RSA *       rsa_pri_key = (RSA *)rsa_key_token;
+
+    unsigned char       *padded_data = NULL;
+    int                 padded_data_size = 0;
+    
+    printf(" TPM_RSAKeyToken_PrivateDecrypt:\n");
     /* intermediate buffer for the decrypted but still padded data */
     if (rc == 0) {
         /* the size of the decrypted data is guaranteed to be less than this */
         padded_data_size = RSA_size(rsa_pri_key);
-        rc = TPM_Malloc(&padded_data, padded_data_size);
+        rc = TPM_Malloc(&padded_data, padded_data_size);		/* freed @1 */
     }
     if (rc == 0) {
         /* decrypt with private key.  Must decrypt first and then remove padding because the decrypt
@@ -549,14 +786,14 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,   /* decrypted dat
                                       rsa_pri_key,              /* key */
                                       RSA_NO_PADDING);          /* padding */
             if (irc < 0) {
-                printf("TPM_RSAPrivateDecrypt: Error in RSA_private_decrypt()\n");
+                printf("TPM_RSAKeyToken_PrivateDecrypt: Error in RSA_private_decrypt()\n");
                 rc = TPM_DECRYPT_ERROR;
             }
     }
     if (rc == 0) {
-        printf("  TPM_RSAPrivateDecrypt: RSA_private_decrypt() success\n");
-        printf("  TPM_RSAPrivateDecrypt: Padded data size %u\n", padded_data_size);
-        TPM_PrintFour("  TPM_RSAPrivateDecrypt: Decrypt padded data", padded_data);
+        printf("  TPM_RSAKeyToken_PrivateDecrypt: RSA_private_decrypt() success\n");
+        printf("  TPM_RSAKeyToken_PrivateDecrypt: Padded data size %u\n", padded_data_size);
+        TPM_PrintFour("  TPM_RSAKeyToken_PrivateDecrypt: Decrypt padded data", padded_data);
         if (encScheme == TPM_ES_RSAESOAEP_SHA1_MGF1) {
             /* openSSL expects the padded data to skip the first 0x00 byte, since it expects the
                padded data to come from a bignum via bn2bin. */
@@ -570,7 +807,7 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,   /* decrypted dat
                                                                            */
                                                );
             if (irc < 0) {
-                printf("TPM_RSAPrivateDecrypt: Error in RSA_padding_check_PKCS1_OAEP()\n");
+                printf("TPM_RSAKeyToken_PrivateDecrypt: Error in RSA_padding_check_PKCS1_OAEP()\n");
                 rc = TPM_DECRYPT_ERROR;
             }
         }
@@ -582,24 +819,24 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,   /* decrypted dat
                                                  encrypt_data_size      /* rsa_len */
                                                  );
             if (irc < 0) {
-                printf("TPM_RSAPrivateDecrypt: Error in RSA_padding_check_PKCS1_type_2()\n");
+                printf("TPM_RSAKeyToken_PrivateDecrypt: Error in "
+                       "RSA_padding_check_PKCS1_type_2()\n");
                 rc = TPM_DECRYPT_ERROR;
             }
         }
         else {
-            printf("TPM_RSAPrivateDecrypt: Error, unknown encryption scheme %04x\n", encScheme);
+            printf("TPM_RSAKeyToken_PrivateDecrypt: Error, unknown encryption scheme %04x\n",
+                   encScheme);
             rc = TPM_INAPPROPRIATE_ENC;
         }
     }
     if (rc == 0) {
         *decrypt_data_length = irc;
-        printf("  TPM_RSAPrivateDecrypt: RSA_padding_check_PKCS1_OAEP() recovered %d bytes\n", irc);
-        TPM_PrintFour("  TPM_RSAPrivateDecrypt: Decrypt data", decrypt_data);
+        printf("  TPM_RSAKeyToken_PrivateDecrypt: RSA_padding_check_PKCS1_OAEP() "
+               "recovered %d bytes\n", irc);
+        TPM_PrintFour("  TPM_RSAKeyToken_PrivateDecrypt: Decrypt data", decrypt_data);
     }
-    if (rsa_pri_key != NULL) {
-        RSA_free(rsa_pri_key);          /* @1 */
-    }
-    free(padded_data);                  /* @2 */
+    free(padded_data);                  /* @1 */
     return rc;
 }
 
@@ -789,7 +1026,6 @@ TPM_RESULT TPM_RSASign(unsigned char *signature,        /* output */
 {
     TPM_RESULT          rc = 0;
     RSA *               rsa_pri_key = NULL;	/* freed @1 */
-    unsigned int        key_size;
 
     printf(" TPM_RSASign:\n");
     /* construct the OpenSSL private key object */
@@ -802,12 +1038,47 @@ TPM_RESULT TPM_RSASign(unsigned char *signature,        /* output */
 					 darr,		/* private exponent */
 					 dbytes);
     }
+    if (rc == 0) {
+	rc = TPM_RSAKeyToken_Sign(signature,
+				  signature_length,
+				  signature_size,
+				  sigScheme,
+				  message,
+				  message_size,
+				  (TPM_RSA_KEY_TOKEN)rsa_pri_key);
+    }
+    if (rsa_pri_key != NULL) {
+        RSA_free(rsa_pri_key);          /* @1 */
+    }
+    return rc;
+}
+
+/* TPM_RSAKeyToken_Sign() signs 'message' of size 'message_size' using the private key token
+   'rsa_key_token' and the signature scheme 'sigScheme' as specified in PKCS #1 v2.0.
+
+   'signature_length' bytes are moved to 'signature'.  'signature_length' is at most
+   'signature_size'.  signature must point to RSA_size(rsa) bytes of memory.
+*/
+
+TPM_RESULT TPM_RSAKeyToken_Sign(unsigned char *signature,	/* output */
+				unsigned int *signature_length,	/* output, size of signature */
+				unsigned int signature_size,	/* input, size of signature buffer */
+				TPM_SIG_SCHEME sigScheme,	/* input, type of signature */
+				const unsigned char *message,	/* input */
+				size_t message_size,		/* input */
+				TPM_RSA_KEY_TOKEN rsa_key_token)	/* signing private key */
+{
+    TPM_RESULT          rc = 0;
+    RSA *               rsa_pri_key = (RSA *)rsa_key_token;
+    unsigned int        key_size;
+
+    printf(" TPM_RSAKeyToken_Sign:\n");
     /* check the size of the output signature buffer */
     if (rc == 0) {
         key_size = (unsigned int)RSA_size(rsa_pri_key); /* openSSL returns an int, but never
                                                            negative */
         if (signature_size < key_size) {
-            printf("TPM_RSASign: Error (fatal), buffer %u too small for signature %u\n",
+            printf("TPM_RSAKeyToken_Sign: Error (fatal), buffer %u too small for signature %u\n",
                    signature_size, key_size);
             rc = TPM_FAIL;      /* internal error, should never occur */
         }
@@ -816,7 +1087,7 @@ TPM_RESULT TPM_RSASign(unsigned char *signature,        /* output */
     if (rc == 0) {
         switch(sigScheme) {
           case TPM_SS_NONE:
-            printf("TPM_RSASign: Error, sigScheme TPM_SS_NONE\n");
+            printf("TPM_RSAKeyToken_Sign: Error, sigScheme TPM_SS_NONE\n");
             rc = TPM_INVALID_KEYUSAGE;
             break;
           case TPM_SS_RSASSAPKCS1v15_SHA1:
@@ -835,14 +1106,11 @@ TPM_RESULT TPM_RSASign(unsigned char *signature,        /* output */
                                 rsa_pri_key);
             break;
           default:
-            printf("TPM_RSASign: Error, sigScheme %04hx unknown\n", sigScheme);
+            printf("TPM_RSAKeyToken_Sign: Error, sigScheme %04hx unknown\n", sigScheme);
             rc = TPM_INVALID_KEYUSAGE;
             break;
         }
     }
-    if (rsa_pri_key != NULL) {
-        RSA_free(rsa_pri_key);          /* @1 */
-    }
     return rc;
 }
 
@@ -1576,6 +1844,379 @@ TPM_RESULT TPM_BN_mod_mul(TPM_BIGNUM rBignum_in,
     BN_CTX_free(ctx);           /* @1 */
     return rc;
 }
+
+
+/* TPM_BN_MONT_DATA is the TPM_BN_MONT_CTX for a modulus that is used repeatedly.  It holds the
+   Montgomery context of the modulus, and a BN_CTX for the temporaries of the calculations.
+*/
+
+typedef struct tdTPM_BN_MONT_DATA {
+    BIGNUM		*modulus;	/* copy of the modulus */
+    BN_MONT_CTX		*mont;		/* NULL if the modulus is even */
+    BN_CTX		*ctx;
+} TPM_BN_MONT_DATA;
+
+/* TPM_BN_MONT_CTX_new() creates a context for calculating modulo nBignum.
+
+   The context must be freed with TPM_BN_MONT_CTX_free().
+*/
+
+TPM_RESULT TPM_BN_MONT_CTX_new(TPM_BN_MONT_CTX *mont_in,	/* freed by caller */
+                               TPM_BIGNUM nBignum_in)
+{
+    TPM_RESULT		rc = 0;
+    int			irc;
+    TPM_BN_MONT_DATA	*mont_data = NULL;
+    BIGNUM		*nBignum = (BIGNUM *)nBignum_in;
+
+    printf(" TPM_BN_MONT_CTX_new:\n");
+    if (rc == 0) {
+        rc = TPM_Malloc((unsigned char **)&mont_data, sizeof(TPM_BN_MONT_DATA));
+    }
+    if (rc == 0) {
+        mont_data->modulus = NULL;
+        mont_data->mont = NULL;
+        mont_data->ctx = NULL;
+        *mont_in = (TPM_BN_MONT_CTX)mont_data;
+        rc = TPM_BN_CTX_new(&(mont_data->ctx));
+    }
+    if (rc == 0) {
+        mont_data->modulus = BN_dup(nBignum);
+        if (mont_data->modulus == NULL) {
+            printf("TPM_BN_MONT_CTX_new: Error in BN_dup()\n");
+            TPM_OpenSSL_PrintError();
+            rc = TPM_SIZE;
+        }
+    }
+    /* Montgomery multiplication needs an odd modulus, BN_mod_exp() falls back to the reciprocal
+       otherwise */
+    if ((rc == 0) && BN_is_odd(nBignum)) {
+        mont_data->mont = BN_MONT_CTX_new();
+        if (mont_data->mont == NULL) {
+            printf("TPM_BN_MONT_CTX_new: Error in BN_MONT_CTX_new()\n");
+            TPM_OpenSSL_PrintError();
+            rc = TPM_SIZE;
+        }
+    }
+    if ((rc == 0) && (mont_data->mont != NULL)) {
+        irc = BN_MONT_CTX_set(mont_data->mont, nBignum, mont_data->ctx);
+        if (irc != 1) {
+            printf("TPM_BN_MONT_CTX_new: Error in BN_MONT_CTX_set()\n");
+            TPM_OpenSSL_PrintError();
+            rc = TPM_DAA_WRONG_W;
+        }
+    }
+    if ((rc != 0) && (mont_data != NULL)) {
+        TPM_BN_MONT_CTX_free(mont_in);
+    }
+    return rc;
+}
+
+/* TPM_BN_MONT_CTX_free() frees the context and sets it to NULL
+ */
+
+void TPM_BN_MONT_CTX_free(TPM_BN_MONT_CTX *mont_in)
+{
+    TPM_BN_MONT_DATA	*mont_data = (TPM_BN_MONT_DATA *)*mont_in;
+
+    if (mont_data != NULL) {
+        BN_MONT_CTX_free(mont_data->mont);
+        BN_CTX_free(mont_data->ctx);
+        BN_free(mont_data->modulus);
+        free(mont_data);
+        *mont_in = NULL;
+    }
+    return;
+}
+
+/* TPM_BN_mod_exp_mont() is TPM_BN_mod_exp() for the modulus of 'mont_in'
+
+   computes a to the p-th power modulo n (r=a^p % n)
+*/
+
+TPM_RESULT TPM_BN_mod_exp_mont(TPM_BIGNUM rBignum_in,
+                               TPM_BIGNUM aBignum_in,
+                               TPM_BIGNUM pBignum_in,
+                               TPM_BN_MONT_CTX mont_in)
+{
+    TPM_RESULT		rc = 0;
+    int			irc;
+    TPM_BN_MONT_DATA	*mont_data = (TPM_BN_MONT_DATA *)mont_in;
+    BIGNUM		*rBignum = (BIGNUM *)rBignum_in;
+    BIGNUM		*aBignum = (BIGNUM *)aBignum_in;
+    BIGNUM		*pBignum = (BIGNUM *)pBignum_in;
+
+    printf(" TPM_BN_mod_exp_mont:\n");
+    if (mont_data->mont != NULL) {
+        irc = BN_mod_exp_mont(rBignum, aBignum, pBignum, mont_data->modulus,
+                              mont_data->ctx, mont_data->mont);
+    }
+    else {
+        irc = BN_mod_exp(rBignum, aBignum, pBignum, mont_data->modulus, mont_data->ctx);
+    }
+    if (irc != 1) {
+        printf("TPM_BN_mod_exp_mont: Error performing BN_mod_exp_mont()\n");
+        TPM_OpenSSL_PrintError();
+        rc = TPM_DAA_WRONG_W;
+    }
+    return rc;
+}
+
+/* TPM_BN_mod_mul_mont() is TPM_BN_mod_mul() for the modulus of 'mont_in'
+
+   r = (a * b) mod n
+*/
+
+TPM_RESULT TPM_BN_mod_mul_mont(TPM_BIGNUM rBignum_in,
+                               TPM_BIGNUM aBignum_in,
+                               TPM_BIGNUM bBignum_in,
+                               TPM_BN_MONT_CTX mont_in)
+{
+    TPM_RESULT		rc = 0;
+    int			irc;
+    TPM_BN_MONT_DATA	*mont_data = (TPM_BN_MONT_DATA *)mont_in;
+    BIGNUM		*rBignum = (BIGNUM *)rBignum_in;
+    BIGNUM		*aBignum = (BIGNUM *)aBignum_in;
+    BIGNUM		*bBignum = (BIGNUM *)bBignum_in;
+
+    printf(" TPM_BN_mod_mul_mont:\n");
+    irc = BN_mod_mul(rBignum, aBignum, bBignum, mont_data->modulus, mont_data->ctx);
+    if (irc != 1) {
+        printf("TPM_BN_mod_mul_mont: Error performing BN_mod_mul()\n");
+        TPM_OpenSSL_PrintError();
+        rc = TPM_DAA_WRONG_W;
+    }
+    return rc;
+}
+
+
+/* TPM_BN_FIXED_BASE_DATA is the TPM_BN_FIXED_BASE for a base that is raised to many exponents
+   modulo the same modulus.
+
+   The exponent is split into digits of 'window' bits.  powers[i] holds base^(2^(window*i)) in
+   Montgomery form, so that base^p is the product of powers[i]^digit[i].  The product is
+   calculated by collecting the powers with the largest digit value first, which takes about
+   'digits' + 2^window multiplications and no squarings.
+*/
+
+typedef struct tdTPM_BN_FIXED_BASE_DATA {
+    TPM_BN_MONT_DATA	*mont_data;	/* modulus, not owned */
+    BIGNUM		*base;		/* base mod modulus */
+    unsigned int	window;		/* bits per exponent digit */
+    unsigned int	digits;		/* number of entries in 'powers' and 'digit' */
+    BIGNUM		**powers;	/* NULL if the modulus is even */
+    unsigned char	*digit;		/* digits of the current exponent */
+} TPM_BN_FIXED_BASE_DATA;
+
+/* TPM_BN_FIXED_BASE_new() precalculates the powers of 'gBignum_in' for exponents of up to 'bits'
+   bits modulo the modulus of 'mont_in'.
+
+   'mont_in' must not be freed before the TPM_BN_FIXED_BASE.  The TPM_BN_FIXED_BASE must be freed
+   with TPM_BN_FIXED_BASE_free().
+*/
+
+TPM_RESULT TPM_BN_FIXED_BASE_new(TPM_BN_FIXED_BASE *fixed_in,	/* freed by caller */
+                                 TPM_BIGNUM gBignum_in,
+                                 unsigned int bits,
+                                 TPM_BN_MONT_CTX mont_in)
+{
+    TPM_RESULT			rc = 0;
+    int				irc = 1;
+    TPM_BN_FIXED_BASE_DATA	*fixed_data = NULL;
+    TPM_BN_MONT_DATA		*mont_data = (TPM_BN_MONT_DATA *)mont_in;
+    BIGNUM			*gBignum = (BIGNUM *)gBignum_in;
+    unsigned int		window;
+    unsigned int		i;
+    unsigned int		j;
+
+    printf(" TPM_BN_FIXED_BASE_new: %u bits\n", bits);
+    if (rc == 0) {
+        rc = TPM_Malloc((unsigned char **)&fixed_data, sizeof(TPM_BN_FIXED_BASE_DATA));
+    }
+    if (rc == 0) {
+        fixed_data->mont_data = mont_data;
+        fixed_data->base = NULL;
+        fixed_data->powers = NULL;
+        fixed_data->digit = NULL;
+        *fixed_in = (TPM_BN_FIXED_BASE)fixed_data;
+        /* the window with the fewest multiplications */
+        fixed_data->window = 1;
+        for (window = 2 ; window <= 8 ; window++) {
+            if ((((bits + window - 1) / window) + (1U << window)) <
+                (((bits + fixed_data->window - 1) / fixed_data->window) +
+                 (1U << fixed_data->window))) {
+                fixed_data->window = window;
+            }
+        }
+        fixed_data->digits = (bits + fixed_data->window - 1) / fixed_data->window;
+        fixed_data->base = BN_new();
+        if (fixed_data->base == NULL) {
+            printf("TPM_BN_FIXED_BASE_new: Error in BN_new()\n");
+            TPM_OpenSSL_PrintError();
+            rc = TPM_SIZE;
+        }
+    }
+    if (rc == 0) {
+        irc = BN_nnmod(fixed_data->base, gBignum, mont_data->modulus, mont_data->ctx);
+    }
+    /* Montgomery multiplication needs an odd modulus, TPM_BN_mod_exp_fixed() falls back to
+       TPM_BN_mod_exp_mont() otherwise */
+    if ((rc == 0) && (irc == 1) && (mont_data->mont != NULL)) {
+        rc = TPM_Malloc((unsigned char **)&(fixed_data->powers),
+                        fixed_data->digits * sizeof(BIGNUM *));
+        if (rc == 0) {
+            for (i = 0 ; i < fixed_data->digits ; i++) {
+                fixed_data->powers[i] = NULL;
+            }
+            rc = TPM_Malloc(&(fixed_data->digit), fixed_data->digits);
+        }
+        /* powers[0] = base, powers[i] = powers[i-1]^(2^window) */
+        for (i = 0 ; (rc == 0) && (irc == 1) && (i < fixed_data->digits) ; i++) {
+            fixed_data->powers[i] = BN_new();
+            if (fixed_data->powers[i] == NULL) {
+                printf("TPM_BN_FIXED_BASE_new: Error in BN_new()\n");
+                TPM_OpenSSL_PrintError();
+                rc = TPM_SIZE;
+            }
+            else if (i == 0) {
+                irc = BN_to_montgomery(fixed_data->powers[0], fixed_data->base,
+                                       mont_data->mont, mont_data->ctx);
+            }
+            else {
+                irc = BN_mod_mul_montgomery(fixed_data->powers[i],
+                                            fixed_data->powers[i-1], fixed_data->powers[i-1],
+                                            mont_data->mont, mont_data->ctx);
+                for (j = 1 ; (irc == 1) && (j < fixed_data->window) ; j++) {
+                    irc = BN_mod_mul_montgomery(fixed_data->powers[i],
+                                                fixed_data->powers[i], fixed_data->powers[i],
+                                                mont_data->mont, mont_data->ctx);
+                }
+            }
+        }
+    }
+    if ((rc == 0) && (irc != 1)) {
+        printf("TPM_BN_FIXED_BASE_new: Error calculating the powers\n");
+        TPM_OpenSSL_PrintError();
+        rc = TPM_DAA_WRONG_W;
+    }
+    if ((rc != 0) && (fixed_data != NULL)) {
+        TPM_BN_FIXED_BASE_free(fixed_in);
+    }
+    return rc;
+}
+
+/* TPM_BN_FIXED_BASE_free() frees the TPM_BN_FIXED_BASE and sets it to NULL
+ */
+
+void TPM_BN_FIXED_BASE_free(TPM_BN_FIXED_BASE *fixed_in)
+{
+    TPM_BN_FIXED_BASE_DATA	*fixed_data = (TPM_BN_FIXED_BASE_DATA *)*fixed_in;
+    unsigned int		i;
+
+    if (fixed_data != NULL) {
+        if (fixed_data->powers != NULL) {
+            for (i = 0 ; i < fixed_data->digits ; i++) {
+                BN_free(fixed_data->powers[i]);
+            }
+        }
+        free(fixed_data->powers);
+        free(fixed_data->digit);
+        BN_free(fixed_data->base);
+        free(fixed_data);
+        *fixed_in = NULL;
+    }
+    return;
+}
+
+/* TPM_BN_mod_exp_fixed() computes the base of 'fixed_in' to the p-th power modulo n (r=base^p % n)
+ */
+
+TPM_RESULT TPM_BN_mod_exp_fixed(TPM_BIGNUM rBignum_in,
+                                TPM_BIGNUM pBignum_in,
+                                TPM_BN_FIXED_BASE fixed_in)
+{
+    TPM_RESULT			rc = 0;
+    int				irc = 1;
+    TPM_BN_FIXED_BASE_DATA	*fixed_data = (TPM_BN_FIXED_BASE_DATA *)fixed_in;
+    TPM_BN_MONT_DATA		*mont_data = fixed_data->mont_data;
+    BIGNUM			*rBignum = (BIGNUM *)rBignum_in;
+    BIGNUM			*pBignum = (BIGNUM *)pBignum_in;
+    BIGNUM			*aBignum;	/* product of the partial products */
+    BIGNUM			*bBignum;	/* product of the powers with digit >= value */
+    TPM_BOOL			aOne = TRUE;	/* aBignum is still 1 */
+    TPM_BOOL			bOne = TRUE;	/* bBignum is still 1 */
+    unsigned int		value;
+    unsigned int		i;
+    unsigned int		j;
+
+    printf(" TPM_BN_mod_exp_fixed:\n");
+    /* an exponent longer than the table, or an even modulus */
+    if ((fixed_data->powers == NULL) || BN_is_negative(pBignum) ||
+        ((unsigned int)BN_num_bits(pBignum) > (fixed_data->digits * fixed_data->window))) {
+        printf("  TPM_BN_mod_exp_fixed: Exponent not covered by the table\n");
+        return TPM_BN_mod_exp_mont(rBignum_in, (TPM_BIGNUM)fixed_data->base, pBignum_in,
+                                   (TPM_BN_MONT_CTX)mont_data);
+    }
+    /* split the exponent into digits */
+    for (i = 0 ; i < fixed_data->digits ; i++) {
+        fixed_data->digit[i] = 0;
+        for (j = 0 ; j < fixed_data->window ; j++) {
+            if (BN_is_bit_set(pBignum, (i * fixed_data->window) + j)) {
+                fixed_data->digit[i] |= 1 << j;
+            }
+        }
+    }
+    BN_CTX_start(mont_data->ctx);
+    aBignum = BN_CTX_get(mont_data->ctx);
+    bBignum = BN_CTX_get(mont_data->ctx);
+    if (bBignum == NULL) {
+        printf("TPM_BN_mod_exp_fixed: Error in BN_CTX_get()\n");
+        TPM_OpenSSL_PrintError();
+        rc = TPM_SIZE;
+    }
+    /* b accumulates the powers whose digit is at least 'value', so that after the loop a holds
+       the product of powers[i]^digit[i] */
+    for (value = (1U << fixed_data->window) - 1 ; (rc == 0) && (irc == 1) && (value > 0) ;
+         value--) {
+        for (i = 0 ; (irc == 1) && (i < fixed_data->digits) ; i++) {
+            if (fixed_data->digit[i] == value) {
+                if (bOne) {
+                    bOne = (BN_copy(bBignum, fixed_data->powers[i]) == NULL);
+                    irc = !bOne;
+                }
+                else {
+                    irc = BN_mod_mul_montgomery(bBignum, bBignum, fixed_data->powers[i],
+                                                mont_data->mont, mont_data->ctx);
+                }
+            }
+        }
+        if ((irc == 1) && !bOne) {
+            if (aOne) {
+                aOne = (BN_copy(aBignum, bBignum) == NULL);
+                irc = !aOne;
+            }
+            else {
+                irc = BN_mod_mul_montgomery(aBignum, aBignum, bBignum,
+                                            mont_data->mont, mont_data->ctx);
+            }
+        }
+    }
+    if ((rc == 0) && (irc == 1)) {
+        if (aOne) {
+            irc = BN_one(rBignum);
+        }
+        else {
+            irc = BN_from_montgomery(rBignum, aBignum, mont_data->mont, mont_data->ctx);
+        }
+    }
+    if ((rc == 0) && (irc != 1)) {
+        printf("TPM_BN_mod_exp_fixed: Error performing the exponentiation\n");
+        TPM_OpenSSL_PrintError();
+        rc = TPM_DAA_WRONG_W;
+    }
+    BN_CTX_end(mont_data->ctx);
+    return rc;
+}
      
 /* TPM_BN_CTX_new() wraps the openSSL function in a TPM error handler */
 
@@ -1744,6 +2385,31 @@ TPM_RESULT TPM_SHA1FinalCmd(unsigned char *md, void *context)
     return rc;
 }
 
+/* TPM_SHA1CopyCmd() copies the SHA-1 context 'src_context' to 'dest_context'.
+
+   If 'dest_context' is NULL, it is allocated.  It is freed by the caller with TPM_SHA1Delete().
+*/
+
+TPM_RESULT TPM_SHA1CopyCmd(void **dest_context, void *src_context)
+{
+    TPM_RESULT  rc = 0;
+
+    printf(" TPM_SHA1CopyCmd:\n");
+    if (rc == 0) {
+        if (src_context == NULL) {
+            printf("TPM_SHA1CopyCmd: Error, no existing SHA1 thread\n");
+            rc = TPM_SHA_THREAD;
+        }
+    }
+    if ((rc == 0) && (*dest_context == NULL)) {
+        rc = TPM_Malloc((unsigned char **)dest_context, sizeof(SHA_CTX));
+    }
+    if (rc == 0) {
+        memcpy(*dest_context, src_context, sizeof(SHA_CTX));
+    }
+    return rc;
+}
+
 /* TPM_SHA1Delete() zeros and frees the SHA1 context */
 
 void TPM_SHA1Delete(void **context)
@@ -88,6 +88,26 @@ TPM_RESULT TPM_BN_mod_add(TPM_BIGNUM rBignum_in,
                           TPM_BIGNUM bBignum_in,
                           TPM_BIGNUM mBignum_in);
 
+TPM_RESULT TPM_BN_MONT_CTX_new(TPM_BN_MONT_CTX *mont_in,
+                               TPM_BIGNUM nBignum_in);
+void       TPM_BN_MONT_CTX_free(TPM_BN_MONT_CTX *mont_in);
+TPM_RESULT TPM_BN_mod_exp_mont(TPM_BIGNUM rBignum_in,
+                               TPM_BIGNUM aBignum_in,
+                               TPM_BIGNUM pBignum_in,
+                               TPM_BN_MONT_CTX mont_in);
+TPM_RESULT TPM_BN_mod_mul_mont(TPM_BIGNUM rBignum_in,
+                               TPM_BIGNUM aBignum_in,
+                               TPM_BIGNUM bBignum_in,
+                               TPM_BN_MONT_CTX mont_in);
+TPM_RESULT TPM_BN_FIXED_BASE_new(TPM_BN_FIXED_BASE *fixed_in,
+                                 TPM_BIGNUM gBignum_in,
+                                 unsigned int bits,
+                                 TPM_BN_MONT_CTX mont_in);
+void       TPM_BN_FIXED_BASE_free(TPM_BN_FIXED_BASE *fixed_in);
+TPM_RESULT TPM_BN_mod_exp_fixed(TPM_BIGNUM rBignum_in,
+                                TPM_BIGNUM pBignum_in,
+                                TPM_BN_FIXED_BASE fixed_in);
+
 TPM_RESULT TPM_bin2bn(TPM_BIGNUM *bn_in,
 		      const unsigned char *bin,
 		      unsigned int bytes);
@@ -120,6 +140,33 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,
                                  unsigned char *d,
                                  uint32_t dbytes);
 
+TPM_RESULT TPM_RSAKeyToken_New(TPM_RSA_KEY_TOKEN *rsa_key_token,
+			       unsigned char *narr,
+			       uint32_t nbytes,
+			       unsigned char *earr,
+			       uint32_t ebytes,
+			       unsigned char *darr,
+			       uint32_t dbytes,
+			       unsigned char *parr,
+			       uint32_t pbytes,
+			       unsigned char *qarr,
+			       uint32_t qbytes);
+void       TPM_RSAKeyToken_Free(TPM_RSA_KEY_TOKEN *rsa_key_token);
+TPM_RESULT TPM_RSAKeyToken_PrivateDecrypt(unsigned char *decrypt_data,
+					  uint32_t *decrypt_data_length,
+					  size_t decrypt_data_size,
+					  TPM_ENC_SCHEME encScheme,
+					  unsigned char *encrypt_data,
+					  uint32_t encrypt_data_size,
+					  TPM_RSA_KEY_TOKEN rsa_key_token);
+TPM_RESULT TPM_RSAKeyToken_Sign(unsigned char *signature,
+				unsigned int *signature_length,
+				unsigned int signature_size,
+				TPM_SIG_SCHEME sigScheme,
+				const unsigned char *message,
+				size_t message_size,
+				TPM_RSA_KEY_TOKEN rsa_key_token);
+
 TPM_RESULT TPM_RSAPublicEncrypt(unsigned char* encrypt_data,
                                 size_t encrypt_data_size,
                                 TPM_ENC_SCHEME encScheme,
@@ -169,6 +216,7 @@ TPM_RESULT TPM_RSAVerifySHA1(unsigned char *signature,
 TPM_RESULT TPM_SHA1InitCmd(void **context);
 TPM_RESULT TPM_SHA1UpdateCmd(void *context, const unsigned char *data, uint32_t length);
 TPM_RESULT TPM_SHA1FinalCmd(unsigned char *md, void *context);
+TPM_RESULT TPM_SHA1CopyCmd(void **dest_context, void *src_context);
 void       TPM_SHA1Delete(void **context);
 
 /* SHA-1 Context */
@@ -555,6 +555,111 @@ static TPM_RESULT TPM_RSAGeneratePrivateToken(RSAPrivateKey *rsa_pri_key, /* fre
     return rc;
 }
 
+/* TPM_RSA_KEY_DATA is the freebl private key token.  It owns copies of the key arrays, since the
+   populated RSAPrivateKey may point into them.
+*/
+
+typedef struct tdTPM_RSA_KEY_DATA {
+    RSAPrivateKey	rsa_pri_key;
+    unsigned char	*buffer;	/* n, e, d, p, q */
+} TPM_RSA_KEY_DATA;
+
+/* TPM_RSAKeyToken_New() creates the private key token 'rsa_key_token' from n, e, d and the prime
+   factors p and q.
+
+   Since the primes are supplied, RSA_PopulatePrivateKey() computes the CRT parameters directly
+   rather than factoring n.  A token kept with a loaded key saves repeating this for each
+   operation.
+
+   The token must be freed with TPM_RSAKeyToken_Free().
+*/
+
+TPM_RESULT TPM_RSAKeyToken_New(TPM_RSA_KEY_TOKEN *rsa_key_token,	/* freed by caller */
+			       unsigned char *narr,	/* public modulus */
+			       uint32_t nbytes,
+			       unsigned char *earr,	/* public exponent */
+			       uint32_t ebytes,
+			       unsigned char *darr,	/* private exponent */
+			       uint32_t dbytes,
+			       unsigned char *parr,	/* secret prime factor */
+			       uint32_t pbytes,
+			       unsigned char *qarr,	/* secret prime factor */
+			       uint32_t qbytes)
+{
+    TPM_RESULT  	rc = 0;
+    SECStatus 		rv = SECSuccess;
+    TPM_RSA_KEY_DATA	*rsa_key_data = NULL;	/* freed @1 */
+    unsigned char	*ptr;
+
+    printf(" TPM_RSAKeyToken_New:\n");
+    *rsa_key_token = NULL;
+    if (rc == 0) {
+	rc = TPM_Malloc((unsigned char **)&rsa_key_data, sizeof(TPM_RSA_KEY_DATA));	/* freed @1 */
+    }
+    if (rc == 0) {
+	TPM_RSAPrivateKeyInit(&(rsa_key_data->rsa_pri_key));
+	rsa_key_data->buffer = NULL;
+	rc = TPM_Malloc(&(rsa_key_data->buffer),
+			nbytes + ebytes + dbytes + pbytes + qbytes);	/* freed @1 */
+    }
+    /* copy the arrays into the token */
+    if (rc == 0) {
+	ptr = rsa_key_data->buffer;
+	memcpy(ptr, narr, nbytes);
+	rsa_key_data->rsa_pri_key.modulus.data = ptr;
+	rsa_key_data->rsa_pri_key.modulus.len = nbytes;
+	ptr += nbytes;
+	memcpy(ptr, earr, ebytes);
+	rsa_key_data->rsa_pri_key.publicExponent.data = ptr;
+	rsa_key_data->rsa_pri_key.publicExponent.len = ebytes;
+	ptr += ebytes;
+	memcpy(ptr, darr, dbytes);
+	rsa_key_data->rsa_pri_key.privateExponent.data = ptr;
+	rsa_key_data->rsa_pri_key.privateExponent.len = dbytes;
+	ptr += dbytes;
+	memcpy(ptr, parr, pbytes);
+	rsa_key_data->rsa_pri_key.prime1.data = ptr;
+	rsa_key_data->rsa_pri_key.prime1.len = pbytes;
+	ptr += pbytes;
+	memcpy(ptr, qarr, qbytes);
+	rsa_key_data->rsa_pri_key.prime2.data = ptr;
+	rsa_key_data->rsa_pri_key.prime2.len = qbytes;
+	/* given n, e, d, p, q, fill in the CRT parameters */
+	rv = RSA_PopulatePrivateKey(&(rsa_key_data->rsa_pri_key));
+	if (rv != SECSuccess) {
+	    printf("TPM_RSAKeyToken_New: Error, RSA_PopulatePrivateKey rv %d\n", rv);
+	    rc = TPM_BAD_PARAMETER;
+	}
+    }
+    if (rc == 0) {
+	*rsa_key_token = (TPM_RSA_KEY_TOKEN)rsa_key_data;
+    }
+    else {
+	TPM_RSAKeyToken_Free((TPM_RSA_KEY_TOKEN *)&rsa_key_data);	/* @1 */
+    }
+    return rc;
+}
+
+/* TPM_RSAKeyToken_Free() frees the private key token created by TPM_RSAKeyToken_New() and sets it
+   to NULL.
+*/
+
+void TPM_RSAKeyToken_Free(TPM_RSA_KEY_TOKEN *rsa_key_token)
+{
+    TPM_RSA_KEY_DATA	*rsa_key_data = (TPM_RSA_KEY_DATA *)*rsa_key_token;
+
+    printf(" TPM_RSAKeyToken_Free:\n");
+    if (rsa_key_data != NULL) {
+	if (rsa_key_data->rsa_pri_key.arena != NULL) {
+	    PORT_FreeArena(rsa_key_data->rsa_pri_key.arena, PR_TRUE);
+	}
+	free(rsa_key_data->buffer);
+	free(rsa_key_data);
+	*rsa_key_token = NULL;
+    }
+    return;
+}
+
 /* TPM_RSAPrivateDecrypt() decrypts 'encrypt_data' using the private key 'n, e, d'.  The OAEP
    padding is removed and 'decrypt_data_length' bytes are moved to 'decrypt_data'.
 
@@ -576,13 +681,11 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,   /* decrypted dat
                                  uint32_t dbytes)
 {
     TPM_RESULT  	rc = 0;
-    SECStatus 		rv = SECSuccess;
-    RSAPrivateKey	rsa_pri_key;
-    unsigned char       *padded_data = NULL;	/* freed @2 */
-    int                 padded_data_size = 0;
+    TPM_RSA_KEY_DATA	rsa_key_data;
 
     printf(" TPM_RSAPrivateDecrypt: Input data size %u\n", encrypt_data_size);
-    TPM_RSAPrivateKeyInit(&rsa_pri_key);			/* freed @1 */
+    TPM_RSAPrivateKeyInit(&(rsa_key_data.rsa_pri_key));	/* freed @1 */
+    rsa_key_data.buffer = NULL;
     /* the encrypted data size must equal the public key size */
     if (rc == 0) {
 	if (encrypt_data_size != nbytes) {
@@ -593,7 +696,7 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,   /* decrypted dat
     }
     /* construct the freebl private key object from n,e,d */
     if (rc == 0) {
-	rc = TPM_RSAGeneratePrivateToken(&rsa_pri_key,	/* freed @1 */
+	rc = TPM_RSAGeneratePrivateToken(&(rsa_key_data.rsa_pri_key),	/* freed @1 */
 					 narr,      	/* public modulus */
 					 nbytes,
 					 earr,      	/* public exponent */
@@ -601,27 +704,73 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,   /* decrypted dat
 					 darr,		/* private exponent */
 					 dbytes);
     }
+    if (rc == 0) {
+	rc = TPM_RSAKeyToken_PrivateDecrypt(decrypt_data,
+					    decrypt_data_length,
+					    decrypt_data_size,
+					    encScheme,
+					    encrypt_data,
+					    encrypt_data_size,
+					    (TPM_RSA_KEY_TOKEN)&rsa_key_data);
+    }
+    PORT_FreeArena(rsa_key_data.rsa_pri_key.arena, PR_TRUE);	/* @1 */
+    return rc;
+}
+
+/* TPM_RSAKeyToken_PrivateDecrypt() decrypts 'encrypt_data' using the private key token
+   'rsa_key_token'.  The OAEP padding is removed and 'decrypt_data_length' bytes are moved to
+   'decrypt_data'.
+
+   'decrypt_data_length' is at most 'decrypt_data_size'.
+*/
+
+TPM_RESULT TPM_RSAKeyToken_PrivateDecrypt(unsigned char *decrypt_data,	/* decrypted data */
+					  uint32_t *decrypt_data_length,	/* length of data put
+										   into
+										   decrypt_data */
+					  size_t decrypt_data_size,	/* size of decrypt_data
+									   buffer */
+					  TPM_ENC_SCHEME encScheme,	/* encryption scheme */
+					  unsigned char *encrypt_data,	/* encrypted data */
+					  uint32_t encrypt_data_size,
+					  TPM_RSA_KEY_TOKEN rsa_key_token)	/* private key */
+{
+    TPM_RESULT  	rc = 0;
+    SECStatus 		rv = SECSuccess;
+    RSAPrivateKey	*rsa_pri_key = &(((TPM_RSA_KEY_DATA *)rsa_key_token)->rsa_pri_key);
+    unsigned char       *padded_data = NULL;	/* freed @1 */
+    int                 padded_data_size = 0;
+
+    printf(" TPM_RSAKeyToken_PrivateDecrypt: Input data size %u\n", encrypt_data_size);
+    /* the encrypted data size must equal the public key size */
+    if (rc == 0) {
+	if (encrypt_data_size != rsa_pri_key->modulus.len) {
+	    printf("TPM_RSAKeyToken_PrivateDecrypt: Error, Encrypted data size is %u not %u\n",
+		   encrypt_data_size, rsa_pri_key->modulus.len);
+	    rc = TPM_DECRYPT_ERROR;
+	}
+    }
     /* allocate intermediate buffer for the decrypted but still padded data */
     if (rc == 0) {
         /* the size of the decrypted data is guaranteed to be less than this */
-        padded_data_size = rsa_pri_key.modulus.len;
-        rc = TPM_Malloc(&padded_data, padded_data_size);	/* freed @2 */
+        padded_data_size = rsa_pri_key->modulus.len;
+        rc = TPM_Malloc(&padded_data, padded_data_size);	/* freed @1 */
     }
     if (rc == 0) {
         /* decrypt with private key.  Must decrypt first and then remove padding because the decrypt
            call cannot specify an encoding parameter */
-	rv = RSA_PrivateKeyOp(&rsa_pri_key,		/* private key token */
+	rv = RSA_PrivateKeyOp(rsa_pri_key,		/* private key token */
 			      padded_data,		/* to - the decrypted but padded data */
 			      encrypt_data);		/* from - the encrypted data */
 	if (rv != SECSuccess) {
-	    printf("TPM_RSAPrivateDecrypt: Error in RSA_PrivateKeyOp(), rv %d\n", rv);
+	    printf("TPM_RSAKeyToken_PrivateDecrypt: Error in RSA_PrivateKeyOp(), rv %d\n", rv);
 	    rc = TPM_DECRYPT_ERROR;
 	}
    }
     if (rc == 0) {
-        printf("  TPM_RSAPrivateDecrypt: RSA_PrivateKeyOp() success\n");
-        printf("  TPM_RSAPrivateDecrypt: Padded data size %u\n", padded_data_size);
-        TPM_PrintFour("  TPM_RSAPrivateDecrypt: Decrypt padded data", padded_data);
+        printf("  TPM_RSAKeyToken_PrivateDecrypt: RSA_PrivateKeyOp() success\n");
+        printf("  TPM_RSAKeyToken_PrivateDecrypt: Padded data size %u\n", padded_data_size);
+        TPM_PrintFour("  TPM_RSAKeyToken_PrivateDecrypt: Decrypt padded data", padded_data);
 	/* check and remove the padding based on the TPM encryption scheme */
         if (encScheme == TPM_ES_RSAESOAEP_SHA1_MGF1) {
 	    /* recovered seed and pHash are not returned */
@@ -647,17 +796,16 @@ TPM_RESULT TPM_RSAPrivateDecrypt(unsigned char *decrypt_data,   /* decrypted dat
 					     padded_data_size);  	/* from length */
         }
         else {
-            printf("TPM_RSAPrivateDecrypt: Error, unknown encryption scheme %04x\n", encScheme);
+            printf("TPM_RSAKeyToken_PrivateDecrypt: Error, unknown encryption scheme %04x\n", encScheme);
             rc = TPM_INAPPROPRIATE_ENC;
         }
     }
     if (rc == 0) {
-        printf("  TPM_RSAPrivateDecrypt: RSA_padding_check_PKCS1 recovered %d bytes\n",
+        printf("  TPM_RSAKeyToken_PrivateDecrypt: RSA_padding_check_PKCS1 recovered %d bytes\n",
 	       *decrypt_data_length);
-        TPM_PrintFour("  TPM_RSAPrivateDecrypt: Decrypt data", decrypt_data);
+        TPM_PrintFour("  TPM_RSAKeyToken_PrivateDecrypt: Decrypt data", decrypt_data);
     }
-    PORT_FreeArena(rsa_pri_key.arena, PR_TRUE);	/* @1 */
-    free(padded_data);                  	/* @2 */
+    free(padded_data);                  	/* @1 */
     return rc;
 }
 
@@ -813,13 +961,14 @@ TPM_RESULT TPM_RSASign(unsigned char *signature,        /* output */
                        uint32_t dbytes)
 {
     TPM_RESULT          rc = 0;
-    RSAPrivateKey 	rsa_pri_key;
+    TPM_RSA_KEY_DATA	rsa_key_data;
 
     printf(" TPM_RSASign:\n");
-    TPM_RSAPrivateKeyInit(&rsa_pri_key);			/* freed @1 */
+    TPM_RSAPrivateKeyInit(&(rsa_key_data.rsa_pri_key));	/* freed @1 */
+    rsa_key_data.buffer = NULL;
     /* construct the free private key object from n,e,d */
     if (rc == 0) {
-	rc = TPM_RSAGeneratePrivateToken(&rsa_pri_key,	/* freed @1 */
+	rc = TPM_RSAGeneratePrivateToken(&(rsa_key_data.rsa_pri_key),	/* freed @1 */
 					 narr,      	/* public modulus */
 					 nbytes,
 					 earr,      	/* public exponent */
@@ -827,11 +976,43 @@ TPM_RESULT TPM_RSASign(unsigned char *signature,        /* output */
 					 darr,		/* private exponent */
 					 dbytes);
     }
+    if (rc == 0) {
+	rc = TPM_RSAKeyToken_Sign(signature,
+				  signature_length,
+				  signature_size,
+				  sigScheme,
+				  message,
+				  message_size,
+				  (TPM_RSA_KEY_TOKEN)&rsa_key_data);
+    }
+    PORT_FreeArena(rsa_key_data.rsa_pri_key.arena, PR_TRUE);	/* @1 */
+    return rc;
+}
+
+/* TPM_RSAKeyToken_Sign() signs 'message' of size 'message_size' using the private key token
+   'rsa_key_token' and the signature scheme 'sigScheme' as specified in PKCS #1 v2.0.
+
+   'signature_length' bytes are moved to 'signature'.  'signature_length' is at most
+   'signature_size'.  signature must point to bytes of memory equal to the public modulus size.
+*/
+
+TPM_RESULT TPM_RSAKeyToken_Sign(unsigned char *signature,	/* output */
+				unsigned int *signature_length,	/* output, size of signature */
+				unsigned int signature_size,	/* input, size of signature buffer */
+				TPM_SIG_SCHEME sigScheme,	/* input, type of signature */
+				const unsigned char *message,	/* input */
+				size_t message_size,		/* input */
+				TPM_RSA_KEY_TOKEN rsa_key_token)	/* signing private key */
+{
+    TPM_RESULT          rc = 0;
+    RSAPrivateKey 	*rsa_pri_key = &(((TPM_RSA_KEY_DATA *)rsa_key_token)->rsa_pri_key);
+
+    printf(" TPM_RSAKeyToken_Sign:\n");
     /* sanity check the size of the output signature buffer */
     if (rc == 0) {
-        if (signature_size < nbytes) {
-            printf("TPM_RSASign: Error (fatal), buffer %u too small for signature %u\n",
-                   signature_size, nbytes);
+        if (signature_size < rsa_pri_key->modulus.len) {
+            printf("TPM_RSAKeyToken_Sign: Error (fatal), buffer %u too small for signature %u\n",
+                   signature_size, rsa_pri_key->modulus.len);
             rc = TPM_FAIL;      /* internal error, should never occur */
         }
     }
@@ -839,7 +1020,7 @@ TPM_RESULT TPM_RSASign(unsigned char *signature,        /* output */
     if (rc == 0) {
         switch(sigScheme) {
           case TPM_SS_NONE:
-            printf("TPM_RSASign: Error, sigScheme TPM_SS_NONE\n");
+            printf("TPM_RSAKeyToken_Sign: Error, sigScheme TPM_SS_NONE\n");
             rc = TPM_INVALID_KEYUSAGE;
             break;
           case TPM_SS_RSASSAPKCS1v15_SHA1:
@@ -848,22 +1029,21 @@ TPM_RESULT TPM_RSASign(unsigned char *signature,        /* output */
                                  signature_length,
                                  message,
                                  message_size,
-                                 &rsa_pri_key);
+                                 rsa_pri_key);
             break;
           case TPM_SS_RSASSAPKCS1v15_DER:
             rc = TPM_RSASignDER(signature,
                                 signature_length,
                                 message,
                                 message_size,
-                                &rsa_pri_key);
+                                rsa_pri_key);
             break;
           default:
-            printf("TPM_RSASign: Error, sigScheme %04hx unknown\n", sigScheme);
+            printf("TPM_RSAKeyToken_Sign: Error, sigScheme %04hx unknown\n", sigScheme);
             rc = TPM_INVALID_KEYUSAGE;
             break;
         }
     }
-    PORT_FreeArena(rsa_pri_key.arena, PR_TRUE);		/* @1 */
     return rc;
 }
 
@@ -1626,6 +1806,165 @@ TPM_RESULT TPM_BN_mod_mul(TPM_BIGNUM rBignum_in,
     return rc;
 }
 
+/* TPM_BN_MONT_DATA is the TPM_BN_MONT_CTX for a modulus that is used repeatedly.  GNU MP keeps no
+   state between calculations, so it only holds a copy of the modulus.
+*/
+
+typedef struct tdTPM_BN_MONT_DATA {
+    mpz_t		modulus;
+} TPM_BN_MONT_DATA;
+
+/* TPM_BN_MONT_CTX_new() creates a context for calculating modulo nBignum.
+
+   The context must be freed with TPM_BN_MONT_CTX_free().
+*/
+
+TPM_RESULT TPM_BN_MONT_CTX_new(TPM_BN_MONT_CTX *mont_in,	/* freed by caller */
+                               TPM_BIGNUM nBignum_in)
+{
+    TPM_RESULT		rc = 0;
+    TPM_BN_MONT_DATA	*mont_data;
+    mpz_t		*nBignum = (mpz_t *)nBignum_in;
+
+    printf(" TPM_BN_MONT_CTX_new:\n");
+    if (rc == 0) {
+        rc = TPM_Malloc(mont_in, sizeof(TPM_BN_MONT_DATA));	/* freed by caller */
+    }
+    if (rc == 0) {
+        mont_data = (TPM_BN_MONT_DATA *)*mont_in;
+        mpz_init_set(mont_data->modulus, *nBignum);
+    }
+    return rc;
+}
+
+/* TPM_BN_MONT_CTX_free() frees the context and sets it to NULL
+ */
+
+void TPM_BN_MONT_CTX_free(TPM_BN_MONT_CTX *mont_in)
+{
+    TPM_BN_MONT_DATA	*mont_data = (TPM_BN_MONT_DATA *)*mont_in;
+
+    if (mont_data != NULL) {
+        mpz_clear(mont_data->modulus);
+        free(mont_data);
+        *mont_in = NULL;
+    }
+    return;
+}
+
+/* TPM_BN_mod_exp_mont() is TPM_BN_mod_exp() for the modulus of 'mont_in'
+
+   computes a to the p-th power modulo n (r=a^p % n)
+*/
+
+TPM_RESULT TPM_BN_mod_exp_mont(TPM_BIGNUM rBignum_in,
+                               TPM_BIGNUM aBignum_in,
+                               TPM_BIGNUM pBignum_in,
+                               TPM_BN_MONT_CTX mont_in)
+{
+    TPM_RESULT		rc = 0;
+    TPM_BN_MONT_DATA	*mont_data = (TPM_BN_MONT_DATA *)mont_in;
+    mpz_t 		*rBignum = (mpz_t *)rBignum_in;
+    mpz_t 		*aBignum = (mpz_t *)aBignum_in;
+    mpz_t 		*pBignum = (mpz_t *)pBignum_in;
+
+    printf(" TPM_BN_mod_exp_mont:\n");
+    mpz_powm(*rBignum, *aBignum, *pBignum, mont_data->modulus);
+    return rc;
+}
+
+/* TPM_BN_mod_mul_mont() is TPM_BN_mod_mul() for the modulus of 'mont_in'
+
+   r = (a * b) mod n
+*/
+
+TPM_RESULT TPM_BN_mod_mul_mont(TPM_BIGNUM rBignum_in,
+                               TPM_BIGNUM aBignum_in,
+                               TPM_BIGNUM bBignum_in,
+                               TPM_BN_MONT_CTX mont_in)
+{
+    TPM_RESULT		rc = 0;
+    TPM_BN_MONT_DATA	*mont_data = (TPM_BN_MONT_DATA *)mont_in;
+    mpz_t 		*rBignum = (mpz_t *)rBignum_in;
+    mpz_t 		*aBignum = (mpz_t *)aBignum_in;
+    mpz_t 		*bBignum = (mpz_t *)bBignum_in;
+
+    printf(" TPM_BN_mod_mul_mont:\n");
+    mpz_mul(*rBignum, *aBignum, *bBignum);
+    mpz_mod(*rBignum, *rBignum, mont_data->modulus);
+    return rc;
+}
+
+/* TPM_BN_FIXED_BASE_DATA is the TPM_BN_FIXED_BASE for a base that is raised to many exponents
+   modulo the same modulus.  GNU MP has no fixed base exponentiation, so it only holds a copy of
+   the base.
+*/
+
+typedef struct tdTPM_BN_FIXED_BASE_DATA {
+    TPM_BN_MONT_DATA	*mont_data;	/* modulus, not owned */
+    mpz_t		base;
+} TPM_BN_FIXED_BASE_DATA;
+
+/* TPM_BN_FIXED_BASE_new() prepares 'gBignum_in' for exponents of up to 'bits' bits modulo the
+   modulus of 'mont_in'.
+
+   'mont_in' must not be freed before the TPM_BN_FIXED_BASE.  The TPM_BN_FIXED_BASE must be freed
+   with TPM_BN_FIXED_BASE_free().
+*/
+
+TPM_RESULT TPM_BN_FIXED_BASE_new(TPM_BN_FIXED_BASE *fixed_in,	/* freed by caller */
+                                 TPM_BIGNUM gBignum_in,
+                                 unsigned int bits,
+                                 TPM_BN_MONT_CTX mont_in)
+{
+    TPM_RESULT			rc = 0;
+    TPM_BN_FIXED_BASE_DATA	*fixed_data;
+    mpz_t			*gBignum = (mpz_t *)gBignum_in;
+
+    printf(" TPM_BN_FIXED_BASE_new: %u bits\n", bits);
+    if (rc == 0) {
+        rc = TPM_Malloc(fixed_in, sizeof(TPM_BN_FIXED_BASE_DATA));	/* freed by caller */
+    }
+    if (rc == 0) {
+        fixed_data = (TPM_BN_FIXED_BASE_DATA *)*fixed_in;
+        fixed_data->mont_data = (TPM_BN_MONT_DATA *)mont_in;
+        mpz_init_set(fixed_data->base, *gBignum);
+    }
+    return rc;
+}
+
+/* TPM_BN_FIXED_BASE_free() frees the TPM_BN_FIXED_BASE and sets it to NULL
+ */
+
+void TPM_BN_FIXED_BASE_free(TPM_BN_FIXED_BASE *fixed_in)
+{
+    TPM_BN_FIXED_BASE_DATA	*fixed_data = (TPM_BN_FIXED_BASE_DATA *)*fixed_in;
+
+    if (fixed_data != NULL) {
+        mpz_clear(fixed_data->base);
+        free(fixed_data);
+        *fixed_in = NULL;
+    }
+    return;
+}
+
+/* TPM_BN_mod_exp_fixed() computes the base of 'fixed_in' to the p-th power modulo n (r=base^p % n)
+ */
+
+TPM_RESULT TPM_BN_mod_exp_fixed(TPM_BIGNUM rBignum_in,
+                                TPM_BIGNUM pBignum_in,
+                                TPM_BN_FIXED_BASE fixed_in)
+{
+    TPM_RESULT			rc = 0;
+    TPM_BN_FIXED_BASE_DATA	*fixed_data = (TPM_BN_FIXED_BASE_DATA *)fixed_in;
+    mpz_t 			*rBignum = (mpz_t *)rBignum_in;
+    mpz_t 			*pBignum = (mpz_t *)pBignum_in;
+
+    printf(" TPM_BN_mod_exp_fixed:\n");
+    mpz_powm(*rBignum, fixed_data->base, *pBignum, fixed_data->mont_data->modulus);
+    return rc;
+}
+
 /* TPM_BN_new() wraps the gnump function in a TPM error handler
 
    Allocates a new bignum
@@ -1829,6 +2168,35 @@ TPM_RESULT TPM_SHA1FinalCmd(unsigned char *md, void *context)
     return rc;
 }
 
+/* TPM_SHA1CopyCmd() copies the SHA-1 context 'src_context' to 'dest_context'.
+
+   If 'dest_context' is NULL, it is allocated.  It is freed by the caller with TPM_SHA1Delete().
+*/
+
+TPM_RESULT TPM_SHA1CopyCmd(void **dest_context, void *src_context)
+{
+    TPM_RESULT  rc = 0;
+
+    printf(" TPM_SHA1CopyCmd:\n");
+    if (rc == 0) {
+	if (src_context == NULL) {
+	    printf("TPM_SHA1CopyCmd: Error, no existing SHA1 thread\n");
+	    rc = TPM_SHA_THREAD;
+	}
+    }
+    if ((rc == 0) && (*dest_context == NULL)) {
+	*dest_context = SHA1_NewContext();
+	if (*dest_context == NULL) {
+	    printf("TPM_SHA1CopyCmd:  Error allocating a new context\n");
+	    rc = TPM_SIZE;
+	}
+    }
+    if (rc == 0) {
+	SHA1_Clone(*dest_context, src_context);
+    }
+    return rc;
+}
+
 /* TPM_SHA1Delete() zeros and frees the SHA1 context */
 
 void TPM_SHA1Delete(void **context)
@@ -41,6 +41,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include "tpm_admin.h"
 #include "tpm_auth.h"
@@ -55,6 +56,7 @@
 #include "tpm_key.h"
 #include "tpm_pcr.h"
 #include "tpm_process.h"
+#include "tpm_secret.h"
 #include "tpm_store.h"
 #include "tpm_ver.h"
 
@@ -68,6 +70,12 @@ static TPM_RESULT TPM_SHA1_valist(TPM_DIGEST md,
 static TPM_RESULT TPM_HMAC_Generatevalist(TPM_HMAC hmac,
 					  const TPM_SECRET key,
 					  va_list ap);
+static TPM_RESULT TPM_HmacContext_SetKey(TPM_HMAC_CONTEXT *hmac_context,
+					 const TPM_SECRET key);
+static TPM_RESULT TPM_HmacContext_Begin(TPM_HMAC_CONTEXT *hmac_context,
+					const TPM_SECRET key);
+static TPM_RESULT TPM_HmacContext_End(TPM_HMAC tpm_hmac,
+				      TPM_HMAC_CONTEXT *hmac_context);
 
 static TPM_RESULT TPM_SHA1CompleteCommon(TPM_DIGEST hashValue,
 					 void **sha1_context,
@@ -839,8 +847,8 @@ TPM_RESULT TPM_SHA1Sbuffer(TPM_DIGEST tpm_digest,
     return rc;
 }
 
-/* TPM_SHA1_GenerateStructure() generates a SHA-1 digest of a structure.  It serializes the
-   structure and hashes the result.
+/* TPM_SHA1_GenerateStructure() generates a SHA-1 digest of a structure.  The structure is hashed
+   as it is serialized.
 
    tpmStructure is the structure to be serialized
    storeFunction is the serialization function for the structure
@@ -851,19 +859,25 @@ TPM_RESULT TPM_SHA1_GenerateStructure(TPM_DIGEST tpm_digest,
 				      TPM_STORE_FUNCTION_T storeFunction)
 {
     TPM_RESULT		rc = 0;
-    TPM_STORE_BUFFER	sbuffer;	/* serialized tpmStructure */
+    void		*context = NULL;	/* platform dependent context, freed @1 */
+    TPM_STORE_BUFFER	sbuffer;		/* digests tpmStructure */
 
     printf(" TPM_SHA1_GenerateStructure:\n");
-    TPM_Sbuffer_Init(&sbuffer);				/* freed @1 */
-    /* Serialize the structure */
     if (rc == 0) {
+	rc = TPM_SHA1InitCmd(&context);				/* freed @1 */
+    }
+    /* serialize the structure into the context */
+    if (rc == 0) {
+	TPM_Sbuffer_InitDigest(&sbuffer, context);
 	rc = storeFunction(&sbuffer, tpmStructure);
     }	 
-    /* hash the serialized buffer to tpm_hmac */
     if (rc == 0) {
-	rc = TPM_SHA1Sbuffer(tpm_digest, &sbuffer);
+	rc = TPM_SHA1FinalCmd(tpm_digest, context);
     }
-    TPM_Sbuffer_Delete(&sbuffer);			/* @1 */
+    if (rc == 0) {
+	TPM_PrintFour("  TPM_SHA1_GenerateStructure: Digest", tpm_digest);
+    }	 
+    TPM_SHA1Delete(&context);				/* @1 */
     return rc;
 }
 
@@ -940,6 +954,34 @@ TPM_RESULT TPM_SHA1_Check(TPM_DIGEST digest_expect, ...)
     return rc;
 }
 
+/* TPM_SHA1_Iovec() hashes the 'iovcnt' streams of the scatter-gather list 'iov'.
+ */
+
+TPM_RESULT TPM_SHA1_Iovec(TPM_DIGEST md,
+			  const TPM_DIGEST_IOVEC *iov,
+			  size_t iovcnt)
+{
+    TPM_RESULT		rc = 0;
+    void		*context = NULL;	/* platform dependent context, freed @1 */
+    size_t		i;
+
+    printf(" TPM_SHA1_Iovec:\n");
+    if (rc == 0) {
+	rc = TPM_SHA1InitCmd(&context);				/* freed @1 */
+    }
+    for (i = 0 ; (rc == 0) && (i < iovcnt) ; i++) {
+	rc = TPM_SHA1UpdateCmd(context, iov[i].buffer, iov[i].length);
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1FinalCmd(md, context);
+    }
+    if (rc == 0) {
+	TPM_PrintFour("  TPM_SHA1_Iovec: Digest", md);
+    }	 
+    TPM_SHA1Delete(&context);				/* @1 */
+    return rc;
+}
+
 /* TPM_SHA1_valist() is the internal function, called with the va_list already created.
 
    It is called from TPM_SHA1() to do a simple hash.  Typically length0==0 and buffer0==NULL.
@@ -1020,8 +1062,8 @@ TPM_RESULT TPM_HMAC_GenerateSbuffer(TPM_HMAC tpm_hmac,
     return rc;
 }
 
-/* TPM_HMAC_GenerateStructure() generates an HMAC of a structure.  It serializes the structure and
-   HMAC's the result.
+/* TPM_HMAC_GenerateStructure() generates an HMAC of a structure.  The structure is HMAC'ed as it
+   is serialized.
 
    hmacKey is the HMAC key
    tpmStructure is the structure to be serialized
@@ -1034,19 +1076,23 @@ TPM_RESULT TPM_HMAC_GenerateStructure(TPM_HMAC tpm_hmac,
 				      TPM_STORE_FUNCTION_T storeFunction)
 {
     TPM_RESULT		rc = 0;
-    TPM_STORE_BUFFER	sbuffer;	/* serialized tpmStructure */
+    TPM_HMAC_CONTEXT	hmac_context;	/* freed @1 */
+    TPM_STORE_BUFFER	sbuffer;	/* digests tpmStructure */
 
     printf(" TPM_HMAC_GenerateStructure:\n");
-    TPM_Sbuffer_Init(&sbuffer);				/* freed @1 */
-    /* Serialize the structure */
+    TPM_HmacContext_Init(&hmac_context);		/* freed @1 */
     if (rc == 0) {
+	rc = TPM_HmacContext_Begin(&hmac_context, hmac_key);
+    }
+    /* serialize the structure into the inner context */
+    if (rc == 0) {
+	TPM_Sbuffer_InitDigest(&sbuffer, hmac_context.context);
 	rc = storeFunction(&sbuffer, tpmStructure);
     }	 
-    /* hash the serialized buffer to tpm_hmac */
     if (rc == 0) {
-	rc = TPM_HMAC_GenerateSbuffer(tpm_hmac, hmac_key, &sbuffer);
+	rc = TPM_HmacContext_End(tpm_hmac, &hmac_context);
     }
-    TPM_Sbuffer_Delete(&sbuffer);			/* @1 */
+    TPM_HmacContext_Delete(&hmac_context);		/* @1 */
     return rc;
 }
     
@@ -1071,49 +1117,76 @@ TPM_RESULT TPM_HMAC_Generate(TPM_HMAC tpm_hmac,
     return rc;
 }
 
+/* TPM_HMAC_GenerateIovec() HMAC's the 'iovcnt' streams of the scatter-gather list 'iov'.
+
+   If 'hmac_context' is not NULL, it holds the key midstates across calls.  They are calculated
+   when 'hmac_key' differs from the key of the previous call.
+*/
+
+TPM_RESULT TPM_HMAC_GenerateIovec(TPM_HMAC tpm_hmac,
+				  TPM_HMAC_CONTEXT *hmac_context,
+				  const TPM_SECRET hmac_key,
+				  const TPM_DIGEST_IOVEC *iov,
+				  size_t iovcnt)
+{
+    TPM_RESULT		rc = 0;
+    TPM_HMAC_CONTEXT	tmp_hmac_context;	/* freed @1 */
+    size_t		i;
+    
+    printf(" TPM_HMAC_GenerateIovec:\n");
+    TPM_HmacContext_Init(&tmp_hmac_context);	/* freed @1 */
+    if (hmac_context == NULL) {
+	hmac_context = &tmp_hmac_context;
+    }
+    if (rc == 0) {
+	rc = TPM_HmacContext_Begin(hmac_context, hmac_key);
+    }
+    for (i = 0 ; (rc == 0) && (i < iovcnt) ; i++) {
+	rc = TPM_SHA1UpdateCmd(hmac_context->context, iov[i].buffer, iov[i].length);
+    }
+    if (rc == 0) {
+	rc = TPM_HmacContext_End(tpm_hmac, hmac_context);
+    }
+    TPM_HmacContext_Delete(&tmp_hmac_context);	/* @1 */
+    return rc;
+}
+
 /* TPM_HMAC_Generatevalist() is the internal function, called with the va_list already created.
 
    It is called from TPM_HMAC_Generate() and TPM_HMAC_Check() with the va_list for the text already
    formed.
 */
 
-#define TPM_HMAC_BLOCK_SIZE 64
-
 static TPM_RESULT TPM_HMAC_Generatevalist(TPM_HMAC tpm_hmac,
 					  const TPM_SECRET key,
 					  va_list ap)
 {
     TPM_RESULT		rc = 0;
-    unsigned char	ipad[TPM_HMAC_BLOCK_SIZE];
-    unsigned char	opad[TPM_HMAC_BLOCK_SIZE];
-    size_t		i;
-    TPM_DIGEST		inner_hash;
+    TPM_HMAC_CONTEXT	hmac_context;	/* freed @1 */
+    uint32_t		length;
+    unsigned char	*buffer;
+    TPM_BOOL		done = FALSE;
 
     printf(" TPM_HMAC_Generatevalist:\n");
-    /* calculate key XOR ipad and key XOR opad */
+    TPM_HmacContext_Init(&hmac_context);	/* freed @1 */
     if (rc == 0) {
-	/* first part, key XOR pad */
-	for (i = 0 ; i < TPM_AUTHDATA_SIZE ; i++) {
-	    ipad[i] = key[i] ^ 0x36;	/* magic numbers from RFC 2104 */
-	    opad[i] = key[i] ^ 0x5c;
+	rc = TPM_HmacContext_Begin(&hmac_context, key);
+    }
+    while ((rc == 0) && !done) {
+	length = va_arg(ap, uint32_t);		/* first vararg is the length */
+	if (length != 0) {			/* loop until a zero length argument terminates */
+	    buffer = va_arg(ap, unsigned char *);	/* second vararg is the array */
+	    printf("  TPM_HMAC_Generatevalist: Digesting %u bytes\n", length);
+	    rc = TPM_SHA1UpdateCmd(hmac_context.context, buffer, length);
+	}
+	else {
+	    done = TRUE;
 	}
-	/* second part, 0x00 XOR pad */
-	memset(ipad + TPM_AUTHDATA_SIZE, 0x36, TPM_HMAC_BLOCK_SIZE - TPM_AUTHDATA_SIZE);
-	memset(opad + TPM_AUTHDATA_SIZE, 0x5c, TPM_HMAC_BLOCK_SIZE - TPM_AUTHDATA_SIZE);
-	/* calculate the inner hash, hash the key XOR ipad and the text */
-	rc = TPM_SHA1_valist(inner_hash,
-			     TPM_HMAC_BLOCK_SIZE, ipad, ap);
     }
-    /* hash the key XOR opad and the previous hash */
     if (rc == 0) {
-	rc = TPM_SHA1(tpm_hmac,
-		      TPM_HMAC_BLOCK_SIZE, opad,
-		      TPM_DIGEST_SIZE, inner_hash,
-		      0, NULL);
+	rc = TPM_HmacContext_End(tpm_hmac, &hmac_context);
     }
-    if (rc == 0) {
-	TPM_PrintFour(" TPM_HMAC_Generatevalist: HMAC", tpm_hmac);
-    }	 
+    TPM_HmacContext_Delete(&hmac_context);	/* @1 */
     return rc;
 }
 
@@ -1186,6 +1259,40 @@ TPM_RESULT TPM_HMAC_Check(TPM_BOOL *valid,
     return rc;
 }
 
+/* TPM_HMAC_CheckIovec() checks the HMAC of the 'iovcnt' streams of the scatter-gather list 'iov'.
+
+   'hmac_context' is as for TPM_HMAC_GenerateIovec().
+*/
+
+TPM_RESULT TPM_HMAC_CheckIovec(TPM_BOOL *valid,
+			       TPM_HMAC expect,
+			       TPM_HMAC_CONTEXT *hmac_context,
+			       const TPM_SECRET key,
+			       const TPM_DIGEST_IOVEC *iov,
+			       size_t iovcnt)
+{
+    TPM_RESULT		rc = 0;
+    TPM_HMAC		actual;
+    int			result;
+
+    printf(" TPM_HMAC_CheckIovec:\n");
+    if (rc == 0) {
+	rc = TPM_HMAC_GenerateIovec(actual, hmac_context, key, iov, iovcnt);
+    }
+    if (rc == 0) {
+	TPM_PrintFour("  TPM_HMAC_CheckIovec: Calculated", actual);
+	TPM_PrintFour("  TPM_HMAC_CheckIovec: Received  ", expect);
+	result = memcmp(expect, actual, TPM_DIGEST_SIZE);
+	if (result == 0) {
+	    *valid = TRUE;
+	}
+	else {
+	    *valid = FALSE;
+	}
+    }
+    return rc;
+}
+
 /* TPM_HMAC_CheckStructure() is a generic function that checks the integrity HMAC of a structure.
 
    hmacKey is the HMAC key
@@ -1207,37 +1314,181 @@ TPM_RESULT TPM_HMAC_CheckStructure(const TPM_SECRET hmac_key,
 				   TPM_RESULT error)
 {
     TPM_RESULT		rc = 0;
-    TPM_STORE_BUFFER	sbuffer;	/* serialized tpmStructure */
     TPM_HMAC		saveExpect;
-    TPM_BOOL		valid;
+    TPM_HMAC		actual;
 
     printf(" TPM_HMAC_CheckStructure:\n");
-    TPM_Sbuffer_Init(&sbuffer);			/* freed @1 */
+    /* HMAC the structure */
     if (rc == 0) {
 	TPM_Digest_Copy(saveExpect, expect);	/* save the expected value */
 	TPM_Digest_Init(expect);		/* set value in structure to NULL */
-	rc = storeFunction(&sbuffer,
-			   tpmStructure);
-    }
-    /* verify the HMAC of the serialized structure */
-    if (rc == 0) {
-	rc = TPM_HMAC_CheckSbuffer(&valid,		/* result */
-				   saveExpect,		/* expected */
-				   hmac_key,		/* key */
-				   &sbuffer);		/* data stream */
+	rc = TPM_HMAC_GenerateStructure(actual,
+					hmac_key,
+					tpmStructure,
+					storeFunction);
     }
+    /* verify the HMAC of the structure */
     if (rc == 0) {
-	if (!valid) {
+	TPM_PrintFour("  TPM_HMAC_CheckStructure: Calculated", actual);
+	TPM_PrintFour("  TPM_HMAC_CheckStructure: Received  ", saveExpect);
+	if (memcmp(saveExpect, actual, TPM_DIGEST_SIZE) != 0) {
 	    printf("TPM_HMAC_CheckStructure: Error checking HMAC\n");
 	    rc = error;
 	}
     }
-    TPM_Sbuffer_Delete(&sbuffer);		/* @1 */
+    return rc;
+}
+
+/*
+  TPM_HMAC_CONTEXT
+*/
+
+/* TPM_HmacContext_Init()
+
+   sets members to default values
+   sets all pointers to NULL and sizes to 0
+   always succeeds - no return code
+*/
+
+void TPM_HmacContext_Init(TPM_HMAC_CONTEXT *hmac_context)
+{
+    hmac_context->valid = FALSE;
+    TPM_Secret_Init(hmac_context->key);
+    hmac_context->innerContext = NULL;
+    hmac_context->outerContext = NULL;
+    hmac_context->context = NULL;
+    return;
+}
+
+/* TPM_HmacContext_Delete()
+
+   No-OP if the parameter is NULL, else:
+   frees memory allocated for the object
+   sets pointers to NULL
+   calls TPM_HmacContext_Init to set members back to default values
+   The object itself is not freed
+*/
+
+void TPM_HmacContext_Delete(TPM_HMAC_CONTEXT *hmac_context)
+{
+    if (hmac_context != NULL) {
+	TPM_SHA1Delete(&(hmac_context->innerContext));
+	TPM_SHA1Delete(&(hmac_context->outerContext));
+	TPM_SHA1Delete(&(hmac_context->context));
+	TPM_HmacContext_Init(hmac_context);
+    }
+    return;
+}
+
+#define TPM_HMAC_BLOCK_SIZE 64
+
+/* TPM_HmacContext_SetKey() hashes the key XOR ipad and key XOR opad blocks of 'key' into the
+   inner and outer contexts.
+
+   It is a no-op if the contexts are already set for 'key'.
+*/
+
+static TPM_RESULT TPM_HmacContext_SetKey(TPM_HMAC_CONTEXT *hmac_context,
+					 const TPM_SECRET key)
+{
+    TPM_RESULT		rc = 0;
+    TPM_BOOL		newKey;
+    unsigned char	ipad[TPM_HMAC_BLOCK_SIZE];
+    unsigned char	opad[TPM_HMAC_BLOCK_SIZE];
+    size_t		i;
+
+    newKey = !hmac_context->valid ||
+	     (memcmp(hmac_context->key, key, TPM_SECRET_SIZE) != 0);
+    if (newKey) {
+	printf(" TPM_HmacContext_SetKey: New key\n");
+	hmac_context->valid = FALSE;
+	TPM_SHA1Delete(&(hmac_context->innerContext));
+	TPM_SHA1Delete(&(hmac_context->outerContext));
+	/* first part, key XOR pad */
+	for (i = 0 ; i < TPM_AUTHDATA_SIZE ; i++) {
+	    ipad[i] = key[i] ^ 0x36;	/* magic numbers from RFC 2104 */
+	    opad[i] = key[i] ^ 0x5c;
+	}
+	/* second part, 0x00 XOR pad */
+	memset(ipad + TPM_AUTHDATA_SIZE, 0x36, TPM_HMAC_BLOCK_SIZE - TPM_AUTHDATA_SIZE);
+	memset(opad + TPM_AUTHDATA_SIZE, 0x5c, TPM_HMAC_BLOCK_SIZE - TPM_AUTHDATA_SIZE);
+    }
+    /* hash key XOR ipad and key XOR opad */
+    if ((rc == 0) && newKey) {
+	rc = TPM_SHA1InitCmd(&(hmac_context->innerContext));
+    }
+    if ((rc == 0) && newKey) {
+	rc = TPM_SHA1UpdateCmd(hmac_context->innerContext, ipad, TPM_HMAC_BLOCK_SIZE);
+    }
+    if ((rc == 0) && newKey) {
+	rc = TPM_SHA1InitCmd(&(hmac_context->outerContext));
+    }
+    if ((rc == 0) && newKey) {
+	rc = TPM_SHA1UpdateCmd(hmac_context->outerContext, opad, TPM_HMAC_BLOCK_SIZE);
+    }
+    if ((rc == 0) && newKey) {
+	TPM_Secret_Copy(hmac_context->key, key);
+	hmac_context->valid = TRUE;
+    }
+    if (newKey) {
+	/* the pads are key material */
+	memset(ipad, 0, TPM_HMAC_BLOCK_SIZE);
+	memset(opad, 0, TPM_HMAC_BLOCK_SIZE);
+    }
+    return rc;
+}
+
+/* TPM_HmacContext_Begin() starts an HMAC with 'key'.  The text is then hashed into the working
+   context 'hmac_context->context', and the HMAC is finished by TPM_HmacContext_End().
+*/
+
+static TPM_RESULT TPM_HmacContext_Begin(TPM_HMAC_CONTEXT *hmac_context,
+					const TPM_SECRET key)
+{
+    TPM_RESULT		rc = 0;
+
+    /* get the key XOR ipad and key XOR opad midstates */
+    if (rc == 0) {
+	rc = TPM_HmacContext_SetKey(hmac_context, key);
+    }
+    /* continue the inner hash from key XOR ipad */
+    if (rc == 0) {
+	rc = TPM_SHA1CopyCmd(&(hmac_context->context), hmac_context->innerContext);
+    }
+    return rc;
+}
+
+/* TPM_HmacContext_End() finishes the HMAC started by TPM_HmacContext_Begin().
+ */
+
+static TPM_RESULT TPM_HmacContext_End(TPM_HMAC tpm_hmac,
+				      TPM_HMAC_CONTEXT *hmac_context)
+{
+    TPM_RESULT		rc = 0;
+    TPM_DIGEST		inner_hash;
+
+    if (rc == 0) {
+	rc = TPM_SHA1FinalCmd(inner_hash, hmac_context->context);
+    }
+    /* calculate the outer hash, continue from key XOR opad with the inner hash */
+    if (rc == 0) {
+	rc = TPM_SHA1CopyCmd(&(hmac_context->context), hmac_context->outerContext);
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1UpdateCmd(hmac_context->context, inner_hash, TPM_DIGEST_SIZE);
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1FinalCmd(tpm_hmac, hmac_context->context);
+    }
+    if (rc == 0) {
+	TPM_PrintFour(" TPM_HmacContext_End: HMAC", tpm_hmac);
+    }	 
     return rc;
 }
 
 /* TPM_XOR XOR's 'in1' and 'in2' of 'length', putting the result in 'out'
 
+   'out' may be the same buffer as 'in1' or 'in2'.
 */
 
 void TPM_XOR(unsigned char *out,
@@ -1245,9 +1496,19 @@ void TPM_XOR(unsigned char *out,
 	     const unsigned char *in2,
 	     size_t length)
 {
-    size_t i;
+    size_t	i;
+    uint64_t	word1;
+    uint64_t	word2;
     
-    for (i = 0 ; i < length ; i++) {
+    /* a word at a time, memcpy() allows unaligned buffers and compiles to plain loads and
+       stores */
+    for (i = 0 ; (i + sizeof(uint64_t)) <= length ; i += sizeof(uint64_t)) {
+	memcpy(&word1, in1 + i, sizeof(uint64_t));
+	memcpy(&word2, in2 + i, sizeof(uint64_t));
+	word1 ^= word2;
+	memcpy(out + i, &word1, sizeof(uint64_t));
+    }
+    for ( ; i < length ; i++) {
 	out[i] = in1[i] ^ in2[i];
     }
     return;
@@ -1294,6 +1555,8 @@ TPM_RESULT TPM_MGF1(unsigned char       *mask,
     uint32_t	        count;          /* counter as an integral type */
     uint32_t		outLen;
     TPM_DIGEST          lastDigest;     
+    void		*seedContext = NULL;	/* after hashing mgfSeed, freed @1 */
+    void		*context = NULL;	/* working copy, freed @2 */
     
     printf(" TPM_MGF1: Output length %u\n", maskLen);
     if (rc == 0) {
@@ -1303,6 +1566,14 @@ TPM_RESULT TPM_MGF1(unsigned char       *mask,
             rc = TPM_FAIL;              /* should never occur */
         }
     }
+    /* the seed is the same for every block, so it is hashed once and each block continues from a
+       copy of that context */
+    if (rc == 0) {
+	rc = TPM_SHA1InitCmd(&seedContext);	/* freed @1 */
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1UpdateCmd(seedContext, mgfSeed, mgfSeedlen);
+    }
     /* 1.If l > 2^32(hLen), output "mask too long" and stop. */
     /* NOTE Checked by caller */
     /* 2. Let T be the empty octet string. */
@@ -1314,27 +1585,30 @@ TPM_RESULT TPM_MGF1(unsigned char       *mask,
 	memcpy(counter, &count_n, 4);
 	/* b.Concatenate the hash of the seed mgfSeed and C to the octet string T: */
 	/* T = T || Hash (mgfSeed || C) */
-	/* If the entire digest is needed for the mask */
-	if ((outLen + TPM_DIGEST_SIZE) < maskLen) {
-	    rc = TPM_SHA1(mask + outLen,
-			  mgfSeedlen, mgfSeed,
-			  4, counter,
-			  0, NULL);
-	    outLen += TPM_DIGEST_SIZE;
-	}
-	/* if the mask is not modulo TPM_DIGEST_SIZE, only part of the final digest is needed */
-	else {
-	    /* hash to a temporary digest variable */
-	    rc = TPM_SHA1(lastDigest,
-			  mgfSeedlen, mgfSeed,
-			  4, counter,
-			  0, NULL);
-	    /* copy what's needed */
-	    memcpy(mask + outLen, lastDigest, maskLen - outLen);
-	    outLen = maskLen;           /* outLen = outLen + maskLen - outLen */
+	rc = TPM_SHA1CopyCmd(&context, seedContext);	/* freed @2 */
+	if (rc == 0) {
+	    rc = TPM_SHA1UpdateCmd(context, counter, 4);
+	}
+	if (rc == 0) {
+	    /* If the entire digest is needed for the mask */
+	    if ((outLen + TPM_DIGEST_SIZE) < maskLen) {
+		rc = TPM_SHA1FinalCmd(mask + outLen, context);
+		outLen += TPM_DIGEST_SIZE;
+	    }
+	    /* if the mask is not modulo TPM_DIGEST_SIZE, only part of the final digest is
+	       needed */
+	    else {
+		/* hash to a temporary digest variable */
+		rc = TPM_SHA1FinalCmd(lastDigest, context);
+		/* copy what's needed */
+		memcpy(mask + outLen, lastDigest, maskLen - outLen);
+		outLen = maskLen;           /* outLen = outLen + maskLen - outLen */
+	    }
 	}
     }
     /* 4.Output the leading l octets of T as the octet string mask. */
+    TPM_SHA1Delete(&seedContext);	/* @1 */
+    TPM_SHA1Delete(&context);		/* @2 */
     return rc;
 }
 
@@ -1587,10 +1861,7 @@ TPM_RESULT TPM_RSAPrivateDecryptH(unsigned char *decrypt_data,	/* decrypted data
     TPM_RESULT		rc = 0;
     unsigned char	*narr;		/* public modulus */
     uint32_t		nbytes;
-    unsigned char	*earr;		/* public exponent */
-    uint32_t		ebytes;
-    unsigned char	*darr;		/* private exponent */
-    uint32_t		dbytes;
+    TPM_RSA_KEY_TOKEN	rsa_key_token;	/* private key, cached with the key */
 
     printf(" TPM_RSAPrivateDecryptH: Data size %u bytes\n", encrypt_data_size);
     TPM_PrintFour("  TPM_RSAPrivateDecryptH: Encrypt data", encrypt_data);
@@ -1604,13 +1875,9 @@ TPM_RESULT TPM_RSAPrivateDecryptH(unsigned char *decrypt_data,	/* decrypted data
     if (rc == 0) {
 	rc = TPM_Key_GetPublicKey(&nbytes, &narr, tpm_key);
     }	
-    /* extract the private key from TPM_KEY */
-    if (rc == 0) {
-	rc = TPM_Key_GetPrivateKey(&dbytes, &darr, tpm_key);
-    }
-    /* extract the exponent from TPM_KEY */
+    /* get the private key token from TPM_KEY */
     if (rc == 0) {
-	rc = TPM_Key_GetExponent(&ebytes, &earr, tpm_key);
+	rc = TPM_Key_GetRSAKeyToken(&rsa_key_token, tpm_key);
     }
     /* check the key size vs the data size */
     if (rc == 0) {
@@ -1623,23 +1890,17 @@ TPM_RESULT TPM_RSAPrivateDecryptH(unsigned char *decrypt_data,	/* decrypted data
     if (rc == 0) {
 	/* debug printing */
 	printf("  TPM_RSAPrivateDecryptH: Public key length %u\n", nbytes);
-	printf("  TPM_RSAPrivateDecryptH: Private key length %u\n", dbytes);
 	TPM_PrintFour("  TPM_RSAPrivateDecryptH: Public key", narr);
-	printf("  TPM_RSAPrivateDecryptH: Exponent %02x %02x %02x\n", earr[0], earr[1], earr[2]);
-	TPM_PrintFour("  TPM_RSAPrivateDecryptH: Private key", darr);
 	/* decrypt with private key */
-	rc = TPM_RSAPrivateDecrypt(decrypt_data,	/* decrypted data */
-				   decrypt_data_length, /* length of data put into decrypt_data */
-				   decrypt_data_size,	/* size of decrypt_data buffer */
-				   tpm_key->algorithmParms.encScheme,	/* encryption scheme */
-				   encrypt_data,	/* encrypted data */
-				   encrypt_data_size,
-				   narr,		/* public modulus */
-				   nbytes,
-				   earr,		/* public exponent */
-				   ebytes,
-				   darr,		/* private exponent */
-				   dbytes);
+	rc = TPM_RSAKeyToken_PrivateDecrypt(decrypt_data,	/* decrypted data */
+					    decrypt_data_length, /* length of data put into
+								    decrypt_data */
+					    decrypt_data_size,	/* size of decrypt_data buffer */
+					    tpm_key->algorithmParms.encScheme,	/* encryption
+										   scheme */
+					    encrypt_data,	/* encrypted data */
+					    encrypt_data_size,
+					    rsa_key_token);
     }
     if (rc == 0) {
 	TPM_PrintFour(" TPM_RSAPrivateDecryptH: Decrypt data", decrypt_data);
@@ -1813,6 +2074,317 @@ TPM_RESULT TPM_RSAPublicEncrypt_Common(TPM_SIZED_BUFFER *enc_data,
     return rc;
 }
 
+/*
+  RSA Key Pair Pool
+
+  The pool holds RSA key pairs that background threads generate ahead of time, so that creating a
+  key does not wait for the prime search.  It is shared by all TPM instances of the process.
+
+  There is a bucket for each key length and public exponent, up to TPM_RSA_KEY_POOL_BUCKETS.  A
+  bucket is added after a key pair with its parameters was generated inline, so that the threads
+  never generate key pairs with parameters that the key generator rejects.  The threads keep each
+  bucket filled up to 'depth' key pairs.  When a bucket is empty, the key pair is generated inline.
+
+  The pool is disabled until TPM_RSAKeyPool_Set() sets a depth.  The threads are started by the
+  first key pair request after that.
+*/
+
+#define TPM_RSA_KEY_POOL_BUCKETS	4
+#define TPM_RSA_KEY_POOL_DEPTH_MAX	64
+#define TPM_RSA_KEY_POOL_THREADS_MAX	8
+#define TPM_RSA_KEY_POOL_EXPONENT_MAX	8	/* maximum bytes of a pooled public exponent */
+
+typedef struct tdTPM_RSA_KEY_PAIR {
+    unsigned char *n;		/* public key - modulus */
+    unsigned char *p;		/* private key prime */
+    unsigned char *q;		/* private key prime */
+    unsigned char *d;		/* private key (private exponent) */
+} TPM_RSA_KEY_PAIR;
+
+typedef struct tdTPM_RSA_KEY_POOL_BUCKET {
+    TPM_BOOL used;
+    int num_bits;				/* key size in bits */
+    unsigned char earr[TPM_RSA_KEY_POOL_EXPONENT_MAX];	/* public exponent */
+    uint32_t e_size;
+    unsigned int count;				/* number of key pairs in the bucket */
+    unsigned int pending;			/* number of key pairs being generated */
+    TPM_RSA_KEY_PAIR keyPairs[TPM_RSA_KEY_POOL_DEPTH_MAX];
+} TPM_RSA_KEY_POOL_BUCKET;
+
+/* tpm_rsa_key_pool_lock protects all other variables of the pool.  tpm_rsa_key_pool_set_lock
+   serializes TPM_RSAKeyPool_Set(), which waits for the threads without holding the pool lock. */
+static pthread_mutex_t tpm_rsa_key_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t tpm_rsa_key_pool_set_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tpm_rsa_key_pool_cond = PTHREAD_COND_INITIALIZER;	/* wakes the threads */
+static TPM_RSA_KEY_POOL_BUCKET tpm_rsa_key_pool_buckets[TPM_RSA_KEY_POOL_BUCKETS];
+static unsigned int tpm_rsa_key_pool_depth = 0;		/* 0 disables the pool */
+static unsigned int tpm_rsa_key_pool_threads = 0;	/* number of threads to run */
+static unsigned int tpm_rsa_key_pool_running = 0;	/* number of threads started */
+static pthread_t tpm_rsa_key_pool_thread[TPM_RSA_KEY_POOL_THREADS_MAX];
+static TPM_BOOL tpm_rsa_key_pool_stop = FALSE;		/* TRUE tells the threads to exit */
+
+/* TPM_RSAKeyPair_Delete() clears and frees the key pair members.  'num_bits' is the key size.
+ */
+
+static void TPM_RSAKeyPair_Delete(TPM_RSA_KEY_PAIR *tpm_rsa_key_pair,
+				  int num_bits)
+{
+    if (tpm_rsa_key_pair->p != NULL) {
+	memset(tpm_rsa_key_pair->p, 0, num_bits/16);
+    }
+    if (tpm_rsa_key_pair->q != NULL) {
+	memset(tpm_rsa_key_pair->q, 0, num_bits/16);
+    }
+    if (tpm_rsa_key_pair->d != NULL) {
+	memset(tpm_rsa_key_pair->d, 0, num_bits/8);
+    }
+    free(tpm_rsa_key_pair->n);
+    free(tpm_rsa_key_pair->p);
+    free(tpm_rsa_key_pair->q);
+    free(tpm_rsa_key_pair->d);
+    tpm_rsa_key_pair->n = NULL;
+    tpm_rsa_key_pair->p = NULL;
+    tpm_rsa_key_pair->q = NULL;
+    tpm_rsa_key_pair->d = NULL;
+    return;
+}
+
+/* TPM_RSAKeyPoolBucket_Trim() deletes the key pairs in the bucket beyond 'depth'.  A depth of 0
+   also frees the bucket.
+
+   The caller must hold tpm_rsa_key_pool_lock.
+*/
+
+static void TPM_RSAKeyPoolBucket_Trim(TPM_RSA_KEY_POOL_BUCKET *bucket,
+				      unsigned int depth)
+{
+    while (bucket->count > depth) {
+	bucket->count--;
+	TPM_RSAKeyPair_Delete(&(bucket->keyPairs[bucket->count]), bucket->num_bits);
+    }
+    if (depth == 0) {
+	bucket->used = FALSE;
+    }
+    return;
+}
+
+/* TPM_RSAKeyPool_Find() returns the bucket for 'num_bits' and 'earr', or NULL if there is none.
+
+   The caller must hold tpm_rsa_key_pool_lock.
+*/
+
+static TPM_RSA_KEY_POOL_BUCKET *TPM_RSAKeyPool_Find(int num_bits,
+						    const unsigned char *earr,
+						    uint32_t e_size)
+{
+    TPM_RSA_KEY_POOL_BUCKET *bucket = NULL;
+    size_t i;
+
+    for (i = 0 ; (i < TPM_RSA_KEY_POOL_BUCKETS) && (bucket == NULL) ; i++) {
+	if (tpm_rsa_key_pool_buckets[i].used &&
+	    (tpm_rsa_key_pool_buckets[i].num_bits == num_bits) &&
+	    (tpm_rsa_key_pool_buckets[i].e_size == e_size) &&
+	    (memcmp(tpm_rsa_key_pool_buckets[i].earr, earr, e_size) == 0)) {
+	    bucket = &(tpm_rsa_key_pool_buckets[i]);
+	}
+    }
+    return bucket;
+}
+
+/* TPM_RSAKeyPool_Thread() is run by each pool thread.  It fills the buckets until
+   tpm_rsa_key_pool_stop is set.
+*/
+
+static void *TPM_RSAKeyPool_Thread(void *arg)
+{
+    TPM_RESULT			rc = 0;
+    TPM_RSA_KEY_POOL_BUCKET	*bucket;
+    TPM_RSA_KEY_PAIR		keyPair;
+    int				num_bits;
+    unsigned char		earr[TPM_RSA_KEY_POOL_EXPONENT_MAX];
+    uint32_t			e_size;
+    size_t			i;
+
+    arg = arg;
+    pthread_mutex_lock(&tpm_rsa_key_pool_lock);
+    while (!tpm_rsa_key_pool_stop) {
+	/* find a bucket that is not full */
+	for (i = 0, bucket = NULL ; (i < TPM_RSA_KEY_POOL_BUCKETS) && (bucket == NULL) ; i++) {
+	    if (tpm_rsa_key_pool_buckets[i].used &&
+		((tpm_rsa_key_pool_buckets[i].count + tpm_rsa_key_pool_buckets[i].pending) <
+		 tpm_rsa_key_pool_depth)) {
+		bucket = &(tpm_rsa_key_pool_buckets[i]);
+	    }
+	}
+	if (bucket == NULL) {
+	    pthread_cond_wait(&tpm_rsa_key_pool_cond, &tpm_rsa_key_pool_lock);
+	    continue;
+	}
+	/* generate the key pair without holding the lock */
+	bucket->pending++;
+	num_bits = bucket->num_bits;
+	e_size = bucket->e_size;
+	memcpy(earr, bucket->earr, e_size);
+	pthread_mutex_unlock(&tpm_rsa_key_pool_lock);
+	rc = TPM_RSAGenerateKeyPair(&keyPair.n, &keyPair.p, &keyPair.q, &keyPair.d,
+				    num_bits, earr, e_size);
+	TPMLIB_LogFlush();
+	pthread_mutex_lock(&tpm_rsa_key_pool_lock);
+	bucket->pending--;
+	/* the bucket may have been trimmed or freed while the lock was released */
+	if ((rc == 0) &&
+	    bucket->used && (bucket->count < tpm_rsa_key_pool_depth)) {
+	    bucket->keyPairs[bucket->count] = keyPair;
+	    bucket->count++;
+	}
+	else {
+	    if (rc != 0) {
+		/* do not retry a failing key generation forever, drop the bucket */
+		printf("TPM_RSAKeyPool_Thread: Error generating a key pair, dropping bucket\n");
+		TPM_RSAKeyPoolBucket_Trim(bucket, 0);
+	    }
+	    TPM_RSAKeyPair_Delete(&keyPair, num_bits);
+	}
+    }
+    pthread_mutex_unlock(&tpm_rsa_key_pool_lock);
+    TPMLIB_LogFlush();
+    return NULL;
+}
+
+/* TPM_RSAKeyPool_Set() sets the number of key pairs that are kept for each key length and public
+   exponent, and the number of threads that generate them.
+
+   A 'depth' of 0 disables the pool and frees all key pairs.  Running threads are stopped, which
+   waits for the key pairs that they are generating.
+*/
+
+TPM_RESULT TPM_RSAKeyPool_Set(unsigned int depth,
+			      unsigned int threads)
+{
+    TPM_RESULT		rc = 0;
+    unsigned int	running;
+    size_t		i;
+
+    printf(" TPM_RSAKeyPool_Set: depth %u threads %u\n", depth, threads);
+    if (rc == 0) {
+	if ((depth > TPM_RSA_KEY_POOL_DEPTH_MAX) ||
+	    (threads > TPM_RSA_KEY_POOL_THREADS_MAX) ||
+	    ((depth != 0) && (threads == 0))) {
+	    printf("TPM_RSAKeyPool_Set: Error, depth %u threads %u out of range\n",
+		   depth, threads);
+	    rc = TPM_BAD_PARAMETER;
+	}
+    }
+    if (rc == 0) {
+	pthread_mutex_lock(&tpm_rsa_key_pool_set_lock);
+	/* stop the running threads */
+	pthread_mutex_lock(&tpm_rsa_key_pool_lock);
+	tpm_rsa_key_pool_stop = TRUE;
+	running = tpm_rsa_key_pool_running;
+	tpm_rsa_key_pool_running = 0;
+	tpm_rsa_key_pool_threads = 0;
+	pthread_cond_broadcast(&tpm_rsa_key_pool_cond);
+	pthread_mutex_unlock(&tpm_rsa_key_pool_lock);
+	for (i = 0 ; i < running ; i++) {
+	    pthread_join(tpm_rsa_key_pool_thread[i], NULL);
+	}
+	/* set the new parameters, the threads are restarted on demand */
+	pthread_mutex_lock(&tpm_rsa_key_pool_lock);
+	tpm_rsa_key_pool_stop = FALSE;
+	tpm_rsa_key_pool_depth = depth;
+	tpm_rsa_key_pool_threads = threads;
+	for (i = 0 ; i < TPM_RSA_KEY_POOL_BUCKETS ; i++) {
+	    TPM_RSAKeyPoolBucket_Trim(&(tpm_rsa_key_pool_buckets[i]), depth);
+	}
+	pthread_mutex_unlock(&tpm_rsa_key_pool_lock);
+	pthread_mutex_unlock(&tpm_rsa_key_pool_set_lock);
+    }
+    return rc;
+}
+
+/* TPM_RSAKeyPool_GenerateKeyPair() returns a key pair like TPM_RSAGenerateKeyPair().  The key pair
+   is taken from the pool if there is one with the same key length and public exponent, else it is
+   generated inline.
+
+   'n', 'p', 'q', 'd' must be freed by the caller
+*/
+
+TPM_RESULT TPM_RSAKeyPool_GenerateKeyPair(unsigned char **n,	/* public key - modulus */
+					  unsigned char **p,	/* private key prime */
+					  unsigned char **q,	/* private key prime */
+					  unsigned char **d,	/* private key (private exponent) */
+					  int num_bits,		/* key size in bits */
+					  const unsigned char *earr, /* public exponent as an array */
+					  uint32_t e_size)
+{
+    TPM_RESULT			rc = 0;
+    TPM_RSA_KEY_POOL_BUCKET	*bucket = NULL;
+    TPM_BOOL			pooled = FALSE;	/* TRUE if the pool can hold these parameters */
+    TPM_BOOL			found = FALSE;	/* TRUE if the key pair came from the pool */
+    size_t			i;
+
+    printf(" TPM_RSAKeyPool_GenerateKeyPair:\n");
+    pthread_mutex_lock(&tpm_rsa_key_pool_lock);
+    if ((tpm_rsa_key_pool_depth > 0) && (e_size <= TPM_RSA_KEY_POOL_EXPONENT_MAX)) {
+	pooled = TRUE;
+	bucket = TPM_RSAKeyPool_Find(num_bits, earr, e_size);
+    }
+    if ((bucket != NULL) && (bucket->count > 0)) {
+	bucket->count--;
+	*n = bucket->keyPairs[bucket->count].n;
+	*p = bucket->keyPairs[bucket->count].p;
+	*q = bucket->keyPairs[bucket->count].q;
+	*d = bucket->keyPairs[bucket->count].d;
+	bucket->keyPairs[bucket->count].n = NULL;
+	bucket->keyPairs[bucket->count].p = NULL;
+	bucket->keyPairs[bucket->count].q = NULL;
+	bucket->keyPairs[bucket->count].d = NULL;
+	found = TRUE;
+	printf("  TPM_RSAKeyPool_GenerateKeyPair: From pool, %u left\n", bucket->count);
+    }
+    /* start the threads, failures leave fewer threads */
+    while (pooled && (tpm_rsa_key_pool_running < tpm_rsa_key_pool_threads)) {
+	if (pthread_create(&tpm_rsa_key_pool_thread[tpm_rsa_key_pool_running], NULL,
+			   TPM_RSAKeyPool_Thread, NULL) != 0) {
+	    printf("TPM_RSAKeyPool_GenerateKeyPair: Error starting a pool thread\n");
+	    tpm_rsa_key_pool_threads = tpm_rsa_key_pool_running;
+	}
+	else {
+	    tpm_rsa_key_pool_running++;
+	}
+    }
+    /* refill the bucket */
+    if (bucket != NULL) {
+	pthread_cond_broadcast(&tpm_rsa_key_pool_cond);
+    }
+    pthread_mutex_unlock(&tpm_rsa_key_pool_lock);
+    if (!found) {
+	rc = TPM_RSAGenerateKeyPair(n, p, q, d, num_bits, earr, e_size);
+    }
+    /* the parameters are valid, add a bucket for them */
+    if ((rc == 0) && pooled && (bucket == NULL)) {
+	pthread_mutex_lock(&tpm_rsa_key_pool_lock);
+	if ((tpm_rsa_key_pool_depth > 0) &&
+	    (TPM_RSAKeyPool_Find(num_bits, earr, e_size) == NULL)) {
+	    for (i = 0 ; (i < TPM_RSA_KEY_POOL_BUCKETS) && (bucket == NULL) ; i++) {
+		if (!tpm_rsa_key_pool_buckets[i].used &&
+		    (tpm_rsa_key_pool_buckets[i].pending == 0)) {
+		    bucket = &(tpm_rsa_key_pool_buckets[i]);
+		    bucket->used = TRUE;
+		    bucket->num_bits = num_bits;
+		    memcpy(bucket->earr, earr, e_size);
+		    bucket->e_size = e_size;
+		    bucket->count = 0;
+		    printf("  TPM_RSAKeyPool_GenerateKeyPair: New bucket for %d bits\n", num_bits);
+		}
+	    }
+	    pthread_cond_broadcast(&tpm_rsa_key_pool_cond);
+	}
+	pthread_mutex_unlock(&tpm_rsa_key_pool_lock);
+    }
+    return rc;
+}
+
 /*
   Signing Functions
 
@@ -1889,45 +2461,24 @@ TPM_RESULT TPM_RSASignH(unsigned char *signature,		/* output */
 			TPM_KEY *tpm_key)		/* input, signing key */
 {
     TPM_RESULT		rc = 0;
-    unsigned char	*narr;		 /* public modulus */
-    uint32_t		nbytes;
-    unsigned char	*earr;		 /* public exponent */
-    uint32_t		ebytes;
-    unsigned char	*darr;		/* private exponent */
-    uint32_t		dbytes;
+    TPM_RSA_KEY_TOKEN	rsa_key_token;	/* private key, cached with the key */
     
     printf(" TPM_RSASignH: Message size %lu bytes\n", (unsigned long)message_size);
     TPM_PrintFour("  TPM_RSASignH: Message", message);
-    /* extract the public key from TPM_KEY */
+    /* get the private key token from TPM_KEY */
     if (rc == 0) {
-	rc = TPM_Key_GetPublicKey(&nbytes, &narr, tpm_key);
-    }	
-    /* extract the private key from TPM_KEY */
-    if (rc == 0) {
-	rc = TPM_Key_GetPrivateKey(&dbytes, &darr, tpm_key);
+	rc = TPM_Key_GetRSAKeyToken(&rsa_key_token, tpm_key);
     }
-    /* extract the exponent from TPM_KEY */
     if (rc == 0) {
-	rc = TPM_Key_GetExponent(&ebytes, &earr, tpm_key);
-    }
-    if (rc == 0) {
-	/* debug printing */
-	TPM_PrintFour("  TPM_RSASignH: Public key", narr);
-	printf("  TPM_RSASignH: Exponent %02x %02x %02x\n", earr[0], earr[1], earr[2]);
-	TPM_PrintFour("  TPM_RSASignH: Private key", darr);
 	/* sign with private key */
-	rc = TPM_RSASign(signature,		/* output */
-			 signature_length,	/* output, size of signature */
-			 signature_size,	/* input, size of signature buffer */
-			 tpm_key->algorithmParms.sigScheme,	/* input, type of signature */
-			 message,	/* input */
-			 message_size,	/* input */
-			 narr,		/* public modulus */
-			 nbytes,
-			 earr,		/* public exponent */
-			 ebytes,
-			 darr,		/* private exponent */
-			 dbytes);
+	rc = TPM_RSAKeyToken_Sign(signature,		/* output */
+				  signature_length,	/* output, size of signature */
+				  signature_size,	/* input, size of signature buffer */
+				  tpm_key->algorithmParms.sigScheme,	/* input, type of
+									   signature */
+				  message,		/* input */
+				  message_size,		/* input */
+				  rsa_key_token);
     }
     if (rc == 0) {
 	TPM_PrintFour("  TPM_RSASignH: Signature", signature);
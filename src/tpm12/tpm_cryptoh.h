@@ -177,6 +177,20 @@ TPM_RESULT TPM_RSAVerify(unsigned char *signature,
 
 TPM_RESULT TPM_RSA_exponent_verify(unsigned long exponent);
 
+/*
+  RSA Key Pair Pool
+*/
+
+TPM_RESULT TPM_RSAKeyPool_Set(unsigned int depth,
+                              unsigned int threads);
+TPM_RESULT TPM_RSAKeyPool_GenerateKeyPair(unsigned char **n,
+                                          unsigned char **p,
+                                          unsigned char **q,
+                                          unsigned char **d,
+                                          int num_bits,
+                                          const unsigned char *earr,
+                                          uint32_t e_size);
+
 /*
   OAEP Padding 
 */
@@ -194,8 +208,18 @@ TPM_RESULT TPM_RSA_padding_check_PKCS1_OAEP(unsigned char *to, uint32_t *tLen, u
   Digest functions - SHA-1 and HMAC
 */
 
+/* one stream of a scatter-gather list to be digested */
+
+typedef struct tdTPM_DIGEST_IOVEC {
+    uint32_t length;
+    const unsigned char *buffer;
+} TPM_DIGEST_IOVEC;
+
 TPM_RESULT TPM_SHA1(TPM_DIGEST md, ...);
 TPM_RESULT TPM_SHA1_Check(TPM_DIGEST digest_expect, ...);
+TPM_RESULT TPM_SHA1_Iovec(TPM_DIGEST md,
+                          const TPM_DIGEST_IOVEC *iov,
+                          size_t iovcnt);
 TPM_RESULT TPM_SHA1Sbuffer(TPM_DIGEST tpm_digest,
                            TPM_STORE_BUFFER *sbuffer);
 TPM_RESULT TPM_SHA1_GenerateStructure(TPM_DIGEST tpm_digest,
@@ -216,6 +240,11 @@ TPM_RESULT TPM_HMAC_GenerateStructure(TPM_HMAC tpm_hmac,
 TPM_RESULT TPM_HMAC_Generate(TPM_HMAC tpm_hmac,
                              const TPM_SECRET hmac_key,
                              ...);
+TPM_RESULT TPM_HMAC_GenerateIovec(TPM_HMAC tpm_hmac,
+                                  TPM_HMAC_CONTEXT *hmac_context,
+                                  const TPM_SECRET hmac_key,
+                                  const TPM_DIGEST_IOVEC *iov,
+                                  size_t iovcnt);
 
 TPM_RESULT TPM_HMAC_CheckSbuffer(TPM_BOOL *valid,
                                  TPM_HMAC expect,
@@ -225,12 +254,25 @@ TPM_RESULT TPM_HMAC_Check(TPM_BOOL *valid,
                           TPM_HMAC expect,
                           const TPM_SECRET key,
                           ...);
+TPM_RESULT TPM_HMAC_CheckIovec(TPM_BOOL *valid,
+                               TPM_HMAC expect,
+                               TPM_HMAC_CONTEXT *hmac_context,
+                               const TPM_SECRET key,
+                               const TPM_DIGEST_IOVEC *iov,
+                               size_t iovcnt);
 TPM_RESULT TPM_HMAC_CheckStructure(const TPM_SECRET hmac_key,
                                    void *structure,
                                    TPM_HMAC expect,
                                    TPM_STORE_FUNCTION_T storeFunction,
                                    TPM_RESULT error);
 
+/*
+  TPM_HMAC_CONTEXT
+*/
+
+void       TPM_HmacContext_Init(TPM_HMAC_CONTEXT *hmac_context);
+void       TPM_HmacContext_Delete(TPM_HMAC_CONTEXT *hmac_context);
+
 /*
   XOR
 */
@@ -55,6 +55,24 @@
 
 #include "tpm_daa.h"
 
+/* local prototypes */
+
+static void       TPM_DAAModuli_Check(TPM_DAA_MODULI *tpm_daa_moduli,
+				      const TPM_DIGEST digestIssuer);
+static TPM_RESULT TPM_DAAModuli_New(TPM_BN_MONT_CTX *mont,
+				    TPM_SIZED_BUFFER *modulus);
+static void       TPM_DAABaseCacheEntry_Init(TPM_DAA_BASE_CACHE_ENTRY *tpm_daa_base_cache_entry);
+static void       TPM_DAABaseCacheEntry_Delete(TPM_DAA_BASE_CACHE_ENTRY *tpm_daa_base_cache_entry);
+
+/* the longest exponent that the JOIN and SIGN stages raise each issuer base to, in bits */
+
+static const unsigned int tpm_daa_base_bits[TPM_DAA_BASES] = {
+    DAA_SIZE_r0 * 8,		/* R0: f0 and r0 */
+    DAA_SIZE_r1 * 8,		/* R1: f1 and r1 */
+    DAA_SIZE_r2 * 8,		/* S0: u0 and r2 */
+    DAA_SIZE_r4 * 8		/* S1: u1, r3, and r4 */
+};
+
 /*
   TPM_DAA_SESSION_DATA	(the entire array)
 */
@@ -399,6 +417,7 @@ void TPM_DaaSessionData_Init(TPM_DAA_SESSION_DATA *tpm_daa_session_data)
     TPM_DAAJoindata_Init(&(tpm_daa_session_data->DAA_joinSession)); 
     tpm_daa_session_data->daaHandle = 0;
     tpm_daa_session_data->valid = FALSE;
+    TPM_DAAModuli_Init(&(tpm_daa_session_data->DAA_moduli));
     return;
 }
 
@@ -498,13 +517,15 @@ void TPM_DaaSessionData_Delete(TPM_DAA_SESSION_DATA *tpm_daa_session_data)
 	TPM_DAATpm_Delete(&(tpm_daa_session_data->DAA_tpmSpecific));
 	TPM_DAAContext_Delete(&(tpm_daa_session_data->DAA_session));
 	TPM_DAAJoindata_Delete(&(tpm_daa_session_data->DAA_joinSession)); 
+	TPM_DAAModuli_Delete(&(tpm_daa_session_data->DAA_moduli));
 	TPM_DaaSessionData_Init(tpm_daa_session_data);
     }
     return;
 }
 
 /* TPM_DaaSessionData_Copy() copies the source to the destination.  The source handle is ignored,
-   since it might already be used.
+   since it might already be used.  DAA_moduli is not copied, the destination builds its own on
+   first use.
 */
 
 void TPM_DaaSessionData_Copy(TPM_DAA_SESSION_DATA *dest_daa_session_data,
@@ -542,6 +563,269 @@ TPM_RESULT TPM_DaaSessionData_CheckStage(TPM_DAA_SESSION_DATA *tpm_daa_session_d
     return rc;
 }
 
+/* TPM_DaaSessionData_GetGamma() returns in 'gammaMont' the context for calculating modulo
+   DAA_generic_gamma.
+
+   The context is built on first use and kept with the session.  It must not be freed by the
+   caller.  The caller must have verified DAA_generic_gamma against DAA_issuerSettings ->
+   DAA_digest_gamma.
+*/
+
+TPM_RESULT TPM_DaaSessionData_GetGamma(TPM_BN_MONT_CTX *gammaMont,
+				       TPM_DAA_SESSION_DATA *tpm_daa_session_data,
+				       TPM_SIZED_BUFFER *DAA_generic_gamma)
+{
+    TPM_RESULT		rc = 0;
+    TPM_DAA_MODULI	*tpm_daa_moduli = &(tpm_daa_session_data->DAA_moduli);
+
+    printf(" TPM_DaaSessionData_GetGamma:\n");
+    TPM_DAAModuli_Check(tpm_daa_moduli, tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer);
+    if (tpm_daa_moduli->gammaMont == NULL) {
+	rc = TPM_DAAModuli_New(&(tpm_daa_moduli->gammaMont), DAA_generic_gamma);
+    }
+    *gammaMont = tpm_daa_moduli->gammaMont;
+    return rc;
+}
+
+/* TPM_DaaSessionData_GetQ() returns DAA_issuerSettings -> DAA_generic_q as a bignum.
+
+   The bignum is built on first use and kept with the session.  It must not be freed by the
+   caller.
+*/
+
+TPM_RESULT TPM_DaaSessionData_GetQ(TPM_BIGNUM *qBignum,
+				   TPM_DAA_SESSION_DATA *tpm_daa_session_data)
+{
+    TPM_RESULT		rc = 0;
+    TPM_DAA_MODULI	*tpm_daa_moduli = &(tpm_daa_session_data->DAA_moduli);
+
+    printf(" TPM_DaaSessionData_GetQ:\n");
+    TPM_DAAModuli_Check(tpm_daa_moduli, tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer);
+    if (tpm_daa_moduli->qBignum == NULL) {
+	rc = TPM_bin2bn(&(tpm_daa_moduli->qBignum),
+			tpm_daa_session_data->DAA_issuerSettings.DAA_generic_q,
+			sizeof(tpm_daa_session_data->DAA_issuerSettings.DAA_generic_q));
+    }
+    *qBignum = tpm_daa_moduli->qBignum;
+    return rc;
+}
+
+/*
+  TPM_DAA_MODULI
+*/
+
+/* TPM_DAAModuli_Init()
+
+   sets members to default values
+   sets all pointers to NULL and sizes to 0
+   always succeeds - no return code
+*/
+
+void TPM_DAAModuli_Init(TPM_DAA_MODULI *tpm_daa_moduli)
+{
+    TPM_Digest_Init(tpm_daa_moduli->digestIssuer);
+    tpm_daa_moduli->gammaMont = NULL;
+    tpm_daa_moduli->qBignum = NULL;
+    return;
+}
+
+/* TPM_DAAModuli_Delete()
+
+   No-OP if the parameter is NULL, else:
+   frees memory allocated for the object
+   sets pointers to NULL
+   calls TPM_DAAModuli_Init to set members back to default values
+   The object itself is not freed
+*/
+
+void TPM_DAAModuli_Delete(TPM_DAA_MODULI *tpm_daa_moduli)
+{
+    if (tpm_daa_moduli != NULL) {
+	TPM_BN_MONT_CTX_free(&(tpm_daa_moduli->gammaMont));
+	TPM_BN_free(tpm_daa_moduli->qBignum);
+	TPM_DAAModuli_Init(tpm_daa_moduli);
+    }
+    return;
+}
+
+/* TPM_DAAModuli_Check() discards the values if they belong to other issuer settings than
+   'digestIssuer'.
+*/
+
+static void TPM_DAAModuli_Check(TPM_DAA_MODULI *tpm_daa_moduli,
+				const TPM_DIGEST digestIssuer)
+{
+    if (memcmp(tpm_daa_moduli->digestIssuer, digestIssuer, TPM_DIGEST_SIZE) != 0) {
+	TPM_DAAModuli_Delete(tpm_daa_moduli);
+	TPM_Digest_Copy(tpm_daa_moduli->digestIssuer, digestIssuer);
+    }
+    return;
+}
+
+/* TPM_DAAModuli_New() creates the context 'mont' for the modulus 'modulus'
+
+   mont must be freed by the caller.
+*/
+
+static TPM_RESULT TPM_DAAModuli_New(TPM_BN_MONT_CTX *mont,		/* freed by caller */
+				    TPM_SIZED_BUFFER *modulus)
+{
+    TPM_RESULT		rc = 0;
+    TPM_BIGNUM		nBignum = NULL;		/* freed @1 */
+
+    if (rc == 0) {
+	rc = TPM_bin2bn(&nBignum, modulus->buffer, modulus->size);
+    }
+    if (rc == 0) {
+	rc = TPM_BN_MONT_CTX_new(mont, nBignum);
+    }
+    TPM_BN_free(nBignum);	/* @1 */
+    return rc;
+}
+
+/*
+  TPM_DAA_BASE_CACHE
+*/
+
+/* TPM_DAABaseCache_Init() initializes the TPM_DAA_BASE_CACHE with all entries unused */
+
+void TPM_DAABaseCache_Init(TPM_DAA_BASE_CACHE *tpm_daa_base_cache)
+{
+    size_t i;
+
+    printf(" TPM_DAABaseCache_Init:\n");
+    tpm_daa_base_cache->useCount = 0;
+    for (i = 0 ; i < TPM_DAA_BASE_CACHE_ENTRIES ; i++) {
+	TPM_DAABaseCacheEntry_Init(&(tpm_daa_base_cache->entries[i]));
+    }
+    return;
+}
+
+/* TPM_DAABaseCache_Delete() deletes all entries of the TPM_DAA_BASE_CACHE */
+
+void TPM_DAABaseCache_Delete(TPM_DAA_BASE_CACHE *tpm_daa_base_cache)
+{
+    size_t i;
+
+    printf(" TPM_DAABaseCache_Delete:\n");
+    for (i = 0 ; i < TPM_DAA_BASE_CACHE_ENTRIES ; i++) {
+	TPM_DAABaseCacheEntry_Delete(&(tpm_daa_base_cache->entries[i]));
+    }
+    TPM_DAABaseCache_Init(tpm_daa_base_cache);
+    return;
+}
+
+/* TPM_DAABaseCache_Get() returns in 'xBase' the powers of the issuer base 'base' (TPM_DAA_BASE_R0
+   etc.) and in 'nMont' the context for calculating modulo DAA_generic_n.  'nMont' may be NULL.
+
+   The entry for 'digestIssuer' is created from DAA_generic_n, and the powers from DAA_generic_X,
+   on first use.  Neither must be freed by the caller.  The caller must have verified
+   DAA_generic_X and DAA_generic_n against the issuer settings of 'digestIssuer'.
+
+   An unused entry is taken if there is one, else the least recently used entry is replaced.
+*/
+
+TPM_RESULT TPM_DAABaseCache_Get(TPM_BN_FIXED_BASE *xBase,
+				TPM_BN_MONT_CTX *nMont,
+				TPM_DAA_BASE_CACHE *tpm_daa_base_cache,
+				const TPM_DIGEST digestIssuer,
+				unsigned int base,
+				TPM_SIZED_BUFFER *DAA_generic_X,
+				TPM_SIZED_BUFFER *DAA_generic_n)
+{
+    TPM_RESULT			rc = 0;
+    TPM_DAA_BASE_CACHE_ENTRY	*tpm_daa_base_cache_entry = NULL;
+    TPM_BIGNUM			xBignum = NULL;		/* freed @1 */
+    size_t			i;
+
+    for (i = 0 ; (i < TPM_DAA_BASE_CACHE_ENTRIES) && (tpm_daa_base_cache_entry == NULL) ; i++) {
+	if (tpm_daa_base_cache->entries[i].valid &&
+	    (memcmp(tpm_daa_base_cache->entries[i].digestIssuer, digestIssuer,
+		    TPM_DIGEST_SIZE) == 0)) {
+	    tpm_daa_base_cache_entry = &(tpm_daa_base_cache->entries[i]);
+	}
+    }
+    /* an unused entry, else the least recently used one */
+    if (tpm_daa_base_cache_entry == NULL) {
+	tpm_daa_base_cache_entry = &(tpm_daa_base_cache->entries[0]);
+	for (i = 0 ; (i < TPM_DAA_BASE_CACHE_ENTRIES) && tpm_daa_base_cache_entry->valid ; i++) {
+	    if (!tpm_daa_base_cache->entries[i].valid ||
+		(tpm_daa_base_cache->entries[i].lastUse < tpm_daa_base_cache_entry->lastUse)) {
+		tpm_daa_base_cache_entry = &(tpm_daa_base_cache->entries[i]);
+	    }
+	}
+	printf(" TPM_DAABaseCache_Get: New entry %lu\n",
+	       (unsigned long)(tpm_daa_base_cache_entry - tpm_daa_base_cache->entries));
+	TPM_DAABaseCacheEntry_Delete(tpm_daa_base_cache_entry);
+	rc = TPM_DAAModuli_New(&(tpm_daa_base_cache_entry->nMont), DAA_generic_n);
+	if (rc == 0) {
+	    TPM_Digest_Copy(tpm_daa_base_cache_entry->digestIssuer, digestIssuer);
+	    tpm_daa_base_cache_entry->valid = TRUE;
+	}
+    }
+    if ((rc == 0) && (tpm_daa_base_cache_entry->bases[base] == NULL)) {
+	printf(" TPM_DAABaseCache_Get: Calculating the powers of base %u\n", base);
+	rc = TPM_bin2bn(&xBignum, DAA_generic_X->buffer, DAA_generic_X->size);
+	if (rc == 0) {
+	    rc = TPM_BN_FIXED_BASE_new(&(tpm_daa_base_cache_entry->bases[base]),
+				       xBignum,
+				       tpm_daa_base_bits[base],
+				       tpm_daa_base_cache_entry->nMont);
+	}
+    }
+    if (rc == 0) {
+	tpm_daa_base_cache->useCount++;
+	tpm_daa_base_cache_entry->lastUse = tpm_daa_base_cache->useCount;
+	*xBase = tpm_daa_base_cache_entry->bases[base];
+	if (nMont != NULL) {
+	    *nMont = tpm_daa_base_cache_entry->nMont;
+	}
+    }
+    TPM_BN_free(xBignum);	/* @1 */
+    return rc;
+}
+
+/* TPM_DAABaseCacheEntry_Init()
+
+   sets members to default values
+   sets all pointers to NULL
+   always succeeds - no return code
+*/
+
+static void TPM_DAABaseCacheEntry_Init(TPM_DAA_BASE_CACHE_ENTRY *tpm_daa_base_cache_entry)
+{
+    size_t i;
+
+    tpm_daa_base_cache_entry->valid = FALSE;
+    TPM_Digest_Init(tpm_daa_base_cache_entry->digestIssuer);
+    tpm_daa_base_cache_entry->nMont = NULL;
+    for (i = 0 ; i < TPM_DAA_BASES ; i++) {
+	tpm_daa_base_cache_entry->bases[i] = NULL;
+    }
+    tpm_daa_base_cache_entry->lastUse = 0;
+    return;
+}
+
+/* TPM_DAABaseCacheEntry_Delete()
+
+   frees memory allocated for the object
+   calls TPM_DAABaseCacheEntry_Init to set members back to default values
+   The object itself is not freed
+*/
+
+static void TPM_DAABaseCacheEntry_Delete(TPM_DAA_BASE_CACHE_ENTRY *tpm_daa_base_cache_entry)
+{
+    size_t i;
+
+    /* the powers refer to nMont */
+    for (i = 0 ; i < TPM_DAA_BASES ; i++) {
+	TPM_BN_FIXED_BASE_free(&(tpm_daa_base_cache_entry->bases[i]));
+    }
+    TPM_BN_MONT_CTX_free(&(tpm_daa_base_cache_entry->nMont));
+    TPM_DAABaseCacheEntry_Init(tpm_daa_base_cache_entry);
+    return;
+}
+
 /*
   TPM_DAA_ISSUER
 */
@@ -1698,13 +1982,11 @@ TPM_RESULT TPM_DAAJoin_Stage04(tpm_state_t *tpm_state,
 			       TPM_SIZED_BUFFER *inputData1)
 {
     TPM_RESULT		rc = 0;
-    TPM_BIGNUM		xBignum = NULL;	/* freed @1 */
-    TPM_BIGNUM		nBignum = NULL;	/* freed @2 */
+    TPM_BN_FIXED_BASE	xBase = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     TPM_BIGNUM		fBignum = NULL;	/* freed @3 */
     TPM_BIGNUM		rBignum = NULL;	/* freed @4 */
 		
     printf("TPM_DAAJoin_Stage04:\n");
-    tpm_state = tpm_state;			/* not used */
     outputData = outputData;			/* not used */
     /* a. Verify that DAA_session ->DAA_stage==4. Return TPM_DAA_STAGE and flush handle on
        mismatch */
@@ -1740,14 +2022,16 @@ TPM_RESULT TPM_DAAJoin_Stage04(tpm_state_t *tpm_state,
 	}
     }
     /* h. Set X = DAA_generic_R0 */
-    if (rc == 0) {
-	printf("TPM_DAAJoin_Stage04: Creating X\n");
-	rc = TPM_bin2bn(&xBignum, inputData0->buffer, inputData0->size);
-    }
     /* i. Set n = DAA_generic_n */
     if (rc == 0) {
-	printf("TPM_DAAJoin_Stage04: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData1->buffer, inputData1->size);
+	printf("TPM_DAAJoin_Stage04: Getting X and n\n");
+	rc = TPM_DAABaseCache_Get(&xBase,
+				  NULL,
+				  &(tpm_state->tpm_daa_base_cache),
+				  tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer,
+				  TPM_DAA_BASE_R0,
+				  inputData0,	/* DAA_generic_R0 */
+				  inputData1);	/* DAA_generic_n */
     }
     /* j. Set f = SHA-1(DAA_tpmSpecific -> DAA_rekey || DAA_tpmSpecific -> DAA_count || 0) ||
        SHA-1(DAA_tpmSpecific -> DAA_rekey || DAA_tpmSpecific -> DAA_count || 1 ) mod
@@ -1761,20 +2045,17 @@ TPM_RESULT TPM_DAAJoin_Stage04(tpm_state_t *tpm_state,
     }
     /* l. Set DAA_session -> DAA_scratch = (X^f0) mod n */
     if (rc == 0) {
-	rc = TPM_ComputeAexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
+	rc = TPM_ComputeXexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
 				  sizeof(tpm_daa_session_data->DAA_session.DAA_scratch),
 				  &rBignum,	/* R */
-				  xBignum,	/* A */
-				  fBignum,	/* P */
-				  nBignum);	/* n */
+				  xBase,	/* X */
+				  fBignum);	/* P */
     }
     /* m. set outputData = NULL */
     /* NOTE Done by caller */
     /* n. increment DAA_session -> DAA_stage by 1 */
     /* NOTE Done by common code */
     /* o. return TPM_SUCCESS */
-    TPM_BN_free(xBignum);	/* @1 */
-    TPM_BN_free(nBignum);	/* @2 */
     TPM_BN_free(fBignum);	/* @3 */
     TPM_BN_free(rBignum);	/* @4 */
     return rc;
@@ -1787,14 +2068,13 @@ TPM_RESULT TPM_DAAJoin_Stage05(tpm_state_t *tpm_state,
 			       TPM_SIZED_BUFFER *inputData1)
 {
     TPM_RESULT		rc = 0;
-    TPM_BIGNUM		xBignum = NULL;		/* freed @1 */
-    TPM_BIGNUM		nBignum = NULL;		/* freed @2 */
+    TPM_BN_FIXED_BASE	xBase = NULL;		/* owned by the TPM_DAA_BASE_CACHE */
+    TPM_BN_MONT_CTX	nMont = NULL;		/* owned by the TPM_DAA_BASE_CACHE */
     TPM_BIGNUM		fBignum = NULL;		/* freed @3 */
     TPM_BIGNUM		f1Bignum = NULL;	/* freed @4 */
     TPM_BIGNUM		zBignum = NULL;		/* freed @5 */
 
     printf("TPM_DAAJoin_Stage05:\n");
-    tpm_state = tpm_state;			/* not used */
     outputData = outputData;			/* not used */
     /* a. Verify that DAA_session ->DAA_stage==5. Return TPM_DAA_STAGE and flush handle on
        mismatch */
@@ -1830,14 +2110,16 @@ TPM_RESULT TPM_DAAJoin_Stage05(tpm_state_t *tpm_state,
 	}
     }
     /* h. Set X = DAA_generic_R1 */
-    if (rc == 0) {
-	printf("TPM_DAAJoin_Stage05: Creating X\n");
-	rc = TPM_bin2bn(&xBignum, inputData0->buffer, inputData0->size);
-    }
     /* i. Set n = DAA_generic_n */
     if (rc == 0) {
-	printf("TPM_DAAJoin_Stage05: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData1->buffer, inputData1->size);
+	printf("TPM_DAAJoin_Stage05: Getting X and n\n");
+	rc = TPM_DAABaseCache_Get(&xBase,
+				  &nMont,
+				  &(tpm_state->tpm_daa_base_cache),
+				  tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer,
+				  TPM_DAA_BASE_R1,
+				  inputData0,	/* DAA_generic_R1 */
+				  inputData1);	/* DAA_generic_n */
     }
     /* j. Set f = SHA-1(DAA_tpmSpecific -> DAA_rekey || DAA_tpmSpecific -> DAA_count || 0) ||
        SHA-1(DAA_tpmSpecific -> DAA_rekey || DAA_tpmSpecific -> DAA_count || 1 ) mod
@@ -1859,20 +2141,18 @@ TPM_RESULT TPM_DAAJoin_Stage05(tpm_state_t *tpm_state,
     }
     /* m. Set DAA_session -> DAA_scratch = Z*(X^f1) mod n */
     if (rc == 0) {
-	rc = TPM_ComputeZxAexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
+	rc = TPM_ComputeZxXexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
 				    sizeof(tpm_daa_session_data->DAA_session.DAA_scratch),
 				    zBignum,	/* Z */
-				    xBignum,	/* A */
+				    xBase,	/* X */
 				    f1Bignum,	/* P */
-				    nBignum);	/* N */
+				    nMont);	/* N */
     }
     /* n. set outputData = NULL */
     /* NOTE Done by caller */
     /* o. increment DAA_session -> DAA_stage by 1 */
     /* NOTE Done by common code */
     /* p. return TPM_SUCCESS */
-    TPM_BN_free(xBignum);	/* @1 */
-    TPM_BN_free(nBignum);	/* @2 */
     TPM_BN_free(fBignum);	/* @3 */
     TPM_BN_free(f1Bignum);	/* @4 */
     TPM_BN_free(zBignum);	/* @5 */
@@ -1886,13 +2166,12 @@ TPM_RESULT TPM_DAAJoin_Stage06(tpm_state_t *tpm_state,
 			       TPM_SIZED_BUFFER *inputData1)
 {
     TPM_RESULT		rc = 0;
-    TPM_BIGNUM		xBignum = NULL;	/* freed @1 */
-    TPM_BIGNUM		nBignum = NULL;	/* freed @2 */
+    TPM_BN_FIXED_BASE	xBase = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
+    TPM_BN_MONT_CTX	nMont = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     TPM_BIGNUM		zBignum = NULL;	/* freed @3 */
     TPM_BIGNUM		yBignum = NULL;	/* freed @4 */
 
     printf("TPM_DAAJoin_Stage06:\n");
-    tpm_state = tpm_state;			/* not used */
     outputData = outputData;			/* not used */
     /* a. Verify that DAA_session ->DAA_stage==6. Return TPM_DAA_STAGE and flush handle on
        mismatch */
@@ -1928,14 +2207,16 @@ TPM_RESULT TPM_DAAJoin_Stage06(tpm_state_t *tpm_state,
 	}
     }
     /* h. Set X = DAA_generic_S0 */
-    if (rc == 0) {
-	printf("TPM_DAAJoin_Stage06: Creating X\n");
-	rc = TPM_bin2bn(&xBignum, inputData0->buffer, inputData0->size);
-    }
     /* i. Set n = DAA_generic_n */
     if (rc == 0) {
-	printf("TPM_DAAJoin_Stage06: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData1->buffer, inputData1->size);
+	printf("TPM_DAAJoin_Stage06: Getting X and n\n");
+	rc = TPM_DAABaseCache_Get(&xBase,
+				  &nMont,
+				  &(tpm_state->tpm_daa_base_cache),
+				  tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer,
+				  TPM_DAA_BASE_S0,
+				  inputData0,	/* DAA_generic_S0 */
+				  inputData1);	/* DAA_generic_n */
     }
     /* j. Set Z = DAA_session -> DAA_scratch */
     if (rc == 0) {
@@ -1953,20 +2234,18 @@ TPM_RESULT TPM_DAAJoin_Stage06(tpm_state_t *tpm_state,
     }
     /* l. Set DAA_session -> DAA_scratch = Z*(X^Y) mod n */
     if (rc == 0) {
-	rc = TPM_ComputeZxAexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
+	rc = TPM_ComputeZxXexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
 				    sizeof(tpm_daa_session_data->DAA_session.DAA_scratch),
 				    zBignum,	/* Z */
-				    xBignum,	/* A */
+				    xBase,	/* X */
 				    yBignum,	/* P */
-				    nBignum);	/* N */
+				    nMont);	/* N */
     }
     /* m. set outputData = NULL */
     /* NOTE Done by caller */
     /* n. increment DAA_session -> DAA_stage by 1 */
     /* NOTE Done by common code */
     /* o. return TPM_SUCCESS */
-    TPM_BN_free(xBignum);	/* @1 */
-    TPM_BN_free(nBignum);	/* @2 */
     TPM_BN_free(zBignum);	/* @3 */
     TPM_BN_free(yBignum);	/* @4 */
     return rc;
@@ -1980,13 +2259,12 @@ TPM_RESULT TPM_DAAJoin_Stage07(tpm_state_t *tpm_state,
 {
     TPM_RESULT		rc = 0;
     uint32_t		nCount;		/* DAA_count in nbo */
-    TPM_BIGNUM		xBignum = NULL;	/* freed @1 */
-    TPM_BIGNUM		nBignum = NULL;	/* freed @2 */
+    TPM_BN_FIXED_BASE	xBase = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
+    TPM_BN_MONT_CTX	nMont = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     TPM_BIGNUM		yBignum = NULL;	/* freed @3 */
     TPM_BIGNUM		zBignum = NULL;	/* freed @4 */
 
     printf("TPM_DAAJoin_Stage07:\n");
-    tpm_state = tpm_state;			/* not used */
     /* a. Verify that DAA_session ->DAA_stage==7. Return TPM_DAA_STAGE and flush handle on
        mismatch */
     /* NOTE Done by common code */
@@ -2021,14 +2299,16 @@ TPM_RESULT TPM_DAAJoin_Stage07(tpm_state_t *tpm_state,
 	}
     }
     /* h. Set X = DAA_generic_S1 */
-    if (rc == 0) {
-	printf("TPM_DAAJoin_Stage07: Creating X\n");
-	rc = TPM_bin2bn(&xBignum, inputData0->buffer, inputData0->size);
-    }
     /* i. Set n = DAA_generic_n */
     if (rc == 0) {
-	printf("TPM_DAAJoin_Stage07: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData1->buffer, inputData1->size);
+	printf("TPM_DAAJoin_Stage07: Getting X and n\n");
+	rc = TPM_DAABaseCache_Get(&xBase,
+				  &nMont,
+				  &(tpm_state->tpm_daa_base_cache),
+				  tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer,
+				  TPM_DAA_BASE_S1,
+				  inputData0,	/* DAA_generic_S1 */
+				  inputData1);	/* DAA_generic_n */
     }
     /* j. Set Y = DAA_joinSession -> DAA_join_u1 */
     if (rc == 0) {
@@ -2046,12 +2326,12 @@ TPM_RESULT TPM_DAAJoin_Stage07(tpm_state_t *tpm_state,
     }
     /* l. Set DAA_session -> DAA_scratch = Z*(X^Y) mod n */
     if (rc == 0) {
-	rc = TPM_ComputeZxAexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
+	rc = TPM_ComputeZxXexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
 				    sizeof(tpm_daa_session_data->DAA_session.DAA_scratch),
 				    zBignum,	/* Z */
-				    xBignum,	/* A */
+				    xBase,	/* X */
 				    yBignum,	/* P */
-				    nBignum);	/* N */
+				    nMont);	/* N */
     }
     /* m. Set DAA_session -> DAA_digest to the SHA-1 (DAA_session -> DAA_scratch || DAA_tpmSpecific
        -> DAA_count || DAA_joinSession -> DAA_digest_n0) */
@@ -2078,8 +2358,6 @@ TPM_RESULT TPM_DAAJoin_Stage07(tpm_state_t *tpm_state,
     /* p. increment DAA_session -> DAA_stage by 1 */
     /* NOTE Done by common code */
     /* q. return TPM_SUCCESS */
-    TPM_BN_free(xBignum);	/* @1 */
-    TPM_BN_free(nBignum);	/* @2 */
     TPM_BN_free(yBignum);	/* @3 */
     TPM_BN_free(zBignum);	/* @4 */
     return rc;
@@ -2149,14 +2427,12 @@ TPM_RESULT TPM_DAAJoin_Stage09_Sign_Stage2(tpm_state_t *tpm_state,
 					   TPM_SIZED_BUFFER *inputData1)
 {
     TPM_RESULT		rc = 0;
+    TPM_BN_FIXED_BASE	xBase = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     unsigned char	*Y = NULL;	/* freed @1 */
     TPM_BIGNUM		yBignum = NULL;	/* freed @2 */
-    TPM_BIGNUM		xBignum = NULL;	/* freed @3 */
-    TPM_BIGNUM		nBignum = NULL;	/* freed @4 */
     TPM_BIGNUM		rBignum = NULL;	/* freed @5 */
 
     printf("TPM_DAAJoin_Stage09_Sign_Stage2:\n");
-    tpm_state = tpm_state;			/* not used */
     outputData = outputData;			/* not used */
     /* a. Verify that DAA_session ->DAA_stage==9. Return TPM_DAA_STAGE and flush handle on
        mismatch */
@@ -2213,23 +2489,24 @@ TPM_RESULT TPM_DAAJoin_Stage09_Sign_Stage2(tpm_state_t *tpm_state,
 	rc = TPM_bin2bn(&yBignum, Y, DAA_SIZE_r0);
     }
     /* j. Set X = DAA_generic_R0 */
-    if (rc == 0) {
-	printf("TPM_DAAJoin_Stage09_Sign_Stage2: Creating X\n");
-	rc = TPM_bin2bn(&xBignum, inputData0->buffer, inputData0->size);
-    }
     /* k. Set n = DAA_generic_n */
     if (rc == 0) {
-	printf("TPM_DAAJoin_Stage09_Sign_Stage2: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData1->buffer, inputData1->size);
+	printf("TPM_DAAJoin_Stage09_Sign_Stage2: Getting X and n\n");
+	rc = TPM_DAABaseCache_Get(&xBase,
+				  NULL,
+				  &(tpm_state->tpm_daa_base_cache),
+				  tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer,
+				  TPM_DAA_BASE_R0,
+				  inputData0,	/* DAA_generic_R0 */
+				  inputData1);	/* DAA_generic_n */
     }
     /* l. Set DAA_session -> DAA_scratch = (X^Y) mod n */
     if (rc == 0) {
-	rc = TPM_ComputeAexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
+	rc = TPM_ComputeXexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
 				  sizeof(tpm_daa_session_data->DAA_session.DAA_scratch),
 				  &rBignum,	/* R */
-				  xBignum,	/* A */
-				  yBignum,	/* P */
-				  nBignum);	/* n */
+				  xBase,	/* X */
+				  yBignum);	/* P */
 
     }
     /* m. set outputData = NULL */
@@ -2239,8 +2516,6 @@ TPM_RESULT TPM_DAAJoin_Stage09_Sign_Stage2(tpm_state_t *tpm_state,
     /* o. return TPM_SUCCESS */
     free(Y);			/* @1 */
     TPM_BN_free(yBignum);	/* @2 */
-    TPM_BN_free(xBignum);	/* @3 */
-    TPM_BN_free(nBignum);	/* @4 */
     TPM_BN_free(rBignum);	/* @5 */
     return rc;
 }
@@ -2252,14 +2527,13 @@ TPM_RESULT TPM_DAAJoin_Stage10_Sign_Stage3(tpm_state_t *tpm_state,
 					   TPM_SIZED_BUFFER *inputData1)
 {
     TPM_RESULT		rc = 0;
+    TPM_BN_FIXED_BASE	xBase = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     unsigned char	*Y= NULL;	/* freed @1 */
-    TPM_BIGNUM		xBignum = NULL;	/* freed @2 */
-    TPM_BIGNUM		nBignum = NULL;	/* freed @3 */
+    TPM_BN_MONT_CTX	nMont = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     TPM_BIGNUM		zBignum = NULL;	/* freed @4 */
     TPM_BIGNUM		yBignum = NULL;	/* freed @5*/
 
     printf("TPM_DAAJoin_Stage10_Sign_Stage3:\n");
-    tpm_state = tpm_state;			/* not used */
     outputData = outputData;			/* not used */
     /* a. Verify that DAA_session ->DAA_stage==10. Return TPM_DAA_STAGE and flush handle on mismatch
        h */
@@ -2312,14 +2586,16 @@ TPM_RESULT TPM_DAAJoin_Stage10_Sign_Stage3(tpm_state_t *tpm_state,
 	rc = TPM_bin2bn(&yBignum, Y, DAA_SIZE_r1);
     }
     /* i. Set X = DAA_generic_R1 */
-    if (rc == 0) {
-	printf("TPM_DAAJoin_Stage10_Sign_Stage3: Creating X\n");
-	rc = TPM_bin2bn(&xBignum, inputData0->buffer, inputData0->size);
-    }
     /* j. Set n = DAA_generic_n */
     if (rc == 0) {
-	printf("TPM_DAAJoin_Stage10_Sign_Stage3: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData1->buffer, inputData1->size);
+	printf("TPM_DAAJoin_Stage10_Sign_Stage3: Getting X and n\n");
+	rc = TPM_DAABaseCache_Get(&xBase,
+				  &nMont,
+				  &(tpm_state->tpm_daa_base_cache),
+				  tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer,
+				  TPM_DAA_BASE_R1,
+				  inputData0,	/* DAA_generic_R1 */
+				  inputData1);	/* DAA_generic_n */
     }
     /* k. Set Z = DAA_session -> DAA_scratch */
     if (rc == 0) {
@@ -2330,12 +2606,12 @@ TPM_RESULT TPM_DAAJoin_Stage10_Sign_Stage3(tpm_state_t *tpm_state,
     }
     /* l. Set DAA_session -> DAA_scratch = Z*(X^Y) mod n */
     if (rc == 0) {
-	rc = TPM_ComputeZxAexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
+	rc = TPM_ComputeZxXexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
 				    sizeof(tpm_daa_session_data->DAA_session.DAA_scratch),
 				    zBignum,	/* Z */
-				    xBignum,	/* A */
+				    xBase,	/* X */
 				    yBignum,	/* P */
-				    nBignum);	/* N */
+				    nMont);	/* N */
     }
     /* m. set outputData = NULL */
     /* NOTE Done by caller */
@@ -2343,8 +2619,6 @@ TPM_RESULT TPM_DAAJoin_Stage10_Sign_Stage3(tpm_state_t *tpm_state,
     /* NOTE Done by common code */
     /* o. return TPM_SUCCESS */
     free(Y);			/* @1 */
-    TPM_BN_free(xBignum);	/* @2 */
-    TPM_BN_free(nBignum);	/* @3 */
     TPM_BN_free(zBignum);	/* @4 */
     TPM_BN_free(yBignum);	/* @5 */
     return rc;
@@ -2357,14 +2631,13 @@ TPM_RESULT TPM_DAAJoin_Stage11_Sign_Stage4(tpm_state_t *tpm_state,
 					   TPM_SIZED_BUFFER *inputData1)
 {
     TPM_RESULT		rc = 0;
+    TPM_BN_FIXED_BASE	xBase = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     unsigned char	*Y= NULL;	/* freed @1 */
     TPM_BIGNUM		yBignum = NULL;	/* freed @2 */
-    TPM_BIGNUM		xBignum = NULL;	/* freed @3 */
-    TPM_BIGNUM		nBignum = NULL;	/* freed @4 */
+    TPM_BN_MONT_CTX	nMont = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     TPM_BIGNUM		zBignum = NULL;	/* freed @5 */
 
     printf("TPM_DAAJoin_Stage11_Sign_Stage4:\n");
-    tpm_state = tpm_state;			/* not used */
     outputData = outputData;			/* not used */
     /* a. Verify that DAA_session ->DAA_stage==11. Return TPM_DAA_STAGE and flush handle on
        mismatch */
@@ -2417,14 +2690,16 @@ TPM_RESULT TPM_DAAJoin_Stage11_Sign_Stage4(tpm_state_t *tpm_state,
 	rc = TPM_bin2bn(&yBignum, Y, DAA_SIZE_r2);
     }
     /* i. Set X = DAA_generic_S0 */
-    if (rc == 0) {
-	printf("TPM_DAAJoin_Stage11_Sign_Stage4: Creating X\n");
-	rc = TPM_bin2bn(&xBignum, inputData0->buffer, inputData0->size);
-    }
     /* j. Set n = DAA_generic_n */
     if (rc == 0) {
-	printf("TPM_DAAJoin_Stage11_Sign_Stage4: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData1->buffer, inputData1->size);
+	printf("TPM_DAAJoin_Stage11_Sign_Stage4: Getting X and n\n");
+	rc = TPM_DAABaseCache_Get(&xBase,
+				  &nMont,
+				  &(tpm_state->tpm_daa_base_cache),
+				  tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer,
+				  TPM_DAA_BASE_S0,
+				  inputData0,	/* DAA_generic_S0 */
+				  inputData1);	/* DAA_generic_n */
     }
     /* k. Set Z = DAA_session -> DAA_scratch */
     if (rc == 0) {
@@ -2435,12 +2710,12 @@ TPM_RESULT TPM_DAAJoin_Stage11_Sign_Stage4(tpm_state_t *tpm_state,
     }
     /* l. Set DAA_session -> DAA_scratch = Z*(X^Y) mod n */
     if (rc == 0) {
-	rc = TPM_ComputeZxAexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
+	rc = TPM_ComputeZxXexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
 				    sizeof(tpm_daa_session_data->DAA_session.DAA_scratch),
 				    zBignum,	/* Z */
-				    xBignum,	/* A */
+				    xBase,	/* X */
 				    yBignum,	/* P */
-				    nBignum);	/* N */
+				    nMont);	/* N */
     }
     /* m. set outputData = NULL */
     /* NOTE Done by caller */
@@ -2449,8 +2724,6 @@ TPM_RESULT TPM_DAAJoin_Stage11_Sign_Stage4(tpm_state_t *tpm_state,
     /* o. return TPM_SUCCESS */
     free(Y);			/* @1 */
     TPM_BN_free(yBignum);	/* @2 */
-    TPM_BN_free(xBignum);	/* @3 */
-    TPM_BN_free(nBignum);	/* @4 */
     TPM_BN_free(zBignum);	/* @5 */
     return rc;
 }
@@ -2462,14 +2735,13 @@ TPM_RESULT TPM_DAAJoin_Stage12(tpm_state_t *tpm_state,
 			       TPM_SIZED_BUFFER *inputData1)
 {
     TPM_RESULT		rc = 0;
+    TPM_BN_FIXED_BASE	xBase = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     unsigned char	*Y = NULL;	/* freed @1 */
     TPM_BIGNUM		yBignum = NULL;	/* freed @2 */
-    TPM_BIGNUM		xBignum = NULL;	/* freed @3 */
-    TPM_BIGNUM		nBignum = NULL;	/* freed @4 */
+    TPM_BN_MONT_CTX	nMont = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     TPM_BIGNUM		zBignum = NULL;	/* freed @5 */
 
     printf("TPM_DAAJoin_Stage12:\n");
-    tpm_state = tpm_state;			/* not used */
     /* a. Verify that DAA_session ->DAA_stage==12. Return TPM_DAA_STAGE and flush handle on
        mismatch */
     /* NOTE Done by common code */
@@ -2521,14 +2793,16 @@ TPM_RESULT TPM_DAAJoin_Stage12(tpm_state_t *tpm_state,
 	rc = TPM_bin2bn(&yBignum, Y, DAA_SIZE_r3);
     }
     /* i. Set X = DAA_generic_S1 */
-    if (rc == 0) {
-	printf("TPM_DAAJoin_Stage12: Creating X\n");
-	rc = TPM_bin2bn(&xBignum, inputData0->buffer, inputData0->size);
-    }
     /* j. Set n = DAA_generic_n */
     if (rc == 0) {
-	printf("TPM_DAAJoin_Stage12: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData1->buffer, inputData1->size);
+	printf("TPM_DAAJoin_Stage12: Getting X and n\n");
+	rc = TPM_DAABaseCache_Get(&xBase,
+				  &nMont,
+				  &(tpm_state->tpm_daa_base_cache),
+				  tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer,
+				  TPM_DAA_BASE_S1,
+				  inputData0,	/* DAA_generic_S1 */
+				  inputData1);	/* DAA_generic_n */
     }
     /* k. Set Z = DAA_session -> DAA_scratch */
     if (rc == 0) {
@@ -2539,12 +2813,12 @@ TPM_RESULT TPM_DAAJoin_Stage12(tpm_state_t *tpm_state,
     }
     /* l. Set DAA_session -> DAA_scratch = Z*(X^Y) mod n */
     if (rc == 0) {
-	rc = TPM_ComputeZxAexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
+	rc = TPM_ComputeZxXexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
 				    sizeof(tpm_daa_session_data->DAA_session.DAA_scratch),
 				    zBignum,	/* Z */
-				    xBignum,	/* A */
+				    xBase,	/* X */
 				    yBignum,	/* P */
-				    nBignum);	/* N */
+				    nMont);	/* N */
     }
     /* m. set outputData = DAA_session -> DAA_scratch */
     if (rc == 0) {
@@ -2561,8 +2835,6 @@ TPM_RESULT TPM_DAAJoin_Stage12(tpm_state_t *tpm_state,
     /* p. return TPM_SUCCESS */
     free(Y);			/* @1 */
     TPM_BN_free(yBignum);	/* @2 */
-    TPM_BN_free(xBignum);	/* @3 */
-    TPM_BN_free(nBignum);	/* @4 */
     TPM_BN_free(zBignum);	/* @5 */
     return rc;
 }
@@ -2575,8 +2847,8 @@ TPM_RESULT TPM_DAAJoin_Stage13_Sign_Stage6(tpm_state_t *tpm_state,
 {
     TPM_RESULT		rc = 0;
     TPM_BIGNUM		wBignum = NULL;		/* freed @1 */
-    TPM_BIGNUM		qBignum = NULL;		/* freed @2 */
-    TPM_BIGNUM		nBignum = NULL;		/* freed @3 */
+    TPM_BIGNUM		qBignum = NULL;		/* owned by the session */
+    TPM_BN_MONT_CTX	nMont = NULL;		/* owned by the session */
     TPM_BIGNUM		w1Bignum = NULL;	/* freed @4 */
 
     printf("TPM_DAAJoin_Stage13_Sign_Stage6:\n");
@@ -2619,14 +2891,12 @@ TPM_RESULT TPM_DAAJoin_Stage13_Sign_Stage6(tpm_state_t *tpm_state,
     /* FIXME added Set q = DAA_issuerSettings -> DAA_generic_q */
     if (rc == 0) {
 	printf("TPM_DAAJoin_Stage13_Sign_Stage6: Creating q from DAA_generic_q\n");
-	rc = TPM_bin2bn(&qBignum,
-			tpm_daa_session_data->DAA_issuerSettings.DAA_generic_q,
-			sizeof(tpm_daa_session_data->DAA_issuerSettings.DAA_generic_q));
+	rc = TPM_DaaSessionData_GetQ(&qBignum, tpm_daa_session_data);
     }
     /* FIXME Set n = DAA_generic_gamma */
     if (rc == 0) {
 	printf("TPM_DAAJoin_Stage13_Sign_Stage6: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData0->buffer, inputData0->size);
+	rc = TPM_DaaSessionData_GetGamma(&nMont, tpm_daa_session_data, inputData0);
     }
     /* h. Set w1 = w^( DAA_issuerSettings -> DAA_generic_q) mod (DAA_generic_gamma) */
     /* FIXME w1 = (w^q) mod n */
@@ -2636,7 +2906,7 @@ TPM_RESULT TPM_DAAJoin_Stage13_Sign_Stage6(tpm_state_t *tpm_state,
 				  &w1Bignum,	/* R */
 				  wBignum,	/* A */
 				  qBignum,	/* P */
-				  nBignum);	/* n */
+				  nMont);	/* n */
     }
     /* i. If w1 != 1 (unity), return error TPM_DAA_WRONG_W */
     if (rc == 0) {
@@ -2655,8 +2925,6 @@ TPM_RESULT TPM_DAAJoin_Stage13_Sign_Stage6(tpm_state_t *tpm_state,
     /* NOTE Done by common code */
     /* m. return TPM_SUCCESS. */
     TPM_BN_free(wBignum);	/* @1 */
-    TPM_BN_free(qBignum);	/* @2 */
-    TPM_BN_free(nBignum);	/* @3 */
     TPM_BN_free(w1Bignum);	/* @4 */
     return rc;
 }
@@ -2669,7 +2937,7 @@ TPM_RESULT TPM_DAAJoin_Stage14_Sign_Stage7(tpm_state_t *tpm_state,
     TPM_RESULT		rc = 0;
     TPM_BIGNUM		fBignum = NULL;	/* freed @1 */
     TPM_BIGNUM		wBignum = NULL;	/* freed @2 */
-    TPM_BIGNUM		nBignum = NULL;	/* freed @3 */
+    TPM_BN_MONT_CTX	nMont = NULL;	/* owned by the session */
     TPM_BIGNUM		eBignum = NULL;	/* freed @4 */
 
     unsigned int	numBytes;	/* for debug */
@@ -2722,11 +2990,7 @@ TPM_RESULT TPM_DAAJoin_Stage14_Sign_Stage7(tpm_state_t *tpm_state,
     /* FIXME Set n = DAA_generic_gamma */
     if (rc == 0) {
 	printf("TPM_DAAJoin_Stage14_Sign_Stage7: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData0->buffer, inputData0->size);
-    }
-    if (rc == 0) {
-	rc = TPM_BN_num_bytes(&numBytes, nBignum);
-	printf("TPM_DAAJoin_Stage14_Sign_Stage7: n size %u\n", numBytes);
+	rc = TPM_DaaSessionData_GetGamma(&nMont, tpm_daa_session_data, inputData0);
     }
     /* g. Set E = ((DAA_session -> DAA_scratch)^f) mod (DAA_generic_gamma). */
     /* FIXME E = (w^f) mod n */
@@ -2736,7 +3000,7 @@ TPM_RESULT TPM_DAAJoin_Stage14_Sign_Stage7(tpm_state_t *tpm_state,
 				  &eBignum,	/* R */
 				  wBignum,	/* A */
 				  fBignum,	/* P */
-				  nBignum);	/* n */
+				  nMont);	/* n */
     }
     /* h. Set outputData = E */
     if (rc == 0) {
@@ -2750,7 +3014,6 @@ TPM_RESULT TPM_DAAJoin_Stage14_Sign_Stage7(tpm_state_t *tpm_state,
     /* j. return TPM_SUCCESS. */
     TPM_BN_free(fBignum);	/* @1 */
     TPM_BN_free(wBignum);	/* @2 */
-    TPM_BN_free(nBignum);	/* @3 */
     TPM_BN_free(eBignum);	/* @4 */
     return rc;
 }
@@ -2768,8 +3031,8 @@ TPM_RESULT TPM_DAAJoin_Stage15_Sign_Stage8(tpm_state_t *tpm_state,
     TPM_BIGNUM		r1sBignum = NULL;	/* freed @5 */
     TPM_BIGNUM		rBignum = NULL;		/* freed @6 */
     TPM_BIGNUM		e1Bignum = NULL;	/* freed @7 */
-    TPM_BIGNUM		qBignum = NULL;		/* freed @8 */
-    TPM_BIGNUM		nBignum = NULL;		/* freed @9 */
+    TPM_BIGNUM		qBignum = NULL;		/* owned by the session */
+    TPM_BN_MONT_CTX	nMont = NULL;		/* owned by the session */
     TPM_BIGNUM		wBignum = NULL;		/* freed @10 */
 
     printf("TPM_DAAJoin_Stage15_Sign_Stage8:\n");
@@ -2832,9 +3095,7 @@ TPM_RESULT TPM_DAAJoin_Stage15_Sign_Stage8(tpm_state_t *tpm_state,
     /* FIXME Set q = DAA_generic_q */
     if (rc == 0) {
 	printf("TPM_DAAJoin_Stage15_Sign_Stage8: Creating n from DAA_generic_q\n");
-	rc = TPM_bin2bn(&qBignum,
-			tpm_daa_session_data->DAA_issuerSettings.DAA_generic_q,
-			sizeof(tpm_daa_session_data->DAA_issuerSettings.DAA_generic_q));
+	rc = TPM_DaaSessionData_GetQ(&qBignum, tpm_daa_session_data);
     }
     /* h. set r = r0 + 2^DAA_power0 * r1 mod (DAA_issuerSettings -> DAA_generic_q). */
     /* FIXME added parentheses
@@ -2854,7 +3115,7 @@ TPM_RESULT TPM_DAAJoin_Stage15_Sign_Stage8(tpm_state_t *tpm_state,
     /* FIXME Set n = DAA_generic_gamma */
     if (rc == 0) {
 	printf("TPM_DAAJoin_Stage15_Sign_Stage8: Creating n1 from DAA_generic_gamma\n");
-	rc = TPM_bin2bn(&nBignum, inputData0->buffer, inputData0->size);
+	rc = TPM_DaaSessionData_GetGamma(&nMont, tpm_daa_session_data, inputData0);
     }
     /* FIXME Set w = DAA_session -> DAA_scratch */
     if (rc == 0) {
@@ -2871,7 +3132,7 @@ TPM_RESULT TPM_DAAJoin_Stage15_Sign_Stage8(tpm_state_t *tpm_state,
 				  &e1Bignum,	/* R */
 				  wBignum,	/* A */
 				  rBignum,	/* P */
-				  nBignum);	/* n */
+				  nMont);	/* n */
     }
     /* j. Set DAA_session -> DAA_scratch = NULL */
     if (rc == 0) {
@@ -2893,8 +3154,6 @@ TPM_RESULT TPM_DAAJoin_Stage15_Sign_Stage8(tpm_state_t *tpm_state,
     TPM_BN_free(r1sBignum);	/* @5 */
     TPM_BN_free(rBignum);	/* @6 */
     TPM_BN_free(e1Bignum);	/* @7 */
-    TPM_BN_free(qBignum);	/* @8 */
-    TPM_BN_free(nBignum);	/* @9 */
     TPM_BN_free(wBignum);	/* @10 */
     return rc;
 }
@@ -3814,14 +4073,13 @@ TPM_RESULT TPM_DAASign_Stage05(tpm_state_t *tpm_state,
 			       TPM_SIZED_BUFFER *inputData1)
 {
     TPM_RESULT		rc = 0;
+    TPM_BN_FIXED_BASE	xBase = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     unsigned char	*Y = NULL;	/* freed @1 */
     TPM_BIGNUM		yBignum = NULL;	/* freed @2 */
-    TPM_BIGNUM		xBignum = NULL;	/* freed @3 */
-    TPM_BIGNUM		nBignum = NULL;	/* freed @4 */
+    TPM_BN_MONT_CTX	nMont = NULL;	/* owned by the TPM_DAA_BASE_CACHE */
     TPM_BIGNUM		zBignum = NULL;	/* freed @5 */
 
     printf("TPM_DAASign_Stage05:\n");
-    tpm_state = tpm_state;		/* not used */
     /* a. Verify that DAA_session ->DAA_stage==5. Return TPM_DAA_STAGE and flush handle on
        mismatch */
     /* NOTE Done by common code */
@@ -3873,14 +4131,16 @@ TPM_RESULT TPM_DAASign_Stage05(tpm_state_t *tpm_state,
 	rc = TPM_bin2bn(&yBignum, Y, DAA_SIZE_r4);
     }
     /* i. Set X = DAA_generic_S1 */
-    if (rc == 0) {
-	printf("TPM_DAASign_Stage05 Creating X\n");
-	rc = TPM_bin2bn(&xBignum, inputData0->buffer, inputData0->size);
-    }
     /* j. Set n = DAA_generic_n */
     if (rc == 0) {
-	printf("TPM_DAASign_Stage05: Creating n\n");
-	rc = TPM_bin2bn(&nBignum, inputData1->buffer, inputData1->size);
+	printf("TPM_DAASign_Stage05: Getting X and n\n");
+	rc = TPM_DAABaseCache_Get(&xBase,
+				  &nMont,
+				  &(tpm_state->tpm_daa_base_cache),
+				  tpm_daa_session_data->DAA_tpmSpecific.DAA_digestIssuer,
+				  TPM_DAA_BASE_S1,
+				  inputData0,	/* DAA_generic_S1 */
+				  inputData1);	/* DAA_generic_n */
     }
     /* k. Set Z = DAA_session -> DAA_scratch */
     if (rc == 0) {
@@ -3891,12 +4151,12 @@ TPM_RESULT TPM_DAASign_Stage05(tpm_state_t *tpm_state,
     }
     /* l. Set DAA_session -> DAA_scratch = Z*(X^Y) mod n */
     if (rc == 0) {
-	rc = TPM_ComputeZxAexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
+	rc = TPM_ComputeZxXexpPmodn(tpm_daa_session_data->DAA_session.DAA_scratch,
 				    sizeof(tpm_daa_session_data->DAA_session.DAA_scratch),
 				    zBignum,	/* Z */
-				    xBignum,	/* A */
+				    xBase,	/* X */
 				    yBignum,	/* P */
-				    nBignum);	/* N */
+				    nMont);	/* N */
     }
     /* m. set outputData = DAA_session -> DAA_scratch */
     if (rc == 0) {
@@ -3913,8 +4173,6 @@ TPM_RESULT TPM_DAASign_Stage05(tpm_state_t *tpm_state,
     /* p. return TPM_SUCCESS */
     free(Y);			/* @1 */
     TPM_BN_free(yBignum);	/* @2 */
-    TPM_BN_free(xBignum);	/* @3 */
-    TPM_BN_free(nBignum);	/* @4 */
     TPM_BN_free(zBignum);	/* @5 */
     return rc;
 }
@@ -3961,8 +4219,9 @@ TPM_RESULT TPM_DAASign_Stage10(tpm_state_t *tpm_state,
 	    rc = TPM_DAA_INPUT_DATA0;
 	}
     }
-    if (rc == 0)
+    if (rc == 0) {
 	printf("TPM_DAASign_Stage10: selector %u\n", selector);
+    }
 	switch (selector) {
 	  case 1:
 	    /* f. If selector == 1, verify that inputSize1 == sizeOf(TPM_DIGEST), and return error
@@ -4450,10 +4709,9 @@ TPM_RESULT TPM_ComputeF(TPM_BIGNUM *fBignum,		/* freed by caller */
     TPM_DIGEST		digest0;	/* first SHA1 calculation */
     TPM_DIGEST		digest1;	/* second SHA1 calculation */
     TPM_BIGNUM		dividend;	/* digest0 || digest1 as a BIGNUM */
-    TPM_BIGNUM		modulus;	/* DAA_generic_q as a BIGNUM */
+    TPM_BIGNUM		modulus;	/* DAA_generic_q as a BIGNUM, owned by the session */
     
     printf(" TPM_ComputeF:\n");
-    modulus = NULL;			/* freed @1 */
     dividend = NULL;			/* freed @2 */
     if (rc == 0) {
 	rc = TPM_BN_new(fBignum);
@@ -4485,21 +4743,20 @@ TPM_RESULT TPM_ComputeF(TPM_BIGNUM *fBignum,		/* freed by caller */
     }	
     /* DAA_generic_q as a positive BIGNUM */
     if (rc == 0) {
-	rc = TPM_bin2bn(&modulus,
-			tpm_daa_session_data->DAA_issuerSettings.DAA_generic_q,
-			sizeof(tpm_daa_session_data->DAA_issuerSettings.DAA_generic_q));
+	rc = TPM_DaaSessionData_GetQ(&modulus, tpm_daa_session_data);
     }
     /* digest mod DAA_generic_q */
     if (rc == 0) {
 	rc = TPM_BN_mod(*fBignum, dividend, modulus);
     }	
-    TPM_BN_free(modulus);	/* @1 */
     TPM_BN_free(dividend);	/* @2 */
     return rc;
 }
 
 /* TPM_ComputeAexpPmodn() performs R = (A ^ P) mod n.
 
+   n is a context from TPM_DaaSessionData_GetGamma().
+
    rBignum is new'ed by this function and must be freed by the caller
 
    If DAA_scratch is not NULL, r is returned in DAA_scratch.
@@ -4510,7 +4767,7 @@ TPM_RESULT TPM_ComputeAexpPmodn(BYTE *DAA_scratch,
 				TPM_BIGNUM *rBignum,	/* freed by caller */
 				TPM_BIGNUM aBignum,
 				TPM_BIGNUM pBignum,
-				TPM_BIGNUM nBignum)
+				TPM_BN_MONT_CTX nMont)
 {
     TPM_RESULT	rc = 0;
     
@@ -4519,7 +4776,39 @@ TPM_RESULT TPM_ComputeAexpPmodn(BYTE *DAA_scratch,
 	rc = TPM_BN_new(rBignum);
     }
     if (rc == 0) {
-	rc = TPM_BN_mod_exp(*rBignum, aBignum, pBignum, nBignum);
+	rc = TPM_BN_mod_exp_mont(*rBignum, aBignum, pBignum, nMont);
+    }
+    /* if the result should be returned in DAA_scratch */
+    if ((rc == 0) && (DAA_scratch != NULL)) {
+	/* store the result in DAA_scratch */
+	rc = TPM_ComputeDAAScratch(DAA_scratch, DAA_scratch_size, *rBignum);
+    }
+    return rc;
+}
+
+/* TPM_ComputeXexpPmodn() performs R = (X ^ P) mod n for an issuer base X.
+
+   X is a base from TPM_DAABaseCache_Get(), which also holds n.
+
+   rBignum is new'ed by this function and must be freed by the caller
+
+   If DAA_scratch is not NULL, r is returned in DAA_scratch.
+*/
+
+TPM_RESULT TPM_ComputeXexpPmodn(BYTE *DAA_scratch,
+				uint32_t DAA_scratch_size,
+				TPM_BIGNUM *rBignum,	/* freed by caller */
+				TPM_BN_FIXED_BASE xBase,
+				TPM_BIGNUM pBignum)
+{
+    TPM_RESULT	rc = 0;
+    
+    printf(" TPM_ComputeXexpPmodn:\n");
+    if (rc == 0) {
+	rc = TPM_BN_new(rBignum);
+    }
+    if (rc == 0) {
+	rc = TPM_BN_mod_exp_fixed(*rBignum, pBignum, xBase);
     }
     /* if the result should be returned in DAA_scratch */
     if ((rc == 0) && (DAA_scratch != NULL)) {
@@ -4529,33 +4818,33 @@ TPM_RESULT TPM_ComputeAexpPmodn(BYTE *DAA_scratch,
     return rc;
 }
 
-/* TPM_ComputeZxAexpPmodn() performs DAA_scratch = Z * (A ^ P) mod n.
+/* TPM_ComputeZxXexpPmodn() performs DAA_scratch = Z * (X ^ P) mod n for an issuer base X.
 
+   X and n are from TPM_DAABaseCache_Get().
 */
 
-TPM_RESULT TPM_ComputeZxAexpPmodn(BYTE *DAA_scratch,
+TPM_RESULT TPM_ComputeZxXexpPmodn(BYTE *DAA_scratch,
 				  uint32_t DAA_scratch_size,
 				  TPM_BIGNUM zBignum,
-				  TPM_BIGNUM aBignum,
+				  TPM_BN_FIXED_BASE xBase,
 				  TPM_BIGNUM pBignum,
-				  TPM_BIGNUM nBignum)
+				  TPM_BN_MONT_CTX nMont)
 {
     TPM_RESULT	rc = 0;
     TPM_BIGNUM	rBignum = NULL;		/* freed @1 */
     
-    printf(" TPM_ComputeZxAexpPmodn:\n");
+    printf(" TPM_ComputeZxXexpPmodn:\n");
     if (rc == 0) {
-	printf("  TPM_ComputeZxAexpPmodn: Calculate R = A ^ P mod n\n");
-	rc = TPM_ComputeAexpPmodn(NULL,		/* DAA_scratch */
+	printf("  TPM_ComputeZxXexpPmodn: Calculate R = X ^ P mod n\n");
+	rc = TPM_ComputeXexpPmodn(NULL,		/* DAA_scratch */
 				  0,
 				  &rBignum,	/* R */
-				  aBignum,	/* A */
-				  pBignum,
-				  nBignum);
+				  xBase,	/* X */
+				  pBignum);
     }
     if (rc == 0) {
-	printf("  TPM_ComputeZxAexpPmodn: Calculate R = Z * R mod n\n");
-	rc = TPM_BN_mod_mul(rBignum, zBignum, rBignum, nBignum);
+	printf("  TPM_ComputeZxXexpPmodn: Calculate R = Z * R mod n\n");
+	rc = TPM_BN_mod_mul_mont(rBignum, zBignum, rBignum, nMont);
     }
     /* store the result in DAA_scratch */
     if (rc == 0) {
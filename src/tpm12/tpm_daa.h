@@ -95,6 +95,32 @@ void       TPM_DaaSessionData_Copy(TPM_DAA_SESSION_DATA *dest_daa_session_data,
                                    TPM_DAA_SESSION_DATA *src_daa_session_data);
 TPM_RESULT TPM_DaaSessionData_CheckStage(TPM_DAA_SESSION_DATA *tpm_daa_session_data,
                                          BYTE stage);
+TPM_RESULT TPM_DaaSessionData_GetGamma(TPM_BN_MONT_CTX *gammaMont,
+                                       TPM_DAA_SESSION_DATA *tpm_daa_session_data,
+                                       TPM_SIZED_BUFFER *DAA_generic_gamma);
+TPM_RESULT TPM_DaaSessionData_GetQ(TPM_BIGNUM *qBignum,
+                                   TPM_DAA_SESSION_DATA *tpm_daa_session_data);
+
+/*
+  TPM_DAA_MODULI
+*/
+
+void       TPM_DAAModuli_Init(TPM_DAA_MODULI *tpm_daa_moduli);
+void       TPM_DAAModuli_Delete(TPM_DAA_MODULI *tpm_daa_moduli);
+
+/*
+  TPM_DAA_BASE_CACHE
+*/
+
+void       TPM_DAABaseCache_Init(TPM_DAA_BASE_CACHE *tpm_daa_base_cache);
+void       TPM_DAABaseCache_Delete(TPM_DAA_BASE_CACHE *tpm_daa_base_cache);
+TPM_RESULT TPM_DAABaseCache_Get(TPM_BN_FIXED_BASE *xBase,
+                                TPM_BN_MONT_CTX *nMont,
+                                TPM_DAA_BASE_CACHE *tpm_daa_base_cache,
+                                const TPM_DIGEST digestIssuer,
+                                unsigned int base,
+                                TPM_SIZED_BUFFER *DAA_generic_X,
+                                TPM_SIZED_BUFFER *DAA_generic_n);
 
 /*
   TPM_DAA_ISSUER
@@ -195,13 +221,18 @@ TPM_RESULT TPM_ComputeAexpPmodn(BYTE *DAA_scratch,
                                 TPM_BIGNUM *rBignum,
                                 TPM_BIGNUM xBignum,
                                 TPM_BIGNUM fBignum,
-                                TPM_BIGNUM nBignum);
-TPM_RESULT TPM_ComputeZxAexpPmodn(BYTE *DAA_scratch,
+                                TPM_BN_MONT_CTX nMont);
+TPM_RESULT TPM_ComputeXexpPmodn(BYTE *DAA_scratch,
+                                uint32_t DAA_scratch_size,
+                                TPM_BIGNUM *rBignum,
+                                TPM_BN_FIXED_BASE xBase,
+                                TPM_BIGNUM pBignum);
+TPM_RESULT TPM_ComputeZxXexpPmodn(BYTE *DAA_scratch,
                                   uint32_t DAA_scratch_size,
                                   TPM_BIGNUM zBignum,
-                                  TPM_BIGNUM aBignum,
+                                  TPM_BN_FIXED_BASE xBase,
                                   TPM_BIGNUM pBignum,
-                                  TPM_BIGNUM nBignum);
+                                  TPM_BN_MONT_CTX nMont);
 TPM_RESULT TPM_ComputeApBmodn(TPM_BIGNUM *rBignum,
                               TPM_BIGNUM aBignum,
                               TPM_BIGNUM bBignum,
@@ -44,18 +44,8 @@
 
 #include "tpm_debug.h"
 #undef printf
-
-#if 0
-
-int swallow_rc = 0;
-
-int tpm_swallow_printf_args(const char *format, ...)
-{
-    format = format;	/* to silence compiler */
-    return 0;
-}
-
-#else
+#undef TPM_PrintFour
+#undef TPM_PrintAll
 
 /* TPM_PrintFour() prints a prefix plus 4 bytes of a buffer */
 
@@ -75,8 +65,6 @@ void TPM_PrintFour(const char *string, const unsigned char* buff)
     return;
 }
 
-#endif
-
 /* TPM_PrintAll() prints 'string', the length, and then the entire byte array
  */
 
@@ -48,22 +48,45 @@
 void TPM_PrintFour(const char *string, const unsigned char* buff);
 void TPM_PrintAll(const char *string, const unsigned char* buff, uint32_t length);
 
-#if 0
-#ifndef TPM_DEBUG       /* if debug is turned off */
+/* The TPM traces with printf(), which is redirected to TPMLIB_LogPrintf().
 
-/* dummy function to match the printf prototype */
-int tpm_swallow_printf_args(const char *format, ...);
+   In a debug build, a trace line costs a single test of the debug level while tracing is turned
+   off.  Otherwise the trace lines are compiled away, while the compiler still checks the
+   arguments against the format.
+*/
 
-/* assign to this dummy value to eliminate "statement has no effect" warnings */
-extern int swallow_rc;
+#ifdef TPM_DEBUG
 
-/* redefine printf to null */
-#define printf swallow_rc = swallow_rc && tpm_swallow_printf_args
-#define TPM_PrintFour(arg1, arg2)
+#define printf(...)						\
+    do {							\
+	if (tpmlib_debug_level != 0) {				\
+	    TPMLIB_LogPrintf(__VA_ARGS__);			\
+	}							\
+    } while (0)
 
-#endif  /* TPM_DEBUG */
-#endif
+#else	/* TPM_DEBUG */
+
+#define printf(...)						\
+    do {							\
+	if (0) {						\
+	    TPMLIB_LogPrintf(__VA_ARGS__);			\
+	}							\
+    } while (0)
+
+#define TPM_PrintFour(...)					\
+    do {							\
+	if (0) {						\
+	    TPM_PrintFour(__VA_ARGS__);				\
+	}							\
+    } while (0)
+
+#define TPM_PrintAll(...)					\
+    do {							\
+	if (0) {						\
+	    TPM_PrintAll(__VA_ARGS__);				\
+	}							\
+    } while (0)
 
-#define printf(...) TPMLIB_LogPrintf(__VA_ARGS__);
+#endif	/* TPM_DEBUG */
 
 #endif
@@ -536,6 +536,7 @@ TPM_RESULT TPM_Delegations_CheckPermission(tpm_state_t *tpm_state,
     if (rc == 0) {
 	rc = TPM_PCRInfoShort_CheckDigest(&(delegatePublic->pcrInfo),
 					  tpm_state->tpm_stclear_data.PCRS,
+					  &(tpm_state->tpm_stclear_data.pcrDigestCache),
 					  tpm_state->tpm_stany_flags.localityModifier);
     }
     return rc;
@@ -39,8 +39,10 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "tpm_crypto.h"
+#include "tpm_daa.h"
 #include "tpm_debug.h"
 #include "tpm_digest.h"
 #include "tpm_error.h"
@@ -60,6 +62,33 @@
 /* state for the TPM's */
 tpm_state_t *tpm_instances[TPMS_MAX];
 
+/* one lock per entry in tpm_instances[].  The lock is held while the entry is created, deleted,
+   or used, so that commands to the same TPM are serialized while different TPM's can process
+   commands concurrently.  The locks are never destroyed, so they remain valid while an entry
+   changes. */
+static pthread_mutex_t tpm_instances_lock[TPMS_MAX] = {
+    [0 ... TPMS_MAX - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+/* TPM_Global_Lock() acquires the lock for the entry 'tpm_number' in tpm_instances[].
+
+   The caller must have checked that 'tpm_number' is less than TPMS_MAX.
+*/
+
+void TPM_Global_Lock(uint32_t tpm_number)
+{
+    pthread_mutex_lock(&tpm_instances_lock[tpm_number]);
+    return;
+}
+
+/* TPM_Global_Unlock() releases the lock acquired by TPM_Global_Lock() */
+
+void TPM_Global_Unlock(uint32_t tpm_number)
+{
+    pthread_mutex_unlock(&tpm_instances_lock[tpm_number]);
+    return;
+}
+
 /* TPM_Global_Init initializes the tpm_state to default values.
 
    It does not load any data from or store data to NVRAM
@@ -105,6 +134,9 @@ TPM_RESULT TPM_Global_Init(tpm_state_t *tpm_state)
     if (rc == 0) {
         printf("TPM_Global_Init: Initializing TPM_KEY_HANDLE_LIST\n");
         TPM_KeyHandleEntries_Init(tpm_state->tpm_key_handle_entries);
+	tpm_state->keyUseCount = 0;
+	TPM_KeyCache_Init(&(tpm_state->tpm_key_cache));
+	TPM_DAABaseCache_Init(&(tpm_state->tpm_daa_base_cache));
 	/* initialize the SHA1 thread context */
 	tpm_state->sha1_context = NULL;
 	/* initialize the TIS SHA1 thread context */
@@ -112,6 +144,10 @@ TPM_RESULT TPM_Global_Init(tpm_state_t *tpm_state)
 	tpm_state->transportHandle = 0;
         printf("TPM_Global_Init: Initializing TPM_NV_INDEX_ENTRIES\n");
 	TPM_NVIndexEntries_Init(&(tpm_state->tpm_nv_index_entries));
+	TPM_Sbuffer_Init(&(tpm_state->permanentAllImage));
+	TPM_VolatileSchedule_Init(&(tpm_state->volatileSchedule));
+	tpm_state->volatileSnapshot.generation = 0;
+	TPM_Sbuffer_Init(&(tpm_state->volatileSnapshot.image));
     }
     /* comes up in limited operation mode */
     /* shutdown is set on a self test failure, before calling TPM_Global_Init() */
@@ -196,10 +232,14 @@ void TPM_Global_Delete(tpm_state_t *tpm_state)
 	TPM_StanyData_Delete(&(tpm_state->tpm_stany_data));
 	printf("  TPM_Global_Delete: Deleting key handle entries\n");
 	TPM_KeyHandleEntries_Delete(tpm_state->tpm_key_handle_entries);
+	TPM_KeyCache_Delete(&(tpm_state->tpm_key_cache));
+	TPM_DAABaseCache_Delete(&(tpm_state->tpm_daa_base_cache));
 	printf("  TPM_Global_Delete: Deleting SHA1 contexts\n");
 	TPM_SHA1Delete(&(tpm_state->sha1_context));
 	TPM_SHA1Delete(&(tpm_state->sha1_context_tis));
 	TPM_NVIndexEntries_Delete(&(tpm_state->tpm_nv_index_entries));
+	TPM_Sbuffer_Delete(&(tpm_state->permanentAllImage));
+	TPM_Sbuffer_Delete(&(tpm_state->volatileSnapshot.image));
     }
     return;
 }
@@ -48,6 +48,38 @@
 #define TPM_TEST_STATE_FULL     2       /* full operation mode */
 #define TPM_TEST_STATE_FAILURE  3       /* failure mode */
 
+/* Policies for saving the volatile state to NVRAM, set with TPM_VolatileSchedule_Set() */
+
+#define TPM_VOLATILE_SCHEDULE_ONDEMAND  0       /* only when requested */
+#define TPM_VOLATILE_SCHEDULE_COMMANDS  1       /* after every 'value' commands */
+#define TPM_VOLATILE_SCHEDULE_IDLE      2       /* after 'value' milliseconds without a command */
+#define TPM_VOLATILE_SCHEDULE_CHANGED   3       /* after each command */
+
+/* The schedule decides when the volatile state is saved.  Commands known not to change the
+   volatile state do not set 'dirty', and a scheduled save is skipped unless it is set.  A save
+   whose serialization has the digest of the saved one does not write NVRAM. */
+
+typedef struct tdTPM_VOLATILE_SCHEDULE {
+    uint32_t policy;            /* TPM_VOLATILE_SCHEDULE_* */
+    uint32_t value;             /* number of commands or milliseconds, depending on the policy */
+    uint32_t commands;          /* commands since the volatile state was saved */
+    TPM_BOOL dirty;             /* the volatile state may differ from the saved one */
+    TPM_BOOL digestValid;       /* TRUE if storedDigest is known */
+    TPM_DIGEST storedDigest;    /* integrity digest of the saved volatile state */
+} TPM_VOLATILE_SCHEDULE;
+
+/* The last snapshot of the volatile state taken by TPM_VolatileAll_StoreDelta(), which the next
+   delta is computed against.  The stream is compared section by section, so that a section that
+   changes its length does not shift the following ones. */
+
+#define TPM_VOLATILE_SECTIONS   9       /* sections of the serialized volatile state */
+
+typedef struct tdTPM_VOLATILE_SNAPSHOT {
+    uint32_t generation;                        /* of the snapshot, 0 if there is none */
+    TPM_STORE_BUFFER image;                     /* the serialized volatile state */
+    uint32_t sections[TPM_VOLATILE_SECTIONS];   /* end offsets of its sections */
+} TPM_VOLATILE_SNAPSHOT;
+
 typedef struct tdTPM_STATE
 {
     /* the number of the virtual TPM */
@@ -64,8 +96,14 @@ typedef struct tdTPM_STATE
     TPM_STCLEAR_DATA tpm_stclear_data;
     /* 7.6 TPM_STANY_DATA  */
     TPM_STANY_DATA tpm_stany_data;
-    /* 5.6 TPM_KEY_HANDLE_ENTRY */
-    TPM_KEY_HANDLE_ENTRY tpm_key_handle_entries[TPM_KEY_HANDLES];
+    /* 5.6 TPM_KEY_HANDLE_ENTRY, the key slots followed by the swap entries */
+    TPM_KEY_HANDLE_ENTRY tpm_key_handle_entries[TPM_KEY_TABLE_ENTRIES];
+    /* incremented at each use of a key, orders the key slots for swapping */
+    uint32_t keyUseCount;
+    /* decrypted key blobs of recently loaded keys, not saved */
+    TPM_KEY_CACHE tpm_key_cache;
+    /* DAA issuer moduli and base powers of recent DAA sessions, not saved */
+    TPM_DAA_BASE_CACHE tpm_daa_base_cache;
     /* Context for SHA1 functions */
     void *sha1_context;
     void *sha1_context_tis;
@@ -77,6 +115,14 @@ typedef struct tdTPM_STATE
        have been read.  The index not being present indicates that some volatile fields should be
        cleared at first read. */
     TPM_NV_INDEX_ENTRIES tpm_nv_index_entries;
+    /* The TPM_PERMANENT_ALL_NAME data as last stored to or loaded from NVRAM.  The next store
+       only writes the bytes that differ, and a roll back restores from it instead of reading
+       NVRAM.  Empty if the NVRAM content is unknown. */
+    TPM_STORE_BUFFER permanentAllImage;
+    /* when the volatile state is saved to NVRAM, not saved */
+    TPM_VOLATILE_SCHEDULE volatileSchedule;
+    /* the last snapshot of the volatile state for computing deltas, not saved */
+    TPM_VOLATILE_SNAPSHOT volatileSnapshot;
     /* NOTE: members added here should be initialized by TPM_Global_Init() and possibly added to
        TPM_SaveState_Load() and TPM_SaveState_Store() */
 } tpm_state_t;
@@ -94,6 +140,9 @@ TPM_RESULT TPM_Global_Load(tpm_state_t *tpm_state);
 TPM_RESULT TPM_Global_Store(tpm_state_t *tpm_state);
 void       TPM_Global_Delete(tpm_state_t *tpm_state);
 
+void       TPM_Global_Lock(uint32_t tpm_number);
+void       TPM_Global_Unlock(uint32_t tpm_number);
+
 
 TPM_RESULT TPM_Global_GetPhysicalPresence(TPM_BOOL *physicalPresence,
                                           const tpm_state_t *tpm_state);
@@ -1343,6 +1343,7 @@ TPM_RESULT TPM_Process_ActivateIdentity(tpm_state_t *tpm_state,
 		returnCode =
 		    TPM_PCRInfoShort_CheckDigest(&(a1.pcrInfo),
 						 tpm_state->tpm_stclear_data.PCRS, /* PCR array */
+						 &(tpm_state->tpm_stclear_data.pcrDigestCache),
 						 tpm_state->tpm_stany_flags.localityModifier);
 	    }
 	}
@@ -70,6 +70,10 @@
 
 static TPM_RESULT TPM_CheckTypes(void);
 
+/* the result of the self tests common to all TPM's, applied to each new instance */
+
+static TPM_RESULT commonTestRc = 0;
+
 
 /* TPM_Init transitions the TPM from a power-off state to one where the TPM begins an initialization
    process.  TPM_Init could be the result of power being applied to the platform or a hard reset.
@@ -87,7 +91,9 @@ static TPM_RESULT TPM_CheckTypes(void);
                 TPM_Crypto_Init() - initializes cryptographic libraries
                 TPM_NVRAM_Init() - get NVRAM path once
                 TPM_LimitedSelfTest() - as per the specification
-                TPM_Global_Init() - initializes the TPM state
+                TPM_InstanceInit() - initializes the state of TPM 0
+
+   Further virtual TPM's are created with TPM_InstanceInit() after TPM_MainInit() has completed.
 
    Returns: 0 on success
 
@@ -100,16 +106,16 @@ static TPM_RESULT TPM_CheckTypes(void);
 TPM_RESULT TPM_MainInit(void)
 {
     TPM_RESULT  rc = 0;         /* results for common code, fatal errors */
-    uint32_t    i;
-    TPM_RESULT  testRc = 0;     /* temporary place to hold common self tests failure before the tpm
-                                   state is created */
-    tpm_state_t *tpm_state;     /* TPM instance state */
 
-    tpm_state = NULL;           /* freed @1 */
     /* preliminary check that platform specific sizes are correct */
     if (rc == 0) {
         rc = TPM_CheckTypes();
     }
+    /* build the ordinal index used to dispatch commands */
+    if (rc == 0) {
+        printf("TPM_MainInit: Initialize the ordinal table\n");
+        rc = TPM_OrdinalTable_Init();
+    }
     /* initialize the TPM to host interface */
     if (rc == 0) {
         printf("TPM_MainInit: Initialize the TPM to host interface\n");
@@ -130,91 +136,177 @@ TPM_RESULT TPM_MainInit(void)
     if (rc == 0) {
         printf("TPM_MainInit: Run common limited self tests\n");
         /* an error is a fatal error, causes a shutdown of the TPM */
-        testRc = TPM_LimitedSelfTestCommon();
+        commonTestRc = TPM_LimitedSelfTestCommon();
     }   
-    /* initialize the global structure for the TPM */
-    for (i = 0 ; (rc == 0) && (i < TPMS_MAX) ; i++) {
-        printf("TPM_MainInit: Initializing global TPM %lu\n", (unsigned long)i);
-        /* Need to malloc and init a TPM state if this is the first time through or if the
-           state was saved in the array.  Otherwise, the malloc'ed structure from the previous
-           time through the loop can be reused. */
-        if ((rc == 0) && (tpm_state == NULL)) {
-            if (rc == 0) {
-                rc = TPM_Malloc((unsigned char **)&tpm_state, sizeof(tpm_state_t));
-            }
-            /* initialize the global instance state */
-            if (rc == 0) {
-                rc = TPM_Global_Init(tpm_state);                /* freed @2 */
-            }
-        }
-        if (rc == 0) {
-            /* record the TPM number in the state */
-            tpm_state->tpm_number = i;
-            /* If the instance exists in NVRAM, it it initialized and saved in the tpm_instances[]
-               array. Restores TPM_PERMANENT_FLAGS and TPM_PERMANENT_DATA to in-memory
-               structures. */
-            /* Returns TPM_RETRY on non-existent file */
-            rc = TPM_PermanentAll_NVLoad(tpm_state);
+    /* initialize the global structure for TPM 0 */
+    if (rc == 0) {
+        rc = TPM_InstanceInit(0);
+    }
+    return rc;
+}
+
+/* TPM_InstanceInit() creates the virtual TPM 'tpm_number' and saves it in the tpm_instances[]
+   array.
+
+   If the instance exists in NVRAM, its state is loaded.  Otherwise the state is created with
+   default values and stored in NVRAM.
+
+   TPM_MainInit() must have been called before, since the common self test result is applied to
+   each new instance.
+
+   Returns: 0 on success
+
+            TPM_BAD_PARAMETER if 'tpm_number' is out of range or the instance already exists
+
+            non-zero on a fatal error where the instance could not be created
+*/
+
+TPM_RESULT TPM_InstanceInit(uint32_t tpm_number)
+{
+    TPM_RESULT  rc = 0;         /* fatal errors */
+    TPM_RESULT  rc1;            /* NVRAM commit */
+    TPM_RESULT  testRc = 0;     /* self test failure for this instance */
+    tpm_state_t *tpm_state;     /* TPM instance state */
+    TPM_BOOL    locked = FALSE; /* the instance lock is held */
+
+    printf("TPM_InstanceInit: Initializing global TPM %lu\n", (unsigned long)tpm_number);
+    tpm_state = NULL;           /* freed @1 */
+    if (rc == 0) {
+        if (tpm_number >= TPMS_MAX) {
+            printf("TPM_InstanceInit: Error, TPM %lu exceeds maximum %u\n",
+                   (unsigned long)tpm_number, TPMS_MAX);
+            rc = TPM_BAD_PARAMETER;
         }
-        /* If there was no state for TPM 0 (instance 0 does not exist), initialize state for the
-           first time using TPM_Global_Init() above.  It is created and set to default values.  */
-        if ((rc == TPM_RETRY) && (i == 0)) {
-            /* save the state for TPM 0 (first time through) */
-            rc = TPM_PermanentAll_NVStore(tpm_state,
-					  TRUE,		/* write NV */
-					  0);		/* no roll back */
+    }
+    /* serialize against commands and other creations or deletions of this instance */
+    if (rc == 0) {
+        TPM_Global_Lock(tpm_number);                    /* unlocked @3 */
+        locked = TRUE;
+    }
+    if (rc == 0) {
+        if (tpm_instances[tpm_number] != NULL) {
+            printf("TPM_InstanceInit: Error, TPM %lu already exists\n",
+                   (unsigned long)tpm_number);
+            rc = TPM_BAD_PARAMETER;
         }
+    }
+    /* complete or discard NVRAM writes that were interrupted by a crash */
+    if (rc == 0) {
+        rc = TPM_NVRAM_Recover(tpm_number);
+    }
+    if (rc == 0) {
+        TPM_NVRAM_Begin(tpm_number);
+        rc = TPM_Malloc((unsigned char **)&tpm_state, sizeof(tpm_state_t));
+    }
+    /* initialize the global instance state */
+    if (rc == 0) {
+        rc = TPM_Global_Init(tpm_state);                /* freed @2 */
+    }
+    if (rc == 0) {
+        /* record the TPM number in the state */
+        tpm_state->tpm_number = tpm_number;
+        /* If the instance exists in NVRAM, it it initialized and saved in the tpm_instances[]
+           array. Restores TPM_PERMANENT_FLAGS and TPM_PERMANENT_DATA to in-memory
+           structures. */
+        /* Returns TPM_RETRY on non-existent file */
+        rc = TPM_PermanentAll_NVLoad(tpm_state);
+    }
+    /* If there was no state for the TPM (the instance does not exist), initialize state for the
+       first time using TPM_Global_Init() above.  It is created and set to default values.  */
+    if (rc == TPM_RETRY) {
+        /* save the state for the TPM (first time through) */
+        rc = TPM_PermanentAll_NVStore(tpm_state,
+                                      TRUE,		/* write NV */
+                                      0);		/* no roll back */
+    }
 #ifdef TPM_VOLATILE_LOAD
-	/* if volatile state exists at startup, load it.  This is used for fail-over restart. */
-	if (rc == 0) {
-	    rc = TPM_VolatileAll_NVLoad(tpm_state);
-	}
+    /* if volatile state exists at startup, load it.  This is used for fail-over restart. */
+    if (rc == 0) {
+        rc = TPM_VolatileAll_NVLoad(tpm_state);
+    }
 #endif	/* TPM_VOLATILE_LOAD */
-        /* if permanent state was loaded successfully (or stored successfully for TPM 0 the first
-           time) */
-        if (rc == 0) {
-            printf("TPM_MainInit: Creating global TPM instance %lu\n", (unsigned long)i);
-            /* set the testState for the TPM based on the common selftest result */
+    /* if permanent state was loaded successfully (or stored successfully the first time) */
+    if (rc == 0) {
+        printf("TPM_InstanceInit: Creating global TPM instance %lu\n",
+               (unsigned long)tpm_number);
+        /* set the testState for the TPM based on the common selftest result */
+        if (commonTestRc != 0) {
+            /* a. When the TPM detects a failure during any self-test, it SHOULD delete values
+               preserved by TPM_SaveState. */
+            TPM_SaveState_NVDelete(tpm_state,
+                                   FALSE);        /* ignore error if the state does not exist */
+            printf("  TPM_InstanceInit: Set testState to %u \n", TPM_TEST_STATE_FAILURE);
+            tpm_state->testState = TPM_TEST_STATE_FAILURE;
+        }
+        /* run individual self test on the TPM */
+        else {
+            printf("TPM_InstanceInit: Run limited self tests on TPM %lu\n",
+                   (unsigned long)tpm_number);
+            testRc = TPM_LimitedSelfTestTPM(tpm_state);
             if (testRc != 0) {
                 /* a. When the TPM detects a failure during any self-test, it SHOULD delete values
                    preserved by TPM_SaveState. */
                 TPM_SaveState_NVDelete(tpm_state,
-                                       FALSE);        /* ignore error if the state does not exist */
-		printf("  TPM_MainInit: Set testState to %u \n", TPM_TEST_STATE_FAILURE);
-                tpm_state->testState = TPM_TEST_STATE_FAILURE;
+                                       FALSE);    /* ignore error if the state does not exist */
             }
-            /* save state in array */
-            tpm_instances[i] = tpm_state;
-            tpm_state = NULL;   /* flag that the malloc'ed structure was used.  It should not be
-                                   freed, and a new instance is needed the next time through the
-                                   loop */
         }
-        /* If there was the non-fatal error TPM_RETRY, the instance does not exist.  If instance > 0
-           does not exist, the array entry is set to NULL.  Continue */
-        else if (rc == TPM_RETRY) {
-            printf("TPM_MainInit: Not Creating global TPM %lu\n", (unsigned long)i);
-            tpm_instances[i] = NULL;    /* flag that the instance does not exist */
-            rc = 0;                     /* Instance does not exist, not fatal error */
+        /* save state in array */
+        tpm_instances[tpm_number] = tpm_state;
+        tpm_state = NULL;       /* flag that the malloc'ed structure was used.  It should not be
+                                   freed */
+    }
+    /* make the NVRAM writes of the initialization durable.  If that fails, the instance is not
+       created. */
+    if (locked) {
+        rc1 = TPM_NVRAM_Commit(tpm_number);
+        if ((rc == 0) && (rc1 != 0)) {
+            tpm_state = tpm_instances[tpm_number];
+            tpm_instances[tpm_number] = NULL;
+            rc = rc1;
         }
     }
-   /* run individual self test on a TPM */
-    for (i = 0 ;
-         (rc == 0) && (i < TPMS_MAX) && (tpm_instances[i] != NULL) &&
-             (tpm_instances[i]->testState != TPM_TEST_STATE_FAILURE) ;  /* don't continue if already
-                                                                           error */
-         i++) {
-        printf("TPM_MainInit: Run limited self tests on TPM %lu\n", (unsigned long)i);
-        testRc = TPM_LimitedSelfTestTPM(tpm_instances[i]);
-        if (testRc != 0) {
-            /* a. When the TPM detects a failure during any self-test, it SHOULD delete values
-               preserved by TPM_SaveState. */
-            TPM_SaveState_NVDelete(tpm_state,
-                                   FALSE);        /* ignore error if the state does not exist */
-        }
-    }
-    /* the _Delete(), free() clean up if the last created instance was not required */
+    /* the _Delete(), free() clean up if the instance was not created */
     TPM_Global_Delete(tpm_state); 	/* @2 */
     free(tpm_state);                    /* @1 */
+    if (locked) {
+        TPM_Global_Unlock(tpm_number);  /* @3 */
+    }
+    return rc;
+}
+
+/* TPM_InstanceDelete() deletes the in-memory state of the virtual TPM 'tpm_number' and removes it
+   from the tpm_instances[] array.
+
+   The NVRAM state of the instance is not affected.  A command being processed by the instance
+   completes before the instance is deleted.
+
+   Returns: 0 on success
+
+            TPM_BAD_PARAMETER if 'tpm_number' is out of range or the instance does not exist
+*/
+
+TPM_RESULT TPM_InstanceDelete(uint32_t tpm_number)
+{
+    TPM_RESULT  rc = 0;
+
+    printf("TPM_InstanceDelete: Deleting global TPM %lu\n", (unsigned long)tpm_number);
+    if (tpm_number >= TPMS_MAX) {
+        rc = TPM_BAD_PARAMETER;
+    }
+    if (rc == 0) {
+        /* waits for a command in progress on the instance to complete */
+        TPM_Global_Lock(tpm_number);
+        if (tpm_instances[tpm_number] != NULL) {
+            TPM_Global_Delete(tpm_instances[tpm_number]);
+            free(tpm_instances[tpm_number]);
+            tpm_instances[tpm_number] = NULL;
+            TPM_NVRAM_Close(tpm_number);
+        }
+        else {
+            rc = TPM_BAD_PARAMETER;
+        }
+        TPM_Global_Unlock(tpm_number);
+    }
     return rc;
 }
 
@@ -621,6 +713,7 @@ void TPM_StclearData_Init(TPM_STCLEAR_DATA *tpm_stclear_data,
         printf("TPM_StclearData_Init: Initializing PCR's\n");
         TPM_PCRs_Init(tpm_stclear_data->PCRS, pcrAttrib);
     }
+    TPM_PCRDigestCache_Init(&(tpm_stclear_data->pcrDigestCache));
 #if  (TPM_REVISION >= 103)      /* added for rev 103 */
     tpm_stclear_data->deferredPhysicalPresence = 0;
 #endif
@@ -689,6 +782,8 @@ TPM_RESULT TPM_StclearData_Load(TPM_STCLEAR_DATA *tpm_stclear_data,
     if (rc == 0) {
         rc = TPM_PCRs_Load(tpm_stclear_data->PCRS, pcrAttrib, stream, stream_size);
     }
+    /* the loaded PCR's invalidate the cached PCR composite hashes */
+    TPM_PCRDigestCache_Init(&(tpm_stclear_data->pcrDigestCache));
 #if  (TPM_REVISION >= 103)      /* added for rev 103 */
     /* load deferredPhysicalPresence */
     if (rc == 0) {
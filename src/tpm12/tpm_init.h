@@ -47,6 +47,10 @@
 /* Power up initialization */
 TPM_RESULT TPM_MainInit(void);
 
+/* virtual TPM instances */
+TPM_RESULT TPM_InstanceInit(uint32_t tpm_number);
+TPM_RESULT TPM_InstanceDelete(uint32_t tpm_number);
+
 /*
   TPM_STANY_FLAGS
 */
@@ -73,6 +73,33 @@ unsigned char tpm_default_rsa_exponent[] = {0x01, 0x00, 0x01};
 /* local prototypes */
 
 static TPM_RESULT TPM_Key_CheckTag(TPM_KEY12 *tpm_key12);
+static void TPM_KeyHandleEntries_Find(TPM_BOOL *found,
+				      TPM_KEY_HANDLE_ENTRY **tpm_key_handle_entry,
+				      TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+				      TPM_KEY_HANDLE tpm_key_handle,
+				      uint32_t first,
+				      uint32_t count);
+static void TPM_KeyHandleEntries_GetFree(TPM_BOOL *isSpace,
+					 uint32_t *index,
+					 const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+					 TPM_KEY_HANDLE tpm_key_handle,
+					 uint32_t first,
+					 uint32_t count);
+static void TPM_KeyHandleEntries_GetLeastRecent(TPM_BOOL *found,
+						uint32_t *index,
+						const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
+static TPM_RESULT TPM_KeyHandleEntries_GetSlot(uint32_t *index,
+					       TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+					       TPM_KEY_HANDLE tpm_key_handle);
+static void TPM_KeyHandleEntries_SwapIn(TPM_KEY_HANDLE_ENTRY **tpm_key_handle_entry,
+					TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
+static TPM_RESULT TPM_Key_GenerateCacheDigest(TPM_DIGEST keyDigest,
+					      TPM_KEY *tpm_key,
+					      TPM_KEY *parent_key);
+static TPM_RESULT TPM_Key_LoadStoreAsymKeyCache(TPM_KEY *tpm_key,
+						TPM_KEY_CACHE_ENTRY *tpm_key_cache_entry);
+static void TPM_KeyCacheEntry_Init(TPM_KEY_CACHE_ENTRY *tpm_key_cache_entry);
+static void TPM_KeyCacheEntry_Delete(TPM_KEY_CACHE_ENTRY *tpm_key_cache_entry);
 
 /*
   TPM_KEY, TPM_KEY12
@@ -962,6 +989,46 @@ TPM_RESULT TPM_Key_GetPrivateKey(uint32_t	*dbytes,
     return rc;
 }
 
+/* TPM_Key_GetRSAKeyToken() gets the crypto library private key token of a TPM_KEY.
+
+   The token is built from the TPM_STORE_ASYMKEY on first use and then kept until the private key
+   is deleted, when the key is flushed or evicted.
+ */
+
+TPM_RESULT TPM_Key_GetRSAKeyToken(TPM_RSA_KEY_TOKEN *rsa_key_token,
+				  TPM_KEY *tpm_key)
+{
+    TPM_RESULT		rc = 0;
+    TPM_STORE_ASYMKEY	*tpm_store_asymkey;
+    unsigned char	*earr;		/* public exponent */
+    uint32_t		ebytes;
+    
+    printf(" TPM_Key_GetRSAKeyToken:\n");
+    if (rc == 0) {
+	rc = TPM_Key_GetStoreAsymkey(&tpm_store_asymkey, tpm_key);
+    }
+    if ((rc == 0) && (tpm_store_asymkey->privKey.rsa_key_token == NULL)) {
+	rc = TPM_Key_GetExponent(&ebytes, &earr, tpm_key);
+	if (rc == 0) {
+	    rc = TPM_RSAKeyToken_New(&(tpm_store_asymkey->privKey.rsa_key_token),
+				     tpm_key->pubKey.buffer,
+				     tpm_key->pubKey.size,
+				     earr,
+				     ebytes,
+				     tpm_store_asymkey->privKey.d_key.buffer,
+				     tpm_store_asymkey->privKey.d_key.size,
+				     tpm_store_asymkey->privKey.p_key.buffer,
+				     tpm_store_asymkey->privKey.p_key.size,
+				     tpm_store_asymkey->privKey.q_key.buffer,
+				     tpm_store_asymkey->privKey.q_key.size);
+	}
+    }
+    if (rc == 0) {
+	*rsa_key_token = tpm_store_asymkey->privKey.rsa_key_token;
+    }
+    return rc;
+}
+
 /* TPM_Key_GetExponent() gets the exponent key from the TPM_RSA_KEY_PARMS contained in a TPM_KEY
  */
 
@@ -1087,13 +1154,13 @@ TPM_RESULT TPM_Key_GenerateRSA(TPM_KEY *tpm_key,		/* output created key */
     }
     /* generate the key pair */
     if (rc == 0) {
-	rc = TPM_RSAGenerateKeyPair(&n,		/* public key (modulus) freed @3 */
-				    &p,		/* private prime factor freed @4 */
-				    &q,		/* private prime factor freed @5 */
-				    &d,		/* private key (private exponent) freed @6 */
-				    tpm_rsa_key_parms->keyLength,	/* key size in bits */
-				    earr,	/* public exponent */
-				    ebytes);
+	rc = TPM_RSAKeyPool_GenerateKeyPair(&n,	/* public key (modulus) freed @3 */
+					    &p,	/* private prime factor freed @4 */
+					    &q,	/* private prime factor freed @5 */
+					    &d,	/* private key (private exponent) freed @6 */
+					    tpm_rsa_key_parms->keyLength, /* key size in bits */
+					    earr,	/* public exponent */
+					    ebytes);
     }
     /* construct the TPM_STORE_ASYMKEY member */
     if (rc == 0) {
@@ -1287,20 +1354,37 @@ TPM_RESULT TPM_Key_GenerateEncData(TPM_KEY *tpm_key,
 /* TPM_Key_DecryptEncData() decrypts the TPM_KEY -> encData using the parent private key.  The
    result is deserialized and stored in the TPM_KEY -> TPM_STORE_ASYMKEY cache.
 
+   If 'tpm_key_cache' is not NULL, a key blob that was loaded before under the same parent is taken
+   from the cache, without decrypting encData or recalculating the private key.  Otherwise, the
+   decrypted encData is added to the cache.  The caller must still do all checks on the result.
 */
 
 TPM_RESULT TPM_Key_DecryptEncData(TPM_KEY *tpm_key,	/* result */
-				  TPM_KEY *parent_key)	/* parent for decrypting encData */
+				  TPM_KEY *parent_key,	/* parent for decrypting encData */
+				  TPM_KEY_CACHE *tpm_key_cache)
 {
     TPM_RESULT		rc = 0;
     unsigned char	*decryptData = NULL;	/* freed @1 */
     uint32_t		decryptDataLength = 0;	/* actual valid data */
     unsigned char	*stream;
     uint32_t		stream_size;
+    TPM_DIGEST		keyDigest;
+    TPM_KEY_CACHE_ENTRY	*tpm_key_cache_entry = NULL;
 
     printf(" TPM_Key_DecryptEncData\n");
+    /* look for the key blob in the cache */
+    if ((rc == 0) && (tpm_key_cache != NULL)) {
+	rc = TPM_Key_GenerateCacheDigest(keyDigest, tpm_key, parent_key);
+    }
+    if ((rc == 0) && (tpm_key_cache != NULL)) {
+	TPM_KeyCache_Find(&tpm_key_cache_entry, tpm_key_cache, keyDigest);
+    }
+    /* if found, load the TPM_STORE_ASYMKEY cache from the cached clear text */
+    if ((rc == 0) && (tpm_key_cache_entry != NULL)) {
+	rc = TPM_Key_LoadStoreAsymKeyCache(tpm_key, tpm_key_cache_entry);
+    }
     /* allocate space for the decrypted data */
-    if (rc == 0) {
+    if ((rc == 0) && (tpm_key_cache_entry == NULL)) {
 	rc = TPM_RSAPrivateDecryptMalloc(&decryptData,			/* decrypted data */
 					 &decryptDataLength,		/* actual size of decrypted
 									   data */
@@ -1309,15 +1393,93 @@ TPM_RESULT TPM_Key_DecryptEncData(TPM_KEY *tpm_key,	/* result */
 					 parent_key);
     }
     /* load the TPM_STORE_ASYMKEY cache from the 'encData' member stream */
-    if (rc == 0) {
+    if ((rc == 0) && (tpm_key_cache_entry == NULL)) {
 	stream = decryptData;
 	stream_size = decryptDataLength;
 	rc = TPM_Key_LoadStoreAsymKey(tpm_key, FALSE, &stream, &stream_size);
     }
+    /* save the decrypted data and the calculated private key for the next load */
+    if ((rc == 0) && (tpm_key_cache_entry == NULL) && (tpm_key_cache != NULL)) {
+	rc = TPM_KeyCache_Add(tpm_key_cache, keyDigest,
+			      decryptData, decryptDataLength,
+			      tpm_key->tpm_store_asymkey);
+    }
     free(decryptData);		/* @1 */
     return rc;
 }
 
+/* TPM_Key_GenerateCacheDigest() generates the TPM_KEY_CACHE digest of 'tpm_key' loaded under
+   'parent_key'.
+
+   The digest covers the public part of the key as well as encData, since the private key is
+   calculated from both.
+*/
+
+static TPM_RESULT TPM_Key_GenerateCacheDigest(TPM_DIGEST keyDigest,
+					      TPM_KEY *tpm_key,
+					      TPM_KEY *parent_key)
+{
+    TPM_RESULT		rc = 0;
+    TPM_DIGEST		blobDigest;
+
+    printf(" TPM_Key_GenerateCacheDigest:\n");
+    if (rc == 0) {
+	rc = TPM_SHA1_GenerateStructure(blobDigest, tpm_key,
+					(TPM_STORE_FUNCTION_T)TPM_Key_Store);
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1(keyDigest,
+		      parent_key->pubKey.size, parent_key->pubKey.buffer,
+		      TPM_DIGEST_SIZE, blobDigest,
+		      0, NULL);
+    }
+    return rc;
+}
+
+/* TPM_Key_LoadStoreAsymKeyCache() is TPM_Key_LoadStoreAsymKey() for a TPM_KEY_CACHE entry.  The
+   private key is copied from the entry rather than calculated.
+*/
+
+static TPM_RESULT TPM_Key_LoadStoreAsymKeyCache(TPM_KEY *tpm_key,
+						TPM_KEY_CACHE_ENTRY *tpm_key_cache_entry)
+{
+    TPM_RESULT		rc = 0;
+    unsigned char	*stream;
+    uint32_t		stream_size;
+
+    printf(" TPM_Key_LoadStoreAsymKeyCache:\n");
+    if (rc == 0) {
+	if (tpm_key->tpm_store_asymkey != NULL) {
+	    printf("TPM_Key_LoadStoreAsymKeyCache: Error (fatal), "
+		   "TPM_STORE_ASYMKEY already loaded\n");
+	    rc = TPM_FAIL;	/* should never occur */
+	}
+    }
+    /* allocate memory for the structure */
+    if (rc == 0) {
+	rc = TPM_Malloc((unsigned char **)&(tpm_key->tpm_store_asymkey),
+			sizeof(TPM_STORE_ASYMKEY));
+    }
+    /* deserialize without converting prime factor p to the private key */
+    if (rc == 0) {
+	TPM_StoreAsymkey_Init(tpm_key->tpm_store_asymkey);
+	stream = tpm_key_cache_entry->clearData.buffer;
+	stream_size = tpm_key_cache_entry->clearData.size;
+	rc = TPM_StoreAsymkey_Load(tpm_key->tpm_store_asymkey, FALSE,
+				   &stream, &stream_size,
+				   NULL, NULL);
+    }
+    if (rc == 0) {
+	rc = TPM_SizedBuffer_Copy(&(tpm_key->tpm_store_asymkey->privKey.q_key),
+				  &(tpm_key_cache_entry->q_key));
+    }
+    if (rc == 0) {
+	rc = TPM_SizedBuffer_Copy(&(tpm_key->tpm_store_asymkey->privKey.d_key),
+				  &(tpm_key_cache_entry->d_key));
+    }
+    return rc;
+}
+
 /* TPM_Key_GeneratePCRDigest() generates a digest based on the current PCR state and the PCR's
    specified with the key.
 
@@ -1341,7 +1503,8 @@ TPM_RESULT TPM_Key_CheckPCRDigest(TPM_KEY *tpm_key,
 	/* ii. Compare H1 to LK -> pcrInfo -> digestAtRelease on mismatch return TPM_WRONGPCRVAL */
 	if (rc == 0) {
 	    rc = TPM_PCRInfo_CheckDigest(tpm_key->tpm_pcr_info,
-					 tpm_state->tpm_stclear_data.PCRS);	/* array of PCR's */
+					 tpm_state->tpm_stclear_data.PCRS, /* array of PCR's */
+					 &(tpm_state->tpm_stclear_data.pcrDigestCache));
 	}
     }
     else {					/* TPM_KEY12 */
@@ -1351,6 +1514,7 @@ TPM_RESULT TPM_Key_CheckPCRDigest(TPM_KEY *tpm_key,
 	if (rc == 0) {
 	    rc = TPM_PCRInfoLong_CheckDigest(tpm_key->tpm_pcr_info_long,
 					     tpm_state->tpm_stclear_data.PCRS,	/* array of PCR's */
+					     &(tpm_state->tpm_stclear_data.pcrDigestCache),
 					     tpm_state->tpm_stany_flags.localityModifier);
 	}
     }
@@ -2613,6 +2777,7 @@ void TPM_StorePrivkey_Init(TPM_STORE_PRIVKEY *tpm_store_privkey)
     TPM_SizedBuffer_Init(&(tpm_store_privkey->d_key));
     TPM_SizedBuffer_Init(&(tpm_store_privkey->p_key));
     TPM_SizedBuffer_Init(&(tpm_store_privkey->q_key));
+    tpm_store_privkey->rsa_key_token = NULL;
     return;
 }
 
@@ -2663,6 +2828,8 @@ TPM_RESULT TPM_StorePrivkey_Convert(TPM_STORE_ASYMKEY *tpm_store_asymkey,	/* I/O
     if (rc == 0) {
 	rc = TPM_SizedBuffer_Set((&(tpm_store_asymkey->privKey.d_key)), dbytes, darr);
     }
+    /* a token built from the previous values is stale */
+    TPM_RSAKeyToken_Free(&(tpm_store_asymkey->privKey.rsa_key_token));
     free(qarr); /* @1 */
     free(darr); /* @2 */
     return rc;
@@ -2698,6 +2865,7 @@ void TPM_StorePrivkey_Delete(TPM_STORE_PRIVKEY *tpm_store_privkey)
 	TPM_SizedBuffer_Delete(&(tpm_store_privkey->d_key));
 	TPM_SizedBuffer_Delete(&(tpm_store_privkey->p_key));
 	TPM_SizedBuffer_Delete(&(tpm_store_privkey->q_key));
+	TPM_RSAKeyToken_Free(&(tpm_store_privkey->rsa_key_token));
 	TPM_StorePrivkey_Init(tpm_store_privkey);
     }
     return;
@@ -2992,6 +3160,7 @@ void TPM_KeyHandleEntry_Init(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entry)
     tpm_key_handle_entry->key = NULL;
     tpm_key_handle_entry->parentPCRStatus = TRUE;
     tpm_key_handle_entry->keyControl = 0;
+    tpm_key_handle_entry->lastUse = 0;
     return;
 }
 
@@ -3133,6 +3302,10 @@ TPM_RESULT TPM_KeyHandleEntry_FlushSpecific(tpm_state_t *tpm_state,
 
 /* TPM_KeyHandleEntries_Init() initializes the fixed TPM_KEY_HANDLE_ENTRY array.  All entries are
    emptied.  The keys are not deleted.
+
+   The array holds TPM_KEY_HANDLES key slots followed by TPM_KEY_SWAP_ENTRIES swap entries.  An
+   entry is placed near the index given by its handle within its part of the array, so that it is
+   usually found without a search.
 */
 
 void TPM_KeyHandleEntries_Init(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
@@ -3140,7 +3313,7 @@ void TPM_KeyHandleEntries_Init(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
     size_t i;
     
     printf(" TPM_KeyHandleEntries_Init:\n");
-    for (i = 0 ; i < TPM_KEY_HANDLES ; i++) {
+    for (i = 0 ; i < TPM_KEY_TABLE_ENTRIES ; i++) {
 	TPM_KeyHandleEntry_Init(&(tpm_key_handle_entries[i]));
     }
     return;
@@ -3155,7 +3328,7 @@ void TPM_KeyHandleEntries_Delete(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
     size_t i;
     
     printf(" TPM_KeyHandleEntries_Delete:\n");
-    for (i = 0 ; i < TPM_KEY_HANDLES ; i++) {
+    for (i = 0 ; i < TPM_KEY_TABLE_ENTRIES ; i++) {
 	TPM_KeyHandleEntry_Delete(&(tpm_key_handle_entries[i]));
     }
     return;
@@ -3172,27 +3345,44 @@ TPM_RESULT TPM_KeyHandleEntries_Load(tpm_state_t *tpm_state,
 				     uint32_t *stream_size)
 {
     TPM_RESULT			rc = 0;
+    TPM_STRUCTURE_TAG		tag;
     uint32_t			keyCount = 0;			/* keys to be saved */
+    uint32_t			keyMax = 0;			/* keys the version can hold */
     size_t			i;
     TPM_KEY_HANDLE_ENTRY	tpm_key_handle_entry;
+    TPM_KEY_HANDLE_ENTRY	*added_key_handle_entry;	/* the entry in the table */
 
-    /* check format tag */
-    /* In the future, if multiple formats are supported, this check will be replaced by a 'switch'
-       on the tag */
+    /* get tag */
     if (rc == 0) {
-	rc = TPM_CheckTag(TPM_TAG_KEY_HANDLE_ENTRIES_V1, stream, stream_size);
+	rc = TPM_Load16(&tag, stream, stream_size);
+    }
+    /* check tag, V1 holds at most the keys of the key slots */
+    if (rc == 0) {
+	printf("  TPM_KeyHandleEntries_Load: stream version %04hx\n", tag);
+	switch (tag) {
+	  case TPM_TAG_KEY_HANDLE_ENTRIES_V1:
+	    keyMax = TPM_KEY_HANDLES;
+	    break;
+	  case TPM_TAG_KEY_HANDLE_ENTRIES_V2:
+	    keyMax = TPM_KEY_TABLE_ENTRIES;
+	    break;
+	  default:
+	    printf("TPM_KeyHandleEntries_Load: Error (fatal), version %04x unsupported\n", tag);
+	    rc = TPM_FAIL;
+	    break;
+	}
     }
     /* get the count of keys in the stream */
     if (rc == 0) {
 	rc = TPM_Load32(&keyCount, stream, stream_size);
 	printf("  TPM_KeyHandleEntries_Load: %u keys to be loaded\n", keyCount);
     }
-    /* sanity check that keyCount not greater than key slots */
+    /* sanity check that keyCount not greater than the keys of the version */
     if (rc == 0) {
-	if (keyCount > TPM_KEY_HANDLES) {
+	if (keyCount > keyMax) {
 	    printf("TPM_KeyHandleEntries_Load: Error (fatal)"
-		   " key handles in stream %u greater than %d\n",
-		   keyCount, TPM_KEY_HANDLES);
+		   " key handles in stream %u greater than %u\n",
+		   keyCount, keyMax);
 	    rc = TPM_FAIL;
 	}
     }    
@@ -3214,6 +3404,15 @@ TPM_RESULT TPM_KeyHandleEntries_Load(tpm_state_t *tpm_state,
 					       tpm_state->tpm_key_handle_entries,
 					       &tpm_key_handle_entry);
 	}
+	/* mark the keys as used in stream order, so that a key stored later swaps out a key stored
+	   earlier */
+	if ((rc == 0) &&
+	    (TPM_KeyHandleEntries_GetEntry(&added_key_handle_entry,
+					   tpm_state->tpm_key_handle_entries,
+					   tpm_key_handle_entry.handle) == 0)) {
+	    tpm_state->keyUseCount++;
+	    added_key_handle_entry->lastUse = tpm_state->keyUseCount;
+	}
 	/* if there was an error copying the entry to the array, the entry must be delete'd to
 	   prevent a memory leak, since a key has been loaded to the entry */
 	if (rc != 0) {
@@ -3227,6 +3426,12 @@ TPM_RESULT TPM_KeyHandleEntries_Load(tpm_state_t *tpm_state,
    through TPM_KeyHandleEntries_Load().
 
    The two functions must be kept in sync.
+
+   The stream is TPM_TAG_KEY_HANDLE_ENTRIES_V1 if the keys fit into the key slots, else
+   TPM_TAG_KEY_HANDLE_ENTRIES_V2.  The swapped out keys are stored before the keys in the key
+   slots.  When the stream is loaded,
+   the keys stored last swap the keys stored first out again, so that the keys in the key slots
+   are again in the key slots.
 */
 
 TPM_RESULT TPM_KeyHandleEntries_Store(TPM_STORE_BUFFER *sbuffer,
@@ -3235,13 +3440,12 @@ TPM_RESULT TPM_KeyHandleEntries_Store(TPM_STORE_BUFFER *sbuffer,
     TPM_RESULT			rc = 0;
     size_t			start;		/* iterator though key handle entries */
     size_t			current;	/* iterator though key handle entries */
+    size_t			end;		/* end of the key handle entries to store */
     uint32_t			keyCount;	/* keys to be saved */
     TPM_BOOL 			save;		/* should key be saved */
     TPM_KEY_HANDLE_ENTRY	*tpm_key_handle_entry;
+    unsigned int		pass;		/* swap entries, then key slots */
     
-    if (rc == 0) {
-	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_KEY_HANDLE_ENTRIES_V1);
-    }
     /* first count up the keys */
     if (rc == 0) {
 	start = 0;
@@ -3260,28 +3464,36 @@ TPM_RESULT TPM_KeyHandleEntries_Store(TPM_STORE_BUFFER *sbuffer,
 	}
 	start = current + 1;
     }
+    /* V1 if older versions can load the keys */
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append16(sbuffer, (keyCount <= TPM_KEY_HANDLES) ?
+				  TPM_TAG_KEY_HANDLE_ENTRIES_V1 :
+				  TPM_TAG_KEY_HANDLE_ENTRIES_V2);
+    }
     /* store the number of entries to save */
     if (rc == 0) {
 	printf("  TPM_KeyHandleEntries_Store: %u keys to be stored\n", keyCount);
 	rc = TPM_Sbuffer_Append32(sbuffer, keyCount);
     }
-    /* for each key handle entry */
-    if (rc == 0) {
+    /* for each key handle entry, first in the swap entries, then in the key slots */
+    for (pass = 0 ; (rc == 0) && (pass < 2) ; pass++) {
 	printf("  TPM_KeyHandleEntries_Store: Storing keys\n");
-	start = 0;
-    }
-    while ((rc == 0) &&
-	   /* returns TPM_RETRY when at the end of the table, terminates loop */
-	   (TPM_KeyHandleEntries_GetNextEntry(&tpm_key_handle_entry,
-					      &current,
-					      tpm_state->tpm_key_handle_entries,
-					      start)) == 0) {
-	TPM_SaveState_IsSaveKey(&save, tpm_key_handle_entry);
-	if (save) {
-	    /* store the key handle entry and its associated key */
-	    rc = TPM_KeyHandleEntry_Store(sbuffer, tpm_key_handle_entry);
+	start = (pass == 0) ? TPM_KEY_HANDLES : 0;
+	end = (pass == 0) ? TPM_KEY_TABLE_ENTRIES : TPM_KEY_HANDLES;
+	while ((rc == 0) &&
+	       /* returns TPM_RETRY when at the end of the table, terminates loop */
+	       (TPM_KeyHandleEntries_GetNextEntry(&tpm_key_handle_entry,
+						  &current,
+						  tpm_state->tpm_key_handle_entries,
+						  start)) == 0 &&
+	       (current < end)) {
+	    TPM_SaveState_IsSaveKey(&save, tpm_key_handle_entry);
+	    if (save) {
+		/* store the key handle entry and its associated key */
+		rc = TPM_KeyHandleEntry_Store(sbuffer, tpm_key_handle_entry);
+	    }
+	    start = current + 1;
 	}
-	start = current + 1;
     }
     return rc;
 }
@@ -3309,8 +3521,8 @@ TPM_RESULT TPM_KeyHandleEntries_StoreHandles(TPM_STORE_BUFFER *sbuffer,
     printf(" TPM_KeyHandleEntries_StoreHandles:\n");
     if (rc == 0) {
 	loadedCount = 0;
-	/* count the number of loaded handles */
-	for (i = 0 ; i < TPM_KEY_HANDLES ; i++) {
+	/* count the number of loaded handles, including swapped out keys */
+	for (i = 0 ; i < TPM_KEY_TABLE_ENTRIES ; i++) {
 	    if (tpm_key_handle_entries[i].key != NULL) {
 		loadedCount++;
 	    }
@@ -3318,7 +3530,7 @@ TPM_RESULT TPM_KeyHandleEntries_StoreHandles(TPM_STORE_BUFFER *sbuffer,
 	/* store 'loaded' handle count */
 	rc = TPM_Sbuffer_Append16(sbuffer, loadedCount); 
     }
-    for (i = 0 ; (rc == 0) && (i < TPM_KEY_HANDLES) ; i++) {
+    for (i = 0 ; (rc == 0) && (i < TPM_KEY_TABLE_ENTRIES) ; i++) {
 	if (tpm_key_handle_entries[i].key != NULL) {	/* if the index is loaded */
 	    rc = TPM_Sbuffer_Append32(sbuffer, tpm_key_handle_entries[i].handle); /* store it */
 	}
@@ -3356,15 +3568,18 @@ TPM_RESULT TPM_KeyHandleEntries_DeleteHandle(TPM_KEY_HANDLE_ENTRY *tpm_key_handl
     return rc;
 }
 
-/* TPM_KeyHandleEntries_IsSpace() returns 'isSpace' TRUE if an entry is available, FALSE if not.
+/* TPM_KeyHandleEntries_IsSpace() returns 'isSpace' TRUE if an entry can be added, FALSE if not.
 
-   If TRUE, 'index' holds the first free position.
+   If TRUE, 'index' holds the first free key slot, or if all key slots are used, the slot of the
+   key that would be swapped out.
 */
 
 void TPM_KeyHandleEntries_IsSpace(TPM_BOOL *isSpace,
 				  uint32_t *index,
 				  const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
 {
+    uint32_t	swapIndex;
+
     printf(" TPM_KeyHandleEntries_IsSpace:\n");
     for (*index = 0, *isSpace = FALSE ; *index < TPM_KEY_HANDLES ; (*index)++) {
 	if (tpm_key_handle_entries[*index].key == NULL) {	/* if the index is empty */
@@ -3373,10 +3588,22 @@ void TPM_KeyHandleEntries_IsSpace(TPM_BOOL *isSpace,
 	    break;
 	}
     }
+    /* if the key slots are full, a key can be swapped out if there is a free swap entry */
+    if (!*isSpace) {
+	TPM_KeyHandleEntries_GetFree(isSpace, &swapIndex, tpm_key_handle_entries,
+				     0, TPM_KEY_HANDLES, TPM_KEY_SWAP_ENTRIES);
+    }
+    if (*isSpace && (*index == TPM_KEY_HANDLES)) {
+	TPM_KeyHandleEntries_GetLeastRecent(isSpace, index, tpm_key_handle_entries);
+	if (*isSpace) {
+	    printf("  TPM_KeyHandleEntries_IsSpace: Can swap out %u\n", *index);
+	}
+    }
     return;
 }
 
-/* TPM_KeyHandleEntries_GetSpace() returns the number of unused key handle entries.
+/* TPM_KeyHandleEntries_GetSpace() returns the number of unused key handle entries, including
+   unused swap entries.
 
 */
 
@@ -3386,7 +3613,7 @@ void TPM_KeyHandleEntries_GetSpace(uint32_t *space,
     uint32_t i;
 
     printf(" TPM_KeyHandleEntries_GetSpace:\n");
-    for (*space = 0 , i = 0 ; i < TPM_KEY_HANDLES ; i++) {
+    for (*space = 0 , i = 0 ; i < TPM_KEY_TABLE_ENTRIES ; i++) {
 	if (tpm_key_handle_entries[i].key == NULL) {	/* if the index is empty */
 	    (*space)++;
 	}	    
@@ -3395,7 +3622,10 @@ void TPM_KeyHandleEntries_GetSpace(uint32_t *space,
 }
 
 /* TPM_KeyHandleEntries_IsEvictSpace() returns 'isSpace' TRUE if there are at least 'minSpace'
-   entries that do not have the ownerEvict bit set, FALSE if not.
+   key slots that do not hold an owner evict key, FALSE if not.
+
+   Owner evict keys are never swapped out, but a swapped out key may be made owner evict, so the
+   owner evict keys in the swap entries are counted as well.
 */
 
 void TPM_KeyHandleEntries_IsEvictSpace(TPM_BOOL *isSpace,
@@ -3405,14 +3635,11 @@ void TPM_KeyHandleEntries_IsEvictSpace(TPM_BOOL *isSpace,
     uint32_t evictSpace;
     uint32_t i;
 
-    for (i = 0,	 evictSpace = 0 ; i < TPM_KEY_HANDLES ; i++) {
-	if (tpm_key_handle_entries[i].key == NULL) {	/* if the index is empty */
-	    evictSpace++;
-	}
-	else {							/* is index is used */
-	    if (!(tpm_key_handle_entries[i].keyControl & TPM_KEY_CONTROL_OWNER_EVICT)) {
-		evictSpace++;	/* space that can be evicted */
-	    }
+    for (i = 0,	 evictSpace = TPM_KEY_HANDLES ; i < TPM_KEY_TABLE_ENTRIES ; i++) {
+	if ((tpm_key_handle_entries[i].key != NULL) &&	/* if the index is used */
+	    (tpm_key_handle_entries[i].keyControl & TPM_KEY_CONTROL_OWNER_EVICT) &&
+	    (evictSpace > 0)) {
+	    evictSpace--;	/* space that cannot be evicted */
 	}
     }
     printf(" TPM_KeyHandleEntries_IsEvictSpace: evictable space, minimum %u free %u\n",
@@ -3467,6 +3694,8 @@ TPM_RESULT TPM_KeyHandleEntries_AddKeyEntry(TPM_KEY_HANDLE *tpm_key_handle,		/*
 	If keepHandle is FALSE, if the handle is already in use, a new value is assigned.
 
    The handle is returned in tpm_key_handle.
+
+   If all key slots are used, the least recently used key is swapped out to make room.
 */
 
 TPM_RESULT TPM_KeyHandleEntries_AddEntry(TPM_KEY_HANDLE *tpm_key_handle,		/* i/o */
@@ -3503,11 +3732,16 @@ TPM_RESULT TPM_KeyHandleEntries_AddEntry(TPM_KEY_HANDLE *tpm_key_handle,		/* i/o
 				       TRUE,				/* isKeyHandle */
 				       (TPM_GETENTRY_FUNCTION_T)TPM_KeyHandleEntries_GetEntry);
     }
+    /* get a key slot near the handle index, swapping out a key if necessary */
+    if (rc == 0) {
+	rc = TPM_KeyHandleEntries_GetSlot(&index, tpm_key_handle_entries, *tpm_key_handle);
+    }
     if (rc == 0) {
 	tpm_key_handle_entries[index].handle = *tpm_key_handle;
 	tpm_key_handle_entries[index].key = tpm_key_handle_entry->key;
 	tpm_key_handle_entries[index].keyControl = tpm_key_handle_entry->keyControl;
 	tpm_key_handle_entries[index].parentPCRStatus = tpm_key_handle_entry->parentPCRStatus;
+	tpm_key_handle_entries[index].lastUse = 0;	/* not used since loaded */
 	printf("  TPM_KeyHandleEntries_AddEntry: Index %u key handle %08x key pointer %p\n",
 	       index, tpm_key_handle_entries[index].handle, tpm_key_handle_entries[index].key);
     }
@@ -3515,24 +3749,25 @@ TPM_RESULT TPM_KeyHandleEntries_AddEntry(TPM_KEY_HANDLE *tpm_key_handle,		/* i/o
 }
 
 /* TPM_KeyHandleEntries_GetEntry() searches all entries for the entry matching the handle, and
-   returns that entry */
+   returns that entry.
+
+   The search starts at the index given by the handle, first in the key slots and then in the swap
+   entries.
+*/
 
 TPM_RESULT TPM_KeyHandleEntries_GetEntry(TPM_KEY_HANDLE_ENTRY **tpm_key_handle_entry,
 					 TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
 					 TPM_KEY_HANDLE tpm_key_handle)
 {
     TPM_RESULT	rc = 0;
-    size_t	i;
     TPM_BOOL	found;
 
     printf(" TPM_KeyHandleEntries_GetEntry: Get entry for handle %08x\n", tpm_key_handle);
-    for (i = 0, found = FALSE ; (i < TPM_KEY_HANDLES) && !found ; i++) {
-	/* first test for matching handle.  Then check for non-NULL to insure that entry is valid */
-	if ((tpm_key_handle_entries[i].handle == tpm_key_handle) &&
-	    tpm_key_handle_entries[i].key != NULL) {	/* found */
-	    found = TRUE;
-	    *tpm_key_handle_entry = &(tpm_key_handle_entries[i]);
-	}
+    TPM_KeyHandleEntries_Find(&found, tpm_key_handle_entry, tpm_key_handle_entries,
+			      tpm_key_handle, 0, TPM_KEY_HANDLES);
+    if (!found) {
+	TPM_KeyHandleEntries_Find(&found, tpm_key_handle_entry, tpm_key_handle_entries,
+				  tpm_key_handle, TPM_KEY_HANDLES, TPM_KEY_SWAP_ENTRIES);
     }
     if (!found) {
 	printf("  TPM_KeyHandleEntries_GetEntry: key handle %08x not found\n", tpm_key_handle);
@@ -3564,7 +3799,7 @@ TPM_RESULT TPM_KeyHandleEntries_GetNextEntry(TPM_KEY_HANDLE_ENTRY **tpm_key_hand
     TPM_RESULT	rc = TPM_RETRY;
 
     printf(" TPM_KeyHandleEntries_GetNextEntry: Start %lu\n", (unsigned long)start);
-    for (*current = start ; *current < TPM_KEY_HANDLES ; (*current)++) {
+    for (*current = start ; *current < TPM_KEY_TABLE_ENTRIES ; (*current)++) {
 	if (tpm_key_handle_entries[*current].key != NULL) {
 	    *tpm_key_handle_entry = &(tpm_key_handle_entries[*current]);
 	    rc = 0;	/* found an entry */
@@ -3661,6 +3896,12 @@ TPM_RESULT TPM_KeyHandleEntries_GetKey(TPM_KEY **tpm_key,
 		   tpm_key_handle);
 	}
     }
+    /* swap the key in if it was swapped out, and mark it as most recently used */
+    if ((rc == 0) && !found) {
+	TPM_KeyHandleEntries_SwapIn(&tpm_key_handle_entry, tpm_state->tpm_key_handle_entries);
+	tpm_state->keyUseCount++;
+	tpm_key_handle_entry->lastUse = tpm_state->keyUseCount;
+    }
     /* Part 1 25.1 Validate Key for use 
        2. Set LK to the loaded key that is being used */
     /* NOTE:  For special handle keys, this was already done.  Just do here for keys in table */
@@ -3808,7 +4049,7 @@ TPM_RESULT TPM_KeyHandleEntries_OwnerEvictStore(TPM_STORE_BUFFER *sbuffer,
     if (rc == 0) {
 	rc = TPM_Sbuffer_Append16(sbuffer, count); 
     }
-    for (i = 0 ; (rc == 0) && (i < TPM_KEY_HANDLES) ; i++) {
+    for (i = 0 ; (rc == 0) && (i < TPM_KEY_TABLE_ENTRIES) ; i++) {
 	/* if the slot is occupied */
 	if (tpm_key_handle_entries[i].key != NULL) {
 	    /* if the key is owner evict */
@@ -3834,7 +4075,7 @@ TPM_KeyHandleEntries_OwnerEvictGetCount(uint16_t *count,
     printf(" TPM_KeyHandleEntries_OwnerEvictGetCount:\n");
     /* count the number of loaded owner evict handles */
     if (rc == 0) {
-	for (i = 0 , *count = 0 ; i < TPM_KEY_HANDLES ; i++) {
+	for (i = 0 , *count = 0 ; i < TPM_KEY_TABLE_ENTRIES ; i++) {
 	    /* if the slot is occupied */
 	    if (tpm_key_handle_entries[i].key != NULL) {
 		/* if the key is owner evict */
@@ -3864,7 +4105,7 @@ void TPM_KeyHandleEntries_OwnerEvictDelete(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_
 {
     uint16_t	i;		/* the uint16_t corresponds to the standard getcap */
 
-    for (i = 0 ; i < TPM_KEY_HANDLES ; i++) {
+    for (i = 0 ; i < TPM_KEY_TABLE_ENTRIES ; i++) {
 	/* if the slot is occupied */
 	if (tpm_key_handle_entries[i].key != NULL) {
 	    /* if the key is owner evict */
@@ -3876,6 +4117,293 @@ void TPM_KeyHandleEntries_OwnerEvictDelete(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_
     return;
 }
 
+/* TPM_KeyHandleEntries_Find() returns 'found' TRUE and the entry for 'tpm_key_handle' in the
+   'count' entries starting at 'first', searching from the entry given by 'tpm_key_handle'.
+*/
+
+static void TPM_KeyHandleEntries_Find(TPM_BOOL *found,
+				      TPM_KEY_HANDLE_ENTRY **tpm_key_handle_entry,
+				      TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+				      TPM_KEY_HANDLE tpm_key_handle,
+				      uint32_t first,
+				      uint32_t count)
+{
+    uint32_t i;
+    uint32_t index;
+
+    for (i = 0, *found = FALSE ; (i < count) && !*found ; i++) {
+	index = first + ((tpm_key_handle + i) % count);
+	/* first test for matching handle.  Then check for non-NULL to insure that entry is valid */
+	if ((tpm_key_handle_entries[index].handle == tpm_key_handle) &&
+	    tpm_key_handle_entries[index].key != NULL) {	/* found */
+	    *found = TRUE;
+	    *tpm_key_handle_entry = &(tpm_key_handle_entries[index]);
+	}
+    }
+    return;
+}
+
+/* TPM_KeyHandleEntries_GetFree() returns 'isSpace' TRUE and the 'index' of a free entry in the
+   'count' entries starting at 'first', searching from the entry given by 'tpm_key_handle'.
+*/
+
+static void TPM_KeyHandleEntries_GetFree(TPM_BOOL *isSpace,
+					 uint32_t *index,
+					 const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+					 TPM_KEY_HANDLE tpm_key_handle,
+					 uint32_t first,
+					 uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0, *isSpace = FALSE ; (i < count) && !*isSpace ; i++) {
+	*index = first + ((tpm_key_handle + i) % count);
+	if (tpm_key_handle_entries[*index].key == NULL) {
+	    *isSpace = TRUE;
+	}
+    }
+    return;
+}
+
+/* TPM_KeyHandleEntries_GetLeastRecent() returns 'found' TRUE and the 'index' of the least recently
+   used key slot that can be swapped out.  Owner evict keys are never swapped out.
+*/
+
+static void TPM_KeyHandleEntries_GetLeastRecent(TPM_BOOL *found,
+						uint32_t *index,
+						const TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+{
+    uint32_t i;
+
+    for (i = 0, *found = FALSE ; i < TPM_KEY_HANDLES ; i++) {
+	if ((tpm_key_handle_entries[i].key != NULL) &&
+	    !(tpm_key_handle_entries[i].keyControl & TPM_KEY_CONTROL_OWNER_EVICT) &&
+	    (!*found ||
+	     (tpm_key_handle_entries[i].lastUse < tpm_key_handle_entries[*index].lastUse))) {
+	    *found = TRUE;
+	    *index = i;
+	}
+    }
+    return;
+}
+
+/* TPM_KeyHandleEntries_GetSlot() returns the 'index' of a free key slot for 'tpm_key_handle'.
+
+   If all key slots are used, the least recently used key is moved to a free swap entry.
+
+   Returns TPM_NOSPACE if there is neither a free key slot nor a key that can be swapped out.
+*/
+
+static TPM_RESULT TPM_KeyHandleEntries_GetSlot(uint32_t *index,
+					       TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries,
+					       TPM_KEY_HANDLE tpm_key_handle)
+{
+    TPM_RESULT	rc = 0;
+    TPM_BOOL	isSpace;
+    TPM_BOOL	isSwapSpace = FALSE;
+    uint32_t	swapIndex;
+
+    TPM_KeyHandleEntries_GetFree(&isSpace, index, tpm_key_handle_entries,
+				 tpm_key_handle, 0, TPM_KEY_HANDLES);
+    /* all key slots are used, find a free swap entry and the key to swap out */
+    if (!isSpace) {
+	TPM_KeyHandleEntries_GetLeastRecent(&isSpace, index, tpm_key_handle_entries);
+    }
+    if (!isSpace) {
+	printf("TPM_KeyHandleEntries_GetSlot: Error, key handle entries full\n");
+	rc = TPM_NOSPACE;
+    }
+    if ((rc == 0) && (tpm_key_handle_entries[*index].key != NULL)) {
+	TPM_KeyHandleEntries_GetFree(&isSwapSpace, &swapIndex, tpm_key_handle_entries,
+				     tpm_key_handle_entries[*index].handle,
+				     TPM_KEY_HANDLES, TPM_KEY_SWAP_ENTRIES);
+	if (!isSwapSpace) {
+	    printf("TPM_KeyHandleEntries_GetSlot: Error, swap entries full\n");
+	    rc = TPM_NOSPACE;
+	}
+    }
+    /* swap out the key */
+    if ((rc == 0) && isSwapSpace) {
+	printf("  TPM_KeyHandleEntries_GetSlot: Swapping out key handle %08x\n",
+	       tpm_key_handle_entries[*index].handle);
+	tpm_key_handle_entries[swapIndex] = tpm_key_handle_entries[*index];
+	TPM_KeyHandleEntry_Init(&(tpm_key_handle_entries[*index]));
+    }
+    return rc;
+}
+
+/* TPM_KeyHandleEntries_SwapIn() moves the entry '*tpm_key_handle_entry' into a key slot if it is a
+   swap entry.  If all key slots are used, it is exchanged with the least recently used key.  If no
+   key can be swapped out, the entry is left in place, which is valid as well.
+
+   On return, '*tpm_key_handle_entry' points to the new position of the entry.  The TPM_KEY itself
+   does not move.
+*/
+
+static void TPM_KeyHandleEntries_SwapIn(TPM_KEY_HANDLE_ENTRY **tpm_key_handle_entry,
+					TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
+{
+    TPM_BOOL			isSpace;
+    uint32_t			index;
+    TPM_KEY_HANDLE_ENTRY	tmp_key_handle_entry;
+
+    if (*tpm_key_handle_entry >= &(tpm_key_handle_entries[TPM_KEY_HANDLES])) {
+	TPM_KeyHandleEntries_GetFree(&isSpace, &index, tpm_key_handle_entries,
+				     (*tpm_key_handle_entry)->handle, 0, TPM_KEY_HANDLES);
+	if (!isSpace) {
+	    TPM_KeyHandleEntries_GetLeastRecent(&isSpace, &index, tpm_key_handle_entries);
+	}
+	if (isSpace) {
+	    printf("  TPM_KeyHandleEntries_SwapIn: Swapping in key handle %08x\n",
+		   (*tpm_key_handle_entry)->handle);
+	    tmp_key_handle_entry = tpm_key_handle_entries[index];
+	    tpm_key_handle_entries[index] = **tpm_key_handle_entry;
+	    **tpm_key_handle_entry = tmp_key_handle_entry;
+	    *tpm_key_handle_entry = &(tpm_key_handle_entries[index]);
+	}
+    }
+    return;
+}
+
+/*
+  Key Cache
+*/
+
+/* TPM_KeyCacheEntry_Init() sets the entry to unused */
+
+static void TPM_KeyCacheEntry_Init(TPM_KEY_CACHE_ENTRY *tpm_key_cache_entry)
+{
+    tpm_key_cache_entry->valid = FALSE;
+    TPM_Digest_Init(tpm_key_cache_entry->keyDigest);
+    TPM_SizedBuffer_Init(&(tpm_key_cache_entry->clearData));
+    TPM_SizedBuffer_Init(&(tpm_key_cache_entry->q_key));
+    TPM_SizedBuffer_Init(&(tpm_key_cache_entry->d_key));
+    tpm_key_cache_entry->lastUse = 0;
+    return;
+}
+
+/* TPM_KeyCacheEntry_Delete() clears and frees the private key material of the entry, and sets the
+   entry to unused */
+
+static void TPM_KeyCacheEntry_Delete(TPM_KEY_CACHE_ENTRY *tpm_key_cache_entry)
+{
+    TPM_SizedBuffer_Zero(&(tpm_key_cache_entry->clearData));
+    TPM_SizedBuffer_Zero(&(tpm_key_cache_entry->q_key));
+    TPM_SizedBuffer_Zero(&(tpm_key_cache_entry->d_key));
+    TPM_SizedBuffer_Delete(&(tpm_key_cache_entry->clearData));
+    TPM_SizedBuffer_Delete(&(tpm_key_cache_entry->q_key));
+    TPM_SizedBuffer_Delete(&(tpm_key_cache_entry->d_key));
+    TPM_KeyCacheEntry_Init(tpm_key_cache_entry);
+    return;
+}
+
+/* TPM_KeyCache_Init() initializes the TPM_KEY_CACHE with all entries unused */
+
+void TPM_KeyCache_Init(TPM_KEY_CACHE *tpm_key_cache)
+{
+    size_t i;
+
+    printf(" TPM_KeyCache_Init:\n");
+    tpm_key_cache->useCount = 0;
+    for (i = 0 ; i < TPM_KEY_CACHE_ENTRIES ; i++) {
+	TPM_KeyCacheEntry_Init(&(tpm_key_cache->entries[i]));
+    }
+    return;
+}
+
+/* TPM_KeyCache_Delete() deletes all entries of the TPM_KEY_CACHE */
+
+void TPM_KeyCache_Delete(TPM_KEY_CACHE *tpm_key_cache)
+{
+    size_t i;
+
+    printf(" TPM_KeyCache_Delete:\n");
+    for (i = 0 ; i < TPM_KEY_CACHE_ENTRIES ; i++) {
+	TPM_KeyCacheEntry_Delete(&(tpm_key_cache->entries[i]));
+    }
+    TPM_KeyCache_Init(tpm_key_cache);
+    return;
+}
+
+/* TPM_KeyCache_Find() returns the entry for 'keyDigest', or NULL if there is none.  A found entry
+   is marked as most recently used.
+*/
+
+void TPM_KeyCache_Find(TPM_KEY_CACHE_ENTRY **tpm_key_cache_entry,
+		       TPM_KEY_CACHE *tpm_key_cache,
+		       const TPM_DIGEST keyDigest)
+{
+    size_t i;
+
+    *tpm_key_cache_entry = NULL;
+    for (i = 0 ; (i < TPM_KEY_CACHE_ENTRIES) && (*tpm_key_cache_entry == NULL) ; i++) {
+	if (tpm_key_cache->entries[i].valid &&
+	    (memcmp(tpm_key_cache->entries[i].keyDigest, keyDigest, TPM_DIGEST_SIZE) == 0)) {
+	    *tpm_key_cache_entry = &(tpm_key_cache->entries[i]);
+	}
+    }
+    if (*tpm_key_cache_entry != NULL) {
+	printf(" TPM_KeyCache_Find: Found entry %lu\n", (unsigned long)(i - 1));
+	tpm_key_cache->useCount++;
+	(*tpm_key_cache_entry)->lastUse = tpm_key_cache->useCount;
+    }
+    else {
+	printf(" TPM_KeyCache_Find: Not found\n");
+    }
+    return;
+}
+
+/* TPM_KeyCache_Add() adds the decrypted encData 'clearData' of a key blob and the private key
+   calculated from it to the TPM_KEY_CACHE.
+
+   An unused entry is taken if there is one, else the least recently used entry is replaced.
+*/
+
+TPM_RESULT TPM_KeyCache_Add(TPM_KEY_CACHE *tpm_key_cache,
+			    const TPM_DIGEST keyDigest,
+			    const unsigned char *clearData,
+			    uint32_t clearDataLength,
+			    TPM_STORE_ASYMKEY *tpm_store_asymkey)
+{
+    TPM_RESULT		rc = 0;
+    TPM_KEY_CACHE_ENTRY	*tpm_key_cache_entry;
+    size_t		i;
+
+    /* an unused entry, else the least recently used one */
+    tpm_key_cache_entry = &(tpm_key_cache->entries[0]);
+    for (i = 0 ; (i < TPM_KEY_CACHE_ENTRIES) && tpm_key_cache_entry->valid ; i++) {
+	if (!tpm_key_cache->entries[i].valid ||
+	    (tpm_key_cache->entries[i].lastUse < tpm_key_cache_entry->lastUse)) {
+	    tpm_key_cache_entry = &(tpm_key_cache->entries[i]);
+	}
+    }
+    printf(" TPM_KeyCache_Add: Entry %lu\n",
+	   (unsigned long)(tpm_key_cache_entry - tpm_key_cache->entries));
+    TPM_KeyCacheEntry_Delete(tpm_key_cache_entry);
+    if (rc == 0) {
+	rc = TPM_SizedBuffer_Set(&(tpm_key_cache_entry->clearData), clearDataLength, clearData);
+    }
+    if (rc == 0) {
+	rc = TPM_SizedBuffer_Copy(&(tpm_key_cache_entry->q_key),
+				  &(tpm_store_asymkey->privKey.q_key));
+    }
+    if (rc == 0) {
+	rc = TPM_SizedBuffer_Copy(&(tpm_key_cache_entry->d_key),
+				  &(tpm_store_asymkey->privKey.d_key));
+    }
+    if (rc == 0) {
+	TPM_Digest_Copy(tpm_key_cache_entry->keyDigest, keyDigest);
+	tpm_key_cache->useCount++;
+	tpm_key_cache_entry->lastUse = tpm_key_cache->useCount;
+	tpm_key_cache_entry->valid = TRUE;
+    }
+    /* a partially filled entry is not used */
+    else {
+	TPM_KeyCacheEntry_Delete(tpm_key_cache_entry);
+    }
+    return rc;
+}
+
 /*
   Processing Functions
 */
@@ -125,7 +125,8 @@ TPM_RESULT TPM_Key_CheckPubDataDigest(TPM_KEY *tpm_key);
 TPM_RESULT TPM_Key_GenerateEncData(TPM_KEY *tpm_key,
                                    TPM_KEY *parent_key);
 TPM_RESULT TPM_Key_DecryptEncData(TPM_KEY *tpm_key,
-                                  TPM_KEY *parent_key);
+                                  TPM_KEY *parent_key,
+                                  TPM_KEY_CACHE *tpm_key_cache);
 
 TPM_RESULT TPM_Key_GetStoreAsymkey(TPM_STORE_ASYMKEY **tpm_store_asymkey,
                                    TPM_KEY *tpm_key);
@@ -142,6 +143,8 @@ TPM_RESULT TPM_Key_GetPrimeFactorP(uint32_t 		*pbytes,
 TPM_RESULT TPM_Key_GetPrivateKey(uint32_t	*dbytes,
                                  unsigned char  **darr,
                                  TPM_KEY        *tpm_key);
+TPM_RESULT TPM_Key_GetRSAKeyToken(TPM_RSA_KEY_TOKEN *rsa_key_token,
+                                  TPM_KEY *tpm_key);
 TPM_RESULT TPM_Key_GetExponent(uint32_t		*ebytes,
                                unsigned char    **earr,
                                TPM_KEY  *tpm_key);
@@ -302,6 +305,21 @@ TPM_RESULT TPM_KeyHandleEntries_OwnerEvictGetCount(uint16_t *count,
 						   *tpm_key_handle_entries);
 void       TPM_KeyHandleEntries_OwnerEvictDelete(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries);
 
+/*
+  TPM_KEY_CACHE
+*/
+
+void       TPM_KeyCache_Init(TPM_KEY_CACHE *tpm_key_cache);
+void       TPM_KeyCache_Delete(TPM_KEY_CACHE *tpm_key_cache);
+void       TPM_KeyCache_Find(TPM_KEY_CACHE_ENTRY **tpm_key_cache_entry,
+                             TPM_KEY_CACHE *tpm_key_cache,
+                             const TPM_DIGEST keyDigest);
+TPM_RESULT TPM_KeyCache_Add(TPM_KEY_CACHE *tpm_key_cache,
+                            const TPM_DIGEST keyDigest,
+                            const unsigned char *clearData,
+                            uint32_t clearDataLength,
+                            TPM_STORE_ASYMKEY *tpm_store_asymkey);
+
 /* TPM_RSA_KEY_PARMS */
 
 void       TPM_RSAKeyParms_Init(TPM_RSA_KEY_PARMS *tpm_rsa_key_parms);
@@ -48,17 +48,60 @@
         TPM_NVRAM_DeleteName();
 
    They take a 'name' that is mapped to a rooted file name.
+
+   The default file implementation does not write the state files directly.  Writes are collected
+   as records in a per-TPM write-ahead journal and made durable at TPM_NVRAM_Commit() with one
+   fsync() of the journal file.  The records are then applied to the state files.  After a crash,
+   TPM_NVRAM_Recover() replays the complete transactions in the journal, so each state file holds
+   either its old or its new content, never a torn write.  Loads and removals within a transaction
+   see the records that are not yet committed, so the transaction is only made durable as a whole.
+
+        TPM_NVRAM_Begin();
+        TPM_NVRAM_Commit();
+        TPM_NVRAM_Recover();
+
+   The fsync() is amortized over the writes of one TPM: all writes of a command, or of a batch of
+   commands, share it.  There is no group commit across TPMs, since each TPM has its own journal
+   and recovers on its own.  A commit only holds the lock of its TPM, so the commits of different
+   TPMs sync their journals concurrently, and the file system may combine them.
+
+   A TPM_NV_MMAP build maps the state files that are loaded through TPM_NVRAM_MapData() and keeps
+   them mapped until TPM_NVRAM_Close().  The state is deserialized directly from the mapping, and
+   journal records that keep the length of a mapped file are applied with a memcpy() into the
+   mapping.  The checkpoint then makes each mapped file durable with one msync().
+
+        TPM_NVRAM_MapData();
+        TPM_NVRAM_ReleaseData();
+        TPM_NVRAM_Close();
+
+   If the user provided NVRAM callbacks, they replace the default file implementation.  Optional
+   callbacks write the changed byte ranges of an update, bracket the writes of a command with
+   begin and commit, and store data asynchronously.  Asynchronous stores are awaited before the
+   next load, update, or removal, and at TPM_NVRAM_Commit().
 */
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef TPM_NV_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef TPM_LIBTPMS_CALLBACKS
+#include <pthread.h>
+#endif
 
+#include "tpm_cryptoh.h"
 #include "tpm_debug.h"
 #include "tpm_error.h"
+#include "tpm_global.h"
+#include "tpm_load.h"
 #include "tpm_memory.h"
 #include "tpm_nvram.h"
+#include "tpm_store.h"
 
 #include "tpm_nvfile.h"
 
@@ -72,6 +115,129 @@
 static void       TPM_NVRAM_GetFilenameForName(char *filename,
 					       uint32_t tpm_number,
                                                const char *name);
+static TPM_RESULT TPM_NVRAM_ReadFile(unsigned char **data,
+                                     uint32_t *length,
+                                     const char *filename);
+static TPM_RESULT TPM_NVRAM_Flush(uint32_t tpm_number);
+static TPM_RESULT TPM_NVRAM_ApplyPending(unsigned char **data,
+                                         uint32_t *length,
+                                         TPM_BOOL *exists,
+                                         TPM_BOOL *written,
+                                         uint32_t tpm_number,
+                                         const char *name);
+static TPM_RESULT TPM_NVRAM_DropRecords(uint32_t tpm_number,
+                                        const char *name);
+static TPM_RESULT TPM_NVRAM_AddRecord(uint32_t tpm_number,
+                                      uint32_t type,
+                                      const char *name,
+                                      uint32_t offset,
+                                      const unsigned char *data,
+                                      uint32_t length);
+static TPM_RESULT TPM_NVRAM_LoadRecord(uint32_t *type,
+                                       char *name,
+                                       uint32_t *offset,
+                                       unsigned char **data,
+                                       uint32_t *length,
+                                       unsigned char **stream,
+                                       uint32_t *stream_size);
+static TPM_RESULT TPM_NVRAM_ApplyRecords(uint32_t tpm_number,
+                                         unsigned char *stream,
+                                         uint32_t stream_size);
+static TPM_RESULT TPM_NVRAM_SyncRecords(uint32_t tpm_number,
+                                        unsigned char *stream,
+                                        uint32_t stream_size);
+static TPM_RESULT TPM_NVRAM_Checkpoint(uint32_t tpm_number,
+                                       TPM_BOOL replay);
+static TPM_RESULT TPM_NVRAM_SyncFile(FILE *file,
+                                     const char *filename);
+#ifdef TPM_LIBTPMS_CALLBACKS
+static TPM_BOOL   TPM_NVRAM_Journaled(void);
+#endif
+
+/* A journal transaction is a sequence of records followed by a commit record.  Each record is
+
+        uint32_t type
+        uint16_t name length, followed by the name without the NUL terminator
+        uint32_t offset
+        uint32_t length, followed by the data
+
+   The commit record has an empty name.  Its offset is the length of the preceding records of the
+   transaction and its data is the SHA-1 digest of those records.  A transaction whose commit
+   record is missing or does not verify was torn by a crash and is discarded.
+*/
+
+#define TPM_NVRAM_RECORD_STORE  1       /* replace the file with the data */
+#define TPM_NVRAM_RECORD_UPDATE 2       /* write the data at the offset */
+#define TPM_NVRAM_RECORD_DELETE 3       /* remove the file */
+#define TPM_NVRAM_RECORD_COMMIT 4       /* end of a transaction */
+
+#define TPM_NVRAM_RECORD_HEADER (4 + 2 + 4 + 4) /* record without the name and the data */
+
+/* the journal state of a TPM instance, protected by the instance lock */
+
+typedef struct tdTPM_NVRAM_JOURNAL {
+    TPM_BOOL            transaction;    /* between TPM_NVRAM_Begin() and TPM_NVRAM_Commit() */
+    TPM_STORE_BUFFER    records;        /* records not yet committed */
+    uint32_t            size;           /* bytes in the journal file */
+    /* the state of the user provided NVRAM, protected by tpm_nvram_async_lock */
+    uint32_t            pending;        /* asynchronous stores not yet completed */
+    TPM_RESULT          callbackRc;     /* first failure of a begin callback or an asynchronous
+                                           store */
+} TPM_NVRAM_JOURNAL;
+
+static TPM_NVRAM_JOURNAL tpm_nvram_journal[TPMS_MAX];
+
+#ifdef TPM_LIBTPMS_CALLBACKS
+
+/* an asynchronous store in progress */
+
+typedef struct tdTPM_NVRAM_ASYNC {
+    uint32_t            tpm_number;
+    unsigned char       *data;          /* copy of the data, valid until the store completes */
+} TPM_NVRAM_ASYNC;
+
+static pthread_mutex_t tpm_nvram_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tpm_nvram_async_cond = PTHREAD_COND_INITIALIZER;	/* a store completed */
+
+static TPM_RESULT TPM_NVRAM_StoreAsync(const unsigned char *data,
+                                       uint32_t length,
+                                       uint32_t tpm_number,
+                                       const char *name);
+static void       TPM_NVRAM_StoreDone(void *context,
+                                      TPM_RESULT result);
+static TPM_RESULT TPM_NVRAM_WaitStores(uint32_t tpm_number);
+static void       TPM_NVRAM_SetCallbackError(uint32_t tpm_number,
+                                             TPM_RESULT result);
+
+#endif	/* TPM_LIBTPMS_CALLBACKS */
+
+#ifdef TPM_NV_MMAP
+
+/* a mapped state file of a TPM instance, protected by the instance lock */
+
+typedef struct tdTPM_NVRAM_MAPPING {
+    char                name[TPM_FILENAME_MAX]; /* empty if the slot is unused */
+    unsigned char       *data;          /* the mapped file */
+    uint32_t            length;         /* length of the file */
+    TPM_BOOL            dirty;          /* not synced since the mapping was written */
+} TPM_NVRAM_MAPPING;
+
+static TPM_NVRAM_MAPPING tpm_nvram_mappings[TPMS_MAX][TPM_NVRAM_MAPPINGS];
+
+static TPM_NVRAM_MAPPING *TPM_NVRAM_FindMapping(uint32_t tpm_number,
+                                                const char *name);
+static TPM_RESULT TPM_NVRAM_MapFile(TPM_NVRAM_MAPPING **mapping,
+                                    uint32_t tpm_number,
+                                    const char *name);
+static void       TPM_NVRAM_UnmapFile(TPM_NVRAM_MAPPING *mapping);
+static TPM_BOOL   TPM_NVRAM_WriteMapping(uint32_t tpm_number,
+                                         uint32_t type,
+                                         const char *name,
+                                         uint32_t offset,
+                                         const unsigned char *data,
+                                         uint32_t length);
+
+#endif	/* TPM_NV_MMAP */
 
 
 /* A file name in NVRAM is composed of 3 parts:
@@ -155,10 +321,7 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
                               const char *name) 
 {
     TPM_RESULT  rc = 0;
-    long        lrc;
-    size_t      src;
-    int         irc;
-    FILE        *file = NULL;
+    TPM_BOOL    exists = FALSE;         /* the file exists, including the open transaction */
     char        filename[FILENAME_MAX]; /* rooted file name from name */
 
 #ifdef TPM_LIBTPMS_CALLBACKS
@@ -167,7 +330,10 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     /* call user-provided function if available, otherwise execute
        default behavior */
     if (cbs->tpm_nvram_loaddata) {
-        rc = cbs->tpm_nvram_loaddata(data, length, tpm_number, name);
+        rc = TPM_NVRAM_WaitStores(tpm_number);
+        if (rc == 0) {
+            rc = cbs->tpm_nvram_loaddata(data, length, tpm_number, name);
+        }
         return rc;
     }
 #endif
@@ -175,19 +341,63 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     printf(" TPM_NVRAM_LoadData: From file %s\n", name);
     *data = NULL;
     *length = 0;
-    /* open the file */
     if (rc == 0) {
         /* map name to the rooted filename */
         TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
-        printf("  TPM_NVRAM_LoadData: Opening file %s\n", filename);
+        rc = TPM_NVRAM_ReadFile(data, length, filename);
+        exists = (rc == 0);
+        if (rc == TPM_RETRY) {
+            rc = 0;
+        }
+    }
+    /* the data must reflect writes of the open transaction, which are not yet in the file */
+    if (rc == 0) {
+        rc = TPM_NVRAM_ApplyPending(data, length, &exists, NULL, tpm_number, name);
+    }
+    if ((rc == 0) && !exists) {
+        rc = TPM_RETRY;
+    }
+    if (rc != 0) {
+        free(*data);
+        *data = NULL;
+        *length = 0;
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_ReadFile() reads the contents of the rooted 'filename' into 'data' of 'length'.
+
+   'data' must be freed after use.
+
+   Returns
+        0 on success.
+        TPM_RETRY and NULL,0 on non-existent file
+        TPM_FAIL on failure to read
+*/
+
+static TPM_RESULT TPM_NVRAM_ReadFile(unsigned char **data,     /* freed by caller */
+                                     uint32_t *length,
+                                     const char *filename)
+{
+    TPM_RESULT  rc = 0;
+    long        lrc;
+    size_t      src;
+    int         irc;
+    FILE        *file = NULL;
+
+    *data = NULL;
+    *length = 0;
+    /* open the file */
+    if (rc == 0) {
+        printf("  TPM_NVRAM_ReadFile: Opening file %s\n", filename);
         file = fopen(filename, "rb");                           /* closed @1 */
         if (file == NULL) {     /* if failure, determine cause */
             if (errno == ENOENT) {
-                printf("TPM_NVRAM_LoadData: No such file %s\n", filename);
+                printf("TPM_NVRAM_ReadFile: No such file %s\n", filename);
                 rc = TPM_RETRY;         /* first time start up */
             }
             else {
-                printf("TPM_NVRAM_LoadData: Error (fatal) opening %s for read, %s\n",
+                printf("TPM_NVRAM_ReadFile: Error (fatal) opening %s for read, %s\n",
                        filename, strerror(errno));
                 rc = TPM_FAIL;
             }
@@ -197,7 +407,7 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     if (rc == 0) {
         irc = fseek(file, 0L, SEEK_END);        /* seek to end of file */
         if (irc == -1L) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) fseek'ing %s, %s\n",
+            printf("TPM_NVRAM_ReadFile: Error (fatal) fseek'ing %s, %s\n",
                    filename, strerror(errno));
             rc = TPM_FAIL;
         }
@@ -205,7 +415,7 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     if (rc == 0) {
         lrc = ftell(file);                      /* get position in the stream */
         if (lrc == -1L) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) ftell'ing %s, %s\n",
+            printf("TPM_NVRAM_ReadFile: Error (fatal) ftell'ing %s, %s\n",
                    filename, strerror(errno));
             rc = TPM_FAIL;
         }
@@ -216,17 +426,17 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     if (rc == 0) {
         irc = fseek(file, 0L, SEEK_SET);        /* seek back to the beginning of the file */
         if (irc == -1L) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) fseek'ing %s, %s\n",
+            printf("TPM_NVRAM_ReadFile: Error (fatal) fseek'ing %s, %s\n",
                    filename, strerror(errno));
             rc = TPM_FAIL;
         }
     }
     /* allocate a buffer for the actual data */
     if ((rc == 0) && *length != 0) {
-        printf(" TPM_NVRAM_LoadData: Reading %u bytes of data\n", *length);
+        printf(" TPM_NVRAM_ReadFile: Reading %u bytes of data\n", *length);
         rc = TPM_Malloc(data, *length);
 	if (rc != 0) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) allocating %u bytes\n", *length);
+            printf("TPM_NVRAM_ReadFile: Error (fatal) allocating %u bytes\n", *length);
             rc = TPM_FAIL;
 	}
     }
@@ -234,21 +444,21 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
     if ((rc == 0) && *length != 0) {
         src = fread(*data, 1, *length, file);
         if (src != *length) {
-            printf("TPM_NVRAM_LoadData: Error (fatal), data read of %u only read %lu\n",
+            printf("TPM_NVRAM_ReadFile: Error (fatal), data read of %u only read %lu\n",
                    *length, (unsigned long)src);
             rc = TPM_FAIL;
         }
     }
     /* close the file */
     if (file != NULL) {
-        printf(" TPM_NVRAM_LoadData: Closing file %s\n", filename);
+        printf(" TPM_NVRAM_ReadFile: Closing file %s\n", filename);
         irc = fclose(file);             /* @1 */
         if (irc != 0) {
-            printf("TPM_NVRAM_LoadData: Error (fatal) closing file %s\n", filename);
+            printf("TPM_NVRAM_ReadFile: Error (fatal) closing file %s\n", filename);
             rc = TPM_FAIL;
         }
         else {
-            printf(" TPM_NVRAM_LoadData: Closed file %s\n", filename);
+            printf(" TPM_NVRAM_ReadFile: Closed file %s\n", filename);
         }
     }
     return rc;
@@ -256,6 +466,8 @@ TPM_RESULT TPM_NVRAM_LoadData(unsigned char **data,     /* freed by caller */
 
 /* TPM_NVRAM_StoreData stores 'data' of 'length' to the rooted 'filename'
 
+   The data is written to the journal.  It reaches the file when the transaction is committed.
+
    Returns
         0 on success
         TPM_FAIL for other fatal errors
@@ -267,16 +479,16 @@ TPM_RESULT TPM_NVRAM_StoreData(const unsigned char *data,
                                const char *name)
 {
     TPM_RESULT  rc = 0;
-    uint32_t      lrc;
-    int         irc;
-    FILE        *file = NULL;
-    char        filename[FILENAME_MAX]; /* rooted file name from name */
 
 #ifdef TPM_LIBTPMS_CALLBACKS
     struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
 
     /* call user-provided function if available, otherwise execute
        default behavior */
+    if (cbs->tpm_nvram_storedata_async) {
+        rc = TPM_NVRAM_StoreAsync(data, length, tpm_number, name);
+        return rc;
+    }
     if (cbs->tpm_nvram_storedata) {
         rc = cbs->tpm_nvram_storedata(data, length, tpm_number, name);
         return rc;
@@ -285,37 +497,156 @@ TPM_RESULT TPM_NVRAM_StoreData(const unsigned char *data,
 
     printf(" TPM_NVRAM_StoreData: To name %s\n", name);
     if (rc == 0) {
-        /* map name to the rooted filename */
+        rc = TPM_NVRAM_AddRecord(tpm_number, TPM_NVRAM_RECORD_STORE, name, 0, data, length);
+    }
+    return rc;
+}
+
+
+/* TPM_NVRAM_UpdateData() stores 'data' of 'length' to the rooted 'filename', where 'oldData' of
+   'oldLength' is what was last stored to or loaded from the same name.
+
+   If the lengths match and the file still has that length, including the writes of the open
+   transaction, only the byte ranges that differ are journaled and written in place.  If the user
+   provided an update callback, it writes the ranges instead.  Otherwise, or if the user only
+   provided store callbacks, the data is stored as a whole through TPM_NVRAM_StoreData().
+   'oldData' can be NULL if the previous content is unknown.
+
+   Returns
+        0 on success
+        TPM_FAIL for other fatal errors
+*/
+
+TPM_RESULT TPM_NVRAM_UpdateData(const unsigned char *data,
+				uint32_t length,
+				const unsigned char *oldData,
+				uint32_t oldLength,
+				uint32_t tpm_number,
+				const char *name)
+{
+    TPM_RESULT  rc = 0;
+    TPM_BOOL    storeAll = FALSE;       /* store the data as a whole */
+    long        lrc;
+    int         irc;
+    uint32_t    start;                  /* start of a changed range */
+    uint32_t    end;                    /* end of a changed range */
+    uint32_t    same;                   /* unchanged bytes following the range */
+    uint32_t    written = 0;            /* bytes written in place, for tracing */
+    FILE        *file = NULL;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+    TPM_BOOL    checked = FALSE;        /* the stored length need not be checked */
+    TPM_BOOL    callback = FALSE;       /* the user provided function writes the ranges */
+    TPM_BOOL    exists = FALSE;         /* the file exists */
+    TPM_BOOL    sized = FALSE;          /* the file length is known without opening the file */
+    TPM_BOOL    pending = FALSE;        /* the open transaction writes the file */
+    uint32_t    fileLength = 0;
+    const unsigned char *buffer;
+    uint32_t    recordsLength;          /* length of the records not yet committed */
+#ifdef TPM_NV_MMAP
+    TPM_NVRAM_MAPPING *mapping;
+#endif
+
+#ifdef TPM_LIBTPMS_CALLBACKS
+    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+
+    /* the user provided NVRAM holds what was last stored through it */
+    if (cbs->tpm_nvram_updatedata) {
+        callback = TRUE;
+        checked = TRUE;
+    }
+    /* the store callbacks only know how to store the data as a whole */
+    else if (cbs->tpm_nvram_storedata || cbs->tpm_nvram_storedata_async) {
+        storeAll = TRUE;
+    }
+#endif
+
+    printf(" TPM_NVRAM_UpdateData: To name %s\n", name);
+    if (!storeAll) {
+        if ((oldData == NULL) || (length != oldLength)) {
+            printf("  TPM_NVRAM_UpdateData: Length changed from %u to %u\n", oldLength, length);
+            storeAll = TRUE;
+        }
+    }
+#ifdef TPM_NV_MMAP
+    /* the length of a mapped file is known without opening it */
+    if ((rc == 0) && !storeAll && !checked) {
+        mapping = TPM_NVRAM_FindMapping(tpm_number, name);
+        if (mapping != NULL) {
+            exists = TRUE;
+            sized = TRUE;
+            fileLength = mapping->length;
+        }
+    }
+#endif
+    /* the update is only safe if the file holds what was last written */
+    if ((rc == 0) && !storeAll && !checked && !sized) {
         TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
-        /* open the file */
-        printf(" TPM_NVRAM_StoreData: Opening file %s\n", filename);
-        file = fopen(filename, "wb");                           /* closed @1 */
+        file = fopen(filename, "rb");                           /* closed @1 */
         if (file == NULL) {
-            printf("TPM_NVRAM_StoreData: Error (fatal) opening %s for write failed, %s\n",
-                   filename, strerror(errno));
-            rc = TPM_FAIL;
+            printf("  TPM_NVRAM_UpdateData: Cannot open %s, %s\n", filename, strerror(errno));
+        }
+        else {
+            irc = fseek(file, 0L, SEEK_END);
+            lrc = ftell(file);
+            exists = ((irc == 0) && (lrc >= 0));
+            fileLength = (uint32_t)lrc;
+            fclose(file);               /* @1 */
         }
     }
-    /* write the data to the file */
-    if (rc == 0) {
-        printf("  TPM_NVRAM_StoreData: Writing %u bytes of data\n", length);
-        lrc = fwrite(data, 1, length, file);
-        if (lrc != length) {
-            printf("TPM_NVRAM_StoreData: Error (fatal), data write of %u only wrote %u\n",
-                   length, lrc);
-            rc = TPM_FAIL;
+    /* the ranges are written after the records of the open transaction */
+    if ((rc == 0) && !storeAll && !checked) {
+        rc = TPM_NVRAM_ApplyPending(NULL, &fileLength, &exists, &pending, tpm_number, name);
+    }
+    if ((rc == 0) && !storeAll && !checked) {
+        if (!exists || (fileLength != oldLength)) {
+            printf("  TPM_NVRAM_UpdateData: File length %u is not %u\n", fileLength, oldLength);
+            storeAll = TRUE;
         }
     }
-    if (file != NULL) {
-        printf("  TPM_NVRAM_StoreData: Closing file %s\n", filename);
-        irc = fclose(file);             /* @1 */
-        if (irc != 0) {
-            printf("TPM_NVRAM_StoreData: Error (fatal) closing file\n");
-            rc = TPM_FAIL;
+    /* once the ranges of the file fill half of the transaction, a store of the whole data
+       replaces them, so that a long transaction fits the journal */
+    if ((rc == 0) && !storeAll && !checked && pending) {
+        TPM_Sbuffer_Get(&(tpm_nvram_journal[tpm_number].records), &buffer, &recordsLength);
+        if (recordsLength > (TPM_ALLOC_MAX / 2)) {
+            printf("  TPM_NVRAM_UpdateData: Replacing the ranges of %s\n", name);
+            storeAll = TRUE;
+        }
+    }
+#ifdef TPM_LIBTPMS_CALLBACKS
+    /* the ranges must not overtake a store of the whole data */
+    if ((rc == 0) && !storeAll && callback) {
+        rc = TPM_NVRAM_WaitStores(tpm_number);
+    }
+#endif
+    /* journal the changed ranges.  Ranges separated by only a few unchanged bytes are written
+       together to save records and write calls. */
+    for (start = 0 ; (rc == 0) && !storeAll && (start < length) ; start = end) {
+        if (data[start] == oldData[start]) {
+            end = start + 1;
+            continue;
+        }
+        for (end = start + 1, same = 0 ;
+             (end < length) && (same < TPM_NVRAM_UPDATE_GAP) ;
+             end++) {
+            same = (data[end] == oldData[end]) ? (same + 1) : 0;
+        }
+        end -= same;
+        if (!callback) {
+            rc = TPM_NVRAM_AddRecord(tpm_number, TPM_NVRAM_RECORD_UPDATE, name,
+                                     start, data + start, end - start);
         }
+#ifdef TPM_LIBTPMS_CALLBACKS
         else {
-            printf("  TPM_NVRAM_StoreData: Closed file %s\n", filename);
+            rc = cbs->tpm_nvram_updatedata(data + start, end - start, start, tpm_number, name);
         }
+#endif
+        written += end - start;
+    }
+    if ((rc == 0) && !storeAll) {
+        printf("  TPM_NVRAM_UpdateData: Wrote %u of %u bytes\n", written, length);
+    }
+    if ((rc == 0) && storeAll) {
+        rc = TPM_NVRAM_StoreData(data, length, tpm_number, name);
     }
     return rc;
 }
@@ -345,6 +676,9 @@ static void TPM_NVRAM_GetFilenameForName(char *filename,        /* output: roote
         TPM_FAIL if the file could not be removed, since this should never occur and there is
 		no recovery
 
+   The removal is journaled.  The file is removed when the transaction is committed.  Whether the
+   file exists includes the writes of the open transaction.
+
    NOTE: Not portable code, but supported by Linux and Windows
 */
 
@@ -354,6 +688,8 @@ TPM_RESULT TPM_NVRAM_DeleteName(uint32_t tpm_number,
 {
     TPM_RESULT  rc = 0;
     int         irc;
+    TPM_BOOL    exists = FALSE;         /* the file exists and must be removed */
+    uint32_t    length = 0;             /* unused length of the file */
     char        filename[FILENAME_MAX]; /* rooted file name from name */
 
 #ifdef TPM_LIBTPMS_CALLBACKS
@@ -362,24 +698,1246 @@ TPM_RESULT TPM_NVRAM_DeleteName(uint32_t tpm_number,
     /* call user-provided function if available, otherwise execute
        default behavior */
     if (cbs->tpm_nvram_deletename) {
-        rc = cbs->tpm_nvram_deletename(tpm_number, name, mustExist);
+        rc = TPM_NVRAM_WaitStores(tpm_number);
+        if (rc == 0) {
+            rc = cbs->tpm_nvram_deletename(tpm_number, name, mustExist);
+        }
         return rc;
     }
 #endif
     
     printf(" TPM_NVRAM_DeleteName: Name %s\n", name);
-    /* map name to the rooted filename */
-    TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
     if (rc == 0) {
-        irc = remove(filename);
-        if ((irc != 0) &&               /* if the remove failed */
-            (mustExist ||               /* if any error is a failure, or */
-             (errno != ENOENT))) {      /* if error other than no such file */
+        /* map name to the rooted filename */
+        TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+        irc = access(filename, F_OK);
+        if ((irc != 0) && (errno != ENOENT)) {  /* if error other than no such file */
             printf("TPM_NVRAM_DeleteName: Error, (fatal) file remove failed, errno %d\n",
                    errno);
             rc = TPM_FAIL;
         }
+        exists = (irc == 0);
+    }
+    /* whether the file exists depends on the writes of the open transaction */
+    if (rc == 0) {
+        rc = TPM_NVRAM_ApplyPending(NULL, &length, &exists, NULL, tpm_number, name);
+    }
+    if ((rc == 0) && !exists && mustExist) {
+        printf("TPM_NVRAM_DeleteName: Error, (fatal) file remove failed, no file %s\n", name);
+        rc = TPM_FAIL;
+    }
+    if ((rc == 0) && exists) {
+        rc = TPM_NVRAM_AddRecord(tpm_number, TPM_NVRAM_RECORD_DELETE, name, 0, NULL, 0);
+    }
+    return rc;
+}
+
+/*
+  Mapped state files
+*/
+
+/* TPM_NVRAM_MapData() loads 'data' of 'length' from the 'name' like TPM_NVRAM_LoadData(), but
+   without copying it if possible.
+
+   A TPM_NV_MMAP build returns the mapping of the file.  It is valid until the file is written or
+   removed, so the data must be deserialized before the next NVRAM write of the TPM.
+
+   'data' must be released with TPM_NVRAM_ReleaseData() after use.
+
+   Returns
+        0 on success.
+        TPM_RETRY and NULL,0 on non-existent file (non-fatal, first time start up)
+        TPM_FAIL on failure to load (fatal), since it should never occur
+*/
+
+TPM_RESULT TPM_NVRAM_MapData(unsigned char **data,      /* released by caller */
+                             uint32_t *length,
+                             uint32_t tpm_number,
+                             const char *name)
+{
+    TPM_RESULT  rc = 0;
+#ifdef TPM_NV_MMAP
+    TPM_NVRAM_MAPPING *mapping = NULL;
+    TPM_BOOL    map = TRUE;             /* the default NVRAM implementation is used */
+    TPM_BOOL    exists = FALSE;         /* unused existence of the file */
+    uint32_t    fileLength = 0;         /* unused length of the file */
+    TPM_BOOL    pending = FALSE;        /* the open transaction writes the file */
+
+#ifdef TPM_LIBTPMS_CALLBACKS
+    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+
+    /* a user-provided load function returns a copy */
+    if (cbs->tpm_nvram_loaddata) {
+        map = FALSE;
+    }
+#endif
+
+    if (map) {
+        printf(" TPM_NVRAM_MapData: From file %s\n", name);
+        *data = NULL;
+        *length = 0;
+        /* the file does not yet reflect writes of the open transaction, a copy is loaded */
+        if (rc == 0) {
+            rc = TPM_NVRAM_ApplyPending(NULL, &fileLength, &exists, &pending, tpm_number, name);
+        }
+        if ((rc == 0) && !pending) {
+            rc = TPM_NVRAM_MapFile(&mapping, tpm_number, name);
+        }
+        if ((rc == 0) && (mapping != NULL)) {
+            *data = mapping->data;
+            *length = mapping->length;
+        }
+    }
+    /* an empty file, a file beyond the mappings of the TPM, or a file written by the open
+       transaction is read */
+    if ((rc == 0) && (mapping == NULL)) {
+        rc = TPM_NVRAM_LoadData(data, length, tpm_number, name);
+    }
+#else
+    rc = TPM_NVRAM_LoadData(data, length, tpm_number, name);
+#endif
+    return rc;
+}
+
+/* TPM_NVRAM_ReleaseData() releases 'data' returned by TPM_NVRAM_MapData() for the 'name'.
+
+   A copy is freed.  A mapping stays until TPM_NVRAM_Close().
+*/
+
+void TPM_NVRAM_ReleaseData(unsigned char *data,
+                           uint32_t tpm_number,
+                           const char *name)
+{
+#ifdef TPM_NV_MMAP
+    TPM_NVRAM_MAPPING *mapping = TPM_NVRAM_FindMapping(tpm_number, name);
+
+    if ((mapping != NULL) && (mapping->data == data)) {
+        return;
+    }
+#else
+    tpm_number = tpm_number;
+    name = name;
+#endif
+    free(data);
+    return;
+}
+
+/* TPM_NVRAM_Close() unmaps the state files of the TPM 'tpm_number'.
+
+   It is called when the TPM instance is deleted.  Writes to the mappings that are not yet synced
+   are synced through the journal at the next checkpoint, like writes to unmapped files.
+*/
+
+void TPM_NVRAM_Close(uint32_t tpm_number)
+{
+#ifdef TPM_NV_MMAP
+    size_t      i;
+
+    printf(" TPM_NVRAM_Close: TPM %lu\n", (unsigned long)tpm_number);
+    for (i = 0 ; (tpm_number < TPMS_MAX) && (i < TPM_NVRAM_MAPPINGS) ; i++) {
+        if (tpm_nvram_mappings[tpm_number][i].name[0] != '\0') {
+            TPM_NVRAM_UnmapFile(&(tpm_nvram_mappings[tpm_number][i]));
+        }
+    }
+#else
+    tpm_number = tpm_number;
+#endif
+    return;
+}
+
+#ifdef TPM_NV_MMAP
+
+/* TPM_NVRAM_FindMapping() returns the mapping of the file 'name' of the TPM 'tpm_number', or
+   NULL if the file is not mapped.
+*/
+
+static TPM_NVRAM_MAPPING *TPM_NVRAM_FindMapping(uint32_t tpm_number,
+                                                const char *name)
+{
+    size_t      i;
+
+    for (i = 0 ; (tpm_number < TPMS_MAX) && (name[0] != '\0') && (i < TPM_NVRAM_MAPPINGS) ; i++) {
+        if (strcmp(tpm_nvram_mappings[tpm_number][i].name, name) == 0) {
+            return &(tpm_nvram_mappings[tpm_number][i]);
+        }
+    }
+    return NULL;
+}
+
+/* TPM_NVRAM_MapFile() maps the file 'name' of the TPM 'tpm_number' into memory, unless it is
+   mapped already.
+
+   '*mapping' is NULL if the file is empty or all mappings of the TPM are in use.
+
+   Returns
+        0 on success.
+        TPM_RETRY on non-existent file
+        TPM_FAIL on failure to map
+*/
+
+static TPM_RESULT TPM_NVRAM_MapFile(TPM_NVRAM_MAPPING **mapping,
+                                    uint32_t tpm_number,
+                                    const char *name)
+{
+    TPM_RESULT  rc = 0;
+    TPM_NVRAM_MAPPING *slot = NULL;     /* unused mapping */
+    struct stat st;
+    void        *data;
+    size_t      i;
+    int         fd = -1;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+
+    *mapping = TPM_NVRAM_FindMapping(tpm_number, name);
+    if (*mapping != NULL) {
+        return rc;
+    }
+    for (i = 0 ; (tpm_number < TPMS_MAX) && (slot == NULL) && (i < TPM_NVRAM_MAPPINGS) ; i++) {
+        if (tpm_nvram_mappings[tpm_number][i].name[0] == '\0') {
+            slot = &(tpm_nvram_mappings[tpm_number][i]);
+        }
+    }
+    if ((slot == NULL) || (strlen(name) >= TPM_FILENAME_MAX)) {
+        return rc;
+    }
+    if (rc == 0) {
+        TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+        fd = open(filename, O_RDWR);                            /* closed @1 */
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                printf("TPM_NVRAM_MapFile: No such file %s\n", filename);
+                rc = TPM_RETRY;         /* first time start up */
+            }
+            else {
+                printf("TPM_NVRAM_MapFile: Error (fatal) opening %s, %s\n",
+                       filename, strerror(errno));
+                rc = TPM_FAIL;
+            }
+        }
+    }
+    if (rc == 0) {
+        if (fstat(fd, &st) != 0) {
+            printf("TPM_NVRAM_MapFile: Error (fatal) stat'ing %s, %s\n",
+                   filename, strerror(errno));
+            rc = TPM_FAIL;
+        }
+    }
+    /* an empty file cannot be mapped, it is read instead */
+    if ((rc == 0) && (st.st_size > 0) && (st.st_size <= TPM_ALLOC_MAX)) {
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            printf("TPM_NVRAM_MapFile: Error (fatal) mapping %s, %s\n",
+                   filename, strerror(errno));
+            rc = TPM_FAIL;
+        }
+        else {
+            printf("  TPM_NVRAM_MapFile: Mapped %u bytes of %s\n",
+                   (unsigned int)st.st_size, filename);
+            strcpy(slot->name, name);
+            slot->data = data;
+            slot->length = (uint32_t)st.st_size;
+            /* the file may hold unsynced writes from before it was mapped */
+            slot->dirty = TRUE;
+            *mapping = slot;
+        }
+    }
+    /* the mapping stays valid after the file is closed */
+    if (fd >= 0) {
+        close(fd);                      /* @1 */
     }
     return rc;
 }
 
+/* TPM_NVRAM_UnmapFile() unmaps the file of 'mapping' and frees the mapping for another file
+ */
+
+static void TPM_NVRAM_UnmapFile(TPM_NVRAM_MAPPING *mapping)
+{
+    printf("  TPM_NVRAM_UnmapFile: Unmapping %s\n", mapping->name);
+    munmap(mapping->data, mapping->length);
+    mapping->name[0] = '\0';
+    mapping->data = NULL;
+    mapping->length = 0;
+    return;
+}
+
+/* TPM_NVRAM_WriteMapping() applies a journal record of 'type' for the file 'name' of the TPM
+   'tpm_number' to the mapping of the file.
+
+   A record that keeps the length of the file is copied into the mapping.  For a record that
+   removes the file or changes its length, the file is unmapped and the record is applied to the
+   file.  The file is mapped again the next time it is loaded.
+
+   Returns TRUE if the record was applied, FALSE if it must be applied to the file.
+*/
+
+static TPM_BOOL TPM_NVRAM_WriteMapping(uint32_t tpm_number,
+                                       uint32_t type,
+                                       const char *name,
+                                       uint32_t offset,
+                                       const unsigned char *data,
+                                       uint32_t length)
+{
+    TPM_BOOL    written = FALSE;
+    TPM_NVRAM_MAPPING *mapping = TPM_NVRAM_FindMapping(tpm_number, name);
+
+    if (mapping == NULL) {
+        return written;
+    }
+    switch (type) {
+      case TPM_NVRAM_RECORD_STORE:
+        written = (length == mapping->length);
+        break;
+      case TPM_NVRAM_RECORD_UPDATE:
+        written = ((offset <= mapping->length) && (length <= (mapping->length - offset)));
+        break;
+      default:
+        break;
+    }
+    if (written) {
+        printf("  TPM_NVRAM_WriteMapping: Writing %u bytes at %u to mapped %s\n",
+               length, offset, name);
+        memcpy(mapping->data + offset, data, length);
+        mapping->dirty = TRUE;
+    }
+    else {
+        TPM_NVRAM_UnmapFile(mapping);
+    }
+    return written;
+}
+
+#endif	/* TPM_NV_MMAP */
+
+/*
+  Write-ahead journal
+*/
+
+/* TPM_NVRAM_Begin() opens a transaction for the TPM 'tpm_number'.
+
+   Writes and removals are collected until TPM_NVRAM_Commit() and then made durable together.
+   Without an open transaction, each write is committed on its own.
+
+   A failure of the user provided begin function is returned by TPM_NVRAM_Commit().
+*/
+
+void TPM_NVRAM_Begin(uint32_t tpm_number)
+{
+#ifdef TPM_LIBTPMS_CALLBACKS
+    TPM_RESULT  rc;
+    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+#endif
+
+    if (tpm_number < TPMS_MAX) {
+        tpm_nvram_journal[tpm_number].transaction = TRUE;
+#ifdef TPM_LIBTPMS_CALLBACKS
+        if (cbs->tpm_nvram_begin) {
+            rc = cbs->tpm_nvram_begin(tpm_number);
+            if (rc != 0) {
+                printf("TPM_NVRAM_Begin: Error, begin callback failed for TPM %lu\n",
+                       (unsigned long)tpm_number);
+                TPM_NVRAM_SetCallbackError(tpm_number, rc);
+            }
+        }
+#endif
+    }
+    return;
+}
+
+/* TPM_NVRAM_Commit() closes the transaction of the TPM 'tpm_number'.
+
+   The collected records and a commit record are appended to the journal, which is then flushed to
+   the disk with one fsync().  Only then are the records applied to the state files.  When the
+   journal would grow beyond TPM_NVRAM_JOURNAL_MAX, a checkpoint first empties it, so that the
+   journal can be read back in one allocation.
+
+   If the user provided NVRAM callbacks, the asynchronous stores are awaited and the user provided
+   commit function is called instead.
+
+   Returns
+        0 on success
+        TPM_FAIL if the records could not be made durable.  The records are discarded.
+*/
+
+TPM_RESULT TPM_NVRAM_Commit(uint32_t tpm_number)
+{
+    TPM_RESULT          rc = 0;
+#ifdef TPM_LIBTPMS_CALLBACKS
+    TPM_RESULT          rc1;
+#endif
+    TPM_NVRAM_JOURNAL   *journal = NULL;
+    unsigned char       *buffer;        /* the records */
+    uint32_t            length = 0;     /* length of the records */
+    uint32_t            total;          /* length of the records and the commit record */
+    uint32_t            size;           /* allocated size of the buffer */
+    TPM_DIGEST          digest;         /* digest over the records */
+    size_t              src;
+    int                 irc;
+    FILE                *file = NULL;
+    char                filename[FILENAME_MAX]; /* rooted file name of the journal */
+#ifdef TPM_LIBTPMS_CALLBACKS
+    TPM_BOOL            transaction;
+    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+
+    /* the stores of a user provided NVRAM do not use the journal */
+    if (!TPM_NVRAM_Journaled() && (tpm_number < TPMS_MAX)) {
+        transaction = tpm_nvram_journal[tpm_number].transaction;
+        tpm_nvram_journal[tpm_number].transaction = FALSE;
+        rc = TPM_NVRAM_WaitStores(tpm_number);
+        if (transaction && cbs->tpm_nvram_commit) {
+            rc1 = cbs->tpm_nvram_commit(tpm_number);
+            if (rc == 0) {
+                rc = rc1;
+            }
+        }
+        return rc;
+    }
+#endif
+
+    if (tpm_number < TPMS_MAX) {
+        journal = &(tpm_nvram_journal[tpm_number]);
+        journal->transaction = FALSE;
+        TPM_Sbuffer_GetAll(&(journal->records), &buffer, &length, &size);
+    }
+    /* nothing was written */
+    if (length == 0) {
+        return rc;
+    }
+    printf(" TPM_NVRAM_Commit: Committing %u bytes of records\n", length);
+    /* close the transaction with the commit record */
+    if (rc == 0) {
+        rc = TPM_SHA1(digest,
+                      length, buffer,
+                      0, NULL);
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append32(&(journal->records), TPM_NVRAM_RECORD_COMMIT);
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append16(&(journal->records), 0);
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append32(&(journal->records), length);
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append32(&(journal->records), TPM_DIGEST_SIZE);
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append(&(journal->records), digest, TPM_DIGEST_SIZE);
+    }
+    /* the append may have moved the buffer */
+    if (rc == 0) {
+        TPM_Sbuffer_GetAll(&(journal->records), &buffer, &total, &size);
+        if ((journal->size + total) > TPM_NVRAM_JOURNAL_MAX) {
+            rc = TPM_NVRAM_Checkpoint(tpm_number, FALSE);
+        }
+    }
+    if (rc == 0) {
+        TPM_NVRAM_GetFilenameForName(filename, tpm_number, TPM_NVRAM_JOURNAL_NAME);
+        file = fopen(filename, "ab");                           /* closed @1 */
+        if (file == NULL) {
+            printf("TPM_NVRAM_Commit: Error (fatal) opening %s for append, %s\n",
+                   filename, strerror(errno));
+            rc = TPM_FAIL;
+        }
+    }
+    if (rc == 0) {
+        src = fwrite(buffer, 1, total, file);
+        if (src != total) {
+            printf("TPM_NVRAM_Commit: Error (fatal), journal write of %u only wrote %lu\n",
+                   total, (unsigned long)src);
+            rc = TPM_FAIL;
+        }
+    }
+    /* the single fsync() that makes the transaction durable */
+    if (rc == 0) {
+        rc = TPM_NVRAM_SyncFile(file, filename);
+    }
+    if (file != NULL) {
+        irc = fclose(file);             /* @1 */
+        if (irc != 0) {
+            printf("TPM_NVRAM_Commit: Error (fatal) closing file %s\n", filename);
+            rc = TPM_FAIL;
+        }
+    }
+    /* the transaction is durable, apply it to the state files.  A crash from here on is
+       repaired by replaying the journal. */
+    if (rc == 0) {
+        journal->size += total;
+        rc = TPM_NVRAM_ApplyRecords(tpm_number, buffer, length);
+    }
+    TPM_Sbuffer_Clear(&(journal->records));
+    return rc;
+}
+
+/* TPM_NVRAM_Flush() commits the records collected so far, but leaves the transaction of the TPM
+   'tpm_number' open, so that the following writes are still collected.
+
+   It is only used when a transaction outgrows the journal allocation, since the records committed
+   early are no longer undone by a crash before TPM_NVRAM_Commit().
+*/
+
+static TPM_RESULT TPM_NVRAM_Flush(uint32_t tpm_number)
+{
+    TPM_RESULT  rc = 0;
+    TPM_BOOL    transaction = FALSE;
+
+    if (tpm_number < TPMS_MAX) {
+        transaction = tpm_nvram_journal[tpm_number].transaction;
+    }
+    rc = TPM_NVRAM_Commit(tpm_number);
+    if (tpm_number < TPMS_MAX) {
+        tpm_nvram_journal[tpm_number].transaction = transaction;
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Recover() replays the journal of the TPM 'tpm_number' after a restart.
+
+   Each complete transaction is applied to the state files.  A transaction that was torn by a crash
+   while it was appended to the journal is discarded, so the state files hold the result of the
+   last committed transaction.
+
+   It must be called before the state of the TPM is loaded.
+
+   Returns
+        0 on success
+        TPM_FAIL if the state files could not be repaired
+*/
+
+TPM_RESULT TPM_NVRAM_Recover(uint32_t tpm_number)
+{
+    TPM_RESULT  rc = 0;
+
+#ifdef TPM_LIBTPMS_CALLBACKS
+    /* a user-provided NVRAM does not use the journal */
+    if (!TPM_NVRAM_Journaled()) {
+        return rc;
+    }
+#endif
+
+    printf(" TPM_NVRAM_Recover: TPM %lu\n", (unsigned long)tpm_number);
+    if (rc == 0) {
+        if (tpm_number >= TPMS_MAX) {
+            printf("TPM_NVRAM_Recover: Error (fatal), TPM %lu out of range\n",
+                   (unsigned long)tpm_number);
+            rc = TPM_FAIL;
+        }
+    }
+#ifdef TPM_NV_MMAP
+    /* mappings left by an instance that could not be created would miss the replay */
+    if (rc == 0) {
+        TPM_NVRAM_Close(tpm_number);
+    }
+#endif
+    if (rc == 0) {
+        rc = TPM_NVRAM_Checkpoint(tpm_number, TRUE);
+    }
+    return rc;
+}
+
+#ifdef TPM_LIBTPMS_CALLBACKS
+
+/* TPM_NVRAM_Journaled() returns TRUE if the stores use the journal of the default file
+   implementation, FALSE if they use a user provided NVRAM.
+*/
+
+static TPM_BOOL TPM_NVRAM_Journaled(void)
+{
+    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+
+    return ((cbs->tpm_nvram_storedata == NULL) && (cbs->tpm_nvram_storedata_async == NULL));
+}
+
+#endif	/* TPM_LIBTPMS_CALLBACKS */
+
+/* TPM_NVRAM_ApplyPending() applies the records of the open transaction of the TPM 'tpm_number'
+   for the file 'name' to the content of the file, so that a load or removal sees the writes that
+   are not yet committed.
+
+   On input, 'data' of 'length' and 'exists' describe the file.  On output, they describe the file
+   as it will be after the commit.  'data' can be NULL if only the length and the existence are
+   needed.  'written' can be NULL, otherwise it is set TRUE if a record writes the file.
+*/
+
+static TPM_RESULT TPM_NVRAM_ApplyPending(unsigned char **data,
+                                         uint32_t *length,
+                                         TPM_BOOL *exists,
+                                         TPM_BOOL *written,
+                                         uint32_t tpm_number,
+                                         const char *name)
+{
+    TPM_RESULT          rc = 0;
+    const unsigned char *buffer;
+    unsigned char       *stream;
+    uint32_t            stream_size = 0;
+    uint32_t            type;
+    char                recordName[TPM_FILENAME_MAX];
+    uint32_t            offset;
+    unsigned char       *recordData;
+    uint32_t            recordLength;
+    uint32_t            end;            /* end of the written range */
+
+    if (tpm_number < TPMS_MAX) {
+        TPM_Sbuffer_Get(&(tpm_nvram_journal[tpm_number].records), &buffer, &stream_size);
+        stream = (unsigned char *)buffer;
+    }
+    while ((rc == 0) && (stream_size > 0)) {
+        rc = TPM_NVRAM_LoadRecord(&type, recordName, &offset, &recordData, &recordLength,
+                                  &stream, &stream_size);
+        if ((rc != 0) || (strcmp(recordName, name) != 0)) {
+            continue;
+        }
+        if (written != NULL) {
+            *written = TRUE;
+        }
+        switch (type) {
+          case TPM_NVRAM_RECORD_STORE:
+            *exists = TRUE;
+            *length = recordLength;
+            if (data != NULL) {
+                free(*data);
+                *data = NULL;
+                if (recordLength != 0) {
+                    rc = TPM_Malloc(data, recordLength);
+                }
+                if ((rc == 0) && (recordLength != 0)) {
+                    memcpy(*data, recordData, recordLength);
+                }
+            }
+            break;
+          case TPM_NVRAM_RECORD_UPDATE:
+            /* like TPM_NVRAM_ApplyRecords(), an update creates or extends the file */
+            if (!*exists) {
+                *length = 0;
+                *exists = TRUE;
+            }
+            end = offset + recordLength;
+            if ((data != NULL) && (end > *length)) {
+                rc = TPM_Realloc(data, end);
+                if (rc == 0) {
+                    memset(*data + *length, 0, end - *length);
+                }
+            }
+            if (end > *length) {
+                *length = end;
+            }
+            if ((rc == 0) && (data != NULL)) {
+                memcpy(*data + offset, recordData, recordLength);
+            }
+            break;
+          case TPM_NVRAM_RECORD_DELETE:
+            *exists = FALSE;
+            *length = 0;
+            if (data != NULL) {
+                free(*data);
+                *data = NULL;
+            }
+            break;
+          default:
+            break;
+        }
+    }
+    if (rc != 0) {
+        printf("TPM_NVRAM_ApplyPending: Error (fatal) applying the records of %s\n", name);
+        rc = TPM_FAIL;
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_DropRecords() removes the records for the file 'name' from the open transaction of the
+   TPM 'tpm_number'.  It is called before a record that replaces or removes the whole file, which
+   makes the earlier records of the file obsolete.  The transaction then grows with the number of
+   files written, not with the number of writes.
+*/
+
+static TPM_RESULT TPM_NVRAM_DropRecords(uint32_t tpm_number,
+                                        const char *name)
+{
+    TPM_RESULT          rc = 0;
+    TPM_NVRAM_JOURNAL   *journal = &(tpm_nvram_journal[tpm_number]);
+    unsigned char       *buffer;
+    uint32_t            length;         /* length of the records */
+    uint32_t            total;          /* allocated size of the buffer */
+    unsigned char       *stream;
+    uint32_t            stream_size;
+    unsigned char       *record;        /* start of the current record */
+    unsigned char       *kept;          /* end of the records kept */
+    uint32_t            type;
+    char                recordName[TPM_FILENAME_MAX];
+    uint32_t            offset;
+    unsigned char       *recordData;
+    uint32_t            recordLength;
+
+    TPM_Sbuffer_GetAll(&(journal->records), &buffer, &length, &total);
+    stream = buffer;
+    stream_size = length;
+    kept = buffer;
+    while ((rc == 0) && (stream_size > 0)) {
+        record = stream;
+        rc = TPM_NVRAM_LoadRecord(&type, recordName, &offset, &recordData, &recordLength,
+                                  &stream, &stream_size);
+        if ((rc == 0) && (strcmp(recordName, name) != 0)) {
+            memmove(kept, record, stream - record);
+            kept += stream - record;
+        }
+    }
+    if ((rc == 0) && (kept != (buffer + length))) {
+        printf("  TPM_NVRAM_DropRecords: Dropping %u bytes of records of %s\n",
+               (uint32_t)((buffer + length) - kept), name);
+        rc = TPM_Sbuffer_Set(&(journal->records), buffer, (uint32_t)(kept - buffer), total);
+    }
+    if (rc != 0) {
+        printf("TPM_NVRAM_DropRecords: Error (fatal) dropping the records of %s\n", name);
+        rc = TPM_FAIL;
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_Checkpoint() makes the state files of the TPM 'tpm_number' durable and empties the
+   journal.
+
+   If 'replay' is TRUE, the complete transactions in the journal are first applied to the state
+   files.  Otherwise they have already been applied by TPM_NVRAM_Commit().
+
+   The state files are written first and synced afterwards, so that each file costs at most one
+   fsync() however often the journal wrote it.
+*/
+
+static TPM_RESULT TPM_NVRAM_Checkpoint(uint32_t tpm_number,
+                                       TPM_BOOL replay)
+{
+    TPM_RESULT          rc = 0;
+    TPM_RESULT          rc1;
+    unsigned char       *journalData = NULL;    /* freed @1 */
+    uint32_t            journalLength;
+    unsigned char       *stream;
+    uint32_t            stream_size;
+    unsigned char       *transaction;   /* start of the current transaction */
+    unsigned char       *record;        /* start of the current record */
+    uint32_t            committed = 0;  /* length of the complete transactions */
+    uint32_t            type;
+    char                name[TPM_FILENAME_MAX];
+    uint32_t            offset;
+    unsigned char       *data;
+    uint32_t            length;
+    TPM_BOOL            torn = FALSE;   /* the rest of the journal is a torn transaction */
+    int                 irc;
+    int                 fd;
+    FILE                *file = NULL;
+    char                filename[FILENAME_MAX]; /* rooted file name of the journal */
+
+    printf(" TPM_NVRAM_Checkpoint: TPM %lu\n", (unsigned long)tpm_number);
+    if (rc == 0) {
+        TPM_NVRAM_GetFilenameForName(filename, tpm_number, TPM_NVRAM_JOURNAL_NAME);
+        rc = TPM_NVRAM_ReadFile(&journalData, &journalLength, filename);        /* freed @1 */
+    }
+    /* no journal, nothing to recover */
+    if (rc == TPM_RETRY) {
+        tpm_nvram_journal[tpm_number].size = 0;
+        return 0;
+    }
+    /* find the complete transactions */
+    stream = journalData;
+    stream_size = journalLength;
+    transaction = stream;
+    while ((rc == 0) && !torn && (stream_size > 0)) {
+        record = stream;
+        rc1 = TPM_NVRAM_LoadRecord(&type, name, &offset, &data, &length, &stream, &stream_size);
+        if (rc1 != 0) {
+            torn = TRUE;
+        }
+        else if (type == TPM_NVRAM_RECORD_COMMIT) {
+            if ((offset != (uint32_t)(record - transaction)) ||
+                (length != TPM_DIGEST_SIZE) ||
+                (TPM_SHA1_Check(data, offset, transaction, 0, NULL) != 0)) {
+                torn = TRUE;
+            }
+            else {
+                transaction = stream;
+                committed = (uint32_t)(stream - journalData);
+            }
+        }
+    }
+    if ((rc == 0) && (committed != journalLength)) {
+        printf("  TPM_NVRAM_Checkpoint: Discarding %u bytes of a torn transaction\n",
+               journalLength - committed);
+    }
+    if ((rc == 0) && replay) {
+        printf("  TPM_NVRAM_Checkpoint: Replaying %u bytes of the journal\n", committed);
+        rc = TPM_NVRAM_ApplyRecords(tpm_number, journalData, committed);
+    }
+    if (rc == 0) {
+        rc = TPM_NVRAM_SyncRecords(tpm_number, journalData, committed);
+    }
+    /* make created and removed files durable */
+    if (rc == 0) {
+        fd = open(state_directory, O_RDONLY);
+        if ((fd < 0) || (fsync(fd) != 0)) {
+            printf("TPM_NVRAM_Checkpoint: Error (fatal) syncing directory %s, %s\n",
+                   state_directory, strerror(errno));
+            rc = TPM_FAIL;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    /* the state files are durable, empty the journal */
+    if (rc == 0) {
+        file = fopen(filename, "wb");                           /* closed @2 */
+        if (file == NULL) {
+            printf("TPM_NVRAM_Checkpoint: Error (fatal) opening %s for write, %s\n",
+                   filename, strerror(errno));
+            rc = TPM_FAIL;
+        }
+    }
+    if (rc == 0) {
+        rc = TPM_NVRAM_SyncFile(file, filename);
+    }
+    if (file != NULL) {
+        irc = fclose(file);             /* @2 */
+        if (irc != 0) {
+            printf("TPM_NVRAM_Checkpoint: Error (fatal) closing file %s\n", filename);
+            rc = TPM_FAIL;
+        }
+    }
+    if (rc == 0) {
+        tpm_nvram_journal[tpm_number].size = 0;
+    }
+    free(journalData);                  /* @1 */
+    return rc;
+}
+
+/* TPM_NVRAM_AddRecord() adds a record for the file 'name' of the TPM 'tpm_number' to the open
+   transaction.  Without an open transaction, the record is committed at once.
+
+   'data' of 'length' is written at 'offset'.  It is unused for TPM_NVRAM_RECORD_DELETE.
+*/
+
+static TPM_RESULT TPM_NVRAM_AddRecord(uint32_t tpm_number,
+                                      uint32_t type,
+                                      const char *name,
+                                      uint32_t offset,
+                                      const unsigned char *data,
+                                      uint32_t length)
+{
+    TPM_RESULT          rc = 0;
+    TPM_NVRAM_JOURNAL   *journal = NULL;
+    const unsigned char *buffer;
+    uint32_t            pending;        /* length of the records not yet committed */
+    size_t              nameLength = strlen(name);
+
+    if (rc == 0) {
+        if ((tpm_number >= TPMS_MAX) || (nameLength >= TPM_FILENAME_MAX)) {
+            printf("TPM_NVRAM_AddRecord: Error (fatal), TPM %lu name %s out of range\n",
+                   (unsigned long)tpm_number, name);
+            rc = TPM_FAIL;
+        }
+    }
+    /* a record that replaces or removes the file makes its earlier records obsolete */
+    if ((rc == 0) &&
+        ((type == TPM_NVRAM_RECORD_STORE) || (type == TPM_NVRAM_RECORD_DELETE))) {
+        rc = TPM_NVRAM_DropRecords(tpm_number, name);
+    }
+    /* if the record and a commit record still do not fit behind the pending records, commit those
+       first */
+    if (rc == 0) {
+        journal = &(tpm_nvram_journal[tpm_number]);
+        TPM_Sbuffer_Get(&(journal->records), &buffer, &pending);
+        if ((pending != 0) &&
+            ((pending + (2 * TPM_NVRAM_RECORD_HEADER) + nameLength + length + TPM_DIGEST_SIZE) >
+             TPM_ALLOC_MAX)) {
+            rc = TPM_NVRAM_Flush(tpm_number);
+        }
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append32(&(journal->records), type);
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append16(&(journal->records), (uint16_t)nameLength);
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append(&(journal->records), (const unsigned char *)name, nameLength);
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append32(&(journal->records), offset);
+    }
+    if (rc == 0) {
+        rc = TPM_Sbuffer_Append32(&(journal->records), length);
+    }
+    if ((rc == 0) && (length != 0)) {
+        rc = TPM_Sbuffer_Append(&(journal->records), data, length);
+    }
+    /* a partial record would corrupt the transaction */
+    if ((rc != 0) && (journal != NULL)) {
+        printf("TPM_NVRAM_AddRecord: Error (fatal) journaling %s\n", name);
+        TPM_Sbuffer_Clear(&(journal->records));
+        rc = TPM_FAIL;
+    }
+    if ((rc == 0) && !journal->transaction) {
+        rc = TPM_NVRAM_Commit(tpm_number);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_LoadRecord() deserializes a journal record from 'stream'.
+
+   'name' must hold TPM_FILENAME_MAX characters.  'data' points into 'stream'.
+
+   Returns
+        0 on success
+        non-zero if the stream holds no complete record
+*/
+
+static TPM_RESULT TPM_NVRAM_LoadRecord(uint32_t *type,
+                                       char *name,
+                                       uint32_t *offset,
+                                       unsigned char **data,
+                                       uint32_t *length,
+                                       unsigned char **stream,
+                                       uint32_t *stream_size)
+{
+    TPM_RESULT  rc = 0;
+    uint16_t    nameLength = 0;
+
+    if (rc == 0) {
+        rc = TPM_Load32(type, stream, stream_size);
+    }
+    if (rc == 0) {
+        rc = TPM_Load16(&nameLength, stream, stream_size);
+    }
+    if (rc == 0) {
+        if (nameLength >= TPM_FILENAME_MAX) {
+            printf("TPM_NVRAM_LoadRecord: Error, name length %u too large\n", nameLength);
+            rc = TPM_BAD_PARAM_SIZE;
+        }
+    }
+    if (rc == 0) {
+        rc = TPM_Loadn((BYTE *)name, nameLength, stream, stream_size);
+    }
+    if (rc == 0) {
+        name[nameLength] = '\0';
+        rc = TPM_Load32(offset, stream, stream_size);
+    }
+    if (rc == 0) {
+        rc = TPM_Load32(length, stream, stream_size);
+    }
+    if (rc == 0) {
+        if (*length > *stream_size) {
+            printf("TPM_NVRAM_LoadRecord: Error, data length %u exceeds %u\n",
+                   *length, *stream_size);
+            rc = TPM_BAD_PARAM_SIZE;
+        }
+    }
+    if (rc == 0) {
+        *data = *stream;
+        *stream += *length;
+        *stream_size -= *length;
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_ApplyRecords() applies the journal records in 'stream' to the state files of the TPM
+   'tpm_number'.
+
+   Applying a record again has the same result, so a replay after a crash is safe.
+*/
+
+static TPM_RESULT TPM_NVRAM_ApplyRecords(uint32_t tpm_number,
+                                         unsigned char *stream,
+                                         uint32_t stream_size)
+{
+    TPM_RESULT  rc = 0;
+    uint32_t    type;
+    char        name[TPM_FILENAME_MAX];
+    uint32_t    offset;
+    unsigned char *data;
+    uint32_t    length;
+    size_t      src;
+    int         irc;
+    TPM_BOOL    written;                /* the record was applied to a mapping */
+    FILE        *file;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+
+    while ((rc == 0) && (stream_size > 0)) {
+        file = NULL;
+        written = FALSE;
+        rc = TPM_NVRAM_LoadRecord(&type, name, &offset, &data, &length, &stream, &stream_size);
+        if ((rc == 0) && (type != TPM_NVRAM_RECORD_COMMIT)) {
+            TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+#ifdef TPM_NV_MMAP
+            written = TPM_NVRAM_WriteMapping(tpm_number, type, name, offset, data, length);
+#endif
+        }
+        if ((rc == 0) && !written) {
+            switch (type) {
+              case TPM_NVRAM_RECORD_STORE:
+                file = fopen(filename, "wb");                   /* closed @1 */
+                break;
+              case TPM_NVRAM_RECORD_UPDATE:
+                file = fopen(filename, "r+b");                  /* closed @1 */
+                /* a replay may update a file that a later record removed */
+                if ((file == NULL) && (errno == ENOENT)) {
+                    file = fopen(filename, "w+b");              /* closed @1 */
+                }
+                break;
+              case TPM_NVRAM_RECORD_DELETE:
+                irc = remove(filename);
+                if ((irc != 0) && (errno != ENOENT)) {
+                    printf("TPM_NVRAM_ApplyRecords: Error (fatal) removing %s, %s\n",
+                           filename, strerror(errno));
+                    rc = TPM_FAIL;
+                }
+                break;
+              case TPM_NVRAM_RECORD_COMMIT:
+                break;
+              default:
+                printf("TPM_NVRAM_ApplyRecords: Error (fatal), bad record type %08x\n", type);
+                rc = TPM_FAIL;
+                break;
+            }
+        }
+        if ((rc == 0) && !written &&
+            ((type == TPM_NVRAM_RECORD_STORE) || (type == TPM_NVRAM_RECORD_UPDATE))) {
+            if (file == NULL) {
+                printf("TPM_NVRAM_ApplyRecords: Error (fatal) opening %s for write, %s\n",
+                       filename, strerror(errno));
+                rc = TPM_FAIL;
+            }
+        }
+        if ((rc == 0) && (file != NULL)) {
+            printf("  TPM_NVRAM_ApplyRecords: Writing %u bytes at %u to %s\n",
+                   length, offset, filename);
+            irc = fseek(file, (long)offset, SEEK_SET);
+            src = fwrite(data, 1, length, file);
+            if ((irc != 0) || (src != length)) {
+                printf("TPM_NVRAM_ApplyRecords: Error (fatal) writing %s, %s\n",
+                       filename, strerror(errno));
+                rc = TPM_FAIL;
+            }
+        }
+        if (file != NULL) {
+            irc = fclose(file);         /* @1 */
+            if (irc != 0) {
+                printf("TPM_NVRAM_ApplyRecords: Error (fatal) closing file %s\n", filename);
+                rc = TPM_FAIL;
+            }
+        }
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_SyncRecords() flushes the state files written by the journal records in 'stream' of
+   the TPM 'tpm_number' to the disk.
+
+   A file is synced once for each record.  Syncing a file again after its first sync is cheap,
+   since there is nothing left to write.
+*/
+
+static TPM_RESULT TPM_NVRAM_SyncRecords(uint32_t tpm_number,
+                                        unsigned char *stream,
+                                        uint32_t stream_size)
+{
+    TPM_RESULT  rc = 0;
+    uint32_t    type;
+    char        name[TPM_FILENAME_MAX];
+    uint32_t    offset;
+    unsigned char *data;
+    uint32_t    length;
+    TPM_BOOL    synced;                 /* the file is synced through its mapping */
+    FILE        *file;
+    char        filename[FILENAME_MAX]; /* rooted file name from name */
+#ifdef TPM_NV_MMAP
+    TPM_NVRAM_MAPPING *mapping;
+#endif
+
+    while ((rc == 0) && (stream_size > 0)) {
+        file = NULL;
+        synced = FALSE;
+        rc = TPM_NVRAM_LoadRecord(&type, name, &offset, &data, &length, &stream, &stream_size);
+#ifdef TPM_NV_MMAP
+        /* a mapped file is synced once, however many records wrote it */
+        if ((rc == 0) &&
+            ((type == TPM_NVRAM_RECORD_STORE) || (type == TPM_NVRAM_RECORD_UPDATE))) {
+            mapping = TPM_NVRAM_FindMapping(tpm_number, name);
+            if (mapping != NULL) {
+                synced = TRUE;
+                if (mapping->dirty) {
+                    printf("  TPM_NVRAM_SyncRecords: Syncing mapped %s\n", name);
+                    if (msync(mapping->data, mapping->length, MS_SYNC) != 0) {
+                        printf("TPM_NVRAM_SyncRecords: Error (fatal) syncing mapped %s, %s\n",
+                               name, strerror(errno));
+                        rc = TPM_FAIL;
+                    }
+                    mapping->dirty = FALSE;
+                }
+            }
+        }
+#endif
+        if ((rc == 0) && !synced &&
+            ((type == TPM_NVRAM_RECORD_STORE) || (type == TPM_NVRAM_RECORD_UPDATE))) {
+            TPM_NVRAM_GetFilenameForName(filename, tpm_number, name);
+            file = fopen(filename, "rb");                       /* closed @1 */
+            /* a later record removed the file */
+            if ((file == NULL) && (errno != ENOENT)) {
+                printf("TPM_NVRAM_SyncRecords: Error (fatal) opening %s, %s\n",
+                       filename, strerror(errno));
+                rc = TPM_FAIL;
+            }
+        }
+        if ((rc == 0) && (file != NULL)) {
+            rc = TPM_NVRAM_SyncFile(file, filename);
+        }
+        if (file != NULL) {
+            fclose(file);               /* @1 */
+        }
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_SyncFile() flushes the open 'file' to the disk.
+ */
+
+static TPM_RESULT TPM_NVRAM_SyncFile(FILE *file,
+                                     const char *filename)
+{
+    TPM_RESULT  rc = 0;
+    int         irc;
+
+    irc = fflush(file);
+    if (irc == 0) {
+        irc = fsync(fileno(file));
+    }
+    if (irc != 0) {
+        printf("TPM_NVRAM_SyncFile: Error (fatal) syncing %s, %s\n", filename, strerror(errno));
+        rc = TPM_FAIL;
+    }
+    return rc;
+}
+
+#ifdef TPM_LIBTPMS_CALLBACKS
+
+/*
+  Asynchronous stores of the user provided NVRAM
+*/
+
+/* TPM_NVRAM_StoreAsync() starts storing 'data' of 'length' to 'name' through the user provided
+   asynchronous store function.
+
+   The data is copied, since the caller may free it before the store completes.
+*/
+
+static TPM_RESULT TPM_NVRAM_StoreAsync(const unsigned char *data,
+                                       uint32_t length,
+                                       uint32_t tpm_number,
+                                       const char *name)
+{
+    TPM_RESULT          rc = 0;
+    TPM_NVRAM_ASYNC     *async = NULL;  /* freed @1 */
+    struct libtpms_callbacks *cbs = TPMLIB_GetCallbacks();
+
+    printf(" TPM_NVRAM_StoreAsync: To name %s\n", name);
+    if (rc == 0) {
+        if (tpm_number >= TPMS_MAX) {
+            printf("TPM_NVRAM_StoreAsync: Error (fatal), TPM %lu out of range\n",
+                   (unsigned long)tpm_number);
+            rc = TPM_FAIL;
+        }
+    }
+    if (rc == 0) {
+        rc = TPM_Malloc((unsigned char **)&async, sizeof(TPM_NVRAM_ASYNC));
+    }
+    if (rc == 0) {
+        async->tpm_number = tpm_number;
+        async->data = NULL;
+        if (length != 0) {
+            rc = TPM_Malloc(&(async->data), length);    /* freed @2 */
+        }
+    }
+    if ((rc == 0) && (length != 0)) {
+        memcpy(async->data, data, length);
+    }
+    if (rc == 0) {
+        pthread_mutex_lock(&tpm_nvram_async_lock);
+        tpm_nvram_journal[tpm_number].pending++;
+        pthread_mutex_unlock(&tpm_nvram_async_lock);
+        /* the completion may run before the call returns */
+        rc = cbs->tpm_nvram_storedata_async(async->data, length, tpm_number, name,
+                                            TPM_NVRAM_StoreDone, async);
+        /* the store was not started, the completion will not run */
+        if (rc != 0) {
+            printf("TPM_NVRAM_StoreAsync: Error, store of %s not started\n", name);
+            pthread_mutex_lock(&tpm_nvram_async_lock);
+            tpm_nvram_journal[tpm_number].pending--;
+            pthread_mutex_unlock(&tpm_nvram_async_lock);
+        }
+    }
+    if ((rc != 0) && (async != NULL)) {
+        free(async->data);              /* @2 */
+        free(async);                    /* @1 */
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_StoreDone() is the completion of an asynchronous store, called by the user provided
+   NVRAM with the 'context' of TPM_NVRAM_StoreAsync() and the 'result' of the store.  It may be
+   called from any thread.
+*/
+
+static void TPM_NVRAM_StoreDone(void *context,
+                                TPM_RESULT result)
+{
+    TPM_NVRAM_ASYNC     *async = context;
+
+    if (result != 0) {
+        printf("TPM_NVRAM_StoreDone: Error, asynchronous store failed for TPM %lu\n",
+               (unsigned long)async->tpm_number);
+    }
+    pthread_mutex_lock(&tpm_nvram_async_lock);
+    tpm_nvram_journal[async->tpm_number].pending--;
+    if ((result != 0) && (tpm_nvram_journal[async->tpm_number].callbackRc == 0)) {
+        tpm_nvram_journal[async->tpm_number].callbackRc = result;
+    }
+    pthread_cond_broadcast(&tpm_nvram_async_cond);
+    pthread_mutex_unlock(&tpm_nvram_async_lock);
+    free(async->data);                  /* @2 */
+    free(async);                        /* @1 */
+    return;
+}
+
+/* TPM_NVRAM_WaitStores() waits until the asynchronous stores of the TPM 'tpm_number' completed.
+
+   Returns the first failure of a store or of the begin callback since the last call, and clears
+   it.
+*/
+
+static TPM_RESULT TPM_NVRAM_WaitStores(uint32_t tpm_number)
+{
+    TPM_RESULT  rc = 0;
+
+    if (tpm_number < TPMS_MAX) {
+        pthread_mutex_lock(&tpm_nvram_async_lock);
+        while (tpm_nvram_journal[tpm_number].pending != 0) {
+            pthread_cond_wait(&tpm_nvram_async_cond, &tpm_nvram_async_lock);
+        }
+        rc = tpm_nvram_journal[tpm_number].callbackRc;
+        tpm_nvram_journal[tpm_number].callbackRc = 0;
+        pthread_mutex_unlock(&tpm_nvram_async_lock);
+    }
+    return rc;
+}
+
+/* TPM_NVRAM_SetCallbackError() records the failure 'result' of a callback of the TPM
+   'tpm_number', unless an earlier failure is recorded.
+*/
+
+static void TPM_NVRAM_SetCallbackError(uint32_t tpm_number,
+                                       TPM_RESULT result)
+{
+    pthread_mutex_lock(&tpm_nvram_async_lock);
+    if (tpm_nvram_journal[tpm_number].callbackRc == 0) {
+        tpm_nvram_journal[tpm_number].callbackRc = result;
+    }
+    pthread_mutex_unlock(&tpm_nvram_async_lock);
+    return;
+}
+
+#endif	/* TPM_LIBTPMS_CALLBACKS */
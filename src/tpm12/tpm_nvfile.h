@@ -50,6 +50,23 @@
 
 #define TPM_FILENAME_MAX 20
 
+/* changed byte ranges in an updated file that are separated by fewer unchanged bytes than this are
+   written with one write */
+
+#define TPM_NVRAM_UPDATE_GAP 16
+
+/* the write-ahead journal of a TPM, and its size in bytes that triggers a checkpoint */
+
+#define TPM_NVRAM_JOURNAL_NAME "journal"
+#ifndef TPM_NVRAM_JOURNAL_MAX
+#define TPM_NVRAM_JOURNAL_MAX 0x10000
+#endif
+
+/* the number of state files of a TPM that a TPM_NV_MMAP build keeps mapped, enough for the
+   permanent, saved, and volatile state */
+
+#define TPM_NVRAM_MAPPINGS 3
+
 TPM_RESULT TPM_NVRAM_Init(void);
 
 /*
@@ -64,8 +81,35 @@ TPM_RESULT TPM_NVRAM_StoreData(const unsigned char *data,
                                uint32_t length,
 			       uint32_t tpm_number,
                                const char *name);
+TPM_RESULT TPM_NVRAM_UpdateData(const unsigned char *data,
+                                uint32_t length,
+                                const unsigned char *oldData,
+                                uint32_t oldLength,
+                                uint32_t tpm_number,
+                                const char *name);
 TPM_RESULT TPM_NVRAM_DeleteName(uint32_t tpm_number,
 				const char *name,
                                 TPM_BOOL mustExist);
 
+/*
+  Loading without a copy
+*/
+
+TPM_RESULT TPM_NVRAM_MapData(unsigned char **data,
+                             uint32_t *length,
+                             uint32_t tpm_number,
+                             const char *name);
+void       TPM_NVRAM_ReleaseData(unsigned char *data,
+                                 uint32_t tpm_number,
+                                 const char *name);
+void       TPM_NVRAM_Close(uint32_t tpm_number);
+
+/*
+  Transactions
+*/
+
+void       TPM_NVRAM_Begin(uint32_t tpm_number);
+TPM_RESULT TPM_NVRAM_Commit(uint32_t tpm_number);
+TPM_RESULT TPM_NVRAM_Recover(uint32_t tpm_number);
+
 #endif
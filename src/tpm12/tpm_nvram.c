@@ -51,6 +51,7 @@
 #include "tpm_io.h"
 #include "tpm_memory.h"
 #include "tpm_nvfile.h"
+#include "tpm_nvfilename.h"
 #include "tpm_pcr.h"
 #include "tpm_permanent.h"
 #include "tpm_platform.h"
@@ -61,6 +62,25 @@
 
 #include "tpm_nvram.h"
 
+/* local prototypes */
+
+static TPM_RESULT TPM_NVIndexEntries_Rebuild(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
+static uint32_t   TPM_NVIndexEntries_Hash(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					  TPM_NV_INDEX nvIndex);
+static void       TPM_NVIndexEntries_Insert(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					    uint32_t entryIndex);
+static void       TPM_NVIndexEntries_Remove(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					    uint32_t entryIndex);
+
+/* The NV defined space format that TPM_NVIndexEntries_Store() writes.  V3 keeps the data of each
+   NV index under its own NVRAM name, so that writing an index does not rewrite the others. */
+
+#ifdef TPM_NV_INDEX_FILES
+#define TPM_NVSTATE_NV_VERSION TPM_TAG_NVSTATE_NV_V3
+#else
+#define TPM_NVSTATE_NV_VERSION TPM_TAG_NVSTATE_NV_V2
+#endif
+
 /*
   NV Defined Space Utilities
 */
@@ -331,6 +351,7 @@ void TPM_NVDataSensitive_Init(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive)
     TPM_Secret_Init(tpm_nv_data_sensitive->authValue);
     tpm_nv_data_sensitive->data = NULL;
     TPM_Digest_Init(tpm_nv_data_sensitive->digest);
+    tpm_nv_data_sensitive->dataChanged = FALSE;
     return;
 }
 
@@ -374,15 +395,21 @@ TPM_RESULT TPM_NVDataSensitive_Load(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive
     if (rc == 0) {
 	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
     }
-    /* allocate memory for data */
-    if ((rc == 0) && !isGPIO) {
-	rc = TPM_Malloc(&(tpm_nv_data_sensitive->data),
-			tpm_nv_data_sensitive->pubInfo.dataSize);
-    }
-    /* load data */
-    if ((rc == 0) && !isGPIO) {
-	rc = TPM_Loadn(tpm_nv_data_sensitive->data, tpm_nv_data_sensitive->pubInfo.dataSize,
-		       stream, stream_size);
+    /* versions after V2 store the data under its own NVRAM name.  It is loaded by
+       TPM_NVIndexEntries_NVLoad(). */
+    if ((rc == 0) && !isGPIO && (nvEntriesVersion != TPM_TAG_NVSTATE_NV_V3)) {
+	/* allocate memory for data */
+	if (rc == 0) {
+	    rc = TPM_Malloc(&(tpm_nv_data_sensitive->data),
+			    tpm_nv_data_sensitive->pubInfo.dataSize);
+	}
+	/* load data */
+	if (rc == 0) {
+	    rc = TPM_Loadn(tpm_nv_data_sensitive->data, tpm_nv_data_sensitive->pubInfo.dataSize,
+			   stream, stream_size);
+	}
+	/* not yet stored under its own name */
+	tpm_nv_data_sensitive->dataChanged = TRUE;
     }
     /* create digest.  The digest is not stored to save NVRAM space */
     if (rc == 0) {
@@ -401,10 +428,13 @@ TPM_RESULT TPM_NVDataSensitive_Load(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive
    returns 0 or error codes
 
    nvWrite TRUE indicates a write command, not a command to define the space.
+
+   For nvEntriesVersion TPM_TAG_NVSTATE_NV_V3, the data is not serialized.
 */
 
 TPM_RESULT TPM_NVDataSensitive_Store(TPM_STORE_BUFFER *sbuffer,
-				     const TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive)
+				     const TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive,
+				     TPM_TAG nvEntriesVersion)
 {
     TPM_RESULT		rc = 0;
     TPM_BOOL		isGPIO;
@@ -428,7 +458,7 @@ TPM_RESULT TPM_NVDataSensitive_Store(TPM_STORE_BUFFER *sbuffer,
 	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
     }
     /* store data */
-    if ((rc == 0) && !isGPIO) {
+    if ((rc == 0) && !isGPIO && (nvEntriesVersion != TPM_TAG_NVSTATE_NV_V3)) {
 	rc = TPM_Sbuffer_Append(sbuffer, tpm_nv_data_sensitive->data,
 				tpm_nv_data_sensitive->pubInfo.dataSize);
     }
@@ -567,6 +597,12 @@ void TPM_NVIndexEntries_Init(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
     printf(" TPM_NVIndexEntries_Init:\n");
     tpm_nv_index_entries->nvIndexCount = 0;
     tpm_nv_index_entries->tpm_nvindex_entry = NULL;
+    tpm_nv_index_entries->nvIndexSlot = NULL;
+    tpm_nv_index_entries->nvIndexSlots = 0;
+    tpm_nv_index_entries->freeEntry = NULL;
+    tpm_nv_index_entries->freeCount = 0;
+    tpm_nv_index_entries->deletedIndex = NULL;
+    tpm_nv_index_entries->deletedCount = 0;
     return;
 }
 
@@ -574,7 +610,7 @@ void TPM_NVIndexEntries_Init(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
   TPM_NVIndexEntries_Delete() iterates through the entire TPM_NV_INDEX_ENTRIES array, deleting any
   used entries.
 
-  It then frees and reinitializes the array.
+  It then frees and reinitializes the array and its directory.
 */
 
 
@@ -590,6 +626,9 @@ void TPM_NVIndexEntries_Delete(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
     }
     /* free the array */
     free(tpm_nv_index_entries->tpm_nvindex_entry);
+    free(tpm_nv_index_entries->nvIndexSlot);
+    free(tpm_nv_index_entries->freeEntry);
+    free(tpm_nv_index_entries->deletedIndex);
     TPM_NVIndexEntries_Init(tpm_nv_index_entries);
     return;
 }
@@ -616,6 +655,8 @@ void TPM_NVIndexEntries_Trace(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
 /*
   TPM_NVIndexEntries_Load() loads the TPM_NV_INDEX_ENTRIES array from a stream.
 
+  For a V3 stream, the caller must then load the data with TPM_NVIndexEntries_NVLoad().
+
   The first data in the stream must be a uint32_t count of the number of entries to follow.
 */
 
@@ -637,6 +678,7 @@ TPM_RESULT TPM_NVIndexEntries_Load(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 	switch (nvEntriesVersion) {
 	  case TPM_TAG_NVSTATE_NV_V1:
 	  case TPM_TAG_NVSTATE_NV_V2:
+	  case TPM_TAG_NVSTATE_NV_V3:
 	    break;
 	  default:
             printf("TPM_NVIndexEntries_Load: Error (fatal), version %04x unsupported\n",
@@ -677,6 +719,9 @@ TPM_RESULT TPM_NVIndexEntries_Load(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 	    }
 	}
     }
+    if (rc == 0) {
+	rc = TPM_NVIndexEntries_Rebuild(tpm_nv_index_entries);
+    }
     return rc;
 }
 
@@ -698,7 +743,7 @@ TPM_RESULT TPM_NVIndexEntries_Store(TPM_STORE_BUFFER *sbuffer,
 	   tpm_nv_index_entries->nvIndexCount);
     /* append the NV entries version number to the stream */
     if (rc == 0) {
-	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_NVSTATE_NV_V2); 
+	rc = TPM_Sbuffer_Append16(sbuffer, TPM_NVSTATE_NV_VERSION); 
     }
     /* count the number of used entries */
     if (rc == 0) {
@@ -714,7 +759,8 @@ TPM_RESULT TPM_NVIndexEntries_Store(TPM_STORE_BUFFER *sbuffer,
 	if (tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex != TPM_NV_INDEX_LOCK) {
 	    printf("  TPM_NVIndexEntries_Store: Storing slot %lu NV index %08x\n",
 		   (unsigned long)i, tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex);
-	    rc = TPM_NVDataSensitive_Store(sbuffer, &(tpm_nv_index_entries->tpm_nvindex_entry[i]));
+	    rc = TPM_NVDataSensitive_Store(sbuffer, &(tpm_nv_index_entries->tpm_nvindex_entry[i]),
+					   TPM_NVSTATE_NV_VERSION);
 	}
 	else {
 	    printf("  TPM_NVIndexEntries_Store: Skipping unused slot %lu\n", (unsigned long)i);
@@ -723,6 +769,174 @@ TPM_RESULT TPM_NVIndexEntries_Store(TPM_STORE_BUFFER *sbuffer,
     return rc;
 }
 
+/* TPM_NVIndexEntries_NVLoad() loads the data that a V3 TPM_NV_INDEX_ENTRIES stream does not
+   contain.  Each NV index, except GPIO, has its data under the NVRAM name TPM_NV_INDEX_NAME_FORMAT.
+
+   'storedEntries' are the entries that a roll back replaces, or NULL.  The data of an index that
+   did not change since the last store is what NVRAM holds, and it is moved from 'storedEntries'
+   instead of being read again.  Only the data of changed or deleted indexes is read from NVRAM.
+
+   The data of the other versions was loaded from the stream, and this function is a no-op.
+
+   Returns TPM_FAIL if the data is missing or has the wrong size.
+*/
+
+TPM_RESULT TPM_NVIndexEntries_NVLoad(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				     TPM_NV_INDEX_ENTRIES *storedEntries,
+				     uint32_t tpm_number)
+{
+    TPM_RESULT			rc = 0;
+    TPM_NV_DATA_SENSITIVE	*tpm_nv_data_sensitive;
+    TPM_NV_DATA_SENSITIVE	*stored_data_sensitive;
+    TPM_BOOL			isGPIO;
+    uint32_t			length;
+    char			name[TPM_FILENAME_MAX];
+    uint32_t			i;
+
+    printf(" TPM_NVIndexEntries_NVLoad:\n");
+    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) ; i++) {
+	tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
+	/* unused, or the data was in the stream */
+	if ((tpm_nv_data_sensitive->pubInfo.nvIndex == TPM_NV_INDEX_LOCK) ||
+	    (tpm_nv_data_sensitive->data != NULL)) {
+	    continue;
+	}
+	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
+	if ((rc != 0) || isGPIO) {
+	    continue;
+	}
+	sprintf(name, TPM_NV_INDEX_NAME_FORMAT, tpm_nv_data_sensitive->pubInfo.nvIndex);
+	/* the data in memory is what NVRAM holds */
+	if ((storedEntries != NULL) &&
+	    (TPM_NVIndexEntries_GetEntry(&stored_data_sensitive, storedEntries,
+					 tpm_nv_data_sensitive->pubInfo.nvIndex) == 0) &&
+	    (stored_data_sensitive->data != NULL) &&
+	    !stored_data_sensitive->dataChanged &&
+	    (stored_data_sensitive->pubInfo.dataSize == tpm_nv_data_sensitive->pubInfo.dataSize)) {
+	    printf("  TPM_NVIndexEntries_NVLoad: Keeping %s\n", name);
+	    tpm_nv_data_sensitive->data = stored_data_sensitive->data;
+	    stored_data_sensitive->data = NULL;
+	    length = tpm_nv_data_sensitive->pubInfo.dataSize;
+	}
+	else {
+	    rc = TPM_NVRAM_LoadData(&(tpm_nv_data_sensitive->data), &length,
+				    tpm_number, name);
+	}
+	if (rc != 0) {
+	    printf("TPM_NVIndexEntries_NVLoad: Error (fatal) loading %s\n", name);
+	    rc = TPM_FAIL;
+	}
+	else if (length != tpm_nv_data_sensitive->pubInfo.dataSize) {
+	    printf("TPM_NVIndexEntries_NVLoad: Error (fatal) %s size %u not %u\n",
+		   name, length, tpm_nv_data_sensitive->pubInfo.dataSize);
+	    rc = TPM_FAIL;
+	}
+    }
+    return rc;
+}
+
+/* TPM_NVIndexEntries_NVStore() writes the NV index data that changed since the last store to the
+   NVRAM names of the indexes, and deletes the NVRAM names of deleted indexes.
+
+   TPM_PermanentAll_NVStore() calls it after storing the TPM_NV_INDEX_ENTRIES stream, so that the
+   writes are in the same NVRAM transaction.  It is a no-op unless the data is stored under its own
+   names, in a TPM_NV_INDEX_FILES build.
+*/
+
+TPM_RESULT TPM_NVIndexEntries_NVStore(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				      uint32_t tpm_number)
+{
+    TPM_RESULT			rc = 0;
+#ifdef TPM_NV_INDEX_FILES
+    TPM_NV_DATA_SENSITIVE	*tpm_nv_data_sensitive;
+    TPM_BOOL			isGPIO;
+    char			name[TPM_FILENAME_MAX];
+    uint32_t			i;
+
+    printf(" TPM_NVIndexEntries_NVStore: %u deleted\n", tpm_nv_index_entries->deletedCount);
+    /* a redefined index replaces the data below */
+    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->deletedCount) ; i++) {
+	if (TPM_NVIndexEntries_GetEntry(&tpm_nv_data_sensitive, tpm_nv_index_entries,
+					tpm_nv_index_entries->deletedIndex[i]) != 0) {
+	    sprintf(name, TPM_NV_INDEX_NAME_FORMAT, tpm_nv_index_entries->deletedIndex[i]);
+	    rc = TPM_NVRAM_DeleteName(tpm_number, name, FALSE);
+	}
+    }
+    if (rc == 0) {
+	tpm_nv_index_entries->deletedCount = 0;
+    }
+    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) ; i++) {
+	tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
+	if ((tpm_nv_data_sensitive->pubInfo.nvIndex == TPM_NV_INDEX_LOCK) ||
+	    !tpm_nv_data_sensitive->dataChanged) {
+	    continue;
+	}
+	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
+	if ((rc == 0) && !isGPIO) {
+	    sprintf(name, TPM_NV_INDEX_NAME_FORMAT, tpm_nv_data_sensitive->pubInfo.nvIndex);
+	    rc = TPM_NVRAM_StoreData(tpm_nv_data_sensitive->data,
+				     tpm_nv_data_sensitive->pubInfo.dataSize,
+				     tpm_number, name);
+	}
+	if (rc == 0) {
+	    tpm_nv_data_sensitive->dataChanged = FALSE;
+	}
+    }
+#else
+    tpm_nv_index_entries = tpm_nv_index_entries;
+    tpm_number = tpm_number;
+#endif
+    return rc;
+}
+
+/* TPM_NVIndexEntries_IsChanged() returns TRUE if NV index data that the TPM_NV_INDEX_ENTRIES
+   stream does not contain changed since the last store.
+*/
+
+TPM_BOOL TPM_NVIndexEntries_IsChanged(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
+{
+    TPM_BOOL		changed = FALSE;
+#ifdef TPM_NV_INDEX_FILES
+    uint32_t		i;
+
+    changed = (tpm_nv_index_entries->deletedCount != 0);
+    for (i = 0 ; !changed && (i < tpm_nv_index_entries->nvIndexCount) ; i++) {
+	changed = (tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex !=
+		   TPM_NV_INDEX_LOCK) &&
+		  tpm_nv_index_entries->tpm_nvindex_entry[i].dataChanged;
+    }
+#else
+    tpm_nv_index_entries = tpm_nv_index_entries;
+#endif
+    return changed;
+}
+
+/* TPM_NVIndexEntries_GetDataSpace() returns the NV space consumed by the data that the
+   TPM_NV_INDEX_ENTRIES stream does not contain.
+*/
+
+uint32_t TPM_NVIndexEntries_GetDataSpace(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
+{
+    uint32_t		space = 0;
+#ifdef TPM_NV_INDEX_FILES
+    TPM_BOOL		isGPIO;
+    uint32_t		i;
+
+    for (i = 0 ; i < tpm_nv_index_entries->nvIndexCount ; i++) {
+	if ((tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex != TPM_NV_INDEX_LOCK) &&
+	    (TPM_NVDataSensitive_IsGPIO(&isGPIO,
+					tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.nvIndex)
+	     == 0) &&
+	    !isGPIO) {
+	    space += tpm_nv_index_entries->tpm_nvindex_entry[i].pubInfo.dataSize;
+	}
+    }
+#else
+    tpm_nv_index_entries = tpm_nv_index_entries;
+#endif
+    return space;
+}
+
 /* TPM_NVIndexEntries_StClear() steps through each entry in the NV TPM_NV_INDEX_ENTRIES array,
    setting the volatile flags to FALSE.
 */
@@ -965,6 +1179,9 @@ TPM_RESULT TPM_NVIndexEntries_SetVolatile(TPM_NV_DATA_ST *tpm_nv_data_st,
 
    If a free entry does not exist, it it created and initialized.
 
+   The entry stays free until it is added to the directory with TPM_NVIndexEntries_AddEntry(), so
+   the next call returns the same entry if it was not added.
+
    If a slot cannot be created, tpm_nv_data_sensitive returns NULL, so a subsequent free is safe.
 */
 
@@ -972,43 +1189,249 @@ TPM_RESULT TPM_NVIndexEntries_GetFreeEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_s
 					   TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
 {
     TPM_RESULT		rc = 0;
-    TPM_BOOL		done = FALSE;
-    size_t 		i;
-
-    printf(" TPM_NVIndexEntries_GetFreeEntry: Searching %u slots\n",
-	   tpm_nv_index_entries->nvIndexCount);
-    /* for debug - trace the entire TPM_NV_INDEX_ENTRIES array */
-    for (i = 0 ; i < tpm_nv_index_entries->nvIndexCount ; i++) {
+    uint32_t		i = tpm_nv_index_entries->nvIndexCount;
+
+    printf(" TPM_NVIndexEntries_GetFreeEntry: %u free of %u slots\n",
+	   tpm_nv_index_entries->freeCount, tpm_nv_index_entries->nvIndexCount);
+    *tpm_nv_data_sensitive = NULL;
+    /* the last deleted entry */
+    if (tpm_nv_index_entries->freeCount > 0) {
+	i = tpm_nv_index_entries->freeEntry[tpm_nv_index_entries->freeCount - 1];
+	printf("  TPM_NVIndexEntries_GetFreeEntry: Found free slot %u\n", i);
 	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
-	printf("   TPM_NVIndexEntries_GetFreeEntry: slot %lu entry %08x\n",
-	       (unsigned long)i, (*tpm_nv_data_sensitive)->pubInfo.nvIndex);
-    }    
-    /* search the existing array for a free entry */
-    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) && !done ; i++) {
-	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
-	/* if the entry is not used */
-	if ((*tpm_nv_data_sensitive)->pubInfo.nvIndex == TPM_NV_INDEX_LOCK) {
-	    printf("  TPM_NVIndexEntries_GetFreeEntry: Found free slot %lu\n", (unsigned long)i);
-	    done = TRUE;
-	}
+	return rc;
     }
-    /* need to expand the array */
-    if ((rc == 0) && !done) {
-	*tpm_nv_data_sensitive = NULL;
+    /* need to expand the array and the stack of unused entries */
+    if (rc == 0) {
 	rc = TPM_Realloc((unsigned char **)&(tpm_nv_index_entries->tpm_nvindex_entry),
 			 sizeof(TPM_NV_DATA_SENSITIVE) * (i + 1));
     }
+    if (rc == 0) {
+	rc = TPM_Realloc((unsigned char **)&(tpm_nv_index_entries->freeEntry),
+			 sizeof(uint32_t) * (i + 1));
+    }
     /* initialize the new entry in the array */
-    if ((rc == 0) && !done) {
-	printf("  TPM_NVIndexEntries_GetFreeEntry: Created new slot at index %lu\n",
-	       (unsigned long)i);
+    if (rc == 0) {
+	printf("  TPM_NVIndexEntries_GetFreeEntry: Created new slot at index %u\n", i);
 	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
 	TPM_NVDataSensitive_Init(*tpm_nv_data_sensitive);
 	tpm_nv_index_entries->nvIndexCount++;
+	tpm_nv_index_entries->freeEntry[tpm_nv_index_entries->freeCount] = i;
+	tpm_nv_index_entries->freeCount++;
+    }
+    return rc;
+}
+
+/* TPM_NVIndexEntries_AddEntry() adds the entry 'tpm_nv_data_sensitive' from
+   TPM_NVIndexEntries_GetFreeEntry(), whose pubInfo -> nvIndex was set, to the directory, so that
+   TPM_NVIndexEntries_GetEntry() finds it.
+*/
+
+TPM_RESULT TPM_NVIndexEntries_AddEntry(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				       TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive)
+{
+    TPM_RESULT		rc = 0;
+    uint32_t		entryIndex;
+    uint32_t		usedCount;
+    uint32_t		i;
+
+    entryIndex = tpm_nv_data_sensitive - tpm_nv_index_entries->tpm_nvindex_entry;
+    printf(" TPM_NVIndexEntries_AddEntry: NV index %08x at slot %u\n",
+	   tpm_nv_data_sensitive->pubInfo.nvIndex, entryIndex);
+    /* the entry is no longer free.  It is normally the one on top of the stack. */
+    for (i = tpm_nv_index_entries->freeCount ; i > 0 ; i--) {
+	if (tpm_nv_index_entries->freeEntry[i - 1] == entryIndex) {
+	    tpm_nv_index_entries->freeEntry[i - 1] =
+		tpm_nv_index_entries->freeEntry[tpm_nv_index_entries->freeCount - 1];
+	    tpm_nv_index_entries->freeCount--;
+	    break;
+	}
+    }
+    /* keep the hash table at most half full */
+    usedCount = tpm_nv_index_entries->nvIndexCount - tpm_nv_index_entries->freeCount;
+    if ((usedCount * 2) > tpm_nv_index_entries->nvIndexSlots) {
+	rc = TPM_NVIndexEntries_Rebuild(tpm_nv_index_entries);
+    }
+    else {
+	TPM_NVIndexEntries_Insert(tpm_nv_index_entries, entryIndex);
+    }
+    return rc;
+}
+
+/* TPM_NVIndexEntries_DeleteEntry() removes the used entry 'tpm_nv_data_sensitive' from the
+   directory and deletes it.  The entry becomes free.
+
+   In a TPM_NV_INDEX_FILES build, the index is remembered so that TPM_NVIndexEntries_NVStore()
+   deletes the NVRAM name of its data.
+*/
+
+TPM_RESULT TPM_NVIndexEntries_DeleteEntry(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					  TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive)
+{
+    TPM_RESULT		rc = 0;
+    uint32_t		entryIndex;
+#ifdef TPM_NV_INDEX_FILES
+    TPM_BOOL		isGPIO = FALSE;
+#endif
+
+    entryIndex = tpm_nv_data_sensitive - tpm_nv_index_entries->tpm_nvindex_entry;
+    printf(" TPM_NVIndexEntries_DeleteEntry: NV index %08x at slot %u\n",
+	   tpm_nv_data_sensitive->pubInfo.nvIndex, entryIndex);
+    if (tpm_nv_data_sensitive->pubInfo.nvIndex == TPM_NV_INDEX_LOCK) {
+	return rc;
+    }
+#ifdef TPM_NV_INDEX_FILES
+    /* GPIO indexes have no data */
+    if (rc == 0) {
+	rc = TPM_NVDataSensitive_IsGPIO(&isGPIO, tpm_nv_data_sensitive->pubInfo.nvIndex);
+    }
+    if ((rc == 0) && !isGPIO) {
+	rc = TPM_Realloc((unsigned char **)&(tpm_nv_index_entries->deletedIndex),
+			 sizeof(TPM_NV_INDEX) * (tpm_nv_index_entries->deletedCount + 1));
+    }
+    if ((rc == 0) && !isGPIO) {
+	tpm_nv_index_entries->deletedIndex[tpm_nv_index_entries->deletedCount] =
+	    tpm_nv_data_sensitive->pubInfo.nvIndex;
+	tpm_nv_index_entries->deletedCount++;
+    }
+#endif
+    if (rc == 0) {
+	/* the hash of the nvIndex finds the entry in the hash table */
+	TPM_NVIndexEntries_Remove(tpm_nv_index_entries, entryIndex);
+	TPM_NVDataSensitive_Delete(tpm_nv_data_sensitive);
+	tpm_nv_index_entries->freeEntry[tpm_nv_index_entries->freeCount] = entryIndex;
+	tpm_nv_index_entries->freeCount++;
     }
     return rc;
 }
 
+/* TPM_NVIndexEntries_Rebuild() creates the directory of the TPM_NV_INDEX_ENTRIES array, sized for
+   the entries in the array.
+*/
+
+static TPM_RESULT TPM_NVIndexEntries_Rebuild(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries)
+{
+    TPM_RESULT		rc = 0;
+    uint32_t		slots;
+    uint32_t		i;
+
+    /* at least twice the number of entries, so that probe sequences stay short */
+    for (slots = TPM_NV_INDEX_SLOTS_MIN ; slots < (tpm_nv_index_entries->nvIndexCount * 2) ;
+	 slots *= 2) {
+    }
+    printf(" TPM_NVIndexEntries_Rebuild: %u slots for %u entries\n",
+	   slots, tpm_nv_index_entries->nvIndexCount);
+    if (rc == 0) {
+	rc = TPM_Realloc((unsigned char **)&(tpm_nv_index_entries->nvIndexSlot),
+			 sizeof(uint32_t) * slots);
+    }
+    if ((rc == 0) && (tpm_nv_index_entries->nvIndexCount > 0)) {
+	rc = TPM_Realloc((unsigned char **)&(tpm_nv_index_entries->freeEntry),
+			 sizeof(uint32_t) * tpm_nv_index_entries->nvIndexCount);
+    }
+    if (rc == 0) {
+	memset(tpm_nv_index_entries->nvIndexSlot, 0, sizeof(uint32_t) * slots);
+	tpm_nv_index_entries->nvIndexSlots = slots;
+	tpm_nv_index_entries->freeCount = 0;
+	/* pushed in reverse, so that the lowest free entry is used first */
+	for (i = tpm_nv_index_entries->nvIndexCount ; i > 0 ; i--) {
+	    if (tpm_nv_index_entries->tpm_nvindex_entry[i - 1].pubInfo.nvIndex !=
+		TPM_NV_INDEX_LOCK) {
+		TPM_NVIndexEntries_Insert(tpm_nv_index_entries, i - 1);
+	    }
+	    else {
+		tpm_nv_index_entries->freeEntry[tpm_nv_index_entries->freeCount] = i - 1;
+		tpm_nv_index_entries->freeCount++;
+	    }
+	}
+    }
+    /* without a directory, no entry is found */
+    if (rc != 0) {
+	free(tpm_nv_index_entries->nvIndexSlot);
+	tpm_nv_index_entries->nvIndexSlot = NULL;
+	tpm_nv_index_entries->nvIndexSlots = 0;
+    }
+    return rc;
+}
+
+/* TPM_NVIndexEntries_Hash() returns the home slot of 'nvIndex' in the hash table */
+
+static uint32_t TPM_NVIndexEntries_Hash(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					TPM_NV_INDEX nvIndex)
+{
+    uint32_t		hash;
+
+    /* indexes often differ only in their low bits or only in their high bits */
+    hash = nvIndex * 0x9e3779b1;
+    hash ^= hash >> 16;
+    return hash & (tpm_nv_index_entries->nvIndexSlots - 1);
+}
+
+/* TPM_NVIndexEntries_Insert() inserts the used entry 'entryIndex' into the hash table.  The hash
+   table must have an empty slot.
+*/
+
+static void TPM_NVIndexEntries_Insert(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				      uint32_t entryIndex)
+{
+    uint32_t		slot;
+    uint32_t		mask = tpm_nv_index_entries->nvIndexSlots - 1;
+
+    slot = TPM_NVIndexEntries_Hash(tpm_nv_index_entries,
+				   tpm_nv_index_entries->tpm_nvindex_entry[entryIndex].pubInfo.nvIndex);
+    /* linear probing */
+    while (tpm_nv_index_entries->nvIndexSlot[slot] != 0) {
+	slot = (slot + 1) & mask;
+    }
+    tpm_nv_index_entries->nvIndexSlot[slot] = entryIndex + 1;
+    return;
+}
+
+/* TPM_NVIndexEntries_Remove() removes the used entry 'entryIndex' from the hash table.
+
+   The following entries of the probe sequence are moved back, so that no probe sequence has a
+   hole and deleted entries leave no trace in the table.
+*/
+
+static void TPM_NVIndexEntries_Remove(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				      uint32_t entryIndex)
+{
+    uint32_t		slot;		/* the emptied slot */
+    uint32_t		next;		/* a following slot of the probe sequence */
+    uint32_t		home;		/* the home slot of the entry in 'next' */
+    uint32_t		mask = tpm_nv_index_entries->nvIndexSlots - 1;
+
+    if (tpm_nv_index_entries->nvIndexSlot == NULL) {
+	return;
+    }
+    slot = TPM_NVIndexEntries_Hash(tpm_nv_index_entries,
+				   tpm_nv_index_entries->tpm_nvindex_entry[entryIndex].pubInfo.nvIndex);
+    while (tpm_nv_index_entries->nvIndexSlot[slot] != (entryIndex + 1)) {
+	if (tpm_nv_index_entries->nvIndexSlot[slot] == 0) {
+	    return;	/* not in the table */
+	}
+	slot = (slot + 1) & mask;
+    }
+    tpm_nv_index_entries->nvIndexSlot[slot] = 0;
+    for (next = (slot + 1) & mask ;
+	 tpm_nv_index_entries->nvIndexSlot[next] != 0 ;
+	 next = (next + 1) & mask) {
+	home = TPM_NVIndexEntries_Hash(tpm_nv_index_entries,
+				       tpm_nv_index_entries->
+				       tpm_nvindex_entry[tpm_nv_index_entries->nvIndexSlot[next] - 1].
+				       pubInfo.nvIndex);
+	/* the entry can move to the emptied slot unless its home is cyclically in
+	   (slot, next] */
+	if (((next > slot) && ((home <= slot) || (home > next))) ||
+	    ((next < slot) && ((home <= slot) && (home > next)))) {
+	    tpm_nv_index_entries->nvIndexSlot[slot] = tpm_nv_index_entries->nvIndexSlot[next];
+	    tpm_nv_index_entries->nvIndexSlot[next] = 0;
+	    slot = next;
+	}
+    }
+    return;
+}
+
 /* TPM_NVIndexEntries_GetEntry() gets the TPM_NV_DATA_SENSITIVE entry corresponding to nvIndex.
 
    Returns TPM_BADINDEX on non-existent nvIndex
@@ -1019,30 +1442,27 @@ TPM_RESULT TPM_NVIndexEntries_GetEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_sensi
 				       TPM_NV_INDEX nvIndex)
 {
     TPM_RESULT			rc = 0;
-    size_t 			i;
+    uint32_t			slot;
+    uint32_t			entry;		/* entry number + 1 */
     TPM_BOOL			found;
     
     printf(" TPM_NVIndexEntries_GetEntry: Getting NV index %08x in %u slots\n",
 	   nvIndex, tpm_nv_index_entries->nvIndexCount);
-    /* for debug tracing */
-    for (i = 0 ; i < tpm_nv_index_entries->nvIndexCount ; i++) {
-	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
-	printf("   TPM_NVIndexEntries_GetEntry: slot %lu entry %08x\n",
-	       (unsigned long)i, (*tpm_nv_data_sensitive)->pubInfo.nvIndex);
-    }    
     /* check for the special index that indicates an empty entry */
     if (rc == 0) {
-	if (nvIndex == TPM_NV_INDEX_LOCK) {
+	if ((nvIndex == TPM_NV_INDEX_LOCK) || (tpm_nv_index_entries->nvIndexSlot == NULL)) {
 	    rc = TPM_BADINDEX;
 	}
     }
-    for (i = 0 , found = FALSE ;
-	 (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) && !found ;
-	 i++) {
+    /* probe the hash table from the home slot of the index up to an empty slot */
+    for (slot = (rc == 0) ? TPM_NVIndexEntries_Hash(tpm_nv_index_entries, nvIndex) : 0 ,
+	     found = FALSE ;
+	 (rc == 0) && !found && ((entry = tpm_nv_index_entries->nvIndexSlot[slot]) != 0) ;
+	 slot = (slot + 1) & (tpm_nv_index_entries->nvIndexSlots - 1)) {
 
-	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
+	*tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[entry - 1]);
 	if ((*tpm_nv_data_sensitive)->pubInfo.nvIndex == nvIndex) {
-	    printf("  TPM_NVIndexEntries_GetEntry: Found NV index at slot %lu\n", (unsigned long)i);
+	    printf("  TPM_NVIndexEntries_GetEntry: Found NV index at slot %u\n", entry - 1);
 	    printf("   TPM_NVIndexEntries_GetEntry: permission %08x dataSize %u\n",
 		   (*tpm_nv_data_sensitive)->pubInfo.permission.attributes,
 		   (*tpm_nv_data_sensitive)->pubInfo.dataSize);
@@ -1114,7 +1534,7 @@ TPM_RESULT TPM_NVIndexEntries_GetNVList(TPM_STORE_BUFFER *sbuffer,
 /* TPM_NVIndexEntries_GetUsedSpace() gets the NV space consumed by NV defined space indexes.
 
    It does it inefficiently but reliably by serializing the structure with the same function used
-   when writing to NV storage.
+   when writing to NV storage, and adding the data that is stored under its own NVRAM names.
 */
 
 TPM_RESULT TPM_NVIndexEntries_GetUsedSpace(uint32_t *usedSpace,
@@ -1133,6 +1553,7 @@ TPM_RESULT TPM_NVIndexEntries_GetUsedSpace(uint32_t *usedSpace,
     /* get the serialized buffer and its length */
     if (rc == 0) {
 	TPM_Sbuffer_Get(&sbuffer, &buffer, usedSpace);
+	*usedSpace += TPM_NVIndexEntries_GetDataSpace(tpm_nv_index_entries);
 	printf("  TPM_NVIndexEntries_GetUsedSpace: Used space %u\n", *usedSpace);
     }
     TPM_Sbuffer_Delete(&sbuffer);	/* @1 */
@@ -1196,7 +1617,7 @@ TPM_RESULT TPM_NVIndexEntries_DeleteOwnerAuthorized(TPM_NV_INDEX_ENTRIES *tpm_nv
     
     printf(" TPM_NVIndexEntries_DeleteOwnerAuthorized: Deleting from %u slots\n",
 	   tpm_nv_index_entries->nvIndexCount);
-    for (i = 0 ; i < tpm_nv_index_entries->nvIndexCount ; i++) {
+    for (i = 0 ; (rc == 0) && (i < tpm_nv_index_entries->nvIndexCount) ; i++) {
 	/* get an entry in the array */
 	tpm_nv_data_sensitive = &(tpm_nv_index_entries->tpm_nvindex_entry[i]);
 
@@ -1211,7 +1632,8 @@ TPM_RESULT TPM_NVIndexEntries_DeleteOwnerAuthorized(TPM_NV_INDEX_ENTRIES *tpm_nv
 		    /* delete the index */
 		    printf(" TPM_NVIndexEntries_DeleteOwnerAuthorized: Deleting NV index %08x\n",
 			   tpm_nv_data_sensitive->pubInfo.nvIndex);
-		    TPM_NVDataSensitive_Delete(tpm_nv_data_sensitive);
+		    rc = TPM_NVIndexEntries_DeleteEntry(tpm_nv_index_entries,
+							tpm_nv_data_sensitive);
 		}
 	    }
 	}
@@ -1512,6 +1934,7 @@ TPM_RESULT TPM_Process_NVReadValue(tpm_state_t *tpm_state,
     if ((returnCode == TPM_SUCCESS) && !ignore_auth && !dir) {
 	returnCode = TPM_PCRInfoShort_CheckDigest(&(d1NvdataSensitive->pubInfo.pcrInfoRead),
 						  tpm_state->tpm_stclear_data.PCRS,
+						  &(tpm_state->tpm_stclear_data.pcrDigestCache),
 						  tpm_state->tpm_stany_flags.localityModifier);
     }
     if (returnCode == TPM_SUCCESS && !dir) {
@@ -1827,6 +2250,7 @@ TPM_RESULT TPM_Process_NVReadValueAuth(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	returnCode = TPM_PCRInfoShort_CheckDigest(&(d1NvdataSensitive->pubInfo.pcrInfoRead),
 						  tpm_state->tpm_stclear_data.PCRS,
+						  &(tpm_state->tpm_stclear_data.pcrDigestCache),
 						  tpm_state->tpm_stany_flags.localityModifier);
     }
     if (returnCode == TPM_SUCCESS) {
@@ -2279,6 +2703,7 @@ TPM_RESULT TPM_Process_NVWriteValue(tpm_state_t *tpm_state,
     if ((returnCode == TPM_SUCCESS) && !done && !ignore_auth && !dir) {
 	returnCode = TPM_PCRInfoShort_CheckDigest(&(d1NvdataSensitive->pubInfo.pcrInfoWrite),
 						  tpm_state->tpm_stclear_data.PCRS,
+						  &(tpm_state->tpm_stclear_data.pcrDigestCache),
 						  tpm_state->tpm_stany_flags.localityModifier);
     }
     if ((returnCode == TPM_SUCCESS) && !done && !dir) {
@@ -2327,6 +2752,7 @@ TPM_RESULT TPM_Process_NVWriteValue(tpm_state_t *tpm_state,
 			printf("TPM_Process_NVWriteValue: Copying data\n");
 			/* d. Write the new value into the NV storage area */
 			memcpy((d1NvdataSensitive->data) + offset, data.buffer, data.size);
+			d1NvdataSensitive->dataChanged = TRUE;
 			/* must write TPM_PERMANENT_DATA back to NVRAM, set this flag after
 			   strucuture is written */
 			writeAllNV = TRUE;
@@ -2635,6 +3061,7 @@ TPM_RESULT TPM_Process_NVWriteValueAuth(tpm_state_t *tpm_state,
     if (returnCode == TPM_SUCCESS) {
 	returnCode = TPM_PCRInfoShort_CheckDigest(&(d1NvdataSensitive->pubInfo.pcrInfoWrite),
 						  tpm_state->tpm_stclear_data.PCRS,
+						  &(tpm_state->tpm_stclear_data.pcrDigestCache),
 						  tpm_state->tpm_stany_flags.localityModifier);
     }
     if (returnCode == TPM_SUCCESS) {
@@ -2711,6 +3138,7 @@ TPM_RESULT TPM_Process_NVWriteValueAuth(tpm_state_t *tpm_state,
 			/* d. Write the new value into the NV storage area */
 			printf("TPM_Process_NVWriteValueAuth: Copying data\n");
 			memcpy((d1NvdataSensitive->data) + offset, data.buffer, data.size);
+			d1NvdataSensitive->dataChanged = TRUE;
 			/* must write TPM_PERMANENT_DATA back to NVRAM, set this flag after
 			   strucuture is written */
 			writeAllNV = TRUE;
@@ -3164,7 +3592,7 @@ TPM_RESULT TPM_Process_NVDefineSpace(tpm_state_t *tpm_state,
 	/* 6.d. Invalidate the data area currently pointed to by D1 and ensure that if the area is
 	   reallocated no residual information is left */
 	printf("TPM_Process_NVDefineSpace: Deleting index %08x\n", newNVIndex);
-	TPM_NVDataSensitive_Delete(d1_old);
+	returnCode = TPM_NVIndexEntries_DeleteEntry(&(tpm_state->tpm_nv_index_entries), d1_old);
 	/* must write deleted space back to NVRAM */
 	writeAllNV = TRUE;
 	/* 6.e. If NV1_INCREMENTED is TRUE */
@@ -3296,8 +3724,10 @@ TPM_RESULT TPM_Process_NVDefineSpace(tpm_state_t *tpm_state,
 	printf("TPM_Process_NVDefineSpace: Creating index %08x\n", newNVIndex);
 	/* b. Set all bytes in the newly defined area to 0xFF */
 	memset(d1_new->data, 0xff, pubInfo->dataSize);
+	d1_new->dataChanged = TRUE;
 	/* must write newly defined space back to NVRAM */
 	writeAllNV = TRUE;
+	returnCode = TPM_NVIndexEntries_AddEntry(&(tpm_state->tpm_nv_index_entries), d1_new);
     }
     if (returnCode == TPM_SUCCESS) {
 	/* c. If NV1_INCREMENTED is TRUE */
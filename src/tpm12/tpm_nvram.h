@@ -88,7 +88,8 @@ TPM_RESULT TPM_NVDataSensitive_Load(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive
 				    unsigned char **stream,
                                     uint32_t *stream_size);
 TPM_RESULT TPM_NVDataSensitive_Store(TPM_STORE_BUFFER *sbuffer,
-                                     const TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive);
+                                     const TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive,
+                                     TPM_TAG nvEntriesVersion);
 void       TPM_NVDataSensitive_Delete(TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive);
 
 TPM_RESULT TPM_NVDataSensitive_IsValidIndex(TPM_NV_INDEX nvIndex);
@@ -107,6 +108,13 @@ TPM_RESULT TPM_NVIndexEntries_Load(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 				   uint32_t *stream_size);
 TPM_RESULT TPM_NVIndexEntries_Store(TPM_STORE_BUFFER *sbuffer,
 				    TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
+TPM_RESULT TPM_NVIndexEntries_NVLoad(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				     TPM_NV_INDEX_ENTRIES *storedEntries,
+				     uint32_t tpm_number);
+TPM_RESULT TPM_NVIndexEntries_NVStore(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				      uint32_t tpm_number);
+TPM_BOOL   TPM_NVIndexEntries_IsChanged(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
+uint32_t   TPM_NVIndexEntries_GetDataSpace(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
 void       TPM_NVIndexEntries_StClear(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
 TPM_RESULT TPM_NVIndexEntries_LoadVolatile(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 					   unsigned char **stream,
@@ -119,6 +127,10 @@ TPM_RESULT TPM_NVIndexEntries_SetVolatile(TPM_NV_DATA_ST *tpm_nv_data_st,
 					  TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
 TPM_RESULT TPM_NVIndexEntries_GetFreeEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_sensitive,
 					   TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries);
+TPM_RESULT TPM_NVIndexEntries_AddEntry(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+				       TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive);
+TPM_RESULT TPM_NVIndexEntries_DeleteEntry(TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
+					  TPM_NV_DATA_SENSITIVE *tpm_nv_data_sensitive);
 TPM_RESULT TPM_NVIndexEntries_GetEntry(TPM_NV_DATA_SENSITIVE **tpm_nv_data_sensitive,
 				       TPM_NV_INDEX_ENTRIES *tpm_nv_index_entries,
 				       TPM_NV_INDEX nvIndex);
@@ -48,7 +48,9 @@
   TPMS_MAX defines the maximum number of TPM instances.
 */
 
+#ifndef TPMS_MAX
 #define TPMS_MAX        1
+#endif
 
 /*
   NVRAM storage directory path
@@ -955,6 +955,11 @@ TPM_RESULT TPM_OwnerClearCommon(tpm_state_t *tpm_state,
 	printf("TPM_OwnerClearCommon: Deleting owner evict keys\n");
 	TPM_KeyHandleEntries_OwnerEvictDelete(tpm_state->tpm_key_handle_entries);
     }
+    /* the cached key blobs were wrapped by the old SRK hierarchy */
+    if (rc == 0) {
+	printf("TPM_OwnerClearCommon: Deleting the key cache\n");
+	TPM_KeyCache_Delete(&(tpm_state->tpm_key_cache));
+    }
     /* 4.  The TPM MUST NOT modify the following TPM_PERMANENT_DATA items
        a. endorsementKey 
        b. revMajor 
@@ -1090,7 +1095,8 @@ TPM_RESULT TPM_OwnerClearCommon(tpm_state_t *tpm_state,
 					 TPM_NV_INDEX_GPIO_00);
 	/* if found, delete */
 	if (rc == 0) {
-	    TPM_NVDataSensitive_Delete(tpm_nv_data_sensitive);
+	    rc = TPM_NVIndexEntries_DeleteEntry(&(tpm_state->tpm_nv_index_entries),
+						tpm_nv_data_sensitive);
 	}
 	else if (rc == TPM_BADINDEX) {
 	    rc = TPM_SUCCESS;	/* non-existant index is not an error */
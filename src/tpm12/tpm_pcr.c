@@ -327,6 +327,135 @@ TPM_RESULT TPM_PCR_Store(TPM_PCRVALUE *tpm_pcrs,
     return rc;
 }
 
+/*
+  TPM_PCR_DIGEST_CACHE
+*/
+
+/* TPM_PCRDigestCache_Init() invalidates all cached PCR composite hashes
+
+   always succeeds - no return code
+*/
+
+void TPM_PCRDigestCache_Init(TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache)
+{
+    size_t	i;
+
+    printf(" TPM_PCRDigestCache_Init:\n");
+    tpm_pcr_digest_cache->generation = 0;
+    for (i = 0 ; i < TPM_NUM_PCR ; i++) {
+	tpm_pcr_digest_cache->pcrGeneration[i] = 0;
+    }
+    tpm_pcr_digest_cache->nextEntry = 0;
+    for (i = 0 ; i < TPM_PCR_DIGEST_CACHE_ENTRIES ; i++) {
+	tpm_pcr_digest_cache->entries[i].valid = FALSE;
+	TPM_PCRSelection_Init(&(tpm_pcr_digest_cache->entries[i].pcrSelection));
+	tpm_pcr_digest_cache->entries[i].generation = 0;
+	TPM_Digest_Init(tpm_pcr_digest_cache->entries[i].compositeHash);
+    }
+    return;
+}
+
+/* TPM_PCRDigestCache_Invalidate() invalidates the cached PCR composite hashes that select the PCR
+   at 'pcrIndex'.
+
+   It must be called whenever a single PCR changes.  When all PCR's change, call
+   TPM_PCRDigestCache_Init().
+*/
+
+void TPM_PCRDigestCache_Invalidate(TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache,
+				   TPM_PCRINDEX pcrIndex)
+{
+    tpm_pcr_digest_cache->generation++;
+    /* on wrap, start over */
+    if (tpm_pcr_digest_cache->generation == 0) {
+	TPM_PCRDigestCache_Init(tpm_pcr_digest_cache);
+    }
+    else if (pcrIndex < TPM_NUM_PCR) {
+	tpm_pcr_digest_cache->pcrGeneration[pcrIndex] = tpm_pcr_digest_cache->generation;
+    }
+    return;
+}
+
+/* TPM_PCRDigestCache_GenerateDigest() generates the same digest as
+   TPM_PCRSelection_GenerateDigest(), but returns a cached value if none of the selected PCR's
+   changed since it was calculated.
+
+   If 'tpm_pcr_digest_cache' is NULL, the digest is always calculated.
+*/
+
+TPM_RESULT TPM_PCRDigestCache_GenerateDigest(TPM_DIGEST tpm_digest,	/* output digest */
+					     TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache,
+					     TPM_PCR_SELECTION *tpm_pcr_selection, /* input selection
+										      map */
+					     TPM_PCRVALUE *tpm_pcrs) /* points to the TPM PCR
+									array */
+{
+    TPM_RESULT			rc = 0;
+    TPM_PCR_DIGEST_CACHE_ENTRY	*entry = NULL;
+    TPM_BOOL			match;
+    TPM_BOOL			valid = FALSE;
+    size_t			i;
+    size_t			j;
+    TPM_PCRINDEX		pcr_num;
+
+    printf(" TPM_PCRDigestCache_GenerateDigest:\n");
+    if (tpm_pcr_digest_cache == NULL) {
+	rc = TPM_PCRSelection_GenerateDigest(tpm_digest, tpm_pcr_selection, tpm_pcrs);
+    }
+    else {
+	/* test sizeOfSelect value */
+	if (rc == 0) {
+	    rc = TPM_PCRSelection_CheckRange(tpm_pcr_selection);
+	}
+	/* search for an entry with the same selection */
+	for (i = 0 ; (rc == 0) && (i < TPM_PCR_DIGEST_CACHE_ENTRIES) && (entry == NULL) ; i++) {
+	    if (tpm_pcr_digest_cache->entries[i].valid) {
+		TPM_PCRSelection_Compare(&match,
+					 &(tpm_pcr_digest_cache->entries[i].pcrSelection),
+					 tpm_pcr_selection);
+		if (match) {
+		    entry = &(tpm_pcr_digest_cache->entries[i]);
+		}
+	    }
+	}
+	/* the entry is valid if none of the selected PCR's changed after it was created */
+	if ((rc == 0) && (entry != NULL)) {
+	    valid = TRUE;
+	    for (i = 0, pcr_num = 0 ; valid && (i < tpm_pcr_selection->sizeOfSelect) ; i++) {
+		for (j = 0x0001 ; j != (0x0001 << CHAR_BIT) ; j <<= 1, pcr_num++) {
+		    if ((tpm_pcr_selection->pcrSelect[i] & j) &&
+			(tpm_pcr_digest_cache->pcrGeneration[pcr_num] > entry->generation)) {
+			valid = FALSE;
+		    }
+		}
+	    }
+	}
+	if ((rc == 0) && valid) {
+	    printf("  TPM_PCRDigestCache_GenerateDigest: Using cached digest\n");
+	    TPM_Digest_Copy(tpm_digest, entry->compositeHash);
+	}
+	/* calculate the digest and cache it, replacing the entries round robin */
+	if ((rc == 0) && !valid) {
+	    rc = TPM_PCRSelection_GenerateDigest(tpm_digest, tpm_pcr_selection, tpm_pcrs);
+	    if (entry == NULL) {
+		entry = &(tpm_pcr_digest_cache->entries[tpm_pcr_digest_cache->nextEntry]);
+		tpm_pcr_digest_cache->nextEntry =
+		    (tpm_pcr_digest_cache->nextEntry + 1) % TPM_PCR_DIGEST_CACHE_ENTRIES;
+	    }
+	    entry->valid = FALSE;
+	}
+	if ((rc == 0) && !valid) {
+	    rc = TPM_PCRSelection_Copy(&(entry->pcrSelection), tpm_pcr_selection);
+	}
+	if ((rc == 0) && !valid) {
+	    entry->generation = tpm_pcr_digest_cache->generation;
+	    TPM_Digest_Copy(entry->compositeHash, tpm_digest);
+	    entry->valid = TRUE;
+	}
+    }
+    return rc;
+}
+
 /*
   TPM_SELECT_SIZE
 */
@@ -1103,6 +1232,7 @@ TPM_RESULT TPM_PCRInfoShort_GenerateDigest(TPM_DIGEST tpm_digest,		/* output dig
 
 TPM_RESULT TPM_PCRInfoShort_CheckDigest(TPM_PCR_INFO_SHORT *tpm_pcr_info_short,
 					TPM_PCRVALUE *tpm_pcrs, /* points to the TPM PCR array */
+					TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache, /* or NULL */
 					TPM_MODIFIER_INDICATOR localityModifier)
 {
     TPM_RESULT		rc = 0;
@@ -1117,9 +1247,10 @@ TPM_RESULT TPM_PCRInfoShort_CheckDigest(TPM_PCR_INFO_SHORT *tpm_pcr_info_short,
     /* Calculate a TPM_COMPOSITE_HASH of the PCR selected by tpm_pcr_info_short ->
        pcrSelection */
     if ((rc == 0) && pcrUsage) {
-	rc = TPM_PCRSelection_GenerateDigest(tpm_composite_hash,
-					     &(tpm_pcr_info_short->pcrSelection),
-					     tpm_pcrs);		/* array of PCR's */
+	rc = TPM_PCRDigestCache_GenerateDigest(tpm_composite_hash,
+					       tpm_pcr_digest_cache,
+					       &(tpm_pcr_info_short->pcrSelection),
+					       tpm_pcrs);	/* array of PCR's */
     }
     /* Compare to tpm_pcr_info_short -> digestAtRelease on mismatch return TPM_WRONGPCRVAL */
     if ((rc == 0) && pcrUsage) {
@@ -1529,8 +1660,9 @@ TPM_RESULT TPM_PCRInfo_GenerateDigest(TPM_DIGEST tpm_digest,		/* output digest *
 */
 
 TPM_RESULT TPM_PCRInfo_CheckDigest(TPM_PCR_INFO *tpm_pcr_info,
-				   TPM_PCRVALUE *tpm_pcrs)	/* points to the TPM PCR
+				   TPM_PCRVALUE *tpm_pcrs,	/* points to the TPM PCR
 								   array */
+				   TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache) /* or NULL */
 {
     TPM_RESULT		rc = 0;
     TPM_COMPOSITE_HASH	tpm_composite_hash;
@@ -1542,9 +1674,10 @@ TPM_RESULT TPM_PCRInfo_CheckDigest(TPM_PCR_INFO *tpm_pcr_info,
 	rc = TPM_PCRInfo_GetPCRUsage(&pcrUsage, tpm_pcr_info, 0);
     }
     if ((rc == 0) && pcrUsage) {
-	rc = TPM_PCRSelection_GenerateDigest(tpm_composite_hash,
-					     &(tpm_pcr_info->pcrSelection),
-					     tpm_pcrs);		/* array of PCR's */
+	rc = TPM_PCRDigestCache_GenerateDigest(tpm_composite_hash,
+					       tpm_pcr_digest_cache,
+					       &(tpm_pcr_info->pcrSelection),
+					       tpm_pcrs);	/* array of PCR's */
     }
     /* Compare to pcrInfo -> digestAtRelease on mismatch return TPM_WRONGPCRVAL */
     if ((rc == 0) && pcrUsage) {
@@ -1921,6 +2054,7 @@ TPM_RESULT TPM_PCRInfoLong_GenerateDigest(TPM_DIGEST tpm_digest,		/* output dige
 
 TPM_RESULT TPM_PCRInfoLong_CheckDigest(TPM_PCR_INFO_LONG *tpm_pcr_info_long,
 				       TPM_PCRVALUE *tpm_pcrs,	/* points to the TPM PCR array */
+				       TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache, /* or NULL */
 				       TPM_MODIFIER_INDICATOR localityModifier)
 {
     TPM_RESULT		rc = 0;
@@ -1935,9 +2069,10 @@ TPM_RESULT TPM_PCRInfoLong_CheckDigest(TPM_PCR_INFO_LONG *tpm_pcr_info_long,
     /* Calculate a TPM_COMPOSITE_HASH of the PCR selected by tpm_pcr_info_long ->
        releasePCRSelection */
     if ((rc == 0) && pcrUsage) {
-	rc = TPM_PCRSelection_GenerateDigest(tpm_composite_hash,
-					     &(tpm_pcr_info_long->releasePCRSelection),
-					     tpm_pcrs);		/* array of PCR's */
+	rc = TPM_PCRDigestCache_GenerateDigest(tpm_composite_hash,
+					       tpm_pcr_digest_cache,
+					       &(tpm_pcr_info_long->releasePCRSelection),
+					       tpm_pcrs);	/* array of PCR's */
     }
     /* Compare to tpm_pcr_info_long -> digestAtRelease on mismatch return TPM_WRONGPCRVAL */
     if ((rc == 0) && pcrUsage) {
@@ -3407,6 +3542,9 @@ TPM_RESULT TPM_ExtendCommon(TPM_PCRVALUE outDigest,	/* The PCR value after execu
 			   pcrNum,
 			   h1);
     }
+    if (rc == 0) {
+	TPM_PCRDigestCache_Invalidate(&(tpm_state->tpm_stclear_data.pcrDigestCache), pcrNum);
+    }
     if (rc == 0) {
 	/* 8. If TPM_PERMANENT_FLAGS -> disable is TRUE or TPM_STCLEAR_FLAGS -> deactivated is
 	   TRUE */
@@ -3739,6 +3877,8 @@ TPM_RESULT TPM_Process_PcrReset(tpm_state_t *tpm_state,
 		    TPM_PCR_Reset(tpm_state->tpm_stclear_data.PCRS,
 				  tpm_state->tpm_stany_flags.TOSPresent,
 				  pcr_num);
+		    TPM_PCRDigestCache_Invalidate(&(tpm_state->tpm_stclear_data.pcrDigestCache),
+						  pcr_num);
 		}
 	    }
 	}
@@ -78,6 +78,18 @@ TPM_RESULT TPM_PCR_Store(TPM_PCRVALUE *tpm_pcrs,
                          TPM_PCRINDEX index,
                          TPM_PCRVALUE src_pcr);
 
+/*
+  TPM_PCR_DIGEST_CACHE
+*/
+
+void       TPM_PCRDigestCache_Init(TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache);
+void       TPM_PCRDigestCache_Invalidate(TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache,
+                                         TPM_PCRINDEX pcrIndex);
+TPM_RESULT TPM_PCRDigestCache_GenerateDigest(TPM_DIGEST tpm_digest,
+                                             TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache,
+                                             TPM_PCR_SELECTION *tpm_pcr_selection,
+                                             TPM_PCRVALUE *tpm_pcrs);
+
 /*
   TPM_SELECT_SIZE
 */
@@ -179,7 +191,8 @@ TPM_RESULT TPM_PCRInfo_GenerateDigest(TPM_DIGEST tpm_digest,
                                       TPM_PCR_INFO *tpm_pcr_info,
                                       TPM_PCRVALUE *tpm_pcrs);
 TPM_RESULT TPM_PCRInfo_CheckDigest(TPM_PCR_INFO *tpm_pcr_info,
-                                   TPM_PCRVALUE *tpm_pcrs);
+                                   TPM_PCRVALUE *tpm_pcrs,
+                                   TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache);
 TPM_RESULT TPM_PCRInfo_SetDigestAtCreation(TPM_PCR_INFO *tpm_pcr_info,
                                            TPM_PCRVALUE *tpm_pcrs);
 /* getters */
@@ -216,6 +229,7 @@ TPM_RESULT TPM_PCRInfoLong_GenerateDigest(TPM_DIGEST tpm_digest,
                                           TPM_PCRVALUE *tpm_pcrs);
 TPM_RESULT TPM_PCRInfoLong_CheckDigest(TPM_PCR_INFO_LONG *tpm_pcr_info_long,
                                        TPM_PCRVALUE *tpm_pcrs,
+                                       TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache,
                                        TPM_MODIFIER_INDICATOR localityModifier);
 TPM_RESULT TPM_PCRInfoLong_SetDigestAtCreation(TPM_PCR_INFO_LONG *tpm_pcr_info_long,
                                                TPM_PCRVALUE *tpm_pcrs);
@@ -264,6 +278,7 @@ TPM_RESULT TPM_PCRInfoShort_GenerateDigest(TPM_DIGEST tpm_digest,
                                            TPM_PCRVALUE *tpm_pcrs);
 TPM_RESULT TPM_PCRInfoShort_CheckDigest(TPM_PCR_INFO_SHORT *tpm_pcr_info_short,
                                         TPM_PCRVALUE *tpm_pcrs,
+                                        TPM_PCR_DIGEST_CACHE *tpm_pcr_digest_cache,
                                         TPM_MODIFIER_INDICATOR localityModifier);
 
 /* getters */
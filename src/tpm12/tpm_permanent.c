@@ -964,11 +964,15 @@ TPM_RESULT TPM_PermanentData_InitDaa(TPM_PERMANENT_DATA *tpm_permanent_data)
    The two functions must be kept in sync.
 
    Data includes TPM_PERMANENT_DATA, TPM_PERMANENT_FLAGS, Owner Evict keys, and NV defined space.
+
+   'storedEntries' are the NV defined space entries that a roll back replaces, or NULL.  See
+   TPM_NVIndexEntries_NVLoad().
 */
 
 TPM_RESULT TPM_PermanentAll_Load(tpm_state_t *tpm_state,
 				 unsigned char **stream,
-				 uint32_t *stream_size)
+				 uint32_t *stream_size,
+				 TPM_NV_INDEX_ENTRIES *storedEntries)
 {
     TPM_RESULT		rc = 0;
     unsigned char	*stream_start = *stream;	/* copy for integrity check */		
@@ -1001,6 +1005,12 @@ TPM_RESULT TPM_PermanentAll_Load(tpm_state_t *tpm_state,
 	rc = TPM_NVIndexEntries_Load(&(tpm_state->tpm_nv_index_entries),
 				     stream, stream_size);
     }
+    /* NV defined space data that is stored under its own NVRAM names */
+    if (rc == 0) {
+	rc = TPM_NVIndexEntries_NVLoad(&(tpm_state->tpm_nv_index_entries),
+				       storedEntries,
+				       tpm_state->tpm_number);
+    }
     /* sanity check the stream size */
     if (rc == 0) {
 	if (*stream_size != TPM_DIGEST_SIZE) {
@@ -1109,38 +1119,52 @@ TPM_RESULT TPM_PermanentAll_NVLoad(tpm_state_t *tpm_state)
     unsigned char	*stream = NULL;
     unsigned char	*stream_start = NULL;
     uint32_t		stream_size;
+    uint32_t		stream_size_start = 0;
 
     printf(" TPM_PermanentAll_NVLoad:\n");
     if (rc == 0) {
 	/* try loading from NVRAM */
 	/* Returns TPM_RETRY on non-existent file */
-	rc = TPM_NVRAM_LoadData(&stream,		/* freed @1 */
+	rc = TPM_NVRAM_MapData(&stream,		/* released @1 */
 				&stream_size,
 				tpm_state->tpm_number,
 				TPM_PERMANENT_ALL_NAME);
     }
     /* deserialize from stream */
     if (rc == 0) {
-	stream_start = stream;			/* save starting point for free() */
-	rc = TPM_PermanentAll_Load(tpm_state, &stream, &stream_size);
+	stream_start = stream;			/* save starting point for release */
+	stream_size_start = stream_size;
+	rc = TPM_PermanentAll_Load(tpm_state, &stream, &stream_size, NULL);
 	if (rc != 0) {
 	    printf("TPM_PermanentAll_NVLoad: Error (fatal) loading deserializing NV state\n");
 	    rc = TPM_FAIL;
 	}
     }
-    free(stream_start); /* @1 */
+    /* remember what is in NVRAM, so that the next store can write only the changes */
+    TPM_Sbuffer_Clear(&(tpm_state->permanentAllImage));
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append(&(tpm_state->permanentAllImage),
+				stream_start, stream_size_start);
+    }
+    TPM_NVRAM_ReleaseData(stream_start,	/* @1 */
+			  tpm_state->tpm_number,
+			  TPM_PERMANENT_ALL_NAME);
     return rc;
 }
 
 /* TPM_PermanentAll_NVStore() serializes all NV data and stores it in the NV file
    TPM_PERMANENT_ALL_NAME
 
+   The serialized data is compared against the data last stored or loaded, and only the changed
+   bytes are written if the layout is unchanged.
+
    If the writeAllNV flag is FALSE, the function is a no-op, and returns the input 'rcIn'.
 
    If writeAllNV is TRUE and rcIn is not TPM_SUCCESS, this indicates that the ordinal
    modified the in-memory TPM_PERMANENT_DATA and/or TPM_PERMANENT_FLAGS structures (perhaps only
    partially) and then detected an error.  Since the command is failing, roll back the structure by
-   reading the NV file.	 If the read then fails, this is a fatal error.
+   deserializing the image of the last store or load.  NVRAM is read only if there is no image.  If
+   the roll back then fails, this is a fatal error.
 
    Similarly, if writeAllNV is TRUE and the actual NV write fails, this is a fatal error.
 */
@@ -1153,10 +1177,19 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
     TPM_STORE_BUFFER	sbuffer;	/* safe buffer for storing binary data */
     const unsigned char *buffer;
     uint32_t		length;
+    uint32_t		space;			/* required NV space */
+    const unsigned char *oldBuffer;		/* previously stored data */
+    uint32_t		oldLength;
+    unsigned char	*stream;		/* previously stored data, for roll back */
+    uint32_t		stream_size;
+    uint32_t		total;
+    TPM_BOOL		rollback = TRUE;	/* the structures must be rolled back */
     TPM_NV_DATA_ST 	*tpm_nv_data_st = NULL;	/* array of saved NV index volatile flags */ 
+    TPM_NV_INDEX_ENTRIES storedEntries;		/* the NV defined space being rolled back */
 
     printf(" TPM_PermanentAll_NVStore: write flag %u\n", writeAllNV);
     TPM_Sbuffer_Init(&sbuffer);			/* freed @1 */
+    TPM_NVIndexEntries_Init(&storedEntries);	/* freed @3 */
     if (writeAllNV) {
 	if (rcIn == TPM_SUCCESS) {
 	    /* serialize state to be written to NV */
@@ -1165,21 +1198,38 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
 					    &buffer, &length,
 					    tpm_state);
 	    }
-	    /* validate the length of the stream against the maximum provided NV space */
+	    /* validate the length of the stream and the NV index data stored separately against
+	       the maximum provided NV space */
 	    if (rc == 0) {
-		printf("   TPM_PermanentAll_NVStore: Require %u bytes\n", length);
-		if (length > TPM_MAX_NV_SPACE) {
+		space = length +
+			TPM_NVIndexEntries_GetDataSpace(&(tpm_state->tpm_nv_index_entries));
+		printf("   TPM_PermanentAll_NVStore: Require %u bytes\n", space);
+		if (space > TPM_MAX_NV_SPACE) {
 		    printf("TPM_PermanentAll_NVStore: Error, No space, need %u max %u\n",
-			   length, TPM_MAX_NV_SPACE);
+			   space, TPM_MAX_NV_SPACE);
 		    rc = TPM_NOSPACE;
 		}
 	    }
-	    /* store the buffer in NVRAM */
+	    /* store the buffer in NVRAM, writing only what changed since the last store */
+	    if (rc == 0) {
+		TPM_Sbuffer_Get(&(tpm_state->permanentAllImage), &oldBuffer, &oldLength);
+		rc = TPM_NVRAM_UpdateData(buffer,
+					  length,
+					  oldBuffer,
+					  oldLength,
+					  tpm_state->tpm_number,
+					  TPM_PERMANENT_ALL_NAME);
+	    }
+	    /* store the NV index data that changed, in the same transaction */
+	    if (rc == 0) {
+		rc = TPM_NVIndexEntries_NVStore(&(tpm_state->tpm_nv_index_entries),
+						tpm_state->tpm_number);
+	    }
+	    /* the stored buffer becomes the image to compare the next store against */
+	    TPM_Sbuffer_Delete(&(tpm_state->permanentAllImage));
 	    if (rc == 0) {
-		rc = TPM_NVRAM_StoreData(buffer,
-					 length,
-					 tpm_state->tpm_number,
-					 TPM_PERMANENT_ALL_NAME); 
+		tpm_state->permanentAllImage = sbuffer;
+		TPM_Sbuffer_Init(&sbuffer);
 	    }
 	    if (rc != 0) {
 		printf("TPM_PermanentAll_NVStore: Error (fatal), "
@@ -1189,34 +1239,57 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
 	}
 	else {	
 	    /* An in-memory structure was altered, but the ordinal had a subsequent error.  Since
-	       the structure is in an invalid state, roll back to the previous value by reading the
-	       NV file. */
+	       the structure is in an invalid state, roll back to the previous value.  The previous
+	       value is the image of the last NV store or load, so NVRAM is not read. */
 	    printf("  TPM_PermanentAll_NVStore: Ordinal error, "
 		   "rolling back NV structure cache\n");
+	    TPM_Sbuffer_Get(&(tpm_state->permanentAllImage), &oldBuffer, &oldLength);
+	    /* If the ordinal failed before it altered anything, the structures still serialize
+	       to the image, and there is nothing to roll back */
+	    if ((rc == 0) && (oldLength != 0)) {
+		rc = TPM_PermanentAll_Store(&sbuffer,
+					    &buffer, &length,
+					    tpm_state);
+		if ((rc == 0) &&
+		    (length == oldLength) && (memcmp(buffer, oldBuffer, length) == 0) &&
+		    !TPM_NVIndexEntries_IsChanged(&(tpm_state->tpm_nv_index_entries))) {
+		    printf("  TPM_PermanentAll_NVStore: NV structure cache unchanged\n");
+		    rollback = FALSE;
+		}
+	    }
 	    /* Save a copy of the NV defined space volatile state.  It is not stored in NV, so it
 	       will be destroyed during the rollback. */
 	    /* get a copy of the NV volatile flags, to be used during a rollback */
-	    if (rc == 0) {
+	    if ((rc == 0) && rollback) {
 		rc = TPM_NVIndexEntries_GetVolatile(&tpm_nv_data_st,	/* freed @2 */
 						    &(tpm_state->tpm_nv_index_entries));
 	    }
-	    /* Returns TPM_RETRY on non-existent file */
-	    if (rc == 0) {
+	    if ((rc == 0) && rollback) {
 		printf(" TPM_PermanentAllNVStore: Deleting TPM_PERMANENT_DATA structure\n");
 		TPM_PermanentData_Delete(&(tpm_state->tpm_permanent_data), TRUE);
 		printf(" TPM_PermanentAllNVStore: Deleting owner evict keys\n");
 		TPM_KeyHandleEntries_OwnerEvictDelete(tpm_state->tpm_key_handle_entries);
-		printf(" TPM_PermanentAllNVStore: Deleting NV defined space \n");
-		TPM_NVIndexEntries_Delete(&(tpm_state->tpm_nv_index_entries));
+		/* the NV index data that is unchanged since the last store is kept, so that it is
+		   not read from NVRAM again */
+		printf(" TPM_PermanentAllNVStore: Setting aside NV defined space \n");
+		storedEntries = tpm_state->tpm_nv_index_entries;
+		TPM_NVIndexEntries_Init(&(tpm_state->tpm_nv_index_entries));
 		printf(" TPM_PermanentAllNVStore: "
-		       "Rereading TPM_PERMANENT_DATA, TPM_PERMANENT_FLAGS, owner evict keys\n");
+		       "Restoring TPM_PERMANENT_DATA, TPM_PERMANENT_FLAGS, owner evict keys\n");
 		/* re-allocate TPM_PERMANENT_DATA data structures */
 		rc = TPM_PermanentData_Init(&(tpm_state->tpm_permanent_data), TRUE);
 	    }
-	    if (rc == 0) {
+	    /* deserialize the image */
+	    if ((rc == 0) && rollback && (oldLength != 0)) {
+		TPM_Sbuffer_GetAll(&(tpm_state->permanentAllImage), &stream, &stream_size, &total);
+		rc = TPM_PermanentAll_Load(tpm_state, &stream, &stream_size, &storedEntries);
+	    }
+	    /* if the image is unknown, fall back to reading NVRAM.  Returns TPM_RETRY on
+	       non-existent file */
+	    else if ((rc == 0) && rollback) {
 		rc = TPM_PermanentAll_NVLoad(tpm_state);
 	    }
-	    if (rc == 0) {
+	    if ((rc == 0) && rollback) {
 		rc = TPM_NVIndexEntries_SetVolatile(tpm_nv_data_st,
 						    &(tpm_state->tpm_nv_index_entries));
 	    }
@@ -1239,6 +1312,7 @@ TPM_RESULT TPM_PermanentAll_NVStore(tpm_state_t *tpm_state,
     }
     TPM_Sbuffer_Delete(&sbuffer);	/* @1 */
     free(tpm_nv_data_st);		/* @2 */
+    TPM_NVIndexEntries_Delete(&storedEntries);	/* @3 */
     return rc;
 }
 
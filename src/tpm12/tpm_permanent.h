@@ -88,7 +88,8 @@ TPM_RESULT TPM_PermanentData_InitDaa(TPM_PERMANENT_DATA *tpm_permanent_data);
 
 TPM_RESULT TPM_PermanentAll_Load(tpm_state_t *tpm_state,
 				 unsigned char **stream,
-				 uint32_t *stream_size);
+				 uint32_t *stream_size,
+				 TPM_NV_INDEX_ENTRIES *storedEntries);
 TPM_RESULT TPM_PermanentAll_Store(TPM_STORE_BUFFER *sbuffer,
 				  const unsigned char **buffer,
 				  uint32_t *length,
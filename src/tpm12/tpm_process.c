@@ -66,6 +66,7 @@
 #include "tpm_memory.h"
 #include "tpm_migration.h"
 #include "tpm_nonce.h"
+#include "tpm_nvfile.h"
 #include "tpm_nvram.h"
 #include "tpm_owner.h"
 #include "tpm_pcr.h"
@@ -2048,25 +2049,94 @@ static TPM_ORDINAL_TABLE tpm_ordinal_table[] =
    Ordinal Table Utilities
 */
 
+/* The ordinal index maps an ordinal directly to its entry in tpm_ordinal_table[], so that the
+   entry is found with one array access rather than a search of the table.
+
+   All implemented ordinals are either TPM protected ordinals 0x00000000 - 0x000000ff or TSC
+   connection ordinals 0x40000000 - 0x400000ff.  The low byte of the ordinal, together with one bit
+   for the connection command flag, forms the index.
+*/
+
+#define TPM_ORDINAL_INDEX_MASK	0x000000ff
+#define TPM_ORDINAL_INDEX_SIZE	(2 * (TPM_ORDINAL_INDEX_MASK + 1))
+
+static TPM_ORDINAL_TABLE *tpm_ordinal_index[TPM_ORDINAL_INDEX_SIZE];
+
+/* TPM_OrdinalTable_GetIndex() returns the index into tpm_ordinal_index[] for the ordinal.
+
+   If the ordinal cannot be in the table, TPM_BAD_ORDINAL is returned
+*/
+
+static TPM_RESULT TPM_OrdinalTable_GetIndex(size_t *index,
+					    TPM_COMMAND_CODE ordinal)
+{
+    TPM_RESULT	rc = 0;
+
+    if ((ordinal & ~(TPM_CONNECTION_COMMAND | TPM_ORDINAL_INDEX_MASK)) != 0) {
+	rc = TPM_BAD_ORDINAL;
+    }
+    else if (ordinal & TPM_CONNECTION_COMMAND) {
+	*index = (TPM_ORDINAL_INDEX_MASK + 1) + (ordinal & TPM_ORDINAL_INDEX_MASK);
+    }
+    else {
+	*index = ordinal;
+    }
+    return rc;
+}
+
+/* TPM_OrdinalTable_Init() builds the ordinal index from tpm_ordinal_table[].
+
+   It is called once at startup, before any command is processed.  An ordinal that does not fit
+   the index or appears twice in the table is a fatal error.
+*/
+
+TPM_RESULT TPM_OrdinalTable_Init(void)
+{
+    TPM_RESULT	rc = 0;
+    size_t	i;
+    size_t	index;
+
+    printf(" TPM_OrdinalTable_Init:\n");
+    memset(tpm_ordinal_index, 0, sizeof(tpm_ordinal_index));
+    for (i = 0 ; (rc == 0) && (i < (sizeof(tpm_ordinal_table)/sizeof(TPM_ORDINAL_TABLE))) ; i++) {
+	rc = TPM_OrdinalTable_GetIndex(&index, tpm_ordinal_table[i].ordinal);
+	if (rc != 0) {
+	    printf("TPM_OrdinalTable_Init: Error (fatal), ordinal %08x out of range\n",
+		   tpm_ordinal_table[i].ordinal);
+	    rc = TPM_FAIL;
+	}
+	else if (tpm_ordinal_index[index] != NULL) {
+	    printf("TPM_OrdinalTable_Init: Error (fatal), ordinal %08x is duplicate\n",
+		   tpm_ordinal_table[i].ordinal);
+	    rc = TPM_FAIL;
+	}
+	else {
+	    tpm_ordinal_index[index] = &(tpm_ordinal_table[i]);
+	}
+    }
+    return rc;
+}
+
 /* TPM_OrdinalTable_GetEntry() gets the table entry for the ordinal.
 
    If the ordinal is not in the table, TPM_BAD_ORDINAL is returned
 */
 
 TPM_RESULT TPM_OrdinalTable_GetEntry(TPM_ORDINAL_TABLE **entry,
-				     TPM_ORDINAL_TABLE *ordinalTable,
 				     TPM_COMMAND_CODE ordinal)
 {
-    TPM_RESULT	rc = TPM_BAD_ORDINAL;
-    size_t	i;
+    TPM_RESULT	rc = 0;
+    size_t	index;
 
     /* printf(" TPM_OrdinalTable_GetEntry: Ordinal %08x\n", ordinal); */
     *entry = NULL;
-    for (i = 0 ; i < (sizeof(tpm_ordinal_table)/sizeof(TPM_ORDINAL_TABLE)) ; i++) {
-	if (ordinalTable[i].ordinal == ordinal) {	/* if found */
-	    *entry = &(ordinalTable[i]);		/* return the entry */
-	    rc = 0;					/* return found */
-	    break;
+    if (rc == 0) {
+	rc = TPM_OrdinalTable_GetIndex(&index, ordinal);
+    }
+    if (rc == 0) {
+	*entry = tpm_ordinal_index[index];
+	if (*entry == NULL) {
+	    rc = TPM_BAD_ORDINAL;
 	}
     }
     return rc;
@@ -2078,7 +2148,6 @@ TPM_RESULT TPM_OrdinalTable_GetEntry(TPM_ORDINAL_TABLE **entry,
 */
 
 void TPM_OrdinalTable_GetProcessFunction(tpm_process_function_t *tpm_process_function,
-					 TPM_ORDINAL_TABLE *ordinalTable,
 					 TPM_COMMAND_CODE ordinal)
 {
     TPM_RESULT	rc = 0;
@@ -2087,7 +2156,7 @@ void TPM_OrdinalTable_GetProcessFunction(tpm_process_function_t *tpm_process_fun
     printf(" TPM_OrdinalTable_GetProcessFunction: Ordinal %08x\n", ordinal);
 
     if (rc == 0) {
-	rc = TPM_OrdinalTable_GetEntry(&entry, ordinalTable, ordinal);
+	rc = TPM_OrdinalTable_GetEntry(&entry, ordinal);
     }
     if (rc == 0) {	/* if found */
 #ifdef TPM_V12
@@ -2115,7 +2184,7 @@ void TPM_OrdinalTable_GetAuditable(TPM_BOOL *auditable,
     
     printf(" TPM_OrdinalTable_GetAuditable: Ordinal %08x\n", ordinal);
     if (rc == 0) {
-	rc = TPM_OrdinalTable_GetEntry(&entry, tpm_ordinal_table, ordinal);
+	rc = TPM_OrdinalTable_GetEntry(&entry, ordinal);
     }
     /* if not found, unimplemented, not auditable */
     if (rc != 0) {
@@ -2152,7 +2221,7 @@ void TPM_OrdinalTable_GetAuditDefault(TPM_BOOL *auditDefault,
     TPM_ORDINAL_TABLE *entry;
 
     if (rc == 0) {
-	rc = TPM_OrdinalTable_GetEntry(&entry, tpm_ordinal_table, ordinal);
+	rc = TPM_OrdinalTable_GetEntry(&entry, ordinal);
     }
     /* if not found, unimplemented, not auditable */
     if (rc != 0) {
@@ -2178,7 +2247,7 @@ TPM_RESULT TPM_OrdinalTable_GetOwnerPermission(uint16_t *ownerPermissionBlock,
     TPM_ORDINAL_TABLE *entry;
 
     if (rc == 0) {
-	rc = TPM_OrdinalTable_GetEntry(&entry, tpm_ordinal_table, ordinal);
+	rc = TPM_OrdinalTable_GetEntry(&entry, ordinal);
     }
     if (rc == 0) {
 	*ownerPermissionBlock = entry->ownerPermissionBlock;
@@ -2205,7 +2274,7 @@ TPM_RESULT TPM_OrdinalTable_GetKeyPermission(uint16_t *keyPermissionBlock,
     TPM_ORDINAL_TABLE *entry;
 
     if (rc == 0) {
-	rc = TPM_OrdinalTable_GetEntry(&entry, tpm_ordinal_table, ordinal);
+	rc = TPM_OrdinalTable_GetEntry(&entry, ordinal);
     }
     if (rc == 0) {
 	*keyPermissionBlock = entry->keyPermissionBlock;
@@ -2266,7 +2335,7 @@ TPM_RESULT TPM_OrdinalTable_ParseWrappedCmd(uint32_t *datawStart,
     /* get the entry from the ordinal table */
     if (rc == 0) {
 	printf("  TPM_OrdinalTable_ParseWrappedCmd: ordinal %08x\n", *ordinal);
-	rc = TPM_OrdinalTable_GetEntry(&entry, tpm_ordinal_table, *ordinal);
+	rc = TPM_OrdinalTable_GetEntry(&entry, *ordinal);
     }
     if (rc == 0) {
 	/* datawStart indexes into the dataW area, skip the standard 3 inputs and the handles */
@@ -2374,7 +2443,7 @@ TPM_RESULT TPM_OrdinalTable_ParseWrappedRsp(uint32_t *datawStart,
     /* get the entry from the ordinal table */
     if (rc == 0) {
 	printf(" TPM_OrdinalTable_ParseWrappedRsp: returnCode %08x\n", *rcw);
-	rc = TPM_OrdinalTable_GetEntry(&entry, tpm_ordinal_table, ordinal);
+	rc = TPM_OrdinalTable_GetEntry(&entry, ordinal);
     }
     /* parse the success return code case */
     if ((rc == 0) && (*rcw == TPM_SUCCESS)) {
@@ -2434,6 +2503,13 @@ void TPM_KeyHandleEntries_Trace(TPM_KEY_HANDLE_ENTRY *tpm_key_handle_entries)
 
 void TPM_State_Trace(tpm_state_t *tpm_state);
 
+static TPM_RESULT TPM_Process_Command(TPM_STORE_BUFFER *response,
+				      unsigned char *command,
+				      uint32_t command_size,
+				      tpm_state_t *targetInstance,
+				      uint32_t tpm_number,
+				      TPM_BOOL storeVolatile);
+
 void TPM_State_Trace(tpm_state_t *tpm_state)
 {
     printf("TPM_State_Trace: disable %u p_deactive %u v_deactive %u owned %u state %u\n",
@@ -2478,7 +2554,8 @@ TPM_RESULT TPM_ProcessA(unsigned char **response,
 			uint32_t *response_size,
 			uint32_t *response_total,
 			unsigned char *command,		/* complete command array */
-			uint32_t command_size)		/* actual bytes in command */
+			uint32_t command_size,		/* actual bytes in command */
+			uint32_t tpm_number)		/* the target TPM instance */
 
 {
     TPM_RESULT rc = 0;
@@ -2494,7 +2571,8 @@ TPM_RESULT TPM_ProcessA(unsigned char **response,
     if (rc == 0) {
 	rc = TPM_Process(&responseSbuffer,
 			 command,		/* complete command array */
-			 command_size);		/* actual bytes in command */
+			 command_size,		/* actual bytes in command */
+			 tpm_number);		/* the target TPM instance */
 
     }
     /* get the response parameters from the sbuffer */
@@ -2511,6 +2589,10 @@ TPM_RESULT TPM_ProcessA(unsigned char **response,
 
    'command_size' is the actual size of the command stream.
 
+   'tpm_number' selects the TPM instance in tpm_instances[].  If the instance does not exist, the
+   response carries TPM_BAD_PARAMETER.  The instance is locked while the command is processed, so
+   that commands to different instances can be processed concurrently.
+
    Returns:
        0 on success
 
@@ -2520,24 +2602,242 @@ TPM_RESULT TPM_ProcessA(unsigned char **response,
 
 TPM_RESULT TPM_Process(TPM_STORE_BUFFER *response,
 		       unsigned char *command,		/* complete command array */
-		       uint32_t command_size)		/* actual bytes in command */
+		       uint32_t command_size,		/* actual bytes in command */
+		       uint32_t tpm_number)		/* the target TPM instance */
+{
+    TPM_RESULT		rc = 0;				/* fatal error, no response */
+    TPM_RESULT		rc1 = 0;			/* NVRAM commit */
+    tpm_state_t		*targetInstance = NULL;		/* TPM global state */
+
+    /* get the global TPM state */
+    if (tpm_number < TPMS_MAX) {
+	/* commands to the same instance are serialized */
+	TPM_Global_Lock(tpm_number);		/* unlocked @1 */
+	targetInstance = tpm_instances[tpm_number];
+    }
+    if (targetInstance != NULL) {
+	/* the NVRAM writes of the command are made durable together */
+	TPM_NVRAM_Begin(tpm_number);
+    }
+    rc = TPM_Process_Command(response,
+			     command,
+			     command_size,
+			     targetInstance,
+			     tpm_number,
+			     TRUE);		/* save the volatile state */
+    if (targetInstance != NULL) {
+	/* the response must not be returned unless the state it depends on is durable */
+	rc1 = TPM_NVRAM_Commit(tpm_number);
+	if (rc1 != 0) {
+	    printf("TPM_Process: Error, committing the NVRAM writes failed\n");
+	    printf("  TPM_Process: Set testState to %u \n", TPM_TEST_STATE_FAILURE);
+	    targetInstance->testState = TPM_TEST_STATE_FAILURE;
+	    rc = rc1;
+	}
+    }
+    if (tpm_number < TPMS_MAX) {
+	TPM_Global_Unlock(tpm_number);		/* @1 */
+    }
+    return rc;
+}
+
+/* TPM_ProcessBatchA() is an alternate to TPM_ProcessBatch() that uses standard C types.  The
+   response parameters follow the design pattern of TPM_ProcessA().
+*/
+
+TPM_RESULT TPM_ProcessBatchA(unsigned char **response,
+			     uint32_t *response_size,
+			     uint32_t *response_total,
+			     unsigned char *commands,	/* the command arrays, back to back */
+			     uint32_t commands_size,	/* actual bytes in commands */
+			     uint32_t *count,		/* number of commands processed */
+			     uint32_t tpm_number)	/* the target TPM instance */
+{
+    TPM_RESULT rc = 0;
+    TPM_STORE_BUFFER responseSbuffer;
+
+    /* set the sbuffer from the response parameters */
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Set(&responseSbuffer,
+			     *response,
+			     *response_size,
+			     *response_total);
+    }
+    if (rc == 0) {
+	rc = TPM_ProcessBatch(&responseSbuffer,
+			      commands,
+			      commands_size,
+			      count,
+			      tpm_number);
+    }
+    /* get the response parameters from the sbuffer */
+    if (rc == 0) {
+	TPM_Sbuffer_GetAll(&responseSbuffer,
+			   response,
+			   response_size,
+			   response_total);
+    }
+    return rc;
+}
+
+/* TPM_ProcessBatch() processes a batch of commands from the host to the TPM.
+
+   'commands' holds complete commands back to back, each one framed by the paramSize in its
+   header.  'commands_size' is the actual size of all of them.  The responses are appended to
+   'response' in the same order, each one framed by its paramSize.  '*count' returns the number of
+   commands processed.
+
+   Each command is processed as if it were sent with TPM_Process(), so that a failing command does
+   not stop the batch.  The instance is locked once for the batch, the NVRAM writes of all commands
+   are made durable together at the end, and a save of the volatile state is deferred to the last
+   command.
+
+   Returns:
+       0 on success
+
+       TPM_BAD_PARAMETER if the commands are not framed correctly.  No command is processed.
+
+       non-zero on a fatal error preventing the commands from being processed.  The response is
+       invalid in this case.
+*/
+
+TPM_RESULT TPM_ProcessBatch(TPM_STORE_BUFFER *response,
+			    unsigned char *commands,	/* the command arrays, back to back */
+			    uint32_t commands_size,	/* actual bytes in commands */
+			    uint32_t *count,		/* number of commands processed */
+			    uint32_t tpm_number)	/* the target TPM instance */
 {
     TPM_RESULT		rc = 0;				/* fatal error, no response */
+    TPM_RESULT		rc1 = 0;			/* NVRAM commit */
+    uint32_t		offset;				/* of the current command */
+    uint32_t		paramSize = 0;			/* size of the current command */
+    uint32_t		number = 0;			/* number of commands in the batch */
+    uint32_t		i;
+    unsigned char	*stream;
+    uint32_t		stream_size;
+    tpm_state_t		*targetInstance = NULL;		/* TPM global state */
+    TPM_BOOL		locked = FALSE;
+
+    printf(" TPM_ProcessBatch: %u bytes of commands\n", commands_size);
+    *count = 0;
+    /* check the framing of all commands before processing the first one */
+    for (offset = 0 ; (rc == 0) && (offset < commands_size) ; offset += paramSize) {
+	/* skip the tag, get the paramSize */
+	if ((commands_size - offset) < (sizeof(TPM_TAG) + sizeof(uint32_t))) {
+	    printf("TPM_ProcessBatch: Error, command %u header is truncated\n", number);
+	    rc = TPM_BAD_PARAMETER;
+	}
+	if (rc == 0) {
+	    stream = commands + offset + sizeof(TPM_TAG);
+	    stream_size = commands_size - offset - sizeof(TPM_TAG);
+	    rc = TPM_Load32(&paramSize, &stream, &stream_size);
+	}
+	if (rc == 0) {
+	    if ((paramSize < (sizeof(TPM_TAG) + sizeof(uint32_t))) ||
+		(paramSize > (commands_size - offset))) {
+		printf("TPM_ProcessBatch: Error, command %u paramSize %u is inconsistent\n",
+		       number, paramSize);
+		rc = TPM_BAD_PARAMETER;
+	    }
+	}
+	if (rc == 0) {
+	    number++;
+	}
+    }
+    if (rc == 0) {
+	if (number == 0) {
+	    printf("TPM_ProcessBatch: Error, no commands\n");
+	    rc = TPM_BAD_PARAMETER;
+	}
+    }
+    /* get the global TPM state */
+    if ((rc == 0) && (tpm_number < TPMS_MAX)) {
+	/* the batch is serialized with other commands to the same instance */
+	TPM_Global_Lock(tpm_number);		/* unlocked @1 */
+	locked = TRUE;
+	targetInstance = tpm_instances[tpm_number];
+	if (targetInstance != NULL) {
+	    /* the NVRAM writes of the batch are made durable together */
+	    TPM_NVRAM_Begin(tpm_number);
+	}
+    }
+    for (i = 0, offset = 0 ; (rc == 0) && (i < number) ; i++, offset += paramSize) {
+	stream = commands + offset + sizeof(TPM_TAG);
+	stream_size = commands_size - offset - sizeof(TPM_TAG);
+	TPM_Load32(&paramSize, &stream, &stream_size);
+	rc = TPM_Process_Command(response,
+				 commands + offset,
+				 paramSize,
+				 targetInstance,
+				 tpm_number,
+				 (TPM_BOOL)(i == (number - 1)));	/* save the volatile state
+									   at the last one */
+	if (rc == 0) {
+	    (*count)++;
+	}
+    }
+    if (targetInstance != NULL) {
+	/* the responses must not be returned unless the state they depend on is durable */
+	rc1 = TPM_NVRAM_Commit(tpm_number);
+	if (rc1 != 0) {
+	    printf("TPM_ProcessBatch: Error, committing the NVRAM writes failed\n");
+	    printf("  TPM_ProcessBatch: Set testState to %u \n", TPM_TEST_STATE_FAILURE);
+	    targetInstance->testState = TPM_TEST_STATE_FAILURE;
+	    if (rc == 0) {
+		rc = rc1;
+	    }
+	}
+    }
+    if (locked) {
+	TPM_Global_Unlock(tpm_number);		/* @1 */
+    }
+    return rc;
+}
+
+/* TPM_Process_Command() processes one command for TPM_Process() and TPM_ProcessBatch() and
+   appends its response to 'response'.  The caller holds the lock of the instance and the NVRAM
+   transaction.
+
+   'targetInstance' is NULL if the TPM instance 'tpm_number' does not exist.  The response then
+   carries TPM_BAD_PARAMETER.
+
+   'storeVolatile' FALSE defers saving the volatile state that the schedule of the instance may
+   ask for.
+
+   Returns:
+       0 on success
+
+       non-zero on a fatal error preventing the command from being processed.  The response is
+       invalid in this case.
+*/
+
+static TPM_RESULT TPM_Process_Command(TPM_STORE_BUFFER *response,
+				      unsigned char *command,	/* complete command array */
+				      uint32_t command_size,	/* actual bytes in command */
+				      tpm_state_t *targetInstance,
+				      uint32_t tpm_number,
+				      TPM_BOOL storeVolatile)
+{
+    TPM_RESULT		rc = 0;				/* fatal error, no response */
+    TPM_RESULT		rc1 = 0;			/* volatile state schedule */
     TPM_RESULT		returnCode = TPM_SUCCESS;	/* fatal error in ordinal processing,
 							   can be returned */
     TPM_TAG		tag = 0;
     uint32_t		paramSize = 0;
     TPM_COMMAND_CODE	ordinal = 0;
     tpm_process_function_t tpm_process_function = NULL;	/* based on ordinal */
-    tpm_state_t		*targetInstance = NULL;		/* TPM global state */
+    TPM_BOOL		volatileChanged = TRUE;		/* the command may change the volatile
+							   state */
     TPM_STORE_BUFFER	localBuffer;		/* for response if instance was not found */
     TPM_STORE_BUFFER	*sbuffer;		/* either localBuffer or the instance response
 						   buffer */
 
     TPM_Sbuffer_Init(&localBuffer);	/* freed @1 */
-    /* get the global TPM state */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
-	targetInstance = tpm_instances[0];
+	if (targetInstance == NULL) {
+	    printf("TPM_Process: Error, TPM %lu does not exist\n", (unsigned long)tpm_number);
+	    returnCode = TPM_BAD_PARAMETER;
+	}
     }
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
 	/* clear the response form the previous ordinal, the response buffer is reused */
@@ -2546,6 +2846,10 @@ TPM_RESULT TPM_Process(TPM_STORE_BUFFER *response,
 	returnCode = TPM_Process_GetCommandParams(&tag, &paramSize, &ordinal,
 						  &command, &command_size);
     }	 
+    /* commands that cannot change the volatile state do not make the schedule save it */
+    if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
+	volatileChanged = TPM_VolatileSchedule_Changes(targetInstance, tag, ordinal);
+    }
     /* preprocessing common to all ordinals */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
 	returnCode = TPM_Process_Preprocess(targetInstance, ordinal, NULL);
@@ -2557,7 +2861,7 @@ TPM_RESULT TPM_Process(TPM_STORE_BUFFER *response,
     /* process the ordinal */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
 	/* get the processing function from the ordinal table */
-	TPM_OrdinalTable_GetProcessFunction(&tpm_process_function, tpm_ordinal_table, ordinal);
+	TPM_OrdinalTable_GetProcessFunction(&tpm_process_function, ordinal);
 	/* call the processing function to execute the command */
 	returnCode = tpm_process_function(targetInstance,
 					  &(targetInstance->tpm_stclear_data.ordinalResponse),
@@ -2572,12 +2876,17 @@ TPM_RESULT TPM_Process(TPM_STORE_BUFFER *response,
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
 	TPM_State_Trace(targetInstance);
     }
-#ifdef TPM_VOLATILE_STORE
-    /* save the volatile state after each command to handle fail-over restart */
-    if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
-	returnCode = TPM_VolatileAll_NVStore(targetInstance);
+    /* account the command in the volatile state schedule, which may save the state to handle
+       fail-over restart */
+    if ((rc == 0) && (targetInstance != NULL)) {
+	rc1 = TPM_VolatileSchedule_Command(targetInstance,
+					   volatileChanged,
+					   (TPM_BOOL)(storeVolatile &&
+						      (returnCode == TPM_SUCCESS)));
+	if (returnCode == TPM_SUCCESS) {
+	    returnCode = rc1;
+	}
     }
-#endif	/* TPM_VOLATILE_STORE */
     /* If the ordinal processing function returned without a fatal error, append its ordinalResponse
        to the output response buffer */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
@@ -2677,7 +2986,7 @@ TPM_RESULT TPM_Process_Wrapped(TPM_STORE_BUFFER *response,
     /* process the ordinal */
     if ((rc == 0) && (returnCode == TPM_SUCCESS)) {
 	/* get the processing function from the ordinal table */
-	TPM_OrdinalTable_GetProcessFunction(&tpm_process_function, tpm_ordinal_table, ordinal);
+	TPM_OrdinalTable_GetProcessFunction(&tpm_process_function, ordinal);
 	/* call the processing function to execute the command */
 	returnCode = tpm_process_function(targetInstance, &ordinalResponse,
 					  tag, command_size, ordinal, command,
@@ -3744,7 +4053,7 @@ static TPM_RESULT TPM_GetCapability_CapOrd(TPM_STORE_BUFFER *capabilityResponse,
     tpm_process_function_t	tpm_process_function;
     TPM_BOOL			supported;
 
-    TPM_OrdinalTable_GetProcessFunction(&tpm_process_function, tpm_ordinal_table, ordinal);
+    TPM_OrdinalTable_GetProcessFunction(&tpm_process_function, ordinal);
     /* determine of the ordinal is supported */
     if (tpm_process_function != TPM_Process_Unused) {
 	supported = TRUE;
@@ -3930,8 +4239,10 @@ static TPM_RESULT TPM_GetCapability_CapProperty(TPM_STORE_BUFFER *capabilityResp
 	break;
       case TPM_CAP_PROP_MAX_KEYS:	/* The maximum number of 2048 RSA keys that the TPM can
 					   support. The number does not include the EK or SRK. */
-	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_MAX_KEYS %u\n", TPM_KEY_HANDLES);
-	rc = TPM_Sbuffer_Append32(capabilityResponse, TPM_KEY_HANDLES);
+	/* the key slots and the swap entries */
+	printf(" TPM_GetCapability_CapProperty: TPM_CAP_PROP_MAX_KEYS %u\n",
+	       TPM_KEY_TABLE_ENTRIES);
+	rc = TPM_Sbuffer_Append32(capabilityResponse, TPM_KEY_TABLE_ENTRIES);
 	break;
       case TPM_CAP_PROP_OWNER:	/* A value of TRUE indicates that the TPM has successfully installed
 				   an owner. */
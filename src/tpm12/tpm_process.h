@@ -97,10 +97,24 @@ TPM_RESULT TPM_ProcessA(unsigned char **response,
 			uint32_t *response_size,
 			uint32_t *response_total,
 			unsigned char *command,
-			uint32_t command_size);
+			uint32_t command_size,
+			uint32_t tpm_number);
 TPM_RESULT TPM_Process(TPM_STORE_BUFFER *response,
                        unsigned char *command,
-                       uint32_t command_size);
+                       uint32_t command_size,
+                       uint32_t tpm_number);
+TPM_RESULT TPM_ProcessBatchA(unsigned char **response,
+			     uint32_t *response_size,
+			     uint32_t *response_total,
+			     unsigned char *commands,
+			     uint32_t commands_size,
+			     uint32_t *count,
+			     uint32_t tpm_number);
+TPM_RESULT TPM_ProcessBatch(TPM_STORE_BUFFER *response,
+                            unsigned char *commands,
+                            uint32_t commands_size,
+                            uint32_t *count,
+                            uint32_t tpm_number);
 TPM_RESULT TPM_Process_Wrapped(TPM_STORE_BUFFER *response,
                                unsigned char *command,
                                uint32_t command_size,
@@ -225,11 +239,10 @@ typedef struct tdTPM_ORDINAL_TABLE {
                                                            hardware TPM instance  */
 } TPM_ORDINAL_TABLE;
 
+TPM_RESULT TPM_OrdinalTable_Init(void);
 TPM_RESULT TPM_OrdinalTable_GetEntry(TPM_ORDINAL_TABLE **entry,
-                                     TPM_ORDINAL_TABLE *ordinalTable,
                                      TPM_COMMAND_CODE ordinal);
 void       TPM_OrdinalTable_GetProcessFunction(tpm_process_function_t *tpm_process_function,
-                                               TPM_ORDINAL_TABLE *ordinalTable,
                                                TPM_COMMAND_CODE ordinal);
 void       TPM_OrdinalTable_GetAuditable(TPM_BOOL *auditable,
                                          TPM_COMMAND_CODE ordinal);
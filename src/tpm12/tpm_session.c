@@ -111,6 +111,7 @@ void TPM_AuthSessionData_Init(TPM_AUTH_SESSION_DATA *tpm_auth_session_data)
     TPM_Digest_Init(tpm_auth_session_data->entityDigest);
     TPM_DelegatePublic_Init(&(tpm_auth_session_data->pub));
     tpm_auth_session_data->valid = FALSE;
+    TPM_HmacContext_Init(&(tpm_auth_session_data->hmacContext));
     return;
 }
 
@@ -231,13 +232,14 @@ void TPM_AuthSessionData_Delete(TPM_AUTH_SESSION_DATA *tpm_auth_session_data)
     printf(" TPM_AuthSessionData_Delete:\n");
     if (tpm_auth_session_data != NULL) {
 	TPM_DelegatePublic_Delete(&(tpm_auth_session_data->pub));
+	TPM_HmacContext_Delete(&(tpm_auth_session_data->hmacContext));
 	TPM_AuthSessionData_Init(tpm_auth_session_data);
     }
     return;
 }
 
 /* TPM_AuthSessionData_Copy() copies the source to the destination.  The source handle is ignored,
-   since it might already be used.
+   since it might already be used.  The HMAC context is not copied.
 */
 
 void TPM_AuthSessionData_Copy(TPM_AUTH_SESSION_DATA *dest_auth_session_data,
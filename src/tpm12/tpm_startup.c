@@ -39,7 +39,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
 
+#include "tpm_audit.h"
 #include "tpm_debug.h"
 #include "tpm_error.h"
 #include "tpm_constants.h"
@@ -254,21 +258,23 @@ TPM_RESULT TPM_SaveState_NVLoad(tpm_state_t *tpm_state)
     printf(" TPM_SaveState_NVLoad:\n");
     if (rc == 0) {
 	/* load from NVRAM.  Returns TPM_RETRY on non-existent file. */
-	rc = TPM_NVRAM_LoadData(&stream,			/* freed @1 */
+	rc = TPM_NVRAM_MapData(&stream,			/* released @1 */
 				&stream_size,
 				tpm_state->tpm_number,
 				TPM_SAVESTATE_NAME);
     }
     /* deserialize from stream */
     if (rc == 0) {
-	stream_start = stream;			/* save starting point for free() */
+	stream_start = stream;			/* save starting point for release */
 	rc = TPM_SaveState_Load(tpm_state, &stream, &stream_size);
 	if (rc != 0) {
 	    printf("TPM_SaveState_NVLoad: Error (fatal) loading deserializing saved state\n");
 	    rc = TPM_FAIL;
 	}
     }
-    free(stream_start); /* @1 */
+    TPM_NVRAM_ReleaseData(stream_start,	/* @1 */
+			  tpm_state->tpm_number,
+			  TPM_SAVESTATE_NAME);
     return rc;
 }
 
@@ -439,13 +445,36 @@ TPM_RESULT TPM_VolatileAll_Load(tpm_state_t *tpm_state,
     return rc;
 }
 
+/* TPM_VolatileAll_MarkSection() records the current length of 'sbuffer' as the end of the
+   section '*section' in 'sections', unless 'sections' is NULL.
+*/
+
+static void TPM_VolatileAll_MarkSection(uint32_t *sections,
+					size_t *section,
+					TPM_STORE_BUFFER *sbuffer)
+{
+    const unsigned char *buffer;
+    uint32_t length;
+
+    if ((sections != NULL) && (*section < TPM_VOLATILE_SECTIONS)) {
+	TPM_Sbuffer_Get(sbuffer, &buffer, &length);
+	sections[*section] = length;
+	(*section)++;
+    }
+    return;
+}
+
 /* TPM_VolatileAll_Store() stores the TPM state to a stream that can be restored through
    TPM_VolatileAll_Load().
 
    The two functions must be kept in sync.
+
+   If 'sections' is not NULL, it returns the end offsets of the TPM_VOLATILE_SECTIONS sections of
+   the stream, so that TPM_VolatileAll_StoreDelta() can compare the stream section by section.
 */
 
 TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
+				 uint32_t *sections,
 				 tpm_state_t *tpm_state)
 {
     TPM_RESULT			rc = 0;
@@ -454,6 +483,7 @@ TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
     const unsigned char 	*buffer;	/* elements of sbuffer */
     uint32_t 			length;
     TPM_DIGEST			tpm_digest;
+    size_t			section = 0;
 
     printf(" TPM_VolatileAll_Store:\n");
     /* overall format tag */
@@ -464,6 +494,7 @@ TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
     if (rc == 0) {
 	rc = TPM_Parameters_Store(sbuffer);
     }
+    TPM_VolatileAll_MarkSection(sections, &section, sbuffer);
     /* V1 is the TCG standard returned by the getcap.  It's unlikely that this will change */
     if (rc == 0) {
 	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_STCLEAR_FLAGS_V1);
@@ -472,10 +503,12 @@ TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
     if (rc == 0) {
 	rc = TPM_StclearFlags_Store(sbuffer, &(tpm_state->tpm_stclear_flags));
     }
+    TPM_VolatileAll_MarkSection(sections, &section, sbuffer);
     /* TPM_STANY_FLAGS */
     if (rc == 0) {
 	rc = TPM_StanyFlags_Store(sbuffer, &(tpm_state->tpm_stany_flags));
     }
+    TPM_VolatileAll_MarkSection(sections, &section, sbuffer);
     /* TPM_STCLEAR_DATA */
     /* normally, resettable PCRs are not restored.  "All" means to restore everything */
     for (i = 0 ; (rc == 0) && (i < TPM_NUM_PCR) ; i++) {
@@ -486,14 +519,17 @@ TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
 	rc = TPM_StclearData_Store(sbuffer, &(tpm_state->tpm_stclear_data),
 				   (TPM_PCR_ATTRIBUTES *)&pcrAttrib);
     }
+    TPM_VolatileAll_MarkSection(sections, &section, sbuffer);
     /* TPM_STANY_DATA  */
     if (rc == 0) {
 	rc = TPM_StanyData_Store(sbuffer, &(tpm_state->tpm_stany_data));
     }
+    TPM_VolatileAll_MarkSection(sections, &section, sbuffer);
     /* TPM_KEY_HANDLE_ENTRY */
     if (rc == 0) {
 	rc = TPM_KeyHandleEntries_Store(sbuffer, tpm_state);
     }
+    TPM_VolatileAll_MarkSection(sections, &section, sbuffer);
     /* Context for SHA1 functions */
     if (rc == 0) {
 	printf("  TPM_VolatileAll_Store: Storing SHA ordinal context\n");
@@ -504,6 +540,7 @@ TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
 	printf("  TPM_VolatileAll_Store: Storing TIS context\n");
 	rc = TPM_Sha1Context_Store(sbuffer, tpm_state->sha1_context_tis);
     }
+    TPM_VolatileAll_MarkSection(sections, &section, sbuffer);
     /* TPM_TRANSHANDLE */
     if (rc == 0) {
 	rc = TPM_Sbuffer_Append32(sbuffer, tpm_state->transportHandle);
@@ -517,6 +554,7 @@ TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
 	rc = TPM_NVIndexEntries_StoreVolatile(sbuffer,
 					      &(tpm_state->tpm_nv_index_entries));
     }
+    TPM_VolatileAll_MarkSection(sections, &section, sbuffer);
     if (rc == 0) {
 	/* get the current serialized buffer and its length */
 	TPM_Sbuffer_Get(sbuffer, &buffer, &length);
@@ -530,6 +568,7 @@ TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
 	printf(" TPM_VolatileAll_Store: Appending integrity digest\n");
 	rc = TPM_Sbuffer_Append(sbuffer, tpm_digest, TPM_DIGEST_SIZE);
     }
+    TPM_VolatileAll_MarkSection(sections, &section, sbuffer);
     return rc;
 }
 
@@ -553,7 +592,7 @@ TPM_RESULT TPM_VolatileAll_NVLoad(tpm_state_t *tpm_state)
     printf(" TPM_VolatileAll_NVLoad:\n");
     if (rc == 0) {
 	/* load from NVRAM.  Returns TPM_RETRY on non-existent file. */
-	rc = TPM_NVRAM_LoadData(&stream,			/* freed @1 */
+	rc = TPM_NVRAM_MapData(&stream,			/* released @1 */
 				&stream_size,
 				tpm_state->tpm_number,
 				TPM_VOLATILESTATE_NAME);
@@ -569,24 +608,35 @@ TPM_RESULT TPM_VolatileAll_NVLoad(tpm_state_t *tpm_state)
     }
     /* deserialize from stream */
     if ((rc == 0) && !done) {
-	stream_start = stream;			/* save starting point for free() */
+	stream_start = stream;			/* save starting point for release */
 	rc = TPM_VolatileAll_Load(tpm_state, &stream, &stream_size);
 	if (rc != 0) {
 	    printf("TPM_VolatileAll_NVLoad: Error (fatal) loading deserializing state\n");
 	    rc = TPM_FAIL;
 	}
     }
+    /* the stream is left at its integrity digest, which identifies the saved state */
+    if ((rc == 0) && !done) {
+	TPM_Digest_Copy(tpm_state->volatileSchedule.storedDigest, stream);
+	tpm_state->volatileSchedule.digestValid = TRUE;
+	tpm_state->volatileSchedule.dirty = FALSE;
+    }
     if (rc != 0) {
 	printf("  TPM_VolatileAll_NVLoad: Set testState to %u \n", TPM_TEST_STATE_FAILURE);
 	tpm_state->testState = TPM_TEST_STATE_FAILURE;
 	
     }
-    free(stream_start); /* @1 */
+    TPM_NVRAM_ReleaseData(stream_start,	/* @1 */
+			  tpm_state->tpm_number,
+			  TPM_VOLATILESTATE_NAME);
     return rc;
 }
 
 /* TPM_VolatileAll_NVStore() serializes the entire volatile state data and stores it in the NV file
    TPM_VOLATILESTATE_NAME
+
+   If the serialized state has the integrity digest of the state that was last stored, NVRAM is
+   not written.
 */
 
 TPM_RESULT TPM_VolatileAll_NVStore(tpm_state_t *tpm_state)
@@ -595,12 +645,14 @@ TPM_RESULT TPM_VolatileAll_NVStore(tpm_state_t *tpm_state)
     TPM_STORE_BUFFER	sbuffer;		/* safe buffer for storing binary data */
     const unsigned char *buffer;
     uint32_t		length;
+    TPM_VOLATILE_SCHEDULE *schedule = &(tpm_state->volatileSchedule);
+    TPM_BOOL		unchanged = FALSE;
 
     printf(" TPM_VolatileAll_NVStore:\n");
     TPM_Sbuffer_Init(&sbuffer);			/* freed @1 */
     /* serialize relevant data from tpm_state  to be written to NV */
     if (rc == 0) {
-	rc = TPM_VolatileAll_Store(&sbuffer, tpm_state);
+	rc = TPM_VolatileAll_Store(&sbuffer, NULL, tpm_state);
 	/* get the serialized buffer and its length */
 	TPM_Sbuffer_Get(&sbuffer, &buffer, &length);
     }
@@ -613,17 +665,751 @@ TPM_RESULT TPM_VolatileAll_NVStore(tpm_state_t *tpm_state)
 	    rc = TPM_NOSPACE;
 	}
     }
+    /* the stream ends with its integrity digest */
     if (rc == 0) {
+	if (schedule->digestValid) {
+	    unchanged = (memcmp(schedule->storedDigest,
+				buffer + length - TPM_DIGEST_SIZE, TPM_DIGEST_SIZE) == 0);
+	}
+	if (unchanged) {
+	    printf("  TPM_VolatileAll_NVStore: State is unchanged\n");
+	}
+    }
+    if ((rc == 0) && !unchanged) {
 	/* store the buffer in NVRAM */
 	rc = TPM_NVRAM_StoreData(buffer,
 				 length,
 				 tpm_state->tpm_number,
 				 TPM_VOLATILESTATE_NAME);
+	schedule->digestValid = FALSE;
+    }
+    if ((rc == 0) && !unchanged) {
+	TPM_Digest_Copy(schedule->storedDigest, buffer + length - TPM_DIGEST_SIZE);
+	schedule->digestValid = TRUE;
+    }
+    if (rc == 0) {
+	schedule->dirty = FALSE;
+	schedule->commands = 0;
     }
     TPM_Sbuffer_Delete(&sbuffer);	/* @1 */
     return rc;
 }
 
+/*
+  Volatile State Schedule
+
+  The schedule of each instance decides when the volatile state is saved to NVRAM, trading the
+  state lost in a fail-over restart against NVRAM writes.  TPM_VolatileSchedule_Command() is
+  called after each command.  The TPM_VOLATILE_SCHEDULE_IDLE policy saves the state from a thread
+  that is started when the first instance sets it.
+*/
+
+/* the idle thread waits on tpm_volatile_idle_cond for the earliest deadline */
+static pthread_mutex_t tpm_volatile_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tpm_volatile_idle_cond;
+static TPM_BOOL tpm_volatile_idle_running = FALSE;
+static TPM_BOOL tpm_volatile_idle_stop = FALSE;
+static pthread_t tpm_volatile_idle_thread;
+/* monotonic time in milliseconds at which the volatile state of each instance is saved, 0 for
+   none */
+static uint64_t tpm_volatile_idle_deadline[TPMS_MAX];
+
+/* TPM_VolatileSchedule_Now() returns the monotonic time in milliseconds */
+
+static uint64_t TPM_VolatileSchedule_Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* TPM_VolatileSchedule_Init() initializes the schedule to its default policy.
+
+   Without TPM_VOLATILE_STORE, the volatile state is only saved on request.  With it, the state is
+   saved after each command to handle fail-over restart.
+*/
+
+void TPM_VolatileSchedule_Init(TPM_VOLATILE_SCHEDULE *schedule)
+{
+#ifdef TPM_VOLATILE_STORE
+    schedule->policy = TPM_VOLATILE_SCHEDULE_CHANGED;
+#else
+    schedule->policy = TPM_VOLATILE_SCHEDULE_ONDEMAND;
+#endif
+    schedule->value = 0;
+    schedule->commands = 0;
+    schedule->dirty = FALSE;
+    schedule->digestValid = FALSE;
+    return;
+}
+
+/* TPM_VolatileSchedule_Changes() returns FALSE if the command with 'tag' and 'ordinal' cannot
+   change the volatile state.  It is called before the command is processed.
+
+   Only unauthorized commands that read state qualify, and only if the command is not audited, no
+   exclusive transport session would be terminated, and no self test would be run.
+*/
+
+TPM_BOOL TPM_VolatileSchedule_Changes(tpm_state_t *tpm_state,
+				      TPM_TAG tag,
+				      TPM_COMMAND_CODE ordinal)
+{
+    TPM_RESULT	rc = 0;
+    TPM_BOOL	changes = TRUE;
+    TPM_BOOL	auditStatus = TRUE;
+
+    if (tag == TPM_TAG_RQU_COMMAND) {
+	switch (ordinal) {
+	  case TPM_ORD_GetCapability:
+	  case TPM_ORD_GetRandom:
+	  case TPM_ORD_GetTestResult:
+	  case TPM_ORD_PcrRead:
+	  case TPM_ORD_ReadPubek:
+	    changes = FALSE;
+	    break;
+	  default:
+	    break;
+	}
+    }
+    if (!changes) {
+	if ((tpm_state->testState != TPM_TEST_STATE_FULL) ||
+	    (tpm_state->tpm_stany_flags.transportExclusive != 0)) {
+	    changes = TRUE;
+	}
+    }
+    /* an audited ordinal extends the audit digest */
+    if (!changes) {
+	rc = TPM_OrdinalAuditStatus_GetAuditStatus(&auditStatus,
+						   ordinal,
+						   &(tpm_state->tpm_permanent_data));
+	if ((rc != 0) || auditStatus) {
+	    changes = TRUE;
+	}
+    }
+    return changes;
+}
+
+/* TPM_VolatileSchedule_Command() accounts a command in the schedule of the instance and saves the
+   volatile state if the policy asks for it.
+
+   'changed' is FALSE if the command did not change the volatile state.
+
+   'store' FALSE defers saving the state, e.g. to the last command of a batch.
+
+   The caller holds the lock of the instance.
+*/
+
+TPM_RESULT TPM_VolatileSchedule_Command(tpm_state_t *tpm_state,
+					TPM_BOOL changed,
+					TPM_BOOL store)
+{
+    TPM_RESULT		rc = 0;
+    TPM_VOLATILE_SCHEDULE *schedule = &(tpm_state->volatileSchedule);
+
+    if (changed) {
+	schedule->dirty = TRUE;
+    }
+    schedule->commands++;
+    if (schedule->dirty) {
+	switch (schedule->policy) {
+	  case TPM_VOLATILE_SCHEDULE_COMMANDS:
+	    if (store && (schedule->commands >= schedule->value)) {
+		rc = TPM_VolatileAll_NVStore(tpm_state);
+	    }
+	    break;
+	  case TPM_VOLATILE_SCHEDULE_CHANGED:
+	    if (store) {
+		rc = TPM_VolatileAll_NVStore(tpm_state);
+	    }
+	    break;
+	  case TPM_VOLATILE_SCHEDULE_IDLE:
+	    /* each command postpones the deadline */
+	    pthread_mutex_lock(&tpm_volatile_idle_lock);
+	    tpm_volatile_idle_deadline[tpm_state->tpm_number] =
+		TPM_VolatileSchedule_Now() + schedule->value;
+	    pthread_cond_signal(&tpm_volatile_idle_cond);
+	    pthread_mutex_unlock(&tpm_volatile_idle_lock);
+	    break;
+	  default:
+	    break;
+	}
+    }
+    return rc;
+}
+
+/* TPM_VolatileSchedule_Store() saves the volatile state of the TPM instance 'tpm_number' to NVRAM
+   as a transaction of its own.
+
+   If 'ifDirty' is TRUE, the state is only saved if a command may have changed it since it was
+   last saved.
+*/
+
+TPM_RESULT TPM_VolatileSchedule_Store(uint32_t tpm_number,
+				      TPM_BOOL ifDirty)
+{
+    TPM_RESULT		rc = 0;
+    TPM_RESULT		rc1 = 0;
+    tpm_state_t		*tpm_state = NULL;
+
+    printf(" TPM_VolatileSchedule_Store: TPM %lu\n", (unsigned long)tpm_number);
+    if (tpm_number >= TPMS_MAX) {
+	printf("TPM_VolatileSchedule_Store: Error, TPM %lu out of range\n",
+	       (unsigned long)tpm_number);
+	rc = TPM_BAD_PARAMETER;
+    }
+    if (rc == 0) {
+	TPM_Global_Lock(tpm_number);		/* unlocked @1 */
+	tpm_state = tpm_instances[tpm_number];
+	if (tpm_state == NULL) {
+	    printf("TPM_VolatileSchedule_Store: Error, TPM %lu does not exist\n",
+		   (unsigned long)tpm_number);
+	    rc = TPM_BAD_PARAMETER;
+	}
+	if ((rc == 0) && (!ifDirty || tpm_state->volatileSchedule.dirty)) {
+	    TPM_NVRAM_Begin(tpm_number);
+	    rc = TPM_VolatileAll_NVStore(tpm_state);
+	    rc1 = TPM_NVRAM_Commit(tpm_number);
+	    if (rc == 0) {
+		rc = rc1;
+	    }
+	}
+	TPM_Global_Unlock(tpm_number);		/* @1 */
+    }
+    return rc;
+}
+
+/* TPM_VolatileSchedule_Thread() saves the volatile state of the instances with the
+   TPM_VOLATILE_SCHEDULE_IDLE policy when their deadline passes. */
+
+static void *TPM_VolatileSchedule_Thread(void *arg)
+{
+    uint32_t		tpm_number;
+    uint64_t		now;
+    uint64_t		next;		/* the earliest deadline, 0 for none */
+    struct timespec	ts;
+
+    arg = arg;
+    pthread_mutex_lock(&tpm_volatile_idle_lock);
+    while (!tpm_volatile_idle_stop) {
+	now = TPM_VolatileSchedule_Now();
+	next = 0;
+	for (tpm_number = 0 ; tpm_number < TPMS_MAX ; tpm_number++) {
+	    if (tpm_volatile_idle_deadline[tpm_number] == 0) {
+		continue;
+	    }
+	    if (tpm_volatile_idle_deadline[tpm_number] <= now) {
+		tpm_volatile_idle_deadline[tpm_number] = 0;
+		/* the instance lock is taken without holding the idle lock, since commands take
+		   them in the opposite order */
+		pthread_mutex_unlock(&tpm_volatile_idle_lock);
+		if (TPM_VolatileSchedule_Store(tpm_number, TRUE) != 0) {
+		    printf("TPM_VolatileSchedule_Thread: Error saving TPM %lu\n",
+			   (unsigned long)tpm_number);
+		}
+		TPMLIB_LogFlush();
+		pthread_mutex_lock(&tpm_volatile_idle_lock);
+	    }
+	    else if ((next == 0) || (tpm_volatile_idle_deadline[tpm_number] < next)) {
+		next = tpm_volatile_idle_deadline[tpm_number];
+	    }
+	}
+	if (tpm_volatile_idle_stop) {
+	    break;
+	}
+	if (next == 0) {
+	    pthread_cond_wait(&tpm_volatile_idle_cond, &tpm_volatile_idle_lock);
+	}
+	else {
+	    ts.tv_sec = next / 1000;
+	    ts.tv_nsec = (next % 1000) * 1000000;
+	    pthread_cond_timedwait(&tpm_volatile_idle_cond, &tpm_volatile_idle_lock, &ts);
+	}
+    }
+    pthread_mutex_unlock(&tpm_volatile_idle_lock);
+    TPMLIB_LogFlush();
+    return NULL;
+}
+
+/* TPM_VolatileSchedule_Set() sets the policy for saving the volatile state of the TPM instance
+   'tpm_number'.
+
+   'value' is the number of commands for TPM_VOLATILE_SCHEDULE_COMMANDS and the number of
+   milliseconds for TPM_VOLATILE_SCHEDULE_IDLE.  It must not be 0 for them and is ignored for the
+   other policies.
+*/
+
+TPM_RESULT TPM_VolatileSchedule_Set(uint32_t tpm_number,
+				    uint32_t policy,
+				    uint32_t value)
+{
+    TPM_RESULT		rc = 0;
+    tpm_state_t		*tpm_state = NULL;
+    pthread_condattr_t	attr;
+    int			irc;
+
+    printf(" TPM_VolatileSchedule_Set: TPM %lu policy %u value %u\n",
+	   (unsigned long)tpm_number, policy, value);
+    if (rc == 0) {
+	if ((tpm_number >= TPMS_MAX) ||
+	    (policy > TPM_VOLATILE_SCHEDULE_CHANGED) ||
+	    (((policy == TPM_VOLATILE_SCHEDULE_COMMANDS) ||
+	      (policy == TPM_VOLATILE_SCHEDULE_IDLE)) && (value == 0))) {
+	    printf("TPM_VolatileSchedule_Set: Error, TPM %lu policy %u value %u out of range\n",
+		   (unsigned long)tpm_number, policy, value);
+	    rc = TPM_BAD_PARAMETER;
+	}
+    }
+    /* start the idle thread for the first instance that needs it */
+    if ((rc == 0) && (policy == TPM_VOLATILE_SCHEDULE_IDLE)) {
+	pthread_mutex_lock(&tpm_volatile_idle_lock);
+	if (!tpm_volatile_idle_running) {
+	    /* the deadlines are in monotonic time */
+	    pthread_condattr_init(&attr);
+	    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	    pthread_cond_init(&tpm_volatile_idle_cond, &attr);
+	    pthread_condattr_destroy(&attr);
+	    tpm_volatile_idle_stop = FALSE;
+	    irc = pthread_create(&tpm_volatile_idle_thread, NULL,
+				 TPM_VolatileSchedule_Thread, NULL);
+	    if (irc != 0) {
+		printf("TPM_VolatileSchedule_Set: Error creating the idle thread\n");
+		pthread_cond_destroy(&tpm_volatile_idle_cond);
+		rc = TPM_FAIL;
+	    }
+	    else {
+		tpm_volatile_idle_running = TRUE;
+	    }
+	}
+	pthread_mutex_unlock(&tpm_volatile_idle_lock);
+    }
+    if (rc == 0) {
+	TPM_Global_Lock(tpm_number);		/* unlocked @1 */
+	tpm_state = tpm_instances[tpm_number];
+	if (tpm_state == NULL) {
+	    printf("TPM_VolatileSchedule_Set: Error, TPM %lu does not exist\n",
+		   (unsigned long)tpm_number);
+	    rc = TPM_BAD_PARAMETER;
+	}
+	if (rc == 0) {
+	    tpm_state->volatileSchedule.policy = policy;
+	    tpm_state->volatileSchedule.value = value;
+	    tpm_state->volatileSchedule.commands = 0;
+	}
+	/* drop or arm the deadline of the instance */
+	if (rc == 0) {
+	    pthread_mutex_lock(&tpm_volatile_idle_lock);
+	    if ((policy == TPM_VOLATILE_SCHEDULE_IDLE) && tpm_state->volatileSchedule.dirty) {
+		tpm_volatile_idle_deadline[tpm_number] = TPM_VolatileSchedule_Now() + value;
+		pthread_cond_signal(&tpm_volatile_idle_cond);
+	    }
+	    else {
+		tpm_volatile_idle_deadline[tpm_number] = 0;
+	    }
+	    pthread_mutex_unlock(&tpm_volatile_idle_lock);
+	}
+	TPM_Global_Unlock(tpm_number);		/* @1 */
+    }
+    return rc;
+}
+
+/* TPM_VolatileSchedule_Terminate() stops the idle thread.  Pending deadlines are dropped. */
+
+void TPM_VolatileSchedule_Terminate(void)
+{
+    uint32_t tpm_number;
+
+    pthread_mutex_lock(&tpm_volatile_idle_lock);
+    if (tpm_volatile_idle_running) {
+	tpm_volatile_idle_stop = TRUE;
+	pthread_cond_signal(&tpm_volatile_idle_cond);
+	pthread_mutex_unlock(&tpm_volatile_idle_lock);
+	pthread_join(tpm_volatile_idle_thread, NULL);
+	pthread_mutex_lock(&tpm_volatile_idle_lock);
+	pthread_cond_destroy(&tpm_volatile_idle_cond);
+	tpm_volatile_idle_running = FALSE;
+    }
+    for (tpm_number = 0 ; tpm_number < TPMS_MAX ; tpm_number++) {
+	tpm_volatile_idle_deadline[tpm_number] = 0;
+    }
+    pthread_mutex_unlock(&tpm_volatile_idle_lock);
+    return;
+}
+
+/*
+  Volatile State Delta
+
+  A delta holds the serialized volatile state as a sequence of records that either copy a range
+  of the base snapshot or carry new bytes.  It is used to transfer the state repeatedly, e.g.
+  during a live migration, without transferring the unchanged parts.
+
+  The format is:
+
+	TPM_TAG_VSTATE_DELTA_V1
+	base generation, 0 if the delta does not need a base
+	base integrity digest
+	generation of the new snapshot
+	length of the new snapshot
+	records, until the end of the stream:
+	    TPM_VSTATE_DELTA_COPY, offset in the base, length
+	    TPM_VSTATE_DELTA_DATA, length, bytes
+*/
+
+#define TPM_VSTATE_DELTA_COPY	1	/* copy a range of the base */
+#define TPM_VSTATE_DELTA_DATA	2	/* new bytes */
+
+/* changed ranges separated by fewer unchanged bytes than a record header are sent as one record */
+#define TPM_VSTATE_DELTA_GAP	(2 * sizeof(uint32_t))
+
+/* A delta is written through a TPM_VSTATE_DELTA_WRITER, which holds back the last copy, so that
+   copies of adjacent ranges of the base become one record */
+
+typedef struct tdTPM_VSTATE_DELTA_WRITER {
+    TPM_STORE_BUFFER *sbuffer;	/* the delta */
+    uint32_t copyOffset;	/* the pending copy */
+    uint32_t copyLength;	/* 0 if no copy is pending */
+} TPM_VSTATE_DELTA_WRITER;
+
+/* TPM_VolatileDelta_Flush() appends the pending copy record */
+
+static TPM_RESULT TPM_VolatileDelta_Flush(TPM_VSTATE_DELTA_WRITER *writer)
+{
+    TPM_RESULT	rc = 0;
+
+    if ((rc == 0) && (writer->copyLength != 0)) {
+	rc = TPM_Sbuffer_Append32(writer->sbuffer, TPM_VSTATE_DELTA_COPY);
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append32(writer->sbuffer, writer->copyOffset);
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append32(writer->sbuffer, writer->copyLength);
+	}
+	writer->copyLength = 0;
+    }
+    return rc;
+}
+
+/* TPM_VolatileDelta_AppendCopy() adds a copy of 'length' bytes at 'offset' of the base */
+
+static TPM_RESULT TPM_VolatileDelta_AppendCopy(TPM_VSTATE_DELTA_WRITER *writer,
+					       uint32_t offset,
+					       uint32_t length)
+{
+    TPM_RESULT	rc = 0;
+
+    if (length != 0) {
+	/* extend the pending copy if the range follows it */
+	if ((writer->copyLength != 0) &&
+	    ((writer->copyOffset + writer->copyLength) == offset)) {
+	    writer->copyLength += length;
+	}
+	else {
+	    rc = TPM_VolatileDelta_Flush(writer);
+	    writer->copyOffset = offset;
+	    writer->copyLength = length;
+	}
+    }
+    return rc;
+}
+
+/* TPM_VolatileDelta_AppendData() appends a record that carries 'length' bytes of 'data' */
+
+static TPM_RESULT TPM_VolatileDelta_AppendData(TPM_VSTATE_DELTA_WRITER *writer,
+					       const unsigned char *data,
+					       uint32_t length)
+{
+    TPM_RESULT	rc = 0;
+    TPM_STORE_BUFFER *sbuffer = writer->sbuffer;
+
+    if ((rc == 0) && (length != 0)) {
+	rc = TPM_VolatileDelta_Flush(writer);
+    }
+    if ((rc == 0) && (length != 0)) {
+	rc = TPM_Sbuffer_Append32(sbuffer, TPM_VSTATE_DELTA_DATA);
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append32(sbuffer, length);
+	}
+	if (rc == 0) {
+	    rc = TPM_Sbuffer_Append(sbuffer, data, length);
+	}
+    }
+    return rc;
+}
+
+/* TPM_VolatileDelta_AppendSection() appends the records that build the section 'newData' of
+   'newLength' bytes from the base section at 'oldOffset' of 'oldLength' bytes.
+
+   The common prefix and suffix are copied.  If the rest has the same length in both sections, the
+   unchanged runs in it are copied as well.  Otherwise, the rest is sent as a whole.
+*/
+
+static TPM_RESULT TPM_VolatileDelta_AppendSection(TPM_VSTATE_DELTA_WRITER *writer,
+						  const unsigned char *base,
+						  uint32_t oldOffset,
+						  uint32_t oldLength,
+						  const unsigned char *newData,
+						  uint32_t newLength)
+{
+    TPM_RESULT		rc = 0;
+    const unsigned char	*oldData = base + oldOffset;
+    uint32_t		minLength = (oldLength < newLength) ? oldLength : newLength;
+    uint32_t		prefix;
+    uint32_t		suffix;
+    uint32_t		start;		/* start of a run */
+    uint32_t		end;		/* end of a run */
+    uint32_t		same;		/* unchanged bytes following a changed run */
+
+    for (prefix = 0 ;
+	 (prefix < minLength) && (oldData[prefix] == newData[prefix]) ;
+	 prefix++);
+    for (suffix = 0 ;
+	 (suffix < (minLength - prefix)) &&
+	     (oldData[oldLength - suffix - 1] == newData[newLength - suffix - 1]) ;
+	 suffix++);
+    if (rc == 0) {
+	rc = TPM_VolatileDelta_AppendCopy(writer, oldOffset, prefix);
+    }
+    /* the changed middle of equal length sections, compared byte by byte */
+    if (oldLength == newLength) {
+	for (start = prefix ; (rc == 0) && (start < (newLength - suffix)) ; start = end) {
+	    if (oldData[start] == newData[start]) {
+		for (end = start + 1 ;
+		     (end < (newLength - suffix)) && (oldData[end] == newData[end]) ;
+		     end++);
+		rc = TPM_VolatileDelta_AppendCopy(writer, oldOffset + start, end - start);
+	    }
+	    else {
+		for (end = start + 1, same = 0 ;
+		     (end < (newLength - suffix)) && (same < TPM_VSTATE_DELTA_GAP) ;
+		     end++) {
+		    same = (oldData[end] == newData[end]) ? (same + 1) : 0;
+		}
+		end -= same;
+		rc = TPM_VolatileDelta_AppendData(writer, newData + start, end - start);
+	    }
+	}
+    }
+    /* the changed middle of sections that changed their length */
+    else {
+	if (rc == 0) {
+	    rc = TPM_VolatileDelta_AppendData(writer, newData + prefix,
+					      newLength - prefix - suffix);
+	}
+    }
+    if (rc == 0) {
+	rc = TPM_VolatileDelta_AppendCopy(writer, oldOffset + oldLength - suffix, suffix);
+    }
+    return rc;
+}
+
+/* TPM_VolatileAll_StoreDelta() serializes the volatile state and appends it to 'sbuffer' as a
+   delta that can be applied through TPM_VolatileAll_ApplyDelta().
+
+   On input, '*generation' is the generation of the snapshot the receiver holds.  If it is the
+   generation of the last snapshot taken, the delta is against that snapshot.  Otherwise, the
+   delta does not need a base.  On output, '*generation' is the generation of the new snapshot,
+   which replaces the last one.
+*/
+
+TPM_RESULT TPM_VolatileAll_StoreDelta(TPM_STORE_BUFFER *sbuffer,
+				      uint32_t *generation,
+				      tpm_state_t *tpm_state)
+{
+    TPM_RESULT		rc = 0;
+    TPM_VOLATILE_SNAPSHOT *snapshot = &(tpm_state->volatileSnapshot);
+    TPM_STORE_BUFFER	image;		/* the new snapshot */
+    uint32_t		sections[TPM_VOLATILE_SECTIONS];
+    TPM_VSTATE_DELTA_WRITER writer;
+    const unsigned char	*oldBuffer;
+    uint32_t		oldLength;
+    const unsigned char	*newBuffer;
+    uint32_t		newLength;
+    uint32_t		baseGeneration = 0;
+    TPM_DIGEST		baseDigest;
+    uint32_t		oldStart;
+    uint32_t		newStart;
+    size_t		i;
+
+    printf(" TPM_VolatileAll_StoreDelta: Generation %u\n", *generation);
+    TPM_Sbuffer_Init(&image);		/* freed @1 */
+    TPM_Digest_Init(baseDigest);
+    writer.sbuffer = sbuffer;
+    writer.copyOffset = 0;
+    writer.copyLength = 0;
+    if (rc == 0) {
+	rc = TPM_VolatileAll_Store(&image, sections, tpm_state);
+	TPM_Sbuffer_Get(&image, &newBuffer, &newLength);
+    }
+    /* the delta is against the last snapshot if the receiver holds it */
+    if (rc == 0) {
+	TPM_Sbuffer_Get(&(snapshot->image), &oldBuffer, &oldLength);
+	if ((snapshot->generation != 0) && (*generation == snapshot->generation)) {
+	    baseGeneration = snapshot->generation;
+	    TPM_Digest_Copy(baseDigest, oldBuffer + oldLength - TPM_DIGEST_SIZE);
+	}
+	printf("  TPM_VolatileAll_StoreDelta: Base generation %u\n", baseGeneration);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append16(sbuffer, TPM_TAG_VSTATE_DELTA_V1);
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(sbuffer, baseGeneration);
+    }
+    if (rc == 0) {
+	rc = TPM_Digest_Store(sbuffer, baseDigest);
+    }
+    if (rc == 0) {
+	/* the generation wraps around to 1, 0 means no snapshot */
+	rc = TPM_Sbuffer_Append32(sbuffer, (snapshot->generation == 0xffffffff) ?
+				  1 : (snapshot->generation + 1));
+    }
+    if (rc == 0) {
+	rc = TPM_Sbuffer_Append32(sbuffer, newLength);
+    }
+    /* without a base, the snapshot is sent as a whole */
+    if ((rc == 0) && (baseGeneration == 0)) {
+	rc = TPM_VolatileDelta_AppendData(&writer, newBuffer, newLength);
+    }
+    /* compare section by section */
+    for (i = 0, oldStart = 0, newStart = 0 ;
+	 (rc == 0) && (baseGeneration != 0) && (i < TPM_VOLATILE_SECTIONS) ;
+	 oldStart = snapshot->sections[i], newStart = sections[i], i++) {
+	rc = TPM_VolatileDelta_AppendSection(&writer,
+					     oldBuffer,
+					     oldStart,
+					     snapshot->sections[i] - oldStart,
+					     newBuffer + newStart,
+					     sections[i] - newStart);
+    }
+    if (rc == 0) {
+	rc = TPM_VolatileDelta_Flush(&writer);
+    }
+    /* the new snapshot becomes the base of the next delta */
+    if (rc == 0) {
+	snapshot->generation = (snapshot->generation == 0xffffffff) ?
+			       1 : (snapshot->generation + 1);
+	TPM_Sbuffer_Delete(&(snapshot->image));
+	snapshot->image = image;
+	TPM_Sbuffer_Init(&image);
+	for (i = 0 ; i < TPM_VOLATILE_SECTIONS ; i++) {
+	    snapshot->sections[i] = sections[i];
+	}
+	*generation = snapshot->generation;
+    }
+    TPM_Sbuffer_Delete(&image);		/* @1 */
+    return rc;
+}
+
+/* TPM_VolatileAll_ApplyDelta() builds the serialized volatile state from the 'delta' created by
+   TPM_VolatileAll_StoreDelta() and the 'base' snapshot it was computed against, and appends it to
+   'sbuffer'.  'base' is ignored if the delta does not need one.
+
+   The result is the same stream that TPM_VolatileAll_Store() returned when the delta was created.
+
+   Returns
+	0 on success
+	TPM_BAD_PARAMETER if 'base' is not the snapshot the delta needs
+	TPM_BAD_PARAM_SIZE or an integrity error if the delta is malformed
+*/
+
+TPM_RESULT TPM_VolatileAll_ApplyDelta(TPM_STORE_BUFFER *sbuffer,
+				      const unsigned char *base,
+				      uint32_t baseLength,
+				      unsigned char *delta,
+				      uint32_t deltaLength)
+{
+    TPM_RESULT		rc = 0;
+    uint32_t		baseGeneration;
+    TPM_DIGEST		baseDigest;
+    uint32_t		generation;
+    uint32_t		length;		/* of the new snapshot */
+    uint32_t		type;
+    uint32_t		offset;
+    uint32_t		recordLength;
+    const unsigned char	*buffer;
+    uint32_t		bufferLength;
+
+    printf(" TPM_VolatileAll_ApplyDelta: Delta of %u bytes\n", deltaLength);
+    if (rc == 0) {
+	rc = TPM_CheckTag(TPM_TAG_VSTATE_DELTA_V1, &delta, &deltaLength);
+    }
+    if (rc == 0) {
+	rc = TPM_Load32(&baseGeneration, &delta, &deltaLength);
+    }
+    if (rc == 0) {
+	rc = TPM_Digest_Load(baseDigest, &delta, &deltaLength);
+    }
+    if (rc == 0) {
+	rc = TPM_Load32(&generation, &delta, &deltaLength);
+    }
+    if (rc == 0) {
+	rc = TPM_Load32(&length, &delta, &deltaLength);
+    }
+    /* the base must be the snapshot the delta was computed against */
+    if ((rc == 0) && (baseGeneration != 0)) {
+	if ((base == NULL) || (baseLength < TPM_DIGEST_SIZE) ||
+	    (memcmp(baseDigest, base + baseLength - TPM_DIGEST_SIZE, TPM_DIGEST_SIZE) != 0)) {
+	    printf("TPM_VolatileAll_ApplyDelta: Error, base is not generation %u\n",
+		   baseGeneration);
+	    rc = TPM_BAD_PARAMETER;
+	}
+    }
+    while ((rc == 0) && (deltaLength > 0)) {
+	rc = TPM_Load32(&type, &delta, &deltaLength);
+	if ((rc == 0) && (type == TPM_VSTATE_DELTA_COPY) && (baseGeneration != 0)) {
+	    rc = TPM_Load32(&offset, &delta, &deltaLength);
+	    if (rc == 0) {
+		rc = TPM_Load32(&recordLength, &delta, &deltaLength);
+	    }
+	    if ((rc == 0) &&
+		((offset > baseLength) || (recordLength > (baseLength - offset)))) {
+		printf("TPM_VolatileAll_ApplyDelta: Error, copy of %u at %u beyond base\n",
+		       recordLength, offset);
+		rc = TPM_BAD_PARAM_SIZE;
+	    }
+	    if (rc == 0) {
+		rc = TPM_Sbuffer_Append(sbuffer, base + offset, recordLength);
+	    }
+	}
+	else if ((rc == 0) && (type == TPM_VSTATE_DELTA_DATA)) {
+	    rc = TPM_Load32(&recordLength, &delta, &deltaLength);
+	    if ((rc == 0) && (recordLength > deltaLength)) {
+		printf("TPM_VolatileAll_ApplyDelta: Error, data of %u beyond delta\n",
+		       recordLength);
+		rc = TPM_BAD_PARAM_SIZE;
+	    }
+	    if (rc == 0) {
+		rc = TPM_Sbuffer_Append(sbuffer, delta, recordLength);
+		delta += recordLength;
+		deltaLength -= recordLength;
+	    }
+	}
+	else if (rc == 0) {
+	    printf("TPM_VolatileAll_ApplyDelta: Error, record type %u\n", type);
+	    rc = TPM_BAD_PARAM_SIZE;
+	}
+    }
+    /* check the result against its length and its integrity digest */
+    if (rc == 0) {
+	TPM_Sbuffer_Get(sbuffer, &buffer, &bufferLength);
+	if ((bufferLength != length) || (length < TPM_DIGEST_SIZE)) {
+	    printf("TPM_VolatileAll_ApplyDelta: Error, built %u bytes, expected %u\n",
+		   bufferLength, length);
+	    rc = TPM_BAD_PARAM_SIZE;
+	}
+    }
+    if (rc == 0) {
+	rc = TPM_SHA1_Check((unsigned char *)buffer + length - TPM_DIGEST_SIZE,
+			    length - TPM_DIGEST_SIZE, buffer,
+			    0, NULL);
+    }
+    if (rc == 0) {
+	printf("  TPM_VolatileAll_ApplyDelta: Built generation %u of %u bytes\n",
+	       generation, length);
+    }
+    return rc;
+}
+
 /*
   Compiled in TPM Parameters
 */
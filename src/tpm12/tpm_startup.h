@@ -79,10 +79,42 @@ TPM_RESULT TPM_VolatileAll_Load(tpm_state_t *tpm_state,
 				unsigned char **stream,
 				uint32_t *stream_size);
 TPM_RESULT TPM_VolatileAll_Store(TPM_STORE_BUFFER *sbuffer,
+				 uint32_t *sections,
 				 tpm_state_t *tpm_state);
 TPM_RESULT TPM_VolatileAll_NVLoad(tpm_state_t *tpm_state);
 TPM_RESULT TPM_VolatileAll_NVStore(tpm_state_t *tpm_state);
 
+/*
+  Volatile State Schedule
+*/
+
+void       TPM_VolatileSchedule_Init(TPM_VOLATILE_SCHEDULE *schedule);
+TPM_RESULT TPM_VolatileSchedule_Set(uint32_t tpm_number,
+				    uint32_t policy,
+				    uint32_t value);
+TPM_BOOL   TPM_VolatileSchedule_Changes(tpm_state_t *tpm_state,
+					TPM_TAG tag,
+					TPM_COMMAND_CODE ordinal);
+TPM_RESULT TPM_VolatileSchedule_Command(tpm_state_t *tpm_state,
+					TPM_BOOL changed,
+					TPM_BOOL store);
+TPM_RESULT TPM_VolatileSchedule_Store(uint32_t tpm_number,
+				      TPM_BOOL ifDirty);
+void       TPM_VolatileSchedule_Terminate(void);
+
+/*
+  Volatile State Delta
+*/
+
+TPM_RESULT TPM_VolatileAll_StoreDelta(TPM_STORE_BUFFER *sbuffer,
+				      uint32_t *generation,
+				      tpm_state_t *tpm_state);
+TPM_RESULT TPM_VolatileAll_ApplyDelta(TPM_STORE_BUFFER *sbuffer,
+				      const unsigned char *base,
+				      uint32_t baseLength,
+				      unsigned char *delta,
+				      uint32_t deltaLength);
+
 /*
   Compiled in TPM Parameters
 */
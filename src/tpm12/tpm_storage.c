@@ -1810,7 +1810,8 @@ TPM_RESULT TPM_Process_Unseal(tpm_state_t *tpm_state,
 	    /* c. Compare h2 with S2 -> pcrInfo -> digestAtRelease, on mismatch return
 	       TPM_WRONGPCRVALUE */
 	    returnCode = TPM_PCRInfo_CheckDigest(inData.tpm_seal_info,
-						 tpm_state->tpm_stclear_data.PCRS); /* PCR array */
+						 tpm_state->tpm_stclear_data.PCRS, /* PCR array */
+						 &(tpm_state->tpm_stclear_data.pcrDigestCache));
 	}
 	/* b. If V1 is 2 then */
 	else {
@@ -1827,6 +1828,7 @@ TPM_RESULT TPM_Process_Unseal(tpm_state_t *tpm_state,
 	    returnCode =
 		TPM_PCRInfoLong_CheckDigest(s2StoredData->tpm_seal_info_long,
 					    tpm_state->tpm_stclear_data.PCRS,	/* PCR array */
+					    &(tpm_state->tpm_stclear_data.pcrDigestCache),
 					    tpm_state->tpm_stany_flags.localityModifier);
 	}
     }
@@ -3223,7 +3225,7 @@ static TPM_RESULT TPM_LoadKeyCommon(TPM_KEY_HANDLE	*inKeyHandle,	/* output */
        parentHandle.
     */
     if (rc == TPM_SUCCESS) {
-	rc = TPM_Key_DecryptEncData(inKey, parentKey);
+	rc = TPM_Key_DecryptEncData(inKey, parentKey, &(tpm_state->tpm_key_cache));
     }
     /* 6. Validate the integrity of inKey and decrypted TPM_STORE_ASYMKEY
        a. Reproduce inKey -> TPM_STORE_ASYMKEY -> pubDataDigest using the fields of inKey, and check
@@ -72,6 +72,21 @@ void TPM_Sbuffer_Init(TPM_STORE_BUFFER *sbuffer)
     sbuffer->buffer = NULL;
     sbuffer->buffer_current = NULL;
     sbuffer->buffer_end = NULL;
+    sbuffer->sha1_context = NULL;
+}
+
+/* TPM_Sbuffer_InitDigest() sets up a serialize buffer that hashes the appended data into
+   'sha1_context' rather than storing it.  A structure can then be digested by its store function
+   without first being serialized to memory.
+
+   The buffer remains empty, and TPM_Sbuffer_Delete() does not free the context.
+*/
+
+void TPM_Sbuffer_InitDigest(TPM_STORE_BUFFER *sbuffer,
+                            void *sha1_context)
+{
+    TPM_Sbuffer_Init(sbuffer);
+    sbuffer->sha1_context = sha1_context;
 }
 
 /* TPM_Sbuffer_Load() loads TPM_STORE_BUFFER that has been serialized using
@@ -195,6 +210,7 @@ TPM_RESULT TPM_Sbuffer_Set(TPM_STORE_BUFFER *sbuffer,
 	    sbuffer->buffer_current = NULL;
 	    sbuffer->buffer_end = NULL;
 	}
+	sbuffer->sha1_context = NULL;
     }
     return rc;
 }
@@ -215,8 +231,12 @@ TPM_RESULT TPM_Sbuffer_Append(TPM_STORE_BUFFER *sbuffer,
     size_t current_length;      /* bytes in current buffer */
     size_t new_size;            /* size of new buffer */
     
+    /* a digest buffer hashes the data */
+    if ((rc == 0) && (sbuffer->sha1_context != NULL)) {
+        rc = TPM_SHA1UpdateCmd(sbuffer->sha1_context, data, (uint32_t)data_length);
+    }
     /* can data fit? */
-    if (rc == 0) {
+    if ((rc == 0) && (sbuffer->sha1_context == NULL)) {
         /* cast safe as end is always greater than current */
         free_length = (size_t)(sbuffer->buffer_end - sbuffer->buffer_current);
         /* if data cannot fit in buffer as sized */
@@ -256,7 +276,7 @@ TPM_RESULT TPM_Sbuffer_Append(TPM_STORE_BUFFER *sbuffer,
         }
     }
     /* append the data */
-    if (rc == 0) {
+    if ((rc == 0) && (sbuffer->sha1_context == NULL)) {
         memcpy(sbuffer->buffer_current, data, data_length);
         sbuffer->buffer_current += data_length;
     }
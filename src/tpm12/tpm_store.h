@@ -45,6 +45,8 @@
 #include "tpm_types.h"
 
 void       TPM_Sbuffer_Init(TPM_STORE_BUFFER *sbuffer);
+void       TPM_Sbuffer_InitDigest(TPM_STORE_BUFFER *sbuffer,
+                                  void *sha1_context);
 TPM_RESULT TPM_Sbuffer_Load(TPM_STORE_BUFFER *sbuffer,
                             unsigned char **stream,
                             uint32_t *stream_size);
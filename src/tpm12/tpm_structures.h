@@ -108,6 +108,8 @@ typedef struct tdTPM_STORE_BUFFER {
     unsigned char *buffer;              /* beginning of buffer */
     unsigned char *buffer_current;      /* first empty position in buffer */
     unsigned char *buffer_end;          /* one past last valid position in buffer */
+    void *sha1_context;                 /* if not NULL, appended data is hashed rather than
+                                           stored */
 } TPM_STORE_BUFFER;
 
 /* 5.1 TPM_STRUCT_VER rev 100
@@ -701,6 +703,8 @@ typedef struct tdTPM_STORE_PRIVKEY {
     TPM_SIZED_BUFFER d_key;             /* private key */
     TPM_SIZED_BUFFER p_key;             /* private prime factor */
     TPM_SIZED_BUFFER q_key;             /* private prime factor */
+    TPM_RSA_KEY_TOKEN rsa_key_token;    /* crypto library private key built from the above on first
+                                           use, not serialized */
 } TPM_STORE_PRIVKEY; 
 
 /* 10.6 TPM_STORE_ASYMKEY rev 87
@@ -918,6 +922,25 @@ typedef struct tdTPM_PUBKEY {
 #error "TPM_OWNER_EVICT_KEY_HANDLES too large for TPM_KEY_HANDLES"
 #endif
 
+/* When all TPM_KEY_HANDLES key slots are used, loading a key swaps the least recently used key
+   out to one of TPM_KEY_SWAP_ENTRIES swap entries.  A swapped out key stays loaded, and is swapped
+   back in when it is used.  The swap entries follow the key slots in the TPM_KEY_HANDLE_ENTRY
+   array.  0 disables swapping.  The swapped out keys are saved by TPM_SaveState and in the
+   volatile state like the keys in the key slots.
+*/
+
+#ifndef TPM_KEY_SWAP_ENTRIES
+#define TPM_KEY_SWAP_ENTRIES (4 * TPM_KEY_HANDLES)
+#endif
+
+#define TPM_KEY_TABLE_ENTRIES (TPM_KEY_HANDLES + TPM_KEY_SWAP_ENTRIES)
+
+/* TPM_GetCapability uses a uint_16 for the number of loaded keys */
+
+#if (TPM_KEY_TABLE_ENTRIES > 0xffff)
+#error "TPM_KEY_HANDLES + TPM_KEY_SWAP_ENTRIES must be less than 0x10000"
+#endif
+
 /* This is the version used by the TPM implementation.  It is part of the global TPM state */
 
 /* kgold: Added TPM_KEY member.  There needs to be a mapping between a key handle
@@ -929,8 +952,33 @@ typedef struct tdTPM_KEY_HANDLE_ENTRY {
     TPM_BOOL parentPCRStatus;   /* TRUE if parent of this key uses PCR's */
     TPM_KEY_CONTROL keyControl; /* Attributes that can control various aspects of key usage and
                                    manipulation. */
+    uint32_t lastUse;           /* for swapping out the least recently used key, not saved */
 } TPM_KEY_HANDLE_ENTRY; 
 
+/* The key cache holds the decrypted encData of recently loaded key blobs, so that loading the same
+   blob again does not decrypt it with the parent key and recalculate the private key.  Entries
+   are found by a digest of the parent public key and the serialized TPM_KEY.  The least recently
+   used entry is replaced when the cache is full.
+*/
+
+#ifndef TPM_KEY_CACHE_ENTRIES
+#define TPM_KEY_CACHE_ENTRIES TPM_KEY_HANDLES	/* entries in the TPM_KEY_CACHE array */
+#endif
+
+typedef struct tdTPM_KEY_CACHE_ENTRY {
+    TPM_BOOL valid;		/* TRUE if the entry is in use */
+    TPM_DIGEST keyDigest;	/* digest of the parent public key and the serialized TPM_KEY */
+    TPM_SIZED_BUFFER clearData;	/* decrypted TPM_KEY -> encData */
+    TPM_SIZED_BUFFER q_key;	/* private prime factor, calculated from clearData */
+    TPM_SIZED_BUFFER d_key;	/* private key, calculated from clearData */
+    uint32_t lastUse;		/* value of TPM_KEY_CACHE -> useCount at the last use */
+} TPM_KEY_CACHE_ENTRY;
+
+typedef struct tdTPM_KEY_CACHE {
+    uint32_t useCount;		/* incremented at each use of an entry */
+    TPM_KEY_CACHE_ENTRY entries[TPM_KEY_CACHE_ENTRIES];
+} TPM_KEY_CACHE;
+
 /* 5.12 TPM_MIGRATIONKEYAUTH rev 87
 
    This structure provides the proof that the associated public key has TPM Owner authorization to
@@ -1623,6 +1671,18 @@ typedef struct tdTPM_DAA_JOINDATA {
 #define TPM_MIN_DAA_SESSIONS 1
 #endif
 
+/* TPM_DAA_MODULI holds the issuer values that a DAA session calculates modulo, in the form the
+   crypto library calculates with.  It is built from the values as they are first input and reused
+   by the later stages.  DAA_generic_n is kept with the issuer bases in the TPM_DAA_BASE_CACHE.  It
+   is not part of the TPM specification and is not saved.
+*/
+
+typedef struct tdTPM_DAA_MODULI {
+    TPM_DIGEST          digestIssuer;   /* DAA_digestIssuer of the settings the values belong to */
+    TPM_BN_MONT_CTX     gammaMont;      /* DAA_generic_gamma, NULL until used */
+    TPM_BIGNUM          qBignum;        /* DAA_generic_q, NULL until used */
+} TPM_DAA_MODULI;
+
 typedef struct tdTPM_DAA_SESSION_DATA {
     TPM_DAA_ISSUER      DAA_issuerSettings;     /* A set of DAA issuer parameters controlling a DAA
                                                    session. (non-secret) */
@@ -1636,9 +1696,42 @@ typedef struct tdTPM_DAA_SESSION_DATA {
     /* added kgold */
     TPM_HANDLE          daaHandle;              /* DAA session handle */
     TPM_BOOL            valid;                  /* array entry is valid */
+    TPM_DAA_MODULI      DAA_moduli;             /* issuer moduli, not saved */
     /* FIXME should have handle type Join or Sign */
 } TPM_DAA_SESSION_DATA;
 
+/* The DAA base cache holds DAA_generic_n and the powers of the issuer bases DAA_generic_R0, R1, S0,
+   and S1 that the JOIN and SIGN stages raise to TPM secrets.  The powers of a base are calculated
+   when the base is first used, and are reused by later sessions with the same issuer settings.
+   Entries are found by DAA_digestIssuer, which the common stage code verifies against the issuer
+   settings.  The least recently used entry is replaced when the cache is full.  It is not part of
+   the TPM specification and is not saved.
+*/
+
+#ifndef TPM_DAA_BASE_CACHE_ENTRIES
+#define TPM_DAA_BASE_CACHE_ENTRIES 2		/* entries in the TPM_DAA_BASE_CACHE array */
+#endif
+
+#define TPM_DAA_BASE_R0	0			/* index of DAA_generic_R0 in 'bases' */
+#define TPM_DAA_BASE_R1	1
+#define TPM_DAA_BASE_S0	2
+#define TPM_DAA_BASE_S1	3
+#define TPM_DAA_BASES	4
+
+typedef struct tdTPM_DAA_BASE_CACHE_ENTRY {
+    TPM_BOOL valid;				/* TRUE if the entry is in use */
+    TPM_DIGEST digestIssuer;			/* DAA_digestIssuer of the issuer settings */
+    TPM_BN_MONT_CTX nMont;			/* DAA_generic_n */
+    TPM_BN_FIXED_BASE bases[TPM_DAA_BASES];	/* powers of each base, NULL until used */
+    uint32_t lastUse;				/* value of TPM_DAA_BASE_CACHE -> useCount at the
+						   last use */
+} TPM_DAA_BASE_CACHE_ENTRY;
+
+typedef struct tdTPM_DAA_BASE_CACHE {
+    uint32_t useCount;				/* incremented at each use of an entry */
+    TPM_DAA_BASE_CACHE_ENTRY entries[TPM_DAA_BASE_CACHE_ENTRIES];
+} TPM_DAA_BASE_CACHE;
+
 /* 22.8 TPM_DAA_BLOB rev 98
 
    The structure passed during the join process
@@ -2001,6 +2094,19 @@ typedef struct tdTPM_PERMANENT_DATA {
 
 /* NOTE: Vendor specific */
 
+/* TPM_HMAC_CONTEXT holds the SHA-1 contexts after hashing the key XOR ipad and key XOR opad blocks
+   of an HMAC key, so that an HMAC with the same key only hashes the text */
+
+typedef struct tdTPM_HMAC_CONTEXT {
+    TPM_BOOL valid;             /* the contexts are set for key */
+    TPM_SECRET key;             /* HMAC key of the contexts */
+    void *innerContext;         /* after key XOR ipad */
+    void *outerContext;         /* after key XOR opad */
+    void *context;              /* working copy */
+} TPM_HMAC_CONTEXT;
+
+/* NOTE: Vendor specific */
+
 typedef struct tdTPM_AUTH_SESSION_DATA {
     /* vendor specific */
     TPM_AUTHHANDLE handle;      /* Handle for a session */
@@ -2013,6 +2119,7 @@ typedef struct tdTPM_AUTH_SESSION_DATA {
     TPM_DIGEST entityDigest;    /* OSAP tracks which entity established the OSAP session */
     TPM_DELEGATE_PUBLIC pub;    /* DSAP */
     TPM_BOOL valid;             /* added kgold: array entry is valid */
+    TPM_HMAC_CONTEXT hmacContext;       /* last HMAC key used with the session, not serialized */
 } TPM_AUTH_SESSION_DATA;
 
 
@@ -2028,6 +2135,33 @@ typedef struct tdTPM_AUTH_SESSION_DATA {
 #define TPM_MIN_SESSION_LIST 16
 #endif
 
+/* The PCR digest cache holds the composite hashes of recently used PCR selections, so that
+   checking the digestAtRelease of a PCR bound key, sealed data, or NV index does not rebuild the
+   TPM_PCR_COMPOSITE each time.
+
+   'generation' is incremented each time a PCR changes, and 'pcrGeneration' records the generation
+   at which each PCR last changed.  An entry is valid while none of its selected PCRs changed after
+   the entry was created.
+*/
+
+#ifndef TPM_PCR_DIGEST_CACHE_ENTRIES
+#define TPM_PCR_DIGEST_CACHE_ENTRIES 8
+#endif
+
+typedef struct tdTPM_PCR_DIGEST_CACHE_ENTRY {
+    TPM_BOOL valid;
+    TPM_PCR_SELECTION pcrSelection;		/* the PCR selection */
+    uint32_t generation;			/* generation when the digest was calculated */
+    TPM_COMPOSITE_HASH compositeHash;		/* the TPM_PCR_COMPOSITE digest */
+} TPM_PCR_DIGEST_CACHE_ENTRY;
+
+typedef struct tdTPM_PCR_DIGEST_CACHE {
+    uint32_t generation;			/* incremented when a PCR changes */
+    uint32_t pcrGeneration[TPM_NUM_PCR];	/* generation of the last change of each PCR */
+    uint32_t nextEntry;				/* next entry to be replaced */
+    TPM_PCR_DIGEST_CACHE_ENTRY entries[TPM_PCR_DIGEST_CACHE_ENTRIES];
+} TPM_PCR_DIGEST_CACHE;
+
 /* 7.5 TPM_STCLEAR_DATA rev 101
 
    This is an informative structure and not normative. It is purely for convenience of writing the
@@ -2059,6 +2193,8 @@ typedef struct tdTPM_STCLEAR_DATA {
                                    The value is in the STCLEAR_DATA structure as the
                                    implementation of this flag is TPM vendor specific. */
     TPM_PCRVALUE PCRS[TPM_NUM_PCR];     /* Platform configuration registers */
+    /* NOTE: Added for caching PCR composite hashes, not saved */
+    TPM_PCR_DIGEST_CACHE pcrDigestCache;
 #if  (TPM_REVISION >= 103)      /* added for rev 103 */
     uint32_t deferredPhysicalPresence;	/* The value can save the assertion of physicalPresence.
                                            Individual bits indicate to its ordinal that
@@ -2489,11 +2625,25 @@ typedef struct tdTPM_NV_DATA_SENSITIVE {
                                    the TPM does not provide any confidentiality on the data. */
     /* NOTE Added kg */
     TPM_DIGEST digest;          /* for OSAP comparison */
+    TPM_BOOL dataChanged;       /* the data is not yet stored under its own NVRAM name */
 } TPM_NV_DATA_SENSITIVE;
 
+/* The directory of the TPM_NV_INDEX_ENTRIES array is not serialized.  It finds the entry of an
+   nvIndex through an open addressing hash table, and an unused entry through a stack of the
+   unused entry numbers. */
+
+#define TPM_NV_INDEX_SLOTS_MIN 16	/* minimum size of the hash table, a power of 2 */
+
 typedef struct tdTPM_NV_INDEX_ENTRIES {
     uint32_t nvIndexCount;			/* number of entries */
     TPM_NV_DATA_SENSITIVE *tpm_nvindex_entry;	/* array of TPM_NV_DATA_SENSITIVE */
+    uint32_t *nvIndexSlot;			/* hash table of entry numbers + 1, 0 if empty */
+    uint32_t nvIndexSlots;			/* size of the hash table, a power of 2 */
+    uint32_t *freeEntry;			/* stack of unused entry numbers, nvIndexCount long */
+    uint32_t freeCount;				/* number of unused entries */
+    TPM_NV_INDEX *deletedIndex;			/* deleted indexes whose NVRAM names are not yet
+						   deleted */
+    uint32_t deletedCount;			/* number of deleted indexes */
 } TPM_NV_INDEX_ENTRIES;
 
 /* TPM_NV_DATA_ST
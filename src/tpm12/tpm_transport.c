@@ -944,6 +944,7 @@ TPM_RESULT TPM_TransportInternal_Set(TPM_STORE_BUFFER		*response,
     if (rc == 0) {
 	rc = TPM_Authdata_Generate(transAuth,					/* result */
 				   tpm_transport_internal->authData,		/* HMAC key */
+				   NULL,
 				   outParamDigest,				/* params */
 				   tpm_transport_internal->transNonceEven,
 				   transNonceOdd,
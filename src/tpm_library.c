@@ -45,6 +45,9 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #ifdef USE_FREEBL_CRYPTO_LIBRARY
 # include <plbase64.h>
@@ -77,9 +80,20 @@ static const struct tpm_interface *const tpm_iface[] = {
 };
 
 static int debug_fd = -1;
-static unsigned debug_level = 0;
+unsigned int tpmlib_debug_level = 0;    /* tested by the printf macro */
 static char *debug_prefix = NULL;
 
+static void async_terminate(void);
+
+/*
+ * Trace lines are collected per thread and written with a single write()
+ * when the buffer is full or when a library call returns to the caller.
+ */
+#define DEBUG_BUFFER_SIZE 4096
+
+static __thread char debug_buffer[DEBUG_BUFFER_SIZE];
+static __thread size_t debug_buffer_used = 0;
+
 uint32_t TPMLIB_GetVersion(void)
 {
     return TPM_LIBRARY_VERSION;
@@ -87,12 +101,49 @@ uint32_t TPMLIB_GetVersion(void)
 
 TPM_RESULT TPMLIB_MainInit(void)
 {
-    return tpm_iface[0]->MainInit();
+    TPM_RESULT ret = tpm_iface[0]->MainInit();
+
+    TPMLIB_LogFlush();
+
+    return ret;
 }
 
 void TPMLIB_Terminate(void)
 {
+    async_terminate();
+
     tpm_iface[0]->Terminate();
+
+    TPMLIB_LogFlush();
+}
+
+/*
+ * Create the TPM instance with the given number. TPMLIB_MainInit() must
+ * have been called before and has already created instance 0. The state
+ * of the instance is loaded using the tpm_number with which the NVRAM
+ * callbacks are invoked; if no state exists, it is created.
+ */
+TPM_RESULT TPMLIB_CreateInstance(uint32_t tpm_number)
+{
+    TPM_RESULT ret = tpm_iface[0]->CreateInstance(tpm_number);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
+/*
+ * Destroy the TPM instance with the given number and free its resources.
+ * The state of the instance that was written via the NVRAM callbacks is
+ * not touched.
+ */
+TPM_RESULT TPMLIB_DestroyInstance(uint32_t tpm_number)
+{
+    TPM_RESULT ret = tpm_iface[0]->DestroyInstance(tpm_number);
+
+    TPMLIB_LogFlush();
+
+    return ret;
 }
 
 /*
@@ -108,8 +159,278 @@ TPM_RESULT TPMLIB_Process(unsigned char **respbuffer, uint32_t *resp_size,
                           uint32_t *respbufsize,
 		          unsigned char *command, uint32_t command_size)
 {
-    return tpm_iface[0]->Process(respbuffer, resp_size, respbufsize,
-                                 command, command_size);
+    TPM_RESULT ret = tpm_iface[0]->Process(0, respbuffer, resp_size,
+                                           respbufsize, command, command_size);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
+/*
+ * Send a command to the TPM instance with the given number; otherwise
+ * the same as TPMLIB_Process().
+ */
+TPM_RESULT TPMLIB_ProcessInstance(uint32_t tpm_number,
+                                  unsigned char **respbuffer,
+                                  uint32_t *resp_size,
+                                  uint32_t *respbufsize,
+                                  unsigned char *command,
+                                  uint32_t command_size)
+{
+    TPM_RESULT ret = tpm_iface[0]->Process(tpm_number, respbuffer, resp_size,
+                                           respbufsize, command, command_size);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
+/*
+ * Send a batch of commands to the TPM instance with the given number. The
+ * commands buffer holds well formatted TPM commands back to back and
+ * commands_size indicates their total size. The responses are returned
+ * back to back in the respbuffer, which is handled as in TPMLIB_Process().
+ * count returns the number of commands that were processed.
+ */
+TPM_RESULT TPMLIB_ProcessBatch(uint32_t tpm_number,
+                               unsigned char **respbuffer,
+                               uint32_t *resp_size,
+                               uint32_t *respbufsize,
+                               unsigned char *commands,
+                               uint32_t commands_size,
+                               uint32_t *count)
+{
+    TPM_RESULT ret = tpm_iface[0]->ProcessBatch(tpm_number, respbuffer,
+                                                resp_size, respbufsize,
+                                                commands, commands_size,
+                                                count);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
+/*
+ * Commands submitted with TPMLIB_ProcessAsync() are queued per TPM instance
+ * and processed by a pool of worker threads. A worker takes the next
+ * command of an instance only while no other worker processes a command
+ * of the same instance, so the commands of an instance are processed in
+ * the order of their submission. The instances that have a command queued
+ * and no command in process wait in a ready list, so that the workers take
+ * the instances in turn without scanning all of them.
+ */
+#define ASYNC_WORKERS 4
+
+struct async_job {
+    struct async_job *next;
+    uint32_t tpm_number;
+    unsigned char *command;
+    uint32_t command_size;
+    TPMLIB_ProcessCallback callback;
+    void *opaque;
+};
+
+struct async_queue {
+    struct async_job *head;
+    struct async_job *tail;
+    TPM_BOOL busy;          /* a worker is processing a command */
+    struct async_queue *next_ready;
+};
+
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t async_idle = PTHREAD_COND_INITIALIZER;
+static struct async_queue async_queues[TPMS_MAX];
+static uint32_t async_pending = 0;    /* queued and running commands */
+/* the queues with a command and no busy worker, in the order they got ready */
+static struct async_queue *async_ready_head = NULL;
+static struct async_queue *async_ready_tail = NULL;
+static pthread_t async_workers[ASYNC_WORKERS];
+static unsigned int async_running = 0;
+static TPM_BOOL async_stop = FALSE;
+
+/* must be called with async_lock held */
+static void async_set_ready(struct async_queue *queue)
+{
+    queue->next_ready = NULL;
+    if (async_ready_tail)
+        async_ready_tail->next_ready = queue;
+    else
+        async_ready_head = queue;
+    async_ready_tail = queue;
+}
+
+/* must be called with async_lock held */
+static struct async_job *async_get_job(void)
+{
+    struct async_queue *queue = async_ready_head;
+    struct async_job *job;
+
+    if (!queue)
+        return NULL;
+
+    async_ready_head = queue->next_ready;
+    if (!async_ready_head)
+        async_ready_tail = NULL;
+
+    job = queue->head;
+    queue->head = job->next;
+    if (!job->next)
+        queue->tail = NULL;
+    queue->busy = TRUE;
+
+    return job;
+}
+
+static void *async_worker(void *arg)
+{
+    struct async_job *job;
+    unsigned char *response;
+    uint32_t resp_size, respbufsize;
+    TPM_RESULT ret;
+
+    arg = arg;
+
+    pthread_mutex_lock(&async_lock);
+
+    while (TRUE) {
+        job = async_get_job();
+        if (!job) {
+            if (async_stop)
+                break;
+            pthread_cond_wait(&async_work, &async_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&async_lock);
+
+        response = NULL;
+        resp_size = 0;
+        respbufsize = 0;
+        ret = TPMLIB_ProcessInstance(job->tpm_number, &response, &resp_size,
+                                     &respbufsize,
+                                     job->command, job->command_size);
+        job->callback(job->opaque, ret, response, resp_size);
+        TPM_Free(response);
+
+        pthread_mutex_lock(&async_lock);
+
+        async_queues[job->tpm_number].busy = FALSE;
+        async_pending--;
+        /* the instance goes behind the others that are ready */
+        if (async_queues[job->tpm_number].head) {
+            async_set_ready(&async_queues[job->tpm_number]);
+            pthread_cond_signal(&async_work);
+        }
+        if (async_pending == 0)
+            pthread_cond_broadcast(&async_idle);
+
+        TPM_Free(job->command);
+        TPM_Free((unsigned char *)job);
+    }
+
+    pthread_mutex_unlock(&async_lock);
+
+    return NULL;
+}
+
+/*
+ * Wait for all submitted commands to complete and stop the worker threads.
+ */
+static void async_terminate(void)
+{
+    unsigned int i, running;
+
+    pthread_mutex_lock(&async_lock);
+
+    while (async_pending > 0)
+        pthread_cond_wait(&async_idle, &async_lock);
+
+    async_stop = TRUE;
+    running = async_running;
+    async_running = 0;
+    pthread_cond_broadcast(&async_work);
+
+    pthread_mutex_unlock(&async_lock);
+
+    for (i = 0; i < running; i++)
+        pthread_join(async_workers[i], NULL);
+
+    pthread_mutex_lock(&async_lock);
+    async_stop = FALSE;
+    pthread_mutex_unlock(&async_lock);
+}
+
+/*
+ * Submit a command to the TPM instance with the given number and return
+ * without waiting for it. The command is copied. Once the TPM has processed
+ * the command, the callback is invoked from a worker thread with the result
+ * of the processing and the response; the response buffer is freed when
+ * the callback returns. The commands of an instance are processed in the
+ * order in which they were submitted.
+ */
+TPM_RESULT TPMLIB_ProcessAsync(uint32_t tpm_number,
+                               const unsigned char *command,
+                               uint32_t command_size,
+                               TPMLIB_ProcessCallback callback,
+                               void *opaque)
+{
+    struct async_job *job = NULL;
+    TPM_RESULT ret;
+
+    if (tpm_number >= TPMS_MAX || !command || !command_size || !callback)
+        return TPM_BAD_PARAMETER;
+
+    ret = TPM_Malloc((unsigned char **)&job, sizeof(*job));
+    if (ret == TPM_SUCCESS) {
+        job->command = NULL;
+        ret = TPM_Malloc(&job->command, command_size);
+    }
+    if (ret != TPM_SUCCESS) {
+        TPM_Free((unsigned char *)job);
+        TPMLIB_LogFlush();
+        return ret;
+    }
+
+    memcpy(job->command, command, command_size);
+    job->next = NULL;
+    job->tpm_number = tpm_number;
+    job->command_size = command_size;
+    job->callback = callback;
+    job->opaque = opaque;
+
+    pthread_mutex_lock(&async_lock);
+
+    /* start the workers with the first command; if none can be started,
+       the command cannot be processed */
+    while (async_running < ASYNC_WORKERS &&
+           pthread_create(&async_workers[async_running], NULL,
+                          async_worker, NULL) == 0)
+        async_running++;
+
+    if (async_running == 0) {
+        ret = TPM_FAIL;
+    } else {
+        if (async_queues[tpm_number].tail) {
+            async_queues[tpm_number].tail->next = job;
+        } else {
+            async_queues[tpm_number].head = job;
+            if (!async_queues[tpm_number].busy)
+                async_set_ready(&async_queues[tpm_number]);
+        }
+        async_queues[tpm_number].tail = job;
+        async_pending++;
+        pthread_cond_signal(&async_work);
+    }
+
+    pthread_mutex_unlock(&async_lock);
+
+    if (ret != TPM_SUCCESS) {
+        TPM_Free(job->command);
+        TPM_Free((unsigned char *)job);
+    }
+
+    return ret;
 }
 
 /*
@@ -120,7 +441,98 @@ TPM_RESULT TPMLIB_Process(unsigned char **respbuffer, uint32_t *resp_size,
 TPM_RESULT TPMLIB_VolatileAll_Store(unsigned char **buffer,
                                     uint32_t *buflen)
 {
-    return tpm_iface[0]->VolatileAllStore(buffer, buflen);
+    TPM_RESULT ret = tpm_iface[0]->VolatileAllStore(0, buffer, buflen);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
+/*
+ * Get the volatile state from the TPM instance with the given number.
+ */
+TPM_RESULT TPMLIB_VolatileAll_StoreInstance(uint32_t tpm_number,
+                                            unsigned char **buffer,
+                                            uint32_t *buflen)
+{
+    TPM_RESULT ret = tpm_iface[0]->VolatileAllStore(tpm_number, buffer,
+                                                    buflen);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
+/*
+ * Get the volatile state from the TPM instance with the given number as
+ * a delta against the snapshot of the given generation, which is the
+ * generation returned by the previous call. Pass 0 for a delta that does
+ * not need a previous snapshot.
+ */
+TPM_RESULT TPMLIB_VolatileAll_StoreDelta(uint32_t tpm_number,
+                                         uint32_t *generation,
+                                         unsigned char **buffer,
+                                         uint32_t *buflen)
+{
+    TPM_RESULT ret = tpm_iface[0]->VolatileAllStoreDelta(tpm_number,
+                                                         generation,
+                                                         buffer, buflen);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
+/*
+ * Build the volatile state from a delta and the snapshot it was computed
+ * against. The result is the same as TPMLIB_VolatileAll_StoreInstance()
+ * would have returned when the delta was created.
+ */
+TPM_RESULT TPMLIB_VolatileAll_ApplyDelta(const unsigned char *base,
+                                         uint32_t base_len,
+                                         const unsigned char *delta,
+                                         uint32_t delta_len,
+                                         unsigned char **buffer,
+                                         uint32_t *buflen)
+{
+    TPM_RESULT ret = tpm_iface[0]->VolatileAllApplyDelta(base, base_len,
+                                                         delta, delta_len,
+                                                         buffer, buflen);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
+/*
+ * Set when the TPM instance with the given number writes its volatile
+ * state to NVRAM on its own. The value is the number of commands for
+ * TPMLIB_VOLATILE_STORE_COMMANDS and the number of milliseconds for
+ * TPMLIB_VOLATILE_STORE_IDLE.
+ */
+TPM_RESULT TPMLIB_SetVolatileStorePolicy(uint32_t tpm_number,
+                                         enum TPMLIB_VolatileStorePolicy policy,
+                                         uint32_t value)
+{
+    TPM_RESULT ret = tpm_iface[0]->SetVolatileStorePolicy(tpm_number, policy,
+                                                          value);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
+/*
+ * Write the volatile state of the TPM instance with the given number to
+ * NVRAM now, unless it is unchanged since it was last written.
+ */
+TPM_RESULT TPMLIB_VolatileAll_NVStore(uint32_t tpm_number)
+{
+    TPM_RESULT ret = tpm_iface[0]->VolatileAllNVStore(tpm_number);
+
+    TPMLIB_LogFlush();
+
+    return ret;
 }
 
 /*
@@ -144,24 +556,54 @@ TPM_RESULT TPMLIB_GetTPMProperty(enum TPMLIB_TPMProperty prop,
     return TPM_SUCCESS;
 }
 
+/*
+ * Keep up to depth pre-generated RSA key pairs for each key length and
+ * public exponent that is used to create keys, generated by the given
+ * number of background threads. A depth of 0 disables the pool.
+ */
+TPM_RESULT TPMLIB_SetRSAKeyPool(unsigned int depth, unsigned int threads)
+{
+    TPM_RESULT ret = tpm_iface[0]->SetRSAKeyPool(depth, threads);
+
+    TPMLIB_LogFlush();
+
+    return ret;
+}
+
 TPM_RESULT TPM_IO_Hash_Start(void)
 {
-    return tpm_iface[0]->HashStart();
+    TPM_RESULT ret = tpm_iface[0]->HashStart();
+
+    TPMLIB_LogFlush();
+
+    return ret;
 }
 
 TPM_RESULT TPM_IO_Hash_Data(const unsigned char *data, uint32_t data_length)
 {
-    return tpm_iface[0]->HashData(data, data_length);
+    TPM_RESULT ret = tpm_iface[0]->HashData(data, data_length);
+
+    TPMLIB_LogFlush();
+
+    return ret;
 }
 
 TPM_RESULT TPM_IO_Hash_End(void)
 {
-    return tpm_iface[0]->HashEnd();
+    TPM_RESULT ret = tpm_iface[0]->HashEnd();
+
+    TPMLIB_LogFlush();
+
+    return ret;
 }
 
 TPM_RESULT TPM_IO_TpmEstablished_Get(TPM_BOOL *tpmEstablished)
 {
-    return tpm_iface[0]->TpmEstablishedGet(tpmEstablished);
+    TPM_RESULT ret = tpm_iface[0]->TpmEstablishedGet(tpmEstablished);
+
+    TPMLIB_LogFlush();
+
+    return ret;
 }
 
 static struct libtpms_callbacks libtpms_cbs;
@@ -357,7 +799,7 @@ void TPMLIB_SetDebugFD(int fd)
 
 void TPMLIB_SetDebugLevel(unsigned level)
 {
-    debug_level = level;
+    tpmlib_debug_level = level;
 }
 
 TPM_RESULT TPMLIB_SetDebugPrefix(const char *prefix)
@@ -375,16 +817,68 @@ TPM_RESULT TPMLIB_SetDebugPrefix(const char *prefix)
     return TPM_SUCCESS;
 }
 
+/*
+ * Write the trace lines collected by this thread. If debug_fd is non-blocking
+ * and cannot take all of the output, the rest is dropped rather than waiting.
+ */
+static void TPMLIB_LogWrite(const char *data, size_t length)
+{
+    size_t written = 0;
+    ssize_t n;
+
+    while (written < length) {
+        n = write(debug_fd, &data[written], length - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        written += n;
+    }
+}
+
+void TPMLIB_LogFlush(void)
+{
+    TPMLIB_LogWrite(debug_buffer, debug_buffer_used);
+    debug_buffer_used = 0;
+}
+
+static void TPMLIB_LogAppend(const char *data, size_t length)
+{
+    if (debug_buffer_used + length > sizeof(debug_buffer))
+        TPMLIB_LogFlush();
+    /* too long to collect, write it behind the lines before it */
+    if (length > sizeof(debug_buffer)) {
+        TPMLIB_LogWrite(data, length);
+        return;
+    }
+
+    memcpy(&debug_buffer[debug_buffer_used], data, length);
+    debug_buffer_used += length;
+}
+
+/*
+ * Print a trace line if its indentation is less than the debug level.
+ * Returns the indentation of a printed line, -1 otherwise.
+ */
 int TPMLIB_LogPrintf(const char *format, ...)
 {
-    unsigned level = debug_level, i;
+    unsigned level = tpmlib_debug_level, i;
     va_list args;
     char buffer[256];
     int n;
 
-    if (!debug_fd || !debug_level)
+    if (!debug_fd || !level)
         return -1;
 
+    level--;
+
+    /* the indentation is usually part of the format; skip lines that are
+       too deep before formatting them */
+    for (i = 0; format[i] == ' '; i++) {
+        if (i == level)
+            return -1;
+    }
+
     va_start(args, format);
     n = vsnprintf(buffer, sizeof(buffer), format, args);
     va_end(args);
@@ -392,8 +886,6 @@ int TPMLIB_LogPrintf(const char *format, ...)
     if (n < 0 || n >= (int)sizeof(buffer))
         return -1;
 
-    level--;
-
     i = 0;
     while (1) {
         if (buffer[i] == 0)
@@ -404,34 +896,60 @@ int TPMLIB_LogPrintf(const char *format, ...)
             return -1;
         i++;
     }
-#if 0
+
     if (debug_prefix)
-        dprintf(debug_fd, debug_prefix);
-    dprintf(debug_fd, buffer);
-#endif
+        TPMLIB_LogAppend(debug_prefix, strlen(debug_prefix));
+    TPMLIB_LogAppend(buffer, n);
+
     return i;
 }
 
 /*
  * TPMLIB_LogPrintfA: Printf to the logfd without indentation check
+ *
+ * A message that does not fit the buffer on the stack is formatted again
+ * into an allocated one, or printed directly if that cannot be allocated.
  */
 void TPMLIB_LogPrintfA(unsigned int indent, const char *format, ...)
 {
     va_list args;
-    char spaces[20];
+    char buffer[256];
+    char *line = buffer;
+    int n;
 
-    if (!debug_fd || !debug_level)
+    if (!debug_fd || !tpmlib_debug_level)
         return;
 
-    if (indent) {
-        if (indent > sizeof(spaces) - 1)
-            indent = sizeof(spaces) - 1;
-        memset(spaces, ' ', indent);
-        spaces[indent] = 0;
-        vdprintf(debug_fd, spaces, NULL);
-    }
+    if (indent > 19)
+        indent = 19;
+    memset(buffer, ' ', indent);
 
     va_start(args, format);
-    vdprintf(debug_fd, format, args);
+    n = vsnprintf(&buffer[indent], sizeof(buffer) - indent, format, args);
     va_end(args);
+
+    if (n < 0)
+        return;
+
+    if (n >= (int)(sizeof(buffer) - indent)) {
+        line = malloc(indent + n + 1);
+        if (!line) {
+            TPMLIB_LogFlush();
+            dprintf(debug_fd, "%*s", (int)indent, "");
+            va_start(args, format);
+            vdprintf(debug_fd, format, args);
+            va_end(args);
+            return;
+        }
+        memset(line, ' ', indent);
+        va_start(args, format);
+        n = vsnprintf(&line[indent], n + 1, format, args);
+        va_end(args);
+    }
+
+    if (n >= 0)
+        TPMLIB_LogAppend(line, indent + n);
+
+    if (line != buffer)
+        free(line);
 }
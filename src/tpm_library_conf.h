@@ -53,6 +53,12 @@
 /* maximum size of the IO buffer used for requests and responses */
 #define TPM_BUFFER_MAX             4096
 
+/*
+ * maximum number of TPM instances a process can drive; instance
+ * numbers passed to TPMLIB_CreateInstance() must be below this value
+ */
+#define TPMS_MAX                   1024
+
 /*
  * Below the following acronyms are used to identify what
  * #define influences which one of the state blobs the TPM
@@ -77,6 +83,12 @@
  */
 #define TPM_KEY_HANDLES                  20            /* SS, VA,  BAL */
 
+/*
+ * Keys swapped out of the key slots are saved like the keys in the
+ * key slots and account for the same increase.
+ */
+#define TPM_KEY_SWAP_ENTRIES             (4 * TPM_KEY_HANDLES) /* SS, VA */
+
 /*
  * Every 2048 bit key on which the owner evict key flag is set
  * accounts for an increase of 559 bytes of the permanentall
@@ -140,14 +152,16 @@
                                       TPM_MAX_NV_DEFINED_SIZE)
 
 #define TPM_MAX_SAVESTATE_SPACE      (972 + /* base size */         \
-                                      TPM_KEY_HANDLES * 559 +       \
+                                      (TPM_KEY_HANDLES +            \
+                                       TPM_KEY_SWAP_ENTRIES) * 559 + \
                                       TPM_MIN_TRANS_SESSIONS * 78 + \
                                       TPM_MIN_DAA_SESSIONS * 844 +  \
                                       TPM_MIN_AUTH_SESSIONS * 119 + \
                                       TPM_SPACE_SAFETY_MARGIN)
 
 #define TPM_MAX_VOLATILESTATE_SPACE  (1203  + /* base size */       \
-                                      TPM_KEY_HANDLES * 559 +       \
+                                      (TPM_KEY_HANDLES +            \
+                                       TPM_KEY_SWAP_ENTRIES) * 559 + \
                                       TPM_MIN_TRANS_SESSIONS * 78 + \
                                       TPM_MIN_DAA_SESSIONS * 844 +  \
                                       TPM_MIN_AUTH_SESSIONS * 119 + \
@@ -52,10 +52,33 @@ struct libtpms_callbacks *TPMLIB_GetCallbacks(void);
 struct tpm_interface {
     TPM_RESULT (*MainInit)(void);
     void (*Terminate)(void);
-    TPM_RESULT (*Process)(unsigned char **respbuffer, uint32_t *resp_size,
+    TPM_RESULT (*CreateInstance)(uint32_t tpm_number);
+    TPM_RESULT (*DestroyInstance)(uint32_t tpm_number);
+    TPM_RESULT (*Process)(uint32_t tpm_number,
+                          unsigned char **respbuffer, uint32_t *resp_size,
                           uint32_t *respbufsize,
 		          unsigned char *command, uint32_t command_size);
-    TPM_RESULT (*VolatileAllStore)(unsigned char **buffer, uint32_t *buflen);
+    TPM_RESULT (*ProcessBatch)(uint32_t tpm_number,
+                               unsigned char **respbuffer, uint32_t *resp_size,
+                               uint32_t *respbufsize,
+                               unsigned char *commands, uint32_t commands_size,
+                               uint32_t *count);
+    TPM_RESULT (*VolatileAllStore)(uint32_t tpm_number,
+                                   unsigned char **buffer, uint32_t *buflen);
+    TPM_RESULT (*SetVolatileStorePolicy)(uint32_t tpm_number,
+                                         enum TPMLIB_VolatileStorePolicy policy,
+                                         uint32_t value);
+    TPM_RESULT (*VolatileAllNVStore)(uint32_t tpm_number);
+    TPM_RESULT (*VolatileAllStoreDelta)(uint32_t tpm_number,
+                                        uint32_t *generation,
+                                        unsigned char **buffer,
+                                        uint32_t *buflen);
+    TPM_RESULT (*VolatileAllApplyDelta)(const unsigned char *base,
+                                        uint32_t base_len,
+                                        const unsigned char *delta,
+                                        uint32_t delta_len,
+                                        unsigned char **buffer,
+                                        uint32_t *buflen);
     TPM_RESULT (*GetTPMProperty)(enum TPMLIB_TPMProperty prop,
                                  int *result);
     TPM_RESULT (*TpmEstablishedGet)(TPM_BOOL *tpmEstablished);
@@ -63,6 +86,7 @@ struct tpm_interface {
     TPM_RESULT (*HashData)(const unsigned char *data,
                            uint32_t data_length);
     TPM_RESULT (*HashEnd)(void);
+    TPM_RESULT (*SetRSAKeyPool)(unsigned int depth, unsigned int threads);
 };
 
 extern const struct tpm_interface TPM12Interface;
@@ -75,7 +99,9 @@ TPM_RESULT TPM12_IO_Hash_End(void);
 TPM_RESULT TPM12_IO_TpmEstablished_Get(TPM_BOOL *tpmEstablished);
 
 /* internal logging function */
+extern unsigned int tpmlib_debug_level;
 int TPMLIB_LogPrintf(const char *format, ...);
 void TPMLIB_LogPrintfA(unsigned int indent, const char *format, ...);
+void TPMLIB_LogFlush(void);
 
 #endif /* TPM_LIBRARY_INTERN_H */
@@ -42,6 +42,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "tpm12/tpm_cryptoh.h"
 #include "tpm12/tpm_debug.h"
 #include "tpm_error.h"
 #include "tpm12/tpm_init.h"
@@ -56,21 +57,49 @@ TPM_RESULT TPM12_MainInit(void)
 
 void TPM12_Terminate(void)
 {
-    TPM_Global_Delete(tpm_instances[0]);
-    free(tpm_instances[0]);
-    tpm_instances[0] = NULL;
+    uint32_t tpm_number;
+
+    TPM_VolatileSchedule_Terminate();
+    /* stop the key pool threads and free the pooled key pairs */
+    TPM_RSAKeyPool_Set(0, 0);
+
+    for (tpm_number = 0; tpm_number < TPMS_MAX; tpm_number++)
+        TPM_InstanceDelete(tpm_number);
+}
+
+TPM_RESULT TPM12_CreateInstance(uint32_t tpm_number)
+{
+    return TPM_InstanceInit(tpm_number);
 }
 
-TPM_RESULT TPM12_Process(unsigned char **respbuffer, uint32_t *resp_size,
+TPM_RESULT TPM12_DestroyInstance(uint32_t tpm_number)
+{
+    return TPM_InstanceDelete(tpm_number);
+}
+
+TPM_RESULT TPM12_Process(uint32_t tpm_number,
+                         unsigned char **respbuffer, uint32_t *resp_size,
                          uint32_t *respbufsize,
 		         unsigned char *command, uint32_t command_size)
 {
     *resp_size = 0;
     return TPM_ProcessA(respbuffer, resp_size, respbufsize,
-                        command, command_size);
+                        command, command_size, tpm_number);
+}
+
+TPM_RESULT TPM12_ProcessBatch(uint32_t tpm_number,
+                              unsigned char **respbuffer, uint32_t *resp_size,
+                              uint32_t *respbufsize,
+                              unsigned char *commands, uint32_t commands_size,
+                              uint32_t *count)
+{
+    *resp_size = 0;
+    return TPM_ProcessBatchA(respbuffer, resp_size, respbufsize,
+                             commands, commands_size, count, tpm_number);
 }
 
-TPM_RESULT TPM12_VolatileAllStore(unsigned char **buffer,
+TPM_RESULT TPM12_VolatileAllStore(uint32_t tpm_number,
+                                  unsigned char **buffer,
                                   uint32_t *buflen)
 {
     TPM_RESULT rc;
@@ -78,11 +107,81 @@ TPM_RESULT TPM12_VolatileAllStore(unsigned char **buffer,
     TPM_Sbuffer_Init(&tsb);
     uint32_t total;
 
-#ifdef TPM_DEBUG
-    assert(tpm_instances[0] != NULL);
-#endif
+    if (tpm_number >= TPMS_MAX) {
+        *buflen = 0;
+        *buffer = NULL;
+        return TPM_BAD_PARAMETER;
+    }
+
+    TPM_Global_Lock(tpm_number);
+    if (tpm_instances[tpm_number] != NULL)
+        rc = TPM_VolatileAll_Store(&tsb, NULL, tpm_instances[tpm_number]);
+    else
+        rc = TPM_BAD_PARAMETER;
+    TPM_Global_Unlock(tpm_number);
+
+    if (rc == TPM_SUCCESS) {
+        /* caller now owns the buffer and needs to free it */
+        TPM_Sbuffer_GetAll(&tsb, buffer, buflen, &total);
+    } else {
+        TPM_Sbuffer_Delete(&tsb);
+        *buflen = 0;
+        *buffer = NULL;
+    }
+
+    return rc;
+}
+
+TPM_RESULT TPM12_VolatileAllStoreDelta(uint32_t tpm_number,
+                                       uint32_t *generation,
+                                       unsigned char **buffer,
+                                       uint32_t *buflen)
+{
+    TPM_RESULT rc;
+    TPM_STORE_BUFFER tsb;
+    TPM_Sbuffer_Init(&tsb);
+    uint32_t total;
+
+    if (tpm_number >= TPMS_MAX) {
+        *buflen = 0;
+        *buffer = NULL;
+        return TPM_BAD_PARAMETER;
+    }
+
+    TPM_Global_Lock(tpm_number);
+    if (tpm_instances[tpm_number] != NULL)
+        rc = TPM_VolatileAll_StoreDelta(&tsb, generation,
+                                        tpm_instances[tpm_number]);
+    else
+        rc = TPM_BAD_PARAMETER;
+    TPM_Global_Unlock(tpm_number);
+
+    if (rc == TPM_SUCCESS) {
+        /* caller now owns the buffer and needs to free it */
+        TPM_Sbuffer_GetAll(&tsb, buffer, buflen, &total);
+    } else {
+        TPM_Sbuffer_Delete(&tsb);
+        *buflen = 0;
+        *buffer = NULL;
+    }
+
+    return rc;
+}
+
+TPM_RESULT TPM12_VolatileAllApplyDelta(const unsigned char *base,
+                                       uint32_t base_len,
+                                       const unsigned char *delta,
+                                       uint32_t delta_len,
+                                       unsigned char **buffer,
+                                       uint32_t *buflen)
+{
+    TPM_RESULT rc;
+    TPM_STORE_BUFFER tsb;
+    TPM_Sbuffer_Init(&tsb);
+    uint32_t total;
 
-    rc = TPM_VolatileAll_Store(&tsb, tpm_instances[0]);
+    rc = TPM_VolatileAll_ApplyDelta(&tsb, base, base_len,
+                                    (unsigned char *)delta, delta_len);
 
     if (rc == TPM_SUCCESS) {
         /* caller now owns the buffer and needs to free it */
@@ -96,6 +195,41 @@ TPM_RESULT TPM12_VolatileAllStore(unsigned char **buffer,
     return rc;
 }
 
+TPM_RESULT TPM12_SetVolatileStorePolicy(uint32_t tpm_number,
+                                        enum TPMLIB_VolatileStorePolicy policy,
+                                        uint32_t value)
+{
+    uint32_t schedule;
+
+    switch (policy) {
+    case TPMLIB_VOLATILE_STORE_ON_DEMAND:
+        schedule = TPM_VOLATILE_SCHEDULE_ONDEMAND;
+        break;
+
+    case TPMLIB_VOLATILE_STORE_COMMANDS:
+        schedule = TPM_VOLATILE_SCHEDULE_COMMANDS;
+        break;
+
+    case TPMLIB_VOLATILE_STORE_IDLE:
+        schedule = TPM_VOLATILE_SCHEDULE_IDLE;
+        break;
+
+    case TPMLIB_VOLATILE_STORE_CHANGED:
+        schedule = TPM_VOLATILE_SCHEDULE_CHANGED;
+        break;
+
+    default:
+        return TPM_BAD_PARAMETER;
+    }
+
+    return TPM_VolatileSchedule_Set(tpm_number, schedule, value);
+}
+
+TPM_RESULT TPM12_VolatileAllNVStore(uint32_t tpm_number)
+{
+    return TPM_VolatileSchedule_Store(tpm_number, FALSE);
+}
+
 TPM_RESULT TPM12_GetTPMProperty(enum TPMLIB_TPMProperty prop,
                                 int *result)
 {
@@ -158,6 +292,10 @@ TPM_RESULT TPM12_GetTPMProperty(enum TPMLIB_TPMProperty prop,
         *result = TPM_MAX_VOLATILESTATE_SPACE;
         break;
 
+    case  TPMPROP_TPM_INSTANCES_MAX:
+        *result = TPMS_MAX;
+        break;
+
     default:
         return TPM_FAIL;
     }
@@ -165,14 +303,27 @@ TPM_RESULT TPM12_GetTPMProperty(enum TPMLIB_TPMProperty prop,
     return TPM_SUCCESS;
 }
 
+TPM_RESULT TPM12_SetRSAKeyPool(unsigned int depth, unsigned int threads)
+{
+    return TPM_RSAKeyPool_Set(depth, threads);
+}
+
 const struct tpm_interface TPM12Interface = {
     .MainInit = TPM12_MainInit,
     .Terminate = TPM12_Terminate,
+    .CreateInstance = TPM12_CreateInstance,
+    .DestroyInstance = TPM12_DestroyInstance,
     .Process = TPM12_Process,
+    .ProcessBatch = TPM12_ProcessBatch,
     .VolatileAllStore = TPM12_VolatileAllStore,
+    .SetVolatileStorePolicy = TPM12_SetVolatileStorePolicy,
+    .VolatileAllNVStore = TPM12_VolatileAllNVStore,
+    .VolatileAllStoreDelta = TPM12_VolatileAllStoreDelta,
+    .VolatileAllApplyDelta = TPM12_VolatileAllApplyDelta,
     .GetTPMProperty = TPM12_GetTPMProperty,
     .TpmEstablishedGet = TPM12_IO_TpmEstablished_Get,
     .HashStart = TPM12_IO_Hash_Start,
     .HashData = TPM12_IO_Hash_Data,
     .HashEnd = TPM12_IO_Hash_End,
+    .SetRSAKeyPool = TPM12_SetRSAKeyPool,
 };
@@ -68,10 +68,13 @@
 TPM_RESULT TPM12_IO_Hash_Start(void)
 {
     TPM_RESULT		rc = 0;
-    tpm_state_t		*tpm_state = tpm_instances[0];	/* TPM global state */
+    tpm_state_t		*tpm_state;		/* TPM global state */
     TPM_PCRVALUE	zeroPCR;
     TPM_BOOL		altered = FALSE;	/* TRUE if the structure has been changed */
+    TPM_PCRINDEX	pcrIndex;
 
+    TPM_Global_Lock(0);				/* unlocked @1 */
+    tpm_state = tpm_instances[0];
     printf("\nTPM_IO_Hash_Start: Ordinal Entry\n");
     TPM_Digest_Init(zeroPCR);
 
@@ -120,6 +123,10 @@ TPM_RESULT TPM12_IO_Hash_Start(void)
 	TPM_PCR_Store(tpm_state->tpm_stclear_data.PCRS, 20, zeroPCR);
 	TPM_PCR_Store(tpm_state->tpm_stclear_data.PCRS, 21, zeroPCR);
 	TPM_PCR_Store(tpm_state->tpm_stclear_data.PCRS, 22, zeroPCR);
+	for (pcrIndex = 17 ; pcrIndex <= 22 ; pcrIndex++) {
+	    TPM_PCRDigestCache_Invalidate(&(tpm_state->tpm_stclear_data.pcrDigestCache),
+					  pcrIndex);
+	}
 	/* (8) Ignore any data component of the TPM_HASH_START LPC command. */
 	/* (9) Allocate tempLocation of a size required to perform the SHA-1 operation. */
 	/* (10) Initialize tempLocation per SHA-1. */
@@ -139,6 +146,7 @@ TPM_RESULT TPM12_IO_Hash_Start(void)
 	printf("  TPM_IO_Hash_Start: Set testState to %u \n", TPM_TEST_STATE_FAILURE);
 	tpm_state->testState = TPM_TEST_STATE_FAILURE;
     }
+    TPM_Global_Unlock(0);			/* @1 */
     return rc;
 }
 
@@ -148,8 +156,10 @@ TPM_RESULT TPM12_IO_Hash_Data(const unsigned char *data,
 			      uint32_t data_length)
 {
     TPM_RESULT 		rc = 0;
-    tpm_state_t		*tpm_state = tpm_instances[0];	/* TPM global state */
+    tpm_state_t		*tpm_state;		/* TPM global state */
 
+    TPM_Global_Lock(0);				/* unlocked @1 */
+    tpm_state = tpm_instances[0];
     printf("\nTPM_IO_Hash_Data: Ordinal Entry\n");
     /* (1) Transform tempLocation per SHA-1 with data received from this command. */
     /* (2) Repeat for each TPM_HASH_DATA LPC command received. */
@@ -173,6 +183,7 @@ TPM_RESULT TPM12_IO_Hash_Data(const unsigned char *data,
 	printf("  TPM_IO_Hash_Data: Set testState to %u \n", TPM_TEST_STATE_FAILURE);
 	tpm_state->testState = TPM_TEST_STATE_FAILURE;
     }
+    TPM_Global_Unlock(0);			/* @1 */
     return rc;
 }
 
@@ -183,8 +194,10 @@ TPM_RESULT TPM12_IO_Hash_End(void)
     TPM_RESULT 		rc = 0;
     TPM_PCRVALUE	zeroPCR;
     TPM_DIGEST 		extendDigest;
-    tpm_state_t		*tpm_state = tpm_instances[0];	/* TPM global state */
+    tpm_state_t		*tpm_state;		/* TPM global state */
 
+    TPM_Global_Lock(0);				/* unlocked @1 */
+    tpm_state = tpm_instances[0];
     printf("\nTPM_IO_Hash_End: Ordinal Entry\n");
     if (rc == 0) {
 	if (tpm_state->sha1_context_tis == NULL) {
@@ -208,6 +221,8 @@ TPM_RESULT TPM12_IO_Hash_End(void)
 		      TPM_DIGEST_SIZE, zeroPCR,
 		      TPM_DIGEST_SIZE, extendDigest,
 		      0, NULL);
+	TPM_PCRDigestCache_Invalidate(&(tpm_state->tpm_stclear_data.pcrDigestCache),
+				      TPM_LOCALITY_4_PCR);
     }
     /* NOTE: Done by caller
        (4) Clear TPM_ACCESS_x.activeLocality for Locality 4. */
@@ -223,14 +238,17 @@ TPM_RESULT TPM12_IO_Hash_End(void)
 	tpm_state->testState = TPM_TEST_STATE_FAILURE;
     }
     TPM_SHA1Delete(&(tpm_state->sha1_context_tis));
+    TPM_Global_Unlock(0);			/* @1 */
     return rc;
 }
 
 TPM_RESULT TPM12_IO_TpmEstablished_Get(TPM_BOOL *tpmEstablished)
 {
     TPM_RESULT 		rc = 0;
-    tpm_state_t		*tpm_state = tpm_instances[0];	/* TPM global state */
+    tpm_state_t		*tpm_state;		/* TPM global state */
 
+    TPM_Global_Lock(0);				/* unlocked @1 */
+    tpm_state = tpm_instances[0];
     if (rc == 0) {
 	*tpmEstablished = tpm_state->tpm_permanent_flags.tpmEstablished;
     }
@@ -245,15 +263,18 @@ TPM_RESULT TPM12_IO_TpmEstablished_Get(TPM_BOOL *tpmEstablished)
 	printf("  TPM_IO_TpmEstablished_Get: Set testState to %u \n", TPM_TEST_STATE_FAILURE);
 	tpm_state->testState = TPM_TEST_STATE_FAILURE;
     }
+    TPM_Global_Unlock(0);			/* @1 */
     return 0;
 }
 
 TPM_RESULT TPM12_IO_TpmEstablished_Reset(void)
 {
     TPM_RESULT          returnCode = 0;
-    tpm_state_t		*tpm_state = tpm_instances[0];	/* TPM global state */
+    tpm_state_t		*tpm_state;		/* TPM global state */
     TPM_BOOL		writeAllNV = FALSE;	/* flag to write back flags */
 
+    TPM_Global_Lock(0);				/* unlocked @1 */
+    tpm_state = tpm_instances[0];
     if (returnCode == TPM_SUCCESS) {
         returnCode = TPM_IO_GetLocality(&(tpm_state->tpm_stany_flags.localityModifier),
                                         tpm_state->tpm_number);
@@ -276,5 +297,6 @@ TPM_RESULT TPM12_IO_TpmEstablished_Reset(void)
 					  writeAllNV,
 					  returnCode);
 
+    TPM_Global_Unlock(0);			/* @1 */
     return returnCode;
 }
@@ -0,0 +1,157 @@
+/*
+ * Check that NV indices are found after colliding indices were deleted.
+ *
+ * The TPM finds an NV index through an open addressing hash table.  The
+ * indices defined here all hash to the last slot of the table, so that their
+ * probe sequence wraps around the end of the table.  Indices are deleted from
+ * the start, the middle and the end of the probe sequence and defined again,
+ * and after each step every defined index must still be found with its data,
+ * also after the TPM restarts.
+ *
+ * TPM_PATH must name an empty directory.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libtpms/tpm_types.h>
+#include <libtpms/tpm_library.h>
+#include <libtpms/tpm_error.h>
+
+#include "tpm_command.h"
+
+#define NV_INDEX_BASE   0x00020000
+#define INDICES         6
+/* the home slot is the last one for hash tables of up to this size */
+#define SLOTS_MAX       64
+
+static uint32_t nv_index[INDICES];
+static int defined[INDICES];
+
+/* the hash of an NV index as the TPM uses it, before it is reduced to the table size */
+static uint32_t nv_hash(uint32_t nvIndex)
+{
+    uint32_t hash = nvIndex * 0x9e3779b1;
+
+    return hash ^ (hash >> 16);
+}
+
+/* define index 'i' with 'size' bytes, or delete it if 'size' is 0 */
+static int nv_define(unsigned int i, uint32_t size)
+{
+    build_nv_define(nv_index[i], size);
+    if (run_command() != TPM_SUCCESS) {
+        printf("%s index %08x failed.\n", size ? "Defining" : "Deleting", nv_index[i]);
+        return 0;
+    }
+    defined[i] = size != 0;
+    return 1;
+}
+
+/* write the number of index 'i' to it */
+static int nv_write(unsigned int i)
+{
+    start_command(ORD_NV_WriteValue);
+    put32(nv_index[i]);
+    put32(0);
+    put32(1);
+    put8(i);
+    if (run_command() != TPM_SUCCESS) {
+        printf("Writing index %08x failed.\n", nv_index[i]);
+        return 0;
+    }
+    return 1;
+}
+
+static int nv_define_write(unsigned int i)
+{
+    return nv_define(i, 1) && nv_write(i);
+}
+
+/* every defined index must hold its number, every deleted index must be unknown */
+static int check_indices(const char *when)
+{
+    unsigned int i;
+    uint32_t rc;
+
+    for (i = 0; i < INDICES; i++) {
+        start_command(ORD_NV_ReadValue);
+        put32(nv_index[i]);
+        put32(0);
+        put32(1);
+        rc = run_command();
+        if (defined[i] && (rc != TPM_SUCCESS || resp_len < 15 || resp[14] != i)) {
+            printf("Index %08x was not found %s.\n", nv_index[i], when);
+            return 0;
+        }
+        if (!defined[i] && rc != TPM_BADINDEX) {
+            printf("Deleted index %08x was found %s.\n", nv_index[i], when);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(void)
+{
+    int res = EXIT_FAILURE;
+    unsigned int i;
+    uint32_t nvIndex;
+
+    /* indices that all have the last slot as their home slot */
+    for (i = 0, nvIndex = NV_INDEX_BASE; i < INDICES; nvIndex++) {
+        if ((nv_hash(nvIndex) & (SLOTS_MAX - 1)) == SLOTS_MAX - 1)
+            nv_index[i++] = nvIndex;
+    }
+
+    if (!boot()) {
+        printf("The TPM does not start.\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < INDICES; i++) {
+        if (!nv_define_write(i))
+            goto exit;
+    }
+    if (!check_indices("after defining them"))
+        goto exit;
+
+    /* delete from the home slot and from the wrapped part of the sequence */
+    if (!nv_define(0, 0) || !nv_define(2, 0) ||
+        !check_indices("after deleting the first and the third"))
+        goto exit;
+
+    /* the free entries are used again, in the opposite order */
+    if (!nv_define_write(2) || !nv_define_write(0) ||
+        !check_indices("after defining them again"))
+        goto exit;
+
+    /* delete the end of the sequence and one before it, define one again */
+    if (!nv_define(INDICES - 1, 0) || !nv_define(1, 0) || !nv_define_write(1) ||
+        !check_indices("after deleting the last"))
+        goto exit;
+
+    /* the table is built again from the saved state */
+    TPMLIB_Terminate();
+    if (!boot()) {
+        printf("The TPM does not restart.\n");
+        return EXIT_FAILURE;
+    }
+    if (!check_indices("after a restart"))
+        goto exit;
+
+    /* all entries are used again after the restart */
+    if (!nv_define(3, 0) || !nv_define_write(INDICES - 1) ||
+        !check_indices("after defining the last again"))
+        goto exit;
+
+    res = EXIT_SUCCESS;
+
+exit:
+    TPMLIB_Terminate();
+    free(resp);
+
+    return res;
+}
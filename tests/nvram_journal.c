@@ -0,0 +1,360 @@
+/*
+ * Check that the NVRAM journal repairs the state files after a crash.
+ *
+ * The journal written by a few commands is cut at each record boundary and
+ * inside each record, as a crash while appending it would leave it, and the
+ * TPM is restarted on the state files from before the commands.  The TPM must
+ * start, and each command must be found either in full or not at all, in the
+ * order it was sent.  The index is deleted and defined again in between, so
+ * that the permanent state and the files of the NV index data, when they are
+ * kept apart, must be repaired together.  When the commands are sent as one
+ * batch, they must be found together or not at all.
+ *
+ * TPM_PATH must name an empty directory.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <libtpms/tpm_types.h>
+#include <libtpms/tpm_library.h>
+#include <libtpms/tpm_error.h>
+
+#include "tpm_command.h"
+
+#define JOURNAL_NAME    "00.journal"
+#define NV_INDEX        0x00020011
+#define MAX_FILES       64
+
+enum {
+    NV_ABSENT = 0,      /* the index is not defined */
+    NV_DEFINED,         /* the index is defined but not written */
+    NV_WRITTEN,         /* the index holds the written data */
+};
+
+struct file {
+    char name[256];
+    unsigned char *data;
+    size_t len;
+};
+
+static const char *dir;
+static struct file snapshot[MAX_FILES];
+static unsigned int snapshot_count;
+
+static const unsigned char written[] = { 0x12, 0x34 };
+
+static void build_nv_write(void)
+{
+    start_command(ORD_NV_WriteValue);
+    put32(NV_INDEX);
+    put32(0);
+    put32(sizeof(written));
+    memcpy(cmd + cmd_len, written, sizeof(written));
+    cmd_len += sizeof(written);
+    finish_command();
+}
+
+/* the commands, and the index state each of them leaves */
+static const struct step {
+    uint32_t size;      /* the size to define, or 0 to delete, unless writing */
+    int write;
+    int state;
+} steps[] = {
+    { 8, 0, NV_DEFINED },
+    { 0, 1, NV_WRITTEN },
+    { 0, 0, NV_ABSENT },
+    { 8, 0, NV_DEFINED },
+    { 0, 1, NV_WRITTEN },
+};
+#define STEPS   (sizeof(steps) / sizeof(steps[0]))
+
+static void build_step(unsigned int i)
+{
+    if (steps[i].write)
+        build_nv_write();
+    else
+        build_nv_define(NV_INDEX, steps[i].size);
+}
+
+/* send all steps, return TRUE on success */
+static int nv_commands(int batched)
+{
+    unsigned char batch[STEPS * sizeof(cmd)];
+    uint32_t batch_len, count, offset;
+    unsigned int i;
+
+    if (!batched) {
+        for (i = 0; i < STEPS; i++) {
+            build_step(i);
+            if (run_command() != TPM_SUCCESS)
+                return 0;
+        }
+        return 1;
+    }
+    for (i = 0, batch_len = 0; i < STEPS; i++) {
+        build_step(i);
+        memcpy(batch + batch_len, cmd, cmd_len);
+        batch_len += cmd_len;
+    }
+    if (TPMLIB_ProcessBatch(0, &resp, &resp_len, &resp_total, batch, batch_len,
+                            &count) != TPM_SUCCESS || count != STEPS)
+        return 0;
+    /* the result codes of all responses */
+    for (i = 0, offset = 0; i < STEPS; i++, offset += get32(resp + offset + 2)) {
+        if (offset + 10 > resp_len || get32(resp + offset + 6) != TPM_SUCCESS)
+            return 0;
+    }
+    return 1;
+}
+
+/* return the state of the index, or -1 if it is inconsistent */
+static int nv_state(void)
+{
+    uint32_t rc;
+
+    start_command(ORD_NV_ReadValue);
+    put32(NV_INDEX);
+    put32(0);
+    put32(sizeof(written));
+    rc = run_command();
+    if (rc == TPM_BADINDEX)
+        return NV_ABSENT;
+    if (rc != TPM_SUCCESS || resp_len < 14 + sizeof(written))
+        return -1;
+    if (memcmp(resp + 14, written, sizeof(written)) == 0)
+        return NV_WRITTEN;
+    if (resp[14] == 0xff && resp[15] == 0xff)
+        return NV_DEFINED;
+    return -1;
+}
+
+static char *path(const char *name)
+{
+    static char buf[4096];
+
+    snprintf(buf, sizeof(buf), "%s/%s", dir, name);
+    return buf;
+}
+
+static unsigned char *read_file(const char *name, size_t *len)
+{
+    long sz;
+    unsigned char *res;
+    FILE *f = fopen(path(name), "rb");
+
+    if (!f) {
+        printf("Could not open file %s for reading.\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    fseek(f, 0, SEEK_END);
+    sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    res = malloc(sz + 1);
+    if (res == NULL || fread(res, 1, sz, f) != (size_t)sz) {
+        printf("Could not read file %s.\n", name);
+        exit(EXIT_FAILURE);
+    }
+    *len = sz;
+
+    fclose(f);
+
+    return res;
+}
+
+static void write_file(const char *name, const unsigned char *data, size_t len)
+{
+    FILE *f = fopen(path(name), "wb");
+
+    if (!f || fwrite(data, 1, len, f) != len || fclose(f) != 0) {
+        printf("Could not write file %s.\n", name);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* remember the state files */
+static void take_snapshot(void)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+
+    while (d && (de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
+        if (snapshot_count == MAX_FILES) {
+            printf("Too many state files.\n");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(snapshot[snapshot_count].name, sizeof(snapshot[0].name),
+                 "%s", de->d_name);
+        snapshot[snapshot_count].data = read_file(de->d_name,
+                                                  &snapshot[snapshot_count].len);
+        snapshot_count++;
+    }
+    if (d)
+        closedir(d);
+}
+
+/* restore the state files, with the journal replaced by 'journal' */
+static void restore_snapshot(const unsigned char *journal, size_t journal_len)
+{
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    unsigned int i;
+
+    while (d && (de = readdir(d)) != NULL) {
+        if (de->d_name[0] != '.')
+            unlink(path(de->d_name));
+    }
+    if (d)
+        closedir(d);
+    for (i = 0; i < snapshot_count; i++) {
+        if (strcmp(snapshot[i].name, JOURNAL_NAME) != 0)
+            write_file(snapshot[i].name, snapshot[i].data, snapshot[i].len);
+    }
+    write_file(JOURNAL_NAME, journal, journal_len);
+}
+
+/* return the end of the journal record at 'pos' */
+static size_t record_end(const unsigned char *journal, size_t pos)
+{
+    size_t name_len = ((size_t)journal[pos + 4] << 8) | journal[pos + 5];
+    const unsigned char *p = journal + pos + 6 + name_len + 4;
+
+    return pos + 6 + name_len + 8 + get32(p);
+}
+
+/* restart the TPM after a crash that left 'journal', return the state of the index */
+static int crash(const unsigned char *journal, size_t journal_len)
+{
+    int state;
+
+    restore_snapshot(journal, journal_len);
+    if (!boot()) {
+        printf("The TPM does not start with %zu bytes of journal.\n", journal_len);
+        exit(EXIT_FAILURE);
+    }
+    state = nv_state();
+    TPMLIB_Terminate();
+    return state;
+}
+
+/* remove the state files */
+static void clear_state(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < snapshot_count; i++)
+        free(snapshot[i].data);
+    snapshot_count = 0;
+    restore_snapshot(NULL, 0);
+}
+
+/* crash while the steps are sent, in one batch if 'batched' */
+static int check_crashes(int batched)
+{
+    unsigned char *journal, *torn;
+    size_t journal_len, base_len, pos, end;
+    size_t cuts[3];
+    int state;
+    unsigned int i, j, k, stage = 0;
+
+    clear_state();
+
+    /* create the state, then restart so that the journal holds only the startup */
+    if (!boot()) {
+        printf("The TPM does not start.\n");
+        return EXIT_FAILURE;
+    }
+    TPMLIB_Terminate();
+    if (!boot()) {
+        printf("The TPM does not restart.\n");
+        return EXIT_FAILURE;
+    }
+    take_snapshot();
+    free(read_file(JOURNAL_NAME, &base_len));
+
+    if (!nv_commands(batched)) {
+        printf("Sending the commands failed.\n");
+        return EXIT_FAILURE;
+    }
+    TPMLIB_Terminate();
+    journal = read_file(JOURNAL_NAME, &journal_len);
+    if (journal_len <= base_len) {
+        printf("The commands were not journaled.\n");
+        return EXIT_FAILURE;
+    }
+
+    /* a crash before, or while, each record was appended */
+    for (pos = base_len; pos < journal_len; pos = end) {
+        end = record_end(journal, pos);
+        if (end > journal_len) {
+            printf("Bad journal record at %zu.\n", pos);
+            return EXIT_FAILURE;
+        }
+        cuts[0] = pos;
+        cuts[1] = pos + 5;
+        cuts[2] = end - 1;
+        for (j = 0; j < 3; j++) {
+            state = crash(journal, cuts[j]);
+            /* the state of the initial or of a later step */
+            if (stage == 0 && state == NV_ABSENT)
+                k = 0;
+            else
+                for (k = stage ? stage : 1; k <= STEPS && steps[k - 1].state != state; k++)
+                    ;
+            if (k > STEPS || (batched && k != 0 && k != STEPS)) {
+                printf("Index state %d after %zu bytes of journal is not complete.\n",
+                       state, cuts[j]);
+                return EXIT_FAILURE;
+            }
+            stage = k;
+        }
+    }
+    if (crash(journal, base_len) != NV_ABSENT ||
+        crash(journal, journal_len) != NV_WRITTEN) {
+        printf("The journal was not replayed.\n");
+        return EXIT_FAILURE;
+    }
+
+    /* garbage after the last transaction, as left by a torn append */
+    torn = malloc(journal_len + 32);
+    if (torn == NULL)
+        return EXIT_FAILURE;
+    memcpy(torn, journal, journal_len);
+    for (i = 0; i < 32; i++)
+        torn[journal_len + i] = (unsigned char)(i * 37);
+    if (crash(torn, journal_len + 32) != NV_WRITTEN) {
+        printf("A torn tail was not discarded.\n");
+        return EXIT_FAILURE;
+    }
+
+    free(torn);
+    free(journal);
+
+    return EXIT_SUCCESS;
+}
+
+int main(void)
+{
+    int res;
+
+    dir = getenv("TPM_PATH");
+    if (dir == NULL) {
+        printf("TPM_PATH is not set.\n");
+        return EXIT_FAILURE;
+    }
+
+    res = check_crashes(0);
+    if (res == EXIT_SUCCESS)
+        res = check_crashes(1);
+    clear_state();
+
+    return res;
+}
@@ -0,0 +1,119 @@
+/*
+ * Check the framing of the commands passed to TPMLIB_ProcessBatch().
+ *
+ * A batch with an empty, truncated or oversized command must be rejected
+ * before any of its commands is processed.
+ *
+ * TPM_PATH must name an empty directory.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libtpms/tpm_types.h>
+#include <libtpms/tpm_library.h>
+#include <libtpms/tpm_error.h>
+
+#include "tpm_command.h"
+
+static const unsigned char startup[] = {
+    TAG_RQU_COMMAND >> 8, TAG_RQU_COMMAND & 0xff,
+    0x00, 0x00, 0x00, 0x0c,
+    0x00, 0x00, 0x00, ORD_Startup,
+    ST_CLEAR >> 8, ST_CLEAR & 0xff
+};
+
+static const unsigned char pcrread[] = {
+    TAG_RQU_COMMAND >> 8, TAG_RQU_COMMAND & 0xff,
+    0x00, 0x00, 0x00, 0x0e,
+    0x00, 0x00, 0x00, ORD_PcrRead,
+    0x00, 0x00, 0x00, 0x00
+};
+
+/* the batch of 'len' bytes must be rejected without processing a command */
+static int check_rejected(const char *what, unsigned char *batch, uint32_t len)
+{
+    uint32_t count = 1;
+    TPM_RESULT rc;
+
+    rc = TPMLIB_ProcessBatch(0, &resp, &resp_len, &resp_total, batch, len, &count);
+    if (rc != TPM_BAD_PARAMETER || count != 0) {
+        printf("A batch with %s returned %08x after %u commands.\n",
+               what, rc, count);
+        return 0;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    int res = EXIT_SUCCESS;
+    unsigned char batch[sizeof(startup) + sizeof(pcrread)];
+    uint32_t count, offset, number;
+
+    if (TPMLIB_MainInit() != TPM_SUCCESS) {
+        printf("The TPM does not start.\n");
+        return EXIT_FAILURE;
+    }
+
+    memcpy(batch, startup, sizeof(startup));
+    memcpy(batch + sizeof(startup), pcrread, sizeof(pcrread));
+
+    /* no command at all */
+    if (!check_rejected("no command", batch, 0))
+        res = EXIT_FAILURE;
+
+    /* a header cut before the paramSize is complete */
+    if (!check_rejected("a truncated header", batch, 5))
+        res = EXIT_FAILURE;
+
+    /* a header cut behind a valid command */
+    if (!check_rejected("a truncated second header", batch, sizeof(startup) + 3))
+        res = EXIT_FAILURE;
+
+    /* a command cut before its end, behind a valid one */
+    if (!check_rejected("a truncated second command", batch, sizeof(batch) - 1))
+        res = EXIT_FAILURE;
+
+    /* a paramSize beyond the end of the commands */
+    set32(batch + 2, sizeof(batch) + 1);
+    if (!check_rejected("a paramSize beyond the buffer", batch, sizeof(batch)))
+        res = EXIT_FAILURE;
+
+    /* a paramSize smaller than the header, which would never advance */
+    set32(batch + 2, 4);
+    if (!check_rejected("a paramSize below the header", batch, sizeof(batch)))
+        res = EXIT_FAILURE;
+
+    /* none of the rejected commands was processed, so the TPM is not started */
+    memcpy(batch, startup, sizeof(startup));
+    count = 0;
+    if (TPMLIB_ProcessBatch(0, &resp, &resp_len, &resp_total, batch,
+                            sizeof(batch), &count) != TPM_SUCCESS ||
+        count != 2) {
+        printf("A valid batch was not processed.\n");
+        res = EXIT_FAILURE;
+    }
+
+    /* two responses, back to back, both successful */
+    for (offset = 0, number = 0;
+         res == EXIT_SUCCESS && offset + 10 <= resp_len;
+         offset += get32(resp + offset + 2), number++) {
+        if (get32(resp + offset + 6) != TPM_SUCCESS ||
+            get32(resp + offset + 2) < 10) {
+            printf("Response %u is %08x.\n", number, get32(resp + offset + 6));
+            res = EXIT_FAILURE;
+        }
+    }
+    if (res == EXIT_SUCCESS && (offset != resp_len || number != 2)) {
+        printf("The responses are not framed.\n");
+        res = EXIT_FAILURE;
+    }
+
+    TPMLIB_Terminate();
+    free(resp);
+
+    return res;
+}
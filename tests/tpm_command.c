@@ -0,0 +1,122 @@
+/*
+ * Helpers for the tests that send TPM 1.2 commands through the public API.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <libtpms/tpm_types.h>
+#include <libtpms/tpm_library.h>
+#include <libtpms/tpm_error.h>
+
+#include "tpm_command.h"
+
+unsigned char cmd[CMD_MAX];
+uint32_t cmd_len;
+unsigned char *resp;
+uint32_t resp_len, resp_total;
+
+void put8(uint8_t v)
+{
+    cmd[cmd_len++] = v;
+}
+
+void put16(uint16_t v)
+{
+    put8(v >> 8);
+    put8(v);
+}
+
+void put32(uint32_t v)
+{
+    put16(v >> 16);
+    put16(v);
+}
+
+uint32_t get32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+void set32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+void start_command(uint32_t ordinal)
+{
+    cmd_len = 0;
+    put16(TAG_RQU_COMMAND);
+    put32(0);
+    put32(ordinal);
+}
+
+/* set the paramSize of the command */
+void finish_command(void)
+{
+    set32(cmd + 2, cmd_len);
+}
+
+/* send the command, return the result code of its response */
+uint32_t run_command(void)
+{
+    finish_command();
+    if (TPMLIB_Process(&resp, &resp_len, &resp_total, cmd, cmd_len) != TPM_SUCCESS ||
+        resp_len < 10) {
+        printf("Processing ordinal %02x failed.\n", cmd[9]);
+        exit(EXIT_FAILURE);
+    }
+    return get32(resp + 6);
+}
+
+/* start the TPM, return FALSE if it does not start */
+int boot(void)
+{
+    if (TPMLIB_MainInit() != TPM_SUCCESS)
+        return 0;
+    start_command(ORD_Startup);
+    put16(ST_CLEAR);
+    if (run_command() != TPM_SUCCESS) {
+        TPMLIB_Terminate();
+        return 0;
+    }
+    return 1;
+}
+
+static void put_pcr_info_short(void)
+{
+    int i;
+
+    put16(3);
+    put8(0);
+    put8(0);
+    put8(0);
+    put8(LOC_ALL);
+    for (i = 0; i < 20; i++)
+        put8(0);
+}
+
+/* build the command that defines 'nvIndex' with 'size' bytes, or deletes it if 'size' is 0 */
+void build_nv_define(uint32_t nvIndex, uint32_t size)
+{
+    int i;
+
+    start_command(ORD_NV_DefineSpace);
+    put16(TAG_NV_DATA_PUBLIC);
+    put32(nvIndex);
+    put_pcr_info_short();
+    put_pcr_info_short();
+    put16(TAG_NV_ATTRIBUTES);
+    put32(NV_PER_OWNERWRITE);
+    put8(0);
+    put8(0);
+    put8(0);
+    put32(size);
+    for (i = 0; i < 20; i++)
+        put8(0);
+    finish_command();
+}
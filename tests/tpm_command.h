@@ -0,0 +1,49 @@
+/*
+ * Helpers for the tests that send TPM 1.2 commands through the public API.
+ *
+ * A command is built in 'cmd' with start_command() and the put functions,
+ * and sent with run_command(), which leaves the response in 'resp'.
+ */
+
+#ifndef TPM_COMMAND_H
+#define TPM_COMMAND_H
+
+#include <stdint.h>
+
+/* from the TPM 1.2 specification */
+#define TAG_RQU_COMMAND         0x00c1
+#define TAG_NV_ATTRIBUTES       0x0017
+#define TAG_NV_DATA_PUBLIC      0x0018
+#define ORD_OIAP                0x0000000a
+#define ORD_Extend              0x00000014
+#define ORD_PcrRead             0x00000015
+#define ORD_Startup             0x00000099
+#define ORD_NV_DefineSpace      0x000000cc
+#define ORD_NV_WriteValue       0x000000cd
+#define ORD_NV_ReadValue        0x000000cf
+#define ST_CLEAR                0x0001
+#define LOC_ALL                 0x1f
+#define NV_PER_OWNERWRITE       0x00000002
+
+#define CMD_MAX                 256
+
+extern unsigned char cmd[CMD_MAX];
+extern uint32_t cmd_len;
+extern unsigned char *resp;
+extern uint32_t resp_len, resp_total;
+
+void put8(uint8_t v);
+void put16(uint16_t v);
+void put32(uint32_t v);
+uint32_t get32(const unsigned char *p);
+void set32(unsigned char *p, uint32_t v);
+
+void start_command(uint32_t ordinal);
+void finish_command(void);
+uint32_t run_command(void);
+
+int boot(void);
+
+void build_nv_define(uint32_t nvIndex, uint32_t size);
+
+#endif /* TPM_COMMAND_H */
@@ -0,0 +1,10 @@
+#!/bin/bash
+
+# Run a test with TPM_PATH set to an empty directory
+
+TPM_PATH=$(mktemp -d)
+
+trap "rm -rf $TPM_PATH" EXIT
+
+export TPM_PATH
+"$@"
@@ -0,0 +1,186 @@
+/*
+ * Check the deltas of the volatile state.
+ *
+ * The volatile state is changed and transferred as a delta several times.
+ * Each delta applied to the state it was computed against must give the same
+ * bytes as TPMLIB_VolatileAll_StoreInstance().  A delta applied to an older
+ * state, and a delta with a corrupted digest, must be rejected.  A delta for
+ * a generation that is not the last one must hold the whole state.
+ *
+ * TPM_PATH must name an empty directory.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <libtpms/tpm_types.h>
+#include <libtpms/tpm_library.h>
+#include <libtpms/tpm_error.h>
+#include <libtpms/tpm_memory.h>
+
+#include "tpm_command.h"
+
+#define ROUNDS          6
+/* the delta header: tag, base generation, base digest */
+#define BASE_DIGEST_OFFSET      6
+
+/* change the volatile state in round 'round' */
+static int change_state(unsigned int round)
+{
+    int i;
+
+    start_command(ORD_Extend);
+    put32(round);
+    for (i = 0; i < 20; i++)
+        put8(round + i);
+    if (run_command() != TPM_SUCCESS)
+        return 0;
+    /* an authorization session */
+    if (round % 2) {
+        start_command(ORD_OIAP);
+        return run_command() == TPM_SUCCESS;
+    }
+    return 1;
+}
+
+/* the delta must give 'full' when applied to 'base' */
+static int check_apply(const unsigned char *base, uint32_t base_len,
+                       const unsigned char *delta, uint32_t delta_len,
+                       const unsigned char *full, uint32_t full_len,
+                       unsigned char **result, uint32_t *result_len)
+{
+    TPM_RESULT rc;
+
+    rc = TPMLIB_VolatileAll_ApplyDelta(base, base_len, delta, delta_len,
+                                       result, result_len);
+    if (rc != TPM_SUCCESS) {
+        printf("Applying the delta failed with %08x.\n", rc);
+        return 0;
+    }
+    if (*result_len != full_len || memcmp(*result, full, full_len) != 0) {
+        printf("The delta does not give the state.\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* the delta applied to 'base' must be rejected */
+static int check_rejected(const char *what,
+                          const unsigned char *base, uint32_t base_len,
+                          const unsigned char *delta, uint32_t delta_len)
+{
+    unsigned char *result = NULL;
+    uint32_t result_len;
+    TPM_RESULT rc;
+
+    rc = TPMLIB_VolatileAll_ApplyDelta(base, base_len, delta, delta_len,
+                                       &result, &result_len);
+    TPM_Free(result);
+    if (rc == TPM_SUCCESS) {
+        printf("A delta %s was accepted.\n", what);
+        return 0;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    int res = EXIT_FAILURE;
+    unsigned char *base = NULL, *stale = NULL;
+    uint32_t base_len = 0, stale_len = 0;
+    unsigned char *delta = NULL, *full = NULL, *result = NULL;
+    uint32_t delta_len, full_len, result_len;
+    uint32_t generation = 0, last;
+    unsigned int round;
+
+    if (!boot()) {
+        printf("The TPM does not start.\n");
+        return EXIT_FAILURE;
+    }
+
+    for (round = 0; round < ROUNDS; round++) {
+        if (!change_state(round))
+            goto exit;
+
+        last = generation;
+        if (TPMLIB_VolatileAll_StoreDelta(0, &generation, &delta,
+                                          &delta_len) != TPM_SUCCESS ||
+            TPMLIB_VolatileAll_StoreInstance(0, &full, &full_len) != TPM_SUCCESS) {
+            printf("Storing the state failed.\n");
+            goto exit;
+        }
+        if (generation != last + 1) {
+            printf("Generation %u follows %u.\n", generation, last);
+            goto exit;
+        }
+        /* after the first one, only the changes are sent */
+        if (round > 0 && delta_len >= full_len) {
+            printf("A delta of %u bytes for a state of %u bytes.\n",
+                   delta_len, full_len);
+            goto exit;
+        }
+
+        if (!check_apply(base, base_len, delta, delta_len, full, full_len,
+                         &result, &result_len))
+            goto exit;
+
+        /* the state before the last one */
+        if (stale != NULL &&
+            !check_rejected("against an older state", stale, stale_len,
+                            delta, delta_len))
+            goto exit;
+
+        if (round > 0) {
+            /* the digest of the base it needs */
+            delta[BASE_DIGEST_OFFSET] ^= 1;
+            if (!check_rejected("with a corrupted base digest", base, base_len,
+                                delta, delta_len))
+                goto exit;
+            delta[BASE_DIGEST_OFFSET] ^= 1;
+            /* the digest at the end of the state it builds */
+            delta[delta_len - 1] ^= 1;
+            if (!check_rejected("with a corrupted state digest", base, base_len,
+                                delta, delta_len))
+                goto exit;
+            delta[delta_len - 1] ^= 1;
+        }
+
+        TPM_Free(stale);
+        stale = base;
+        stale_len = base_len;
+        base = result;
+        base_len = result_len;
+        result = NULL;
+        TPM_Free(delta);
+        delta = NULL;
+        TPM_Free(full);
+        full = NULL;
+    }
+
+    /* a receiver that holds an older generation gets the whole state */
+    last = generation - 1;
+    if (!change_state(ROUNDS) ||
+        TPMLIB_VolatileAll_StoreDelta(0, &last, &delta, &delta_len) != TPM_SUCCESS ||
+        TPMLIB_VolatileAll_StoreInstance(0, &full, &full_len) != TPM_SUCCESS) {
+        printf("Storing the state failed.\n");
+        goto exit;
+    }
+    if (!check_apply(NULL, 0, delta, delta_len, full, full_len,
+                     &result, &result_len))
+        goto exit;
+
+    res = EXIT_SUCCESS;
+
+exit:
+    TPM_Free(base);
+    TPM_Free(stale);
+    TPM_Free(delta);
+    TPM_Free(full);
+    TPM_Free(result);
+    TPMLIB_Terminate();
+    free(resp);
+
+    return res;
+}